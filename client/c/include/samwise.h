@@ -34,7 +34,7 @@ extern "C" {
 
 
 #define UU __attribute__((unused))
-#define SAMWISE_PROTOCOL_VERSION "120"
+#define SAMWISE_PROTOCOL_VERSION "210"
 
 
 typedef struct samwise_t samwise_t;
@@ -95,6 +95,47 @@ samwise_publish (
     samwise_pub_t *pub);
 
 
+//  --------------------------------------------------------------------------
+/// @brief Register the options of a publishing request as a template
+/// @param self A samwise instance
+/// @param pub Publishing options, the distribution and payload are
+///            ignored
+/// @return Template id or -1 in case of error
+int
+samwise_template (
+    samwise_t *self,
+    samwise_pub_t *pub);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Publish a message referencing a template
+/// @param self A samwise instance
+/// @param id Template id returned by samwise_template
+/// @param pub Distribution and payload; a set routing key and set
+///            options override the template's, headers get added
+/// @return 0 if success, -1 otherwise
+int
+samwise_publish_template (
+    samwise_t *self,
+    int id,
+    samwise_pub_t *pub);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Publish n messages to samd within one request
+/// @param self A samwise instance
+/// @param pubs Array of n publishing options
+/// @param n Number of publishing requests
+/// @param receipts Optional array of size n, gets filled with 0 or -1
+/// @return 0 if the batch was accepted, -1 otherwise
+int
+samwise_publish_batch (
+    samwise_t *self,
+    samwise_pub_t **pubs,
+    int n,
+    int *receipts);
+
+
 //  --------------------------------------------------------------------------
 /// @brief Send a ping to samwise
 /// @param self A samwise instance
@@ -58,92 +58,288 @@ create_msg ()
 
 
 //  --------------------------------------------------------------------------
-/// Publish a message to samd.
-int
-samwise_publish (
-    samwise_t *self,
-    samwise_pub_t *pub)
+/// Writes a little-endian integer of the given width.
+static byte *
+put_le (
+    byte *pos,
+    uint32_t val,
+    int width)
 {
-    zmsg_t *msg = create_msg ();
-    zmsg_addstr (msg, "publish");
+    for (int i = 0; i < width; i++) {
+        pos [i] = val >> (8 * i);
+    }
 
-    size_t buf_size = 256;
-    char buf [buf_size];
+    return pos + width;
+}
 
 
-    // distribution type
-    if (pub->disttype == SAMWISE_ROUNDROBIN) {
-        zmsg_addstr (msg, "round robin");
-    }
-    else if (pub->disttype == SAMWISE_REDUNDANT) {
-        zmsg_addstr (msg, "redundant");
-        snprintf (buf, buf_size, "%d", pub->distcount);
+//  --------------------------------------------------------------------------
+/// Writes a length prefixed string.
+static byte *
+put_str (
+    byte *pos,
+    const char *str,
+    size_t len)
+{
+    pos = put_le (pos, len, 4);
+    memcpy (pos, str, len);
+    return pos + len;
+}
 
-        zmsg_addstr (msg, buf);
+
+//  --------------------------------------------------------------------------
+/// Encode the binary options of a publishing request (see rfc 8).
+/// Absent properties are left out and only marked in the property
+/// bitmap. Options referencing a template (see rfc 9) only contain
+/// the routing key if one is set, the present properties and the
+/// additional headers.
+static zframe_t *
+encode_opts (
+    samwise_pub_t *pub,
+    int template_id)
+{
+    bool template = template_id >= 0;
+    assert (template || pub->exchange);
+
+    const char *routing_key = (pub->routing_key)? pub->routing_key: "";
+    char **props = &pub->options.content_type;
+    size_t amount = pub->headers.amount;
+
+
+    // size of the options
+    size_t size = 8;
+    if (template) {
+        size += 4;
     }
     else {
-        assert (false);
+        size += 4 + strlen (pub->exchange);
     }
 
+    if (!template || pub->routing_key) {
+        size += 4 + strlen (routing_key);
+    }
 
-    // amqp options
-    assert (pub->exchange);
-    zmsg_addstr (msg, pub->exchange);
-    zmsg_addstr (msg, (pub->routing_key)? pub->routing_key: "");
+    uint16_t bitmap = 0;
+    for (int i = 0; i < 12; i++) {
+        if (props [i] && *props [i]) {
+            bitmap |= 1 << i;
+            size += 4 + strlen (props [i]);
+        }
+    }
 
-    snprintf (buf, buf_size, "%d", pub->mandatory);
-    zmsg_addstr (msg, buf);
+    for (size_t i = 0; i < amount; i++) {
+        size += 4 + strlen (pub->headers.keys [i]);
+        size += 4 + strlen (pub->headers.values [i]);
+    }
 
-    snprintf (buf, buf_size, "%d", pub->immediate);
-    zmsg_addstr (msg, buf);
 
+    // fixed size head
+    zframe_t *opts = zframe_new (NULL, size);
+    byte *pos = zframe_data (opts);
 
-    // rabbitmq options
-    zmsg_addstr (msg, "12");
-    size_t amount = 12;
-    while (amount > 0) {
-        char **opt = &pub->options.content_type;
-        zmsg_addstr (msg, *opt? *opt: "");
-        amount -= 1;
+    if (pub->disttype == SAMWISE_ROUNDROBIN) {
+        pos = put_le (pos, 1, 1);
+    }
+    else if (pub->disttype == SAMWISE_REDUNDANT) {
+        pos = put_le (pos, 2, 1);
+    }
+    else {
+        assert (false);
     }
 
+    int
+        flags = (pub->mandatory? 0x01: 0) | (pub->immediate? 0x02: 0),
+        distcount = (pub->disttype == SAMWISE_REDUNDANT)? pub->distcount: 0;
 
-    // header
-    if (!pub->headers.amount) {
-        zmsg_addstr (msg, "0");
+    if (template) {
+        flags = 0x80 | (pub->routing_key? 0x40: 0);
     }
 
-    else {
-        snprintf (buf, buf_size, "%zu", pub->headers.amount);
-        zmsg_addstr (msg, buf);
+    pos = put_le (pos, flags, 1);
+    pos = put_le (pos, distcount, 2);
 
-        char
-            **keys = pub->headers.keys,
-            **values = pub->headers.values;
+    pos = put_le (pos, bitmap, 2);
+    pos = put_le (pos, amount, 2);
 
-        size_t amount = pub->headers.amount;
 
-        while (amount) {
-            zmsg_addstr (msg, *keys);
-            zmsg_addstr (msg, *values);
+    // strings
+    if (template) {
+        pos = put_le (pos, template_id, 4);
+    }
+    else {
+        pos = put_str (pos, pub->exchange, strlen (pub->exchange));
+    }
 
-            amount -= 1;
-            keys += 1;
-            values += 1;
+    if (!template || pub->routing_key) {
+        pos = put_str (pos, routing_key, strlen (routing_key));
+    }
+
+    for (int i = 0; i < 12; i++) {
+        if (bitmap & (1 << i)) {
+            pos = put_str (pos, props [i], strlen (props [i]));
         }
     }
 
+    for (size_t i = 0; i < amount; i++) {
+        char
+            *key = pub->headers.keys [i],
+            *value = pub->headers.values [i];
+
+        pos = put_str (pos, key, strlen (key));
+        pos = put_str (pos, value, strlen (value));
+    }
+
+    assert (pos == zframe_data (opts) + size);
+    return opts;
+}
+
 
-    // payload
+//  --------------------------------------------------------------------------
+/// Append the two frames of a binary publishing request: The options
+/// and the payload.
+static void
+add_pub (
+    zmsg_t *msg,
+    samwise_pub_t *pub,
+    int template_id)
+{
     assert (pub->msg);
     assert (pub->size);
+
+    zframe_t *opts = encode_opts (pub, template_id);
+    zmsg_append (msg, &opts);
+
     zmsg_addmem (msg, pub->msg, pub->size);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Publish a message to samd.
+int
+samwise_publish (
+    samwise_t *self,
+    samwise_pub_t *pub)
+{
+    zmsg_t *msg = create_msg ();
+    zmsg_addstr (msg, "publish");
+    add_pub (msg, pub, -1);
 
     zmsg_send (&msg, self->req);
     return handle_response (self);
 }
 
 
+//  --------------------------------------------------------------------------
+/// Register the options of a publishing request as a template. The
+/// reply message contains the template id.
+int
+samwise_template (
+    samwise_t *self,
+    samwise_pub_t *pub)
+{
+    zmsg_t *msg = create_msg ();
+    zmsg_addstr (msg, "template");
+
+    zframe_t *opts = encode_opts (pub, -1);
+    zmsg_append (msg, &opts);
+
+    zmsg_send (&msg, self->req);
+
+    int code;
+    char *reply;
+
+    zsock_recv (self->req, "is", &code, &reply);
+    if (code) {
+        fprintf (stderr, "received error '%d': %s\n", code, reply);
+    }
+
+    int id = (code)? -1: atoi (reply);
+    free (reply);
+    return id;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Publish a message referencing a template.
+int
+samwise_publish_template (
+    samwise_t *self,
+    int id,
+    samwise_pub_t *pub)
+{
+    assert (id >= 0);
+
+    zmsg_t *msg = create_msg ();
+    zmsg_addstr (msg, "publish");
+    add_pub (msg, pub, id);
+
+    zmsg_send (&msg, self->req);
+    return handle_response (self);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Publish n messages to samd with a single request. The request
+/// count is followed by the two frames of every publishing request.
+int
+samwise_publish_batch (
+    samwise_t *self,
+    samwise_pub_t **pubs,
+    int n,
+    int *receipts)
+{
+    assert (n > 0);
+
+    zmsg_t *msg = create_msg ();
+    zmsg_addstr (msg, "publish.batch");
+
+    byte count [4];
+    put_le (count, n, 4);
+    zmsg_addmem (msg, count, sizeof (count));
+
+    for (int i = 0; i < n; i++) {
+        add_pub (msg, pubs [i], -1);
+    }
+
+    zmsg_send (&msg, self->req);
+
+
+    // read response, followed by one receipt per request
+    msg = zmsg_recv (self->req);
+    if (!msg) {
+        return -1;
+    }
+
+    char *str = zmsg_popstr (msg);
+    int code = atoi (str);
+    free (str);
+
+    str = zmsg_popstr (msg);
+    if (code) {
+        fprintf (stderr, "received error '%d': %s\n", code, str);
+    }
+    free (str);
+
+    if (!code) {
+        str = zmsg_popstr (msg);
+        int count = atoi (str);
+        free (str);
+        assert (count == n);
+
+        for (int i = 0; i < count; i++) {
+            str = zmsg_popstr (msg);
+            if (receipts) {
+                receipts [i] = atoi (str);
+            }
+            free (str);
+        }
+    }
+
+    zmsg_destroy (&msg);
+    return code;
+}
+
+
 //  --------------------------------------------------------------------------
 /// Ping samd.
 int
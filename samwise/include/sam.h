@@ -57,6 +57,8 @@ extern "C" {
 #  error "sam needs at least CZMQ 3.0.0"
 #endif
 
+#include <sys/uio.h>
+
 
 //
 //   MACROS
@@ -64,7 +66,13 @@ extern "C" {
 #define UU __attribute__((unused))
 
 // global configuration
-#define SAM_PROTOCOL_VERSION 120
+#define SAM_PROTOCOL_VERSION 210
+#define SAM_PROTOCOL_VERSION_MIN 120
+#define SAM_PROTOCOL_VERSION_BINARY 200
+#define SAM_PROTOCOL_VERSION_TEMPLATE 210
+#define SAM_PUB_HEAD_SIZE 8
+#define SAM_PUB_TEMPLATE 0x80
+#define SAM_TEMPLATE_MAX 1024
 #define SAM_RET_RESTART 0x10
 
 // enable stats
@@ -94,15 +102,40 @@ typedef enum {
 typedef enum {
     SAM_BE_SIG_CONNECTION_LOSS = 0x10, ///< if a backend was split
     SAM_BE_SIG_RECONNECTED,            ///< if the backend re-connected
-    SAM_BE_SIG_KILL                    ///< backend no longer re-connects
+    SAM_BE_SIG_KILL,                   ///< backend no longer re-connects
+    SAM_BE_SIG_SATURATED,              ///< backend accepts no more messages
+    SAM_BE_SIG_RELIEVED                ///< backend accepts messages again
 } sam_be_sig_t;
 
 
+/// confirmations sent by messaging backends to the buffer
+typedef enum {
+    SAM_BE_ACK = 0x20,  ///< the broker accepted the messages
+    SAM_BE_NACK,        ///< the broker rejected or returned the messages
+    SAM_BE_LOST         ///< the connection broke before a confirm arrived
+} sam_be_confirm_t;
+
+
+/// strategies to select the backends a message gets published to,
+/// the internal flags get combined with one of the strategies
+typedef enum {
+    SAM_DIST_DEFAULT,            ///< as configured (backend/distribution)
+    SAM_DIST_ROUND_ROBIN,        ///< one backend after another
+    SAM_DIST_LEAST_OUTSTANDING,  ///< fewest unconfirmed messages
+    SAM_DIST_WEIGHTED,           ///< proportional to the backends weight
+    SAM_DIST_AFFINITY,           ///< consistent hashing of the routing key
+    SAM_DIST_HEDGE = 0x100,      ///< internal: avoid the backends chosen
+    SAM_DIST_REROUTE = 0x200     ///< internal: avoid all backends chosen
+} sam_dist_t;
+
+
 /// return type for client responses
 typedef struct sam_ret_t {
     int rc;          ///< return code
     char *msg;       ///< additional info, either static or allocated
     bool allocated;  ///< indicates if ret.msg must be free'd
+    int count;       ///< number of receipts (batched requests)
+    int *receipts;   ///< allocated return codes per batched request
 } sam_ret_t;
 
 
@@ -135,14 +168,42 @@ sam_init (
 //  --------------------------------------------------------------------------
 /// @brief Instruct sam to analyze and act according to a message
 /// @param self A sam instance
+/// @param version Protocol version of the request
 /// @param msg Message containing some <action>
 /// @return Some sam_ret_t
 sam_ret_t *
 sam_eval (
     sam_t *self,
+    int version,
     sam_msg_t *msg);
 
 
+//  --------------------------------------------------------------------------
+/// @brief Like sam_eval, but does not wait for publishing requests
+///        to be persisted
+/// @param self A sam instance
+/// @param version Protocol version of the request
+/// @param msg Message containing some <action>
+/// @param tag Opaque pointer handed out again with the receipt
+/// @return Some sam_ret_t for immediate replies or NULL if the reply
+///         arrives later as a receipt (see sam_receipts)
+sam_ret_t *
+sam_eval_async (
+    sam_t *self,
+    int version,
+    sam_msg_t *msg,
+    void *tag);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Socket to receive receipts of asynchronous requests from
+/// @param self A sam instance
+/// @return Pull socket delivering "pp" (tag, sam_ret_t *) messages
+zsock_t *
+sam_receipts (
+    sam_t *self);
+
+
 //  --------------------------------------------------------------------------
 /// @brief Self test this class.
 void *
@@ -30,6 +30,10 @@ extern "C" {
 typedef struct sam_be_rmq_t sam_be_rmq_t;
 
 
+/// used if no window is configured for a backend
+#define SAM_BE_RMQ_WINDOW 4096
+
+
 /// option set to pass for backend creation
 typedef struct sam_be_rmq_opts_t {
     char *host;           ///< hostname, mostly some ip address
@@ -40,10 +44,17 @@ typedef struct sam_be_rmq_opts_t {
 
     int tries;            ///< number of re-connect tries
     uint64_t interval;    ///< interval of re-connect tries
+
+    int window;           ///< max. number of unconfirmed messages
+    int weight;           ///< share of weighted distribution
 } sam_be_rmq_opts_t;
 
 
-/// per-message publishing options
+typedef struct sam_be_rmq_tpl_t sam_be_rmq_tpl_t;
+
+
+/// per-message publishing options, created once per publishing
+/// request by sam_be_rmq_pub_new and shared by all backends
 typedef struct sam_be_rmq_pub_t {
     char *exchange;
     char *routing_key;
@@ -63,11 +74,93 @@ typedef struct sam_be_rmq_pub_t {
         char *app_id;
         char *cluster_id;
     } props;
-    zlist_t *headers;
-    zframe_t *payload;
+    int header_c;         ///< amount of key/value pairs
+    char **headers;       ///< alternating keys and values
+    byte *payload;        ///< points into the publishing request
+    size_t payload_size;  ///< size of the payload
+
+    const sam_be_rmq_tpl_t *tpl;  ///< template the options derive from
+    uint16_t overrides;   ///< properties differing from the template
+
+    struct {
+        amqp_bytes_t exchange;
+        amqp_bytes_t routing_key;
+        amqp_basic_properties_t props;  ///< including the header table
+    } amqp;               ///< translated once when decoding
 } sam_be_rmq_pub_t;
 
 
+/// publishing options registered once (see rfc 9) and referenced by
+/// many publishing requests
+struct sam_be_rmq_tpl_t {
+    sam_be_rmq_pub_t *opts;  ///< decoded options without payload
+};
+
+
+//  --------------------------------------------------------------------------
+/// @brief Decode the publishing options of a publishing request
+/// @param msg Exchange, routing key, mandatory, immediate, the
+///            property and header lists and the payload or the
+///            binary options frame and the payload
+/// @return Options in a single allocation or NULL if malformed
+sam_be_rmq_pub_t *
+sam_be_rmq_pub_new (
+    sam_msg_t *msg);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Decode the publishing options of a publishing request
+///        referencing a template
+/// @param tpl The template referenced by the request
+/// @param msg The binary options frame containing the overrides and
+///            the payload
+/// @return Options in a single allocation or NULL if malformed
+sam_be_rmq_pub_t *
+sam_be_rmq_pub_derive (
+    const sam_be_rmq_tpl_t *tpl,
+    sam_msg_t *msg);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Encode publishing options as self-contained binary options
+/// @param self Decoded publishing options
+/// @param head Head of the original options (distribution)
+/// @param size Gets set to the size of the encoded options
+/// @return Newly allocated binary options
+byte *
+sam_be_rmq_pub_encode (
+    sam_be_rmq_pub_t *self,
+    const byte *head,
+    size_t *size);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Destroy decoded publishing options
+/// @param self Options created by sam_be_rmq_pub_new
+void
+sam_be_rmq_pub_destroy (
+    sam_be_rmq_pub_t **self);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Create a publishing template from binary options
+/// @param data Binary options without template reference
+/// @param size Size of the options
+/// @return New template or NULL if the options are malformed
+sam_be_rmq_tpl_t *
+sam_be_rmq_tpl_new (
+    byte *data,
+    size_t size);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Destroy a publishing template
+/// @param self Template created by sam_be_rmq_tpl_new
+void
+sam_be_rmq_tpl_destroy (
+    sam_be_rmq_tpl_t **self);
+
+
 //  --------------------------------------------------------------------------
 /// @brief Returns the underlying socket of the broker connection
 /// @return The TCP socket's file descriptor
@@ -82,7 +175,7 @@ sam_be_rmq_sockfd (
 sam_be_rmq_t *
 sam_be_rmq_new (
     const char *name,
-    uint64_t id);
+    int id);
 
 
 //  --------------------------------------------------------------------------
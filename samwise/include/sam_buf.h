@@ -33,12 +33,14 @@ typedef struct sam_buf_t sam_buf_t;
 /// @param cfg Samwise configuration
 /// @param in To read acknowledgements from
 /// @param out To re-send publishing requests to
+/// @param receipts To hand out receipts of asynchronous storage requests
 /// @return A new buf instance.
 sam_buf_t *
 sam_buf_new (
     sam_cfg_t *cfg,
     zsock_t **in,
-    zsock_t **out);
+    zsock_t **out,
+    zsock_t **receipts);
 
 
 //  --------------------------------------------------------------------------
@@ -54,12 +56,56 @@ sam_buf_destroy (
 /// @param self A buf instance
 /// @param msg A publishing request wrapped by sam_msg_t
 /// @param count How many backends must acknowledge the message
-/// @return A unique id used to identify the message
-int
+/// @param dist Distribution strategy of the message
+/// @return A unique id used to identify the message, 0 if the
+///         message could not be persisted
+uint64_t
 sam_buf_save (
     sam_buf_t *self,
     sam_msg_t *msg,
-    int count);
+    int count,
+    sam_dist_t dist);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Hand n messages over to store, persisted in one transaction
+/// @param self A buf instance
+/// @param n Number of messages
+/// @param msgs Array of n publishing requests
+/// @param counts How many backends must acknowledge each message
+/// @param dists Distribution strategy of each message
+/// @param keys Array of size n, gets filled with the unique ids or
+///        0 for messages which could not be persisted
+/// @return The number of messages which could not be persisted
+int
+sam_buf_save_batch (
+    sam_buf_t *self,
+    int n,
+    sam_msg_t **msgs,
+    int *counts,
+    sam_dist_t *dists,
+    uint64_t *keys);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Hand n messages over to store without waiting for the store
+/// @param self A buf instance
+/// @param n Number of messages
+/// @param msgs Array of n publishing requests
+/// @param counts How many backends must acknowledge each message
+/// @param dists Distribution strategy of each message
+/// @param tag Opaque pointer handed out with the receipt
+/// @param ret Return object handed out with the receipt, reports the
+///        messages which could not be persisted
+void
+sam_buf_save_async (
+    sam_buf_t *self,
+    int n,
+    sam_msg_t **msgs,
+    int *counts,
+    sam_dist_t *dists,
+    void *tag,
+    sam_ret_t *ret);
 
 
 //  --------------------------------------------------------------------------
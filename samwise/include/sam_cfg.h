@@ -62,6 +62,17 @@ sam_cfg_get (
     zconfig_t **conf);
 
 
+//  --------------------------------------------------------------------------
+/// @brief Convert a BINARY value (e.g. "10M") to bytes
+/// @param str The configured value
+/// @param value Pointer to the value set
+/// @return -1 in case of error, 0 on success
+int
+sam_cfg_binary_value (
+    const char *str,
+    uint64_t *value);
+
+
 //
 //  BUFFER CONFIGURATION
 //
@@ -110,6 +121,97 @@ sam_cfg_buf_retry_threshold (
     uint64_t *threshold);
 
 
+//  --------------------------------------------------------------------------
+/// @brief Returns the group commit window in milliseconds.
+/// @param self A cfg instance
+/// @param window Pointer to the value set
+/// @return -1 in case of error, 0 on success
+int
+sam_cfg_buf_commit_window (
+    sam_cfg_t *self,
+    uint64_t *window);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Returns the maximum number of operations per group commit
+/// @param self A cfg instance
+/// @param count Pointer to the value set
+/// @return -1 in case of error, 0 on success
+int
+sam_cfg_buf_commit_count (
+    sam_cfg_t *self,
+    int *count);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Returns the maximum number of due messages handled before
+///        the buffer handles other requests
+/// @param self A cfg instance
+/// @param budget Pointer to the value set
+/// @return -1 in case of error, 0 on success
+int
+sam_cfg_buf_retry_budget (
+    sam_cfg_t *self,
+    int *budget);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Returns the maximum time in milliseconds spent re-sending
+///        before the buffer handles other requests
+/// @param self A cfg instance
+/// @param slice Pointer to the value set
+/// @return -1 in case of error, 0 on success
+int
+sam_cfg_buf_retry_slice (
+    sam_cfg_t *self,
+    uint64_t *slice);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Returns the maximum number of messages re-sent per second
+/// @param self A cfg instance
+/// @param rate Pointer to the value set
+/// @return -1 in case of error, 0 on success
+int
+sam_cfg_buf_retry_rate (
+    sam_cfg_t *self,
+    int *rate);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Returns the confirmation latency percentile to hedge at
+/// @param self A cfg instance
+/// @param percentile Pointer to the value set
+/// @return -1 in case of error, 0 on success
+int
+sam_cfg_buf_hedge_percentile (
+    sam_cfg_t *self,
+    int *percentile);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Returns the maximum time new records stay in memory
+///        before they are written to the database (milliseconds)
+/// @param self A cfg instance
+/// @param delay Pointer to the value set
+/// @return -1 in case of error, 0 on success
+int
+sam_cfg_buf_stage_delay (
+    sam_cfg_t *self,
+    uint64_t *delay);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Returns the maximum memory of records kept in memory
+/// @param self A cfg instance
+/// @param size Pointer to the value set
+/// @return -1 in case of error, 0 on success
+int
+sam_cfg_buf_stage_size (
+    sam_cfg_t *self,
+    uint64_t *size);
+
+
 //
 //  BACKEND CONFIGURATION
 //
@@ -125,6 +227,17 @@ sam_cfg_endpoint (
     char **endpoint);
 
 
+//  --------------------------------------------------------------------------
+/// @brief Load the optional asynchronous (router) endpoint
+/// @param self A cfg instance
+/// @param endpoint Pointer to point to the data
+/// @return 0 for success, -1 if not configured
+int
+sam_cfg_async_endpoint (
+    sam_cfg_t *self,
+    char **endpoint);
+
+
 //  --------------------------------------------------------------------------
 /// @brief Load the backend type
 /// @param self A cfg instance
@@ -136,6 +249,17 @@ sam_cfg_be_type (
     sam_be_t *be_type);
 
 
+//  --------------------------------------------------------------------------
+/// @brief Returns the name of the default distribution strategy
+/// @param self A cfg instance
+/// @param distribution Is going to point to the name
+/// @return 0 for success, -1 if no default is configured
+int
+sam_cfg_be_distribution (
+    sam_cfg_t *self,
+    char **distribution);
+
+
 //  --------------------------------------------------------------------------
 /// @brief Loads an array of backend options
 /// @param self A cfg instance
@@ -13,8 +13,19 @@
    @brief Handle persistent storage
 
    This interface exists to allow database engine indepented storage
-   for sam_buf. Currently BerkeleyDB is supported. LMDB is going to
-   follow
+   for sam_buf. Currently BerkeleyDB (db/bdb), LMDB (db/lmdb) and an
+   append-only segmented log (db/log) are supported. The engine is
+   chosen by the name of the configuration section handed to
+   sam_db_new ().
+
+   Records obtained by sam_db_get_val () must be considered read
+   only: LMDB returns pointers into its read-only memory map. Use
+   sam_db_edit () to obtain a writable record and sam_db_update () to
+   write it back.
+
+   sam_db_savepoint () and sam_db_rewind () allow to discard a failed
+   operation without aborting the transaction, as long as the
+   operation did not change anything: Validate before writing.
 
 */
 
@@ -27,6 +38,7 @@ extern "C" {
 
 
 typedef struct sam_db_t sam_db_t;
+typedef struct sam_db_engine_t sam_db_engine_t;
 
 
 /// return codes for db operations
@@ -46,8 +58,41 @@ typedef enum {
 } sam_db_flag_t;
 
 
+/// storage engine implementation, all functions
+/// correspond to the sam_db_* functions of the same name.
+/// putv is optional, put gets the concatenated parts otherwise
+struct sam_db_engine_t {
+    const char *name;  ///< name of the configuration section
+
+    void *(*new) (zconfig_t *conf);
+    void (*destroy) (void **self);
+
+    sam_db_ret_t (*begin) (void *self);
+    sam_db_ret_t (*end) (void *self, bool abort);
+
+    uint64_t (*get_key) (void *self);
+    void (*set_key) (void *self, uint64_t *key);
+    void (*get_val) (void *self, size_t *size, void **record);
+    void (*edit) (void *self, size_t *size, void **record);
+
+    sam_db_ret_t (*get) (void *self, uint64_t *key);
+    sam_db_ret_t (*sibling) (void *self, sam_db_flag_t trav);
+    sam_db_ret_t (*put) (void *self, size_t size, byte *record);
+    sam_db_ret_t (*putv) (void *self, struct iovec *parts, int part_c);
+    sam_db_ret_t (*update) (void *self, sam_db_flag_t flag);
+    sam_db_ret_t (*del) (void *self);
+};
+
+
+/// available storage engines
+extern const sam_db_engine_t sam_db_bdb;
+extern const sam_db_engine_t sam_db_lmdb;
+extern const sam_db_engine_t sam_db_log;
+
+
 //  --------------------------------------------------------------------------
 /// @brief Create a new db instance, (re)-opens the database
+/// @param conf Engine configuration, e.g. the db/bdb section
 /// @return A db instance
 sam_db_t *
 sam_db_new (
@@ -75,18 +120,38 @@ sam_db_begin (
 /// @brief End database operations, either commit or abort.
 /// @param self A db instance
 /// @param abort If true, discards all changes since db_begin ()
-/// @return A db status code
-void
+/// @return A db status code, SAM_DB_ERROR if the commit failed
+sam_db_ret_t
 sam_db_end (
     sam_db_t *self,
     bool abort);
 
 
+//  --------------------------------------------------------------------------
+/// @brief Mark the current state of the transaction before an
+///        operation that may fail
+/// @param self A db instance
+void
+sam_db_savepoint (
+    sam_db_t *self);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Discard the operation started at the latest savepoint
+/// @param self A db instance
+/// @return A db status code, SAM_DB_ERROR if a change was attempted
+///         or the engine failed since the savepoint: The transaction
+///         must be aborted then
+sam_db_ret_t
+sam_db_rewind (
+    sam_db_t *self);
+
+
 //  --------------------------------------------------------------------------
 /// @brief Retrieve the key of the current db record
 /// @param self A db instance
 /// @return The records key
-int
+uint64_t
 sam_db_get_key (
     sam_db_t *self);
 
@@ -99,7 +164,7 @@ sam_db_get_key (
 void
 sam_db_set_key (
     sam_db_t *self,
-    int *key);
+    uint64_t *key);
 
 
 //  --------------------------------------------------------------------------
@@ -114,6 +179,20 @@ sam_db_get_val (
     void **record);
 
 
+//  --------------------------------------------------------------------------
+/// @brief Get a writable version of the current record. Changes get
+///        persisted by sam_db_update (). The memory is owned by the
+///        db instance and valid until the next db operation.
+/// @param self A db instance
+/// @param size Size to be set
+/// @param record Pointer to the record to be set
+void
+sam_db_edit (
+    sam_db_t *self,
+    size_t *size,
+    void **record);
+
+
 //  --------------------------------------------------------------------------
 /// @brief Set the current record based on the key
 /// @param self A db instance
@@ -121,7 +200,7 @@ sam_db_get_val (
 sam_db_ret_t
 sam_db_get (
     sam_db_t *self,
-    int *key);
+    uint64_t *key);
 
 
 //  --------------------------------------------------------------------------
@@ -148,6 +227,19 @@ sam_db_put (
     byte *record);
 
 
+//  --------------------------------------------------------------------------
+/// @brief Insert a record consisting of several parts of memory
+/// @param self A db instance
+/// @param parts The parts getting concatenated
+/// @param part_c Amount of parts
+/// @return A db status code
+sam_db_ret_t
+sam_db_putv (
+    sam_db_t *self,
+    struct iovec *parts,
+    int part_c);
+
+
 //  --------------------------------------------------------------------------
 /// @brief Update some existing data
 /// @param self A db instance
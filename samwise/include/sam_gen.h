@@ -31,6 +31,66 @@ sam_gen_handle_pipe (
     void *args);
 
 
+//  --------------------------------------------------------------------------
+/// @brief Bytes a backend set needs to contain the provided id
+/// @return Size of the set in bytes
+size_t
+sam_gen_set_size (
+    int id);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Checks if a backend set contains the provided id
+/// @return True if the id is in the set
+bool
+sam_gen_set_contains (
+    const byte *set,
+    size_t size,
+    int id);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Adds an id to a backend set, which must be large enough
+void
+sam_gen_set_add (
+    byte *set,
+    int id);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Reads a little-endian 16 bit integer (binary protocol)
+/// @return The integer in host byte order
+uint16_t
+sam_gen_le16 (
+    const byte *data);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Reads a little-endian 32 bit integer (binary protocol)
+/// @return The integer in host byte order
+uint32_t
+sam_gen_le32 (
+    const byte *data);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Writes a little-endian 16 bit integer (binary protocol)
+/// @return The position after the integer
+byte *
+sam_gen_put_le16 (
+    byte *data,
+    uint16_t val);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Writes a little-endian 32 bit integer (binary protocol)
+/// @return The position after the integer
+byte *
+sam_gen_put_le32 (
+    byte *data,
+    uint32_t val);
+
+
 //  --------------------------------------------------------------------------
 /// @brief Self test this file
 void *
@@ -35,6 +35,10 @@ typedef enum {
 } sam_msg_rule_t;
 
 
+/// destroys data attached with sam_msg_set_data ()
+typedef void (sam_msg_data_destructor) (void **data);
+
+
 
 //  --------------------------------------------------------------------------
 /// @brief Creates a new sam_msg instance from an existing zmsg
@@ -52,7 +56,7 @@ sam_msg_destroy (
 
 
 //  --------------------------------------------------------------------------
-/// @brief Create a deep copy of the message object
+/// @brief Create a copy of the message object sharing the frames data
 /// @self A sam_msg instance
 /// @return A copy of the sam_msg instance
 sam_msg_t *
@@ -60,6 +64,32 @@ sam_msg_dup (
     sam_msg_t *self);
 
 
+//  --------------------------------------------------------------------------
+/// @brief Move the next n frames into a new message object
+/// @param self A sam_msg instance
+/// @param n Amount of frames to move
+/// @return A new sam_msg instance or NULL if less than n frames are left
+sam_msg_t *
+sam_msg_split (
+    sam_msg_t *self,
+    int n);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Replace a frame, the message must not be shared yet
+/// @param self A sam_msg instance
+/// @param pos Position of the frame, relative to the first one
+/// @param data Content of the new frame, gets copied
+/// @param size Size of the new frame
+/// @return 0 if okay, -1 if there is no frame at the position
+int
+sam_msg_replace (
+    sam_msg_t *self,
+    int pos,
+    byte *data,
+    size_t size);
+
+
 //  --------------------------------------------------------------------------
 /// @brief Become one owner of the msg instance, used for reference counting
 /// @param self A sam_msg_instance
@@ -76,6 +106,42 @@ sam_msg_size (
     sam_msg_t *self);
 
 
+//  --------------------------------------------------------------------------
+/// @brief Attach data which gets destroyed with the message
+/// @param self A sam_msg instance
+/// @param data Data to attach, must not be altered once shared
+/// @param destructor Invoked when the message gets destroyed
+void
+sam_msg_set_data (
+    sam_msg_t *self,
+    void *data,
+    sam_msg_data_destructor *destructor);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Return the attached data
+/// @param self A sam_msg instance
+/// @return The attached data or NULL
+void *
+sam_msg_data (
+    sam_msg_t *self);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Access the data of a frame without copying it
+/// @param self A sam_msg instance
+/// @param pos Position of the frame, 0 is the first non-popped frame
+/// @param data Is going to point to the frames data
+/// @param size Is going to contain the frames size
+/// @return 0 if okay, -1 if there is no such frame
+int
+sam_msg_frame (
+    sam_msg_t *self,
+    int pos,
+    byte **data,
+    size_t *size);
+
+
 //  --------------------------------------------------------------------------
 /// @brief Free's all memory allocated by the last pop() calls
 /// @param self A sam_msg instance
@@ -132,6 +198,26 @@ sam_msg_encoded_size (
     sam_msg_t *self);
 
 
+//  --------------------------------------------------------------------------
+/// @brief Return the number of memory parts of the encoded message
+/// @param self A sam_msg instance
+/// @return Required amount of parts for sam_msg_encode_parts ()
+int
+sam_msg_encoded_parts (
+    sam_msg_t *self);
+
+
+//  --------------------------------------------------------------------------
+/// @brief Describe the encoded message by memory parts without copying
+/// @param self A sam_msg instance
+/// @param iov Is going to describe the parts, see sam_msg_encoded_parts ()
+/// @return Amount of parts
+int
+sam_msg_encode_parts (
+    sam_msg_t *self,
+    struct iovec *iov);
+
+
 //  --------------------------------------------------------------------------
 /// @brief Encode all non-popped frames into an opaque buffer
 /// @param self A sam_msg instance
@@ -50,14 +50,22 @@ typedef struct sam_backend_t sam_backend_t;
 struct sam_backend_t {
     // public interface
     char *name;          ///< name of the backend
-    uint64_t id;         ///< id (power of 2) > 0
+    int id;              ///< id > 0, reused once removed
+    int weight;          ///< share of weighted distribution, > 0
 
     zsock_t *sock_sig;   ///< socket for signaling state changes
     zsock_t *sock_pub;   ///< push messages to be published
     zsock_t *sock_rpc;   ///< request an rpc call
+    bool saturated;      ///< too many unconfirmed messages in flight
+    bool connected;      ///< the backend is connected to its broker
+
+    // maintained by the sam actor
+    unsigned int dispatched;  ///< messages sent to the backend
+    int current;              ///< state of the weighted distribution
 
     // methods
     char *(*str) (sam_backend_t *be);  ///< return string representation
+    unsigned int (*released) (sam_backend_t *be);  ///< no longer in flight
 
     // privates, do not touch!
     zactor_t *_actor;   ///< thread handling the broker connection
@@ -56,6 +56,40 @@
 #include "../include/sam_prelude.h"
 
 
+/// number of remembered routing decisions, must be a power of 2
+#define ROUTES 4096
+
+
+/// points on the hash ring per unit of a backends weight
+#define RING_POINTS 64
+
+/// 32 bit FNV-1a parameters
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+
+/// backends a message was published to
+typedef struct route_t {
+    uint64_t key;            ///< message id
+    byte *ids;               ///< set of backend ids
+    size_t ids_size;         ///< size of the set
+} route_t;
+
+
+/// registered publishing template
+typedef struct template_t {
+    byte *data;              ///< options it got registered with
+    size_t size;             ///< size of the options
+    void *tpl;               ///< backend specific representation
+} template_t;
+
+
+/// position of a backend on the hash ring
+typedef struct point_t {
+    uint32_t hash;           ///< position on the ring
+    sam_backend_t *be;       ///< backend owning the position
+} point_t;
+
 
 /// state used by the sam actor
 typedef struct state_t {
@@ -64,6 +98,13 @@ typedef struct state_t {
     zsock_t *frontend_rpc;   ///< reply socket for rpc requests
     zsock_t *frontend_pub;   ///< pull socket for publishing requests
     zlist_t *backends;       ///< maintains backend handles
+    sam_dist_t distribution; ///< replaces SAM_DIST_DEFAULT
+    int next;                ///< list position for round robin
+    route_t *routes;         ///< backends per message (hedging)
+    point_t *ring;           ///< sorted hash ring (affinity)
+    int ring_size;           ///< amount of points on the ring
+    byte *acks;              ///< backends to avoid for the current msg
+    size_t acks_size;        ///< large enough for all backend ids
 
     sam_stat_handle_t *stat;
 } state_t;
@@ -71,7 +112,6 @@ typedef struct state_t {
 
 /// sam instances
 struct sam_t {
-    int be_id_power;              ///< used to assign backend ids
     sam_be_t be_type;             ///< backend type, used to init backends
 
     zsock_t *frontend_pub;        ///< request socket for rpc calls
@@ -81,11 +121,18 @@ struct sam_t {
     zsock_t *ctl_req;             ///< request socket for control commands
     char *backend_pull_endpoint;  ///< pull endpoint name for backends to bind
 
+    zsock_t *receipts;            ///< receipts of asynchronous requests
+    char *receipts_endpoint;      ///< for sam_buf to hand out receipts
+
     sam_buf_t *buf;               ///< message store
+    sam_dist_t distribution;      ///< replaces SAM_DIST_DEFAULT
     sam_cfg_t *cfg;               ///< configuration
     sam_stat_t *stat_actor;       ///< gather metrics
     sam_stat_handle_t *stat;      ///< handle to send metrics
 
+    template_t *templates;        ///< publishing templates, index is the id
+    int template_c;               ///< amount of registered templates
+
     zactor_t *actor;              ///< thread maintaining broker connections
 };
 
@@ -101,11 +148,91 @@ new_ret ()
     ret->rc = 0;
     ret->msg = "";
     ret->allocated = false;
+    ret->count = 0;
+    ret->receipts = NULL;
 
     return ret;
 }
 
 
+//  --------------------------------------------------------------------------
+/// Continues a 32 bit FNV-1a hash with the provided data.
+static uint32_t
+fnv1a (
+    uint32_t hash,
+    const byte *data,
+    size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data [i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Order points on the hash ring.
+static int
+compare_points (
+    const void *a,
+    const void *b)
+{
+    uint32_t
+        hash_a = ((const point_t *) a)->hash,
+        hash_b = ((const point_t *) b)->hash;
+
+    return (hash_a > hash_b) - (hash_a < hash_b);
+}
+
+
+//  --------------------------------------------------------------------------
+/// (Re-)builds the hash ring. Every backend occupies RING_POINTS
+/// points per unit of its weight, derived from its name. Thus adding
+/// or removing a backend only moves the keys of the points it owns.
+static void
+build_ring (
+    state_t *state)
+{
+    int size = 0;
+    sam_backend_t *be = zlist_first (state->backends);
+    while (be) {
+        size += RING_POINTS * be->weight;
+        be = zlist_next (state->backends);
+    }
+
+    free (state->ring);
+    state->ring = NULL;
+    state->ring_size = size;
+
+    if (!size) {
+        return;
+    }
+
+    state->ring = malloc (size * sizeof (point_t));
+    assert (state->ring);
+
+    int pos = 0;
+    be = zlist_first (state->backends);
+    while (be) {
+        uint32_t hash = fnv1a (
+            FNV_OFFSET, (byte *) be->name, strlen (be->name));
+
+        for (int i = 0; i < RING_POINTS * be->weight; i++) {
+            state->ring [pos].hash = fnv1a (hash, (byte *) &i, sizeof (i));
+            state->ring [pos].be = be;
+            pos += 1;
+        }
+
+        be = zlist_next (state->backends);
+    }
+
+    qsort (state->ring, size, sizeof (point_t), compare_points);
+    sam_log_tracef ("rebuilt hash ring with %d points", size);
+}
+
+
 //  --------------------------------------------------------------------------
 /// This removes a backend and all event listener from its signal socket.
 static int
@@ -132,14 +259,35 @@ remove_backend (
         be = zlist_next (state->backends);
     }
 
+    if (!rc) {
+        build_ring (state);
+    }
+
     return rc;
 }
 
 
 
 //  --------------------------------------------------------------------------
-/// Handle signals from backends. Currently, the only existing signal
-/// is a connection loss.
+/// Returns the backend with the provided name or NULL.
+static sam_backend_t *
+find_backend (
+    state_t *state,
+    const char *name)
+{
+    sam_backend_t *be = zlist_first (state->backends);
+    while (be != NULL && strcmp (name, be->name)) {
+        be = zlist_next (state->backends);
+    }
+
+    return be;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Handle signals from backends. Saturated and disconnected backends
+/// are skipped when distributing messages until they are relieved or
+/// re-connected.
 static int
 handle_sig (
     zloop_t *loop,
@@ -157,7 +305,43 @@ handle_sig (
         return rc;
     }
 
-    sam_log_errorf ("got signal 0x%x from '%s'!", code, be_name);
+    if (code == SAM_BE_SIG_SATURATED || code == SAM_BE_SIG_RELIEVED) {
+        sam_backend_t *be = find_backend (state, be_name);
+        if (be) {
+            be->saturated = (code == SAM_BE_SIG_SATURATED);
+        }
+
+        sam_log_tracef (
+            "'%s' %s", be_name,
+            (code == SAM_BE_SIG_SATURATED)? "saturated": "relieved");
+
+        sam_stat (
+            state->stat, (code == SAM_BE_SIG_SATURATED)?
+            "sam.backends saturated": "sam.backends relieved", 1);
+    }
+
+    else if (
+        code == SAM_BE_SIG_CONNECTION_LOSS ||
+        code == SAM_BE_SIG_RECONNECTED) {
+
+        sam_backend_t *be = find_backend (state, be_name);
+        if (be) {
+            be->connected = (code == SAM_BE_SIG_RECONNECTED);
+        }
+
+        sam_log_infof (
+            "'%s' %s", be_name,
+            (code == SAM_BE_SIG_RECONNECTED)?
+            "re-connected": "lost its connection");
+
+        sam_stat (
+            state->stat, (code == SAM_BE_SIG_RECONNECTED)?
+            "sam.backends re-connected": "sam.backends disconnected", 1);
+    }
+
+    else {
+        sam_log_errorf ("got signal 0x%x from '%s'!", code, be_name);
+    }
 
     if (code == SAM_BE_SIG_KILL) {
         rc = remove_backend (state, loop, be_name);
@@ -168,6 +352,293 @@ handle_sig (
 }
 
 
+//  --------------------------------------------------------------------------
+/// Checks that the backend did not already ack the message, that it
+/// is connected and able to take more messages.
+static bool
+eligible (
+    state_t *state,
+    sam_backend_t *be)
+{
+    return
+        !sam_gen_set_contains (state->acks, state->acks_size, be->id) &&
+        be->connected && !be->saturated;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the lowest id not used by any backend. Ids of removed
+/// backends get reused, which keeps the backend sets small.
+static int
+free_backend_id (
+    state_t *state)
+{
+    int id = 1;
+    sam_backend_t *be = zlist_first (state->backends);
+
+    while (be) {
+        if (be->id == id) {
+            id += 1;
+            be = zlist_first (state->backends);
+        }
+        else {
+            be = zlist_next (state->backends);
+        }
+    }
+
+    return id;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Selects the next eligible backend after the one selected last.
+/// The position is kept in the state because the lists cursor gets
+/// reset by every other iteration over the backends.
+static sam_backend_t *
+select_round_robin (
+    state_t *state)
+{
+    int backend_c = zlist_size (state->backends);
+    if (!backend_c) {
+        return NULL;
+    }
+
+    int start = state->next % backend_c;
+    sam_backend_t *be = zlist_first (state->backends);
+
+    for (int pos = 0; pos < start; pos++) {
+        be = zlist_next (state->backends);
+    }
+
+    for (int i = 0; i < backend_c; i++) {
+        if (be == NULL) {
+            be = zlist_first (state->backends);
+        }
+
+        if (eligible (state, be)) {
+            state->next = (start + i + 1) % backend_c;
+            return be;
+        }
+
+        be = zlist_next (state->backends);
+    }
+
+    return NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Selects the eligible backend with the fewest messages in flight,
+/// i.e. messages sent to the backend but not yet released by it.
+static sam_backend_t *
+select_least_outstanding (
+    state_t *state)
+{
+    sam_backend_t *selected = NULL;
+    unsigned int min = 0;
+
+    sam_backend_t *be = zlist_first (state->backends);
+    while (be) {
+        unsigned int outstanding = be->dispatched - be->released (be);
+        if (eligible (state, be) && (!selected || outstanding < min)) {
+            selected = be;
+            min = outstanding;
+        }
+
+        be = zlist_next (state->backends);
+    }
+
+    return selected;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Selects an eligible backend by its weight (smooth weighted round
+/// robin): Every backend gains its weight, the one with the highest
+/// gain gets selected and pays the sum of all weights.
+static sam_backend_t *
+select_weighted (
+    state_t *state)
+{
+    sam_backend_t *selected = NULL;
+    int total = 0;
+
+    sam_backend_t *be = zlist_first (state->backends);
+    while (be) {
+        if (eligible (state, be)) {
+            be->current += be->weight;
+            total += be->weight;
+
+            if (!selected || selected->current < be->current) {
+                selected = be;
+            }
+        }
+
+        be = zlist_next (state->backends);
+    }
+
+    if (selected) {
+        selected->current -= total;
+    }
+
+    return selected;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Destructor for decoded RabbitMQ publishing options.
+static void
+destroy_pub_rmq (
+    void **opts)
+{
+    sam_be_rmq_pub_destroy ((sam_be_rmq_pub_t **) opts);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Decodes the publishing options of a publishing request once and
+/// attaches them to the message. All backends publish from these
+/// options, so the message must not be shared yet.
+static int
+decode_pub (
+    sam_be_t be_type,
+    sam_msg_t *msg)
+{
+    if (be_type == SAM_BE_RMQ) {
+        sam_be_rmq_pub_t *opts = sam_be_rmq_pub_new (msg);
+        if (opts == NULL) {
+            return -1;
+        }
+
+        sam_msg_set_data (msg, opts, destroy_pub_rmq);
+        return 0;
+    }
+
+    assert (false);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Decodes the publishing options of a publishing request which
+/// references a template. The message gets rewritten to carry
+/// self-contained options: Templates are not persisted and the
+/// buffer must be able to decode the message after a restart.
+static int
+decode_template (
+    sam_t *self,
+    sam_msg_t *msg)
+{
+    byte *data;
+    size_t size;
+
+    sam_msg_frame (msg, 0, &data, &size);
+    if (size < SAM_PUB_HEAD_SIZE + 4) {
+        return -1;
+    }
+
+    uint32_t id = sam_gen_le32 (data + SAM_PUB_HEAD_SIZE);
+    if (id >= (uint32_t) self->template_c) {
+        return -1;
+    }
+
+    if (self->be_type == SAM_BE_RMQ) {
+        sam_be_rmq_pub_t *opts = sam_be_rmq_pub_derive (
+            self->templates [id].tpl, msg);
+
+        if (opts == NULL) {
+            return -1;
+        }
+
+        size_t opts_size;
+        byte *opts_data = sam_be_rmq_pub_encode (opts, data, &opts_size);
+
+        sam_msg_replace (msg, 0, opts_data, opts_size);
+        sam_msg_frame (msg, 1, &opts->payload, &opts->payload_size);
+        free (opts_data);
+
+        sam_msg_set_data (msg, opts, destroy_pub_rmq);
+        return 0;
+    }
+
+    assert (false);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Hashes the routing key of a message, taken from its decoded
+/// publishing options.
+static uint32_t
+hash_routing_key (
+    sam_msg_t *msg)
+{
+    sam_be_rmq_pub_t *opts = sam_msg_data (msg);
+    assert (opts);
+
+    return fnv1a (
+        FNV_OFFSET, (byte *) opts->routing_key, strlen (opts->routing_key));
+}
+
+
+//  --------------------------------------------------------------------------
+/// Selects the backend owning the first point on the hash ring at or
+/// after the hash. If that one is not eligible, the ring is followed
+/// clockwise, which moves only the keys of that backend elsewhere.
+static sam_backend_t *
+select_affinity (
+    state_t *state,
+    uint32_t hash)
+{
+    if (!state->ring_size) {
+        return NULL;
+    }
+
+    int lo = 0, hi = state->ring_size;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (state->ring [mid].hash < hash) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    for (int i = 0; i < state->ring_size; i++) {
+        sam_backend_t *be = state->ring [(lo + i) % state->ring_size].be;
+        if (eligible (state, be)) {
+            return be;
+        }
+    }
+
+    return NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Selects a backend based on the distribution strategy. Returns
+/// NULL if no eligible backend is available.
+static sam_backend_t *
+select_backend (
+    state_t *state,
+    sam_dist_t dist,
+    uint32_t hash)
+{
+    if (dist == SAM_DIST_AFFINITY) {
+        return select_affinity (state, hash);
+    }
+
+    if (dist == SAM_DIST_LEAST_OUTSTANDING) {
+        return select_least_outstanding (state);
+    }
+
+    if (dist == SAM_DIST_WEIGHTED) {
+        return select_weighted (state);
+    }
+
+    return select_round_robin (state);
+}
+
+
 //  --------------------------------------------------------------------------
 /// Publish a message to the backends.
 static int
@@ -179,60 +650,118 @@ handle_frontend_pub (
     state_t *state = args;
     sam_stat (state->stat, "sam.publishing requests (total)", 1);
 
-    int key, n;
+    uint64_t key;
+    int n, dist;
     sam_msg_t *msg;       // only use thread safe methods!
     zframe_t *id_frame;
 
     sam_log_trace ("recv () frontend pub");
-    zsock_recv (pll, "ifip", &key, &id_frame, &n, &msg);
-
-    // get mask containing already ack'd backends
-    uint64_t be_acks = *(uint64_t *) zframe_data (id_frame);
-    zframe_destroy (&id_frame);
+    zsock_recv (pll, "8fiip", &key, &id_frame, &n, &dist, &msg);
 
     int backend_c = zlist_size (state->backends);
     if (!backend_c) {
         sam_log_trace ("discarding message, no backends available");
         sam_stat (state->stat, "sam.publishing requests (discarded)", 1);
+        zframe_destroy (&id_frame);
         sam_msg_destroy (&msg);
         return 0;
     }
 
-    sam_log_tracef (
-        "publish to %d brokers, %d broker(s) available; 0x%" PRIx64 " ack'd",
-        n, backend_c, be_acks);
+    // get set containing already ack'd backends, ids beyond the
+    // scratch set belong to none of the current backends
+    size_t acks_size = zframe_size (id_frame);
+    if (state->acks_size < acks_size) {
+        acks_size = state->acks_size;
+    }
 
+    memset (state->acks, 0, state->acks_size);
+    memcpy (state->acks, zframe_data (id_frame), acks_size);
+    zframe_destroy (&id_frame);
 
-    while (n && backend_c) {
-        sam_backend_t *backend = zlist_next (state->backends);
+    // messages restored by the buffer are not shared and
+    // need to be decoded again
+    if (sam_msg_data (msg) == NULL && decode_pub (state->be_type, msg)) {
+        sam_log_errorf ("discarding malformed message '%" PRIu64 "'", key);
+        sam_stat (state->stat, "sam.publishing requests (discarded)", 1);
+        sam_msg_destroy (&msg);
+        return 0;
+    }
 
-        if (backend == NULL) {
-            backend = zlist_first (state->backends);
+    // hedged and re-routed messages go to other backends than
+    // the ones they were published to before, these may still
+    // hold an unconfirmed copy
+    route_t *route = &state->routes [key & (ROUTES - 1)];
+    bool hedge = (dist & SAM_DIST_HEDGE);
+    bool reroute = (dist & SAM_DIST_REROUTE);
+    dist &= ~(SAM_DIST_HEDGE | SAM_DIST_REROUTE);
+
+    if ((hedge || reroute) && route->key == key) {
+        // never larger than the scratch set
+        for (size_t i = 0; i < route->ids_size; i++) {
+            state->acks [i] |= route->ids [i];
         }
+    }
 
-        // check that the backend not already ack'd the msg
-        if (!(be_acks & backend->id)) {
+    if (route->ids_size < state->acks_size) {
+        route->ids = realloc (route->ids, state->acks_size);
+        assert (route->ids);
 
-            // the backend is trying to destroy it
-            sam_msg_own (msg);
-            sam_log_tracef (
-                "send () message %d to '%s'",
-                key, backend->name);
+        memset (
+            route->ids + route->ids_size, 0,
+            state->acks_size - route->ids_size);
+        route->ids_size = state->acks_size;
+    }
 
-            zsock_send (backend->sock_pub, "ip", key, msg);
+    if (route->key != key) {
+        route->key = key;
+        memset (route->ids, 0, route->ids_size);
+    }
 
-            n -= 1;
-            sam_stat (state->stat, "sam.publishing requests (distributed)", 1);
-        }
+    if (dist == SAM_DIST_DEFAULT) {
+        dist = state->distribution;
+    }
+
+    uint32_t hash = 0;
+    if (dist == SAM_DIST_AFFINITY) {
+        hash = hash_routing_key (msg);
+    }
+
+    sam_log_tracef (
+        "publish to %d brokers, %d broker(s) available",
+        n, backend_c);
 
 
-        backend_c -= 1;
-        if (n && !backend_c) {
+    while (n) {
+        sam_backend_t *backend = select_backend (
+            state, dist, hash);
+
+        if (backend == NULL && hedge) {
+            sam_log_trace ("not hedging msg, no other backend available");
+            break;
+        }
+
+        if (backend == NULL) {
             sam_log_trace (
                 "discarding redundant msg, not enough backends available");
             sam_stat (state->stat, "sam.publishing requests (discarded)", n);
+            break;
         }
 
+        // the backend is trying to destroy it
+        sam_msg_own (msg);
+        sam_log_tracef (
+            "send () message %" PRIu64 " to '%s'",
+            key, backend->name);
+
+        zsock_send (backend->sock_pub, "8p", key, msg);
+
+        // do not select the backend twice
+        sam_gen_set_add (state->acks, backend->id);
+        backend->dispatched += 1;
+        sam_gen_set_add (route->ids, backend->id);
+
+        n -= 1;
+        sam_stat (state->stat, "sam.publishing requests (distributed)", 1);
     }
 
     sam_msg_destroy (&msg);
@@ -310,11 +839,28 @@ handle_ctl_req (
         if (!rc) {
             sam_log_infof ("inserting backend '%s'", be->name);
             rc = zlist_append (state->backends, be);
+
+            // the scratch set never shrinks, it must contain
+            // the ids of removed backends too (see hedging)
+            size_t acks_size = sam_gen_set_size (be->id);
+            if (state->acks_size < acks_size) {
+                state->acks = realloc (state->acks, acks_size);
+                assert (state->acks);
+                state->acks_size = acks_size;
+            }
+
             zloop_reader (loop, be->sock_sig, handle_sig, state);
+            build_ring (state);
         }
     }
 
 
+    // get an id for a new backend
+    else if (!strcmp (cmd, "be.id")) {
+        rc = free_backend_id (state);
+    }
+
+
     // remove a backend
     else if (!strcmp (cmd, "be.rm")) {
         char *name;
@@ -325,6 +871,16 @@ handle_ctl_req (
     }
 
 
+    // set the default distribution strategy
+    else if (!strcmp (cmd, "be.distribution")) {
+        int dist;
+        rc = sam_msg_pop (msg, "i", &dist);
+        if (!rc) {
+            state->distribution = dist;
+        }
+    }
+
+
     // get string representations of active backends
     else if (!strcmp (cmd, "be.active")) {
         zmsg_t *msg = zmsg_new ();
@@ -414,6 +970,13 @@ actor (
     zlist_destroy (&state->backends);
     zsock_destroy (&state->ctl_rep);
 
+    for (int i = 0; i < ROUTES; i++) {
+        free (state->routes [i].ids);
+    }
+
+    free (state->routes);
+    free (state->ring);
+    free (state->acks);
     free (state);
 }
 
@@ -429,9 +992,11 @@ sam_new (
     state_t *state = malloc (sizeof (state_t));
     assert (self);
 
-    self->be_id_power = 0;
     self->buf = NULL;
+    self->distribution = SAM_DIST_ROUND_ROBIN;
     self->cfg = NULL;
+    self->templates = NULL;
+    self->template_c = 0;
 
     self->stat_actor = sam_stat_new ();
     self->stat = sam_stat_handle_new ();
@@ -474,7 +1039,22 @@ sam_new (
     self->backend_pull_endpoint = "inproc://sam-backend";
 
 
+    // receipts for asynchronous requests, used by init_buf
+    self->receipts_endpoint = "inproc://sam-receipts";
+    self->receipts = zsock_new_pull (self->receipts_endpoint);
+    assert (self->receipts);
+
+
     // actor
+    state->distribution = SAM_DIST_ROUND_ROBIN;
+    state->next = 0;
+    state->routes = calloc (ROUTES, sizeof (route_t));
+    assert (state->routes);
+    state->ring = NULL;
+    state->ring_size = 0;
+    state->acks = NULL;
+    state->acks_size = 0;
+
     self->actor = zactor_new (actor, state);
     sam_log_info ("created msg instance");
 
@@ -504,9 +1084,21 @@ sam_destroy (
     zsock_destroy (&(*self)->frontend_pub);
     zsock_destroy (&(*self)->frontend_rpc);
     zsock_destroy (&(*self)->ctl_req);
+    zsock_destroy (&(*self)->receipts);
 
     zactor_destroy (&(*self)->actor);
 
+    // referenced by publishing options until all backends are gone
+    for (int i = 0; i < (*self)->template_c; i++) {
+        template_t *template = &(*self)->templates [i];
+        if ((*self)->be_type == SAM_BE_RMQ) {
+            sam_be_rmq_tpl_destroy ((sam_be_rmq_tpl_t **) &template->tpl);
+        }
+
+        free (template->data);
+    }
+
+    free ((*self)->templates);
     sam_stat_handle_destroy (&(*self)->stat);
     sam_stat_destroy (&(*self)->stat_actor);
 
@@ -530,10 +1122,13 @@ create_be_rmq (
 {
     sam_be_rmq_opts_t *rabbit_opts = opts;
 
-    sam_be_rmq_t *rabbit = sam_be_rmq_new (
-        name, 1 << self->be_id_power);
+    int id = -1;
+    sam_log_trace ("send () 'be.id' internally");
+    zsock_send (self->ctl_req, "s", "be.id");
+    zsock_recv (self->ctl_req, "i", &id);
+    assert (id > 0);
 
-    self->be_id_power += 1;
+    sam_be_rmq_t *rabbit = sam_be_rmq_new (name, id);
     assert (rabbit);
 
     // this call may fail, the started backend
@@ -580,7 +1175,68 @@ sam_be_remove (
     zsock_send (self->ctl_req, "ss", "be.rm", name);
 
     int rc = -1;
-    sam_log_tracef ("recv () return code for be.rm for '%s'", name);
+    sam_log_tracef ("recv () return code for be.rm for '%s'", name);
+    zsock_recv (self->ctl_req, "i", &rc);
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Maps the name of a distribution strategy delivering a message to
+/// a single backend. Returns -1 for unknown names.
+static int
+parse_distribution (
+    const char *name,
+    sam_dist_t *dist)
+{
+    if (!strcmp (name, "round robin")) {
+        *dist = SAM_DIST_ROUND_ROBIN;
+    }
+    else if (!strcmp (name, "least outstanding")) {
+        *dist = SAM_DIST_LEAST_OUTSTANDING;
+    }
+    else if (!strcmp (name, "weighted")) {
+        *dist = SAM_DIST_WEIGHTED;
+    }
+    else if (!strcmp (name, "affinity")) {
+        *dist = SAM_DIST_AFFINITY;
+    }
+    else if (!strcmp (name, "default")) {
+        *dist = SAM_DIST_DEFAULT;
+    }
+    else {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Tell the actor which distribution strategy to use for requests
+/// asking for the default one. Round robin is used if nothing is
+/// configured.
+static int
+init_distribution (
+    sam_t *self)
+{
+    char *name;
+    sam_dist_t dist = SAM_DIST_ROUND_ROBIN;
+
+    if (!sam_cfg_be_distribution (self->cfg, &name) &&
+        (parse_distribution (name, &dist) || dist == SAM_DIST_DEFAULT)) {
+
+        sam_log_errorf ("unknown distribution strategy '%s'", name);
+        return -1;
+    }
+
+    self->distribution = dist;
+
+    sam_log_tracef ("send () 'be.distribution' (%d) internally", dist);
+    zsock_send (self->ctl_req, "si", "be.distribution", dist);
+
+    int rc = -1;
+    sam_log_trace ("recv () return code of 'be.distribution'");
     zsock_recv (self->ctl_req, "i", &rc);
     return rc;
 }
@@ -598,12 +1254,15 @@ init_buf (
 
     zsock_t *backend_pull = zsock_new_pull (self->backend_pull_endpoint);
     zsock_t *frontend_push = zsock_new_push (self->frontend_pub_endpoint);
+    zsock_t *receipts_push = zsock_new_push (self->receipts_endpoint);
 
-    self->buf = sam_buf_new (self->cfg, &backend_pull, &frontend_push);
+    self->buf = sam_buf_new (
+        self->cfg, &backend_pull, &frontend_push, &receipts_push);
 
     if (self->buf == NULL) {
         zsock_destroy (&backend_pull);
         zsock_destroy (&frontend_push);
+        zsock_destroy (&receipts_push);
         return -1;
     }
 
@@ -703,6 +1362,11 @@ sam_init (
         return rc;
     }
 
+    rc = init_distribution (self);
+    if (rc) {
+        return rc;
+    }
+
     sam_log_info ("(re)loaded configuration");
     return 0;
 }
@@ -791,6 +1455,7 @@ check_pub_rmq (
     sam_msg_t *msg)
 {
     char *distribution;
+    sam_dist_t dist;
     int rc = sam_msg_get (msg, "s", &distribution);
     if (rc) {
         return rc;
@@ -814,7 +1479,7 @@ check_pub_rmq (
 
             SAM_MSG_NONZERO);   // payload
     }
-    else if (!strcmp (distribution, "round robin")) {
+    else if (!parse_distribution (distribution, &dist)) {
         rc = sam_msg_expect (
             msg, 8,
             SAM_MSG_NONZERO,    // distribution
@@ -855,6 +1520,58 @@ check_pub (
 }
 
 
+//  --------------------------------------------------------------------------
+/// Checks the fixed size head of a binary publishing request (see
+/// rfc 8) and maps its distribution code. The options frame stays
+/// with the message for the backend to decode. Returns -1 for
+/// malformed requests.
+static int
+check_pub_binary (
+    sam_msg_t *msg,
+    int *n,
+    sam_dist_t *dist)
+{
+    static const sam_dist_t dists [] = {
+        SAM_DIST_DEFAULT,
+        SAM_DIST_ROUND_ROBIN,
+        SAM_DIST_ROUND_ROBIN,         // redundant
+        SAM_DIST_LEAST_OUTSTANDING,
+        SAM_DIST_WEIGHTED,
+        SAM_DIST_AFFINITY
+    };
+
+    byte *data, *payload;
+    size_t size, payload_size;
+
+    if (sam_msg_size (msg) != 2 ||
+        sam_msg_frame (msg, 0, &data, &size) ||
+        sam_msg_frame (msg, 1, &payload, &payload_size) ||
+        size < SAM_PUB_HEAD_SIZE ||
+        payload_size == 0) {
+
+        return -1;
+    }
+
+    int code = data [0];
+    if (code >= (int) (sizeof (dists) / sizeof (sam_dist_t))) {
+        return -1;
+    }
+
+    *n = 1;
+    *dist = dists [code];
+
+    // redundant
+    if (code == 2) {
+        *n = sam_gen_le16 (data + 2);
+        if (*n == 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
 //  --------------------------------------------------------------------------
 /// Returns a string containing all currently connected backends.
 static char *
@@ -952,10 +1669,429 @@ aggregate_status (
 
 
 //  --------------------------------------------------------------------------
-/// Send the sam actor thread a message.
+/// Checks a publishing request, pops its distribution method and
+/// decodes the remaining publishing options. Sets how many backends
+/// must acknowledge the message; redundant messages are distributed
+/// round robin. The default strategy gets resolved, the buffer
+/// stores the actual one. Binary requests keep all their frames, the backend
+/// recognizes them by their frame count when decoding them (again
+/// after a restart). Returns -1 for malformed requests.
+static int
+prepare_pub (
+    sam_t *self,
+    int version,
+    sam_msg_t *msg,
+    int *n,
+    sam_dist_t *dist)
+{
+    if (version >= SAM_PROTOCOL_VERSION_BINARY) {
+        if (check_pub_binary (msg, n, dist)) {
+            return -1;
+        }
+
+        if (*dist == SAM_DIST_DEFAULT) {
+            *dist = self->distribution;
+        }
+
+        byte *data;
+        size_t size;
+        sam_msg_frame (msg, 0, &data, &size);
+
+        if (data [1] & SAM_PUB_TEMPLATE) {
+            return decode_template (self, msg);
+        }
+
+        return decode_pub (self->be_type, msg);
+    }
+
+    if (check_pub (self->be_type, msg)) {
+        return -1;
+    }
+
+    char *distribution;
+    int rc = sam_msg_pop (msg, "s", &distribution);
+    assert (!rc);
+
+    *n = 1;
+    *dist = SAM_DIST_ROUND_ROBIN;
+
+    if (!strcmp (distribution, "redundant")) {
+        rc = sam_msg_pop (msg, "i", n);
+        assert (!rc);
+    }
+    else {
+        rc = parse_distribution (distribution, dist);
+        assert (!rc);
+    }
+
+    if (*dist == SAM_DIST_DEFAULT) {
+        *dist = self->distribution;
+    }
+
+    return decode_pub (self->be_type, msg);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Pass a stored message on for distribution (empty backend set, no
+/// backend ack'd already).
+static void
+distribute (
+    sam_t *self,
+    uint64_t key,
+    int n,
+    sam_dist_t dist,
+    sam_msg_t *msg)
+{
+    zframe_t *id_frame = zframe_new (NULL, 0);
+
+    sam_log_tracef ("send () message '%" PRIu64 "' internally", key);
+    zsock_send (
+        self->frontend_pub, "8fiip", key, id_frame, n, dist, msg);
+
+    zframe_destroy (&id_frame);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Handle a single publishing request: synchronous store,
+/// asynchronous distribution.
+static sam_ret_t *
+publish (
+    sam_t *self,
+    int version,
+    sam_msg_t *msg)
+{
+    int n;
+    sam_dist_t dist;
+
+    if (prepare_pub (self, version, msg, &n, &dist)) {
+        return error (msg, "malformed publishing request");
+    }
+
+    sam_stat (self->stat, "sam.publishing requests (clients)", 1);
+
+    // save to buffer
+    sam_msg_own (msg);
+    uint64_t key = sam_buf_save (self->buf, msg, n, dist);
+
+    if (!key) {
+        return error (msg, "could not persist request");
+    }
+
+    distribute (self, key, n, dist, msg);
+    return new_ret ();
+}
+
+
+//  --------------------------------------------------------------------------
+/// Unpack a batch of publishing requests. The batch must be
+/// well-formed as a whole, otherwise an error is returned and nothing
+/// gets allocated. Malformed publishing requests inside the batch are
+/// discarded and reported with their receipt. The valid requests are
+/// compacted into reqs (already owned for distribution), their
+/// acknowledgement counts into ns and their strategies into dists.
+/// Binary requests (see rfc 8) always consist of two frames and are
+/// not preceded by their frame count.
+static sam_ret_t *
+unpack_batch (
+    sam_t *self,
+    int version,
+    sam_msg_t *msg,
+    sam_msg_t ***reqs,
+    int **ns,
+    sam_dist_t **dists,
+    int *valid)
+{
+    bool binary = version >= SAM_PROTOCOL_VERSION_BINARY;
+
+    int count = 0;
+    if (binary) {
+        byte *data;
+        size_t size;
+
+        if (!sam_msg_frame (msg, 0, &data, &size) && size == 4) {
+            count = sam_gen_le32 (data);
+            sam_msg_pop (msg, "?");
+        }
+
+        // guard against overflowing allocations
+        if (count > sam_msg_size (msg) / 2) {
+            count = 0;
+        }
+    }
+    else if (sam_msg_pop (msg, "i", &count)) {
+        count = 0;
+    }
+
+    if (count < 1) {
+        return error (msg, "malformed batch");
+    }
+
+    *reqs = malloc (count * sizeof (sam_msg_t *));
+    *ns = malloc (count * sizeof (int));
+    *dists = malloc (count * sizeof (sam_dist_t));
+    assert (*reqs);
+    assert (*ns);
+    assert (*dists);
+
+    // unpack all contiguous frame collections
+    int i = 0;
+    while (i < count) {
+        if (binary) {
+            (*reqs) [i] = sam_msg_split (msg, 2);
+        }
+        else if (sam_msg_pop (msg, "m", &(*reqs) [i])) {
+            (*reqs) [i] = NULL;
+        }
+
+        if ((*reqs) [i] == NULL) {
+            break;
+        }
+
+        i += 1;
+    }
+
+    if (i < count || sam_msg_size (msg)) {
+        while (i) {
+            i -= 1;
+            sam_msg_destroy (&(*reqs) [i]);
+        }
+
+        free (*reqs);
+        free (*ns);
+        free (*dists);
+        return error (msg, "malformed batch");
+    }
+
+    sam_msg_destroy (&msg);
+
+    sam_ret_t *ret = new_ret ();
+    ret->count = count;
+    ret->receipts = malloc (count * sizeof (int));
+    assert (ret->receipts);
+
+
+    // check requests, compact the valid ones
+    *valid = 0;
+    for (i = 0; i < count; i++) {
+        sam_msg_t *req = (*reqs) [i];
+
+        if (prepare_pub (
+                self, version, req, &(*ns) [*valid], &(*dists) [*valid])) {
+            ret->receipts [i] = -1;
+            sam_msg_destroy (&req);
+            continue;
+        }
+
+        ret->receipts [i] = 0;
+
+        sam_msg_own (req);
+        (*reqs) [*valid] = req;
+        *valid += 1;
+    }
+
+    sam_stat (self->stat, "sam.publishing requests (clients)", *valid);
+    sam_stat (self->stat, "sam.publishing requests (batched)", *valid);
+
+    return ret;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Handle a batch of publishing requests. All valid requests are
+/// saved to the buffer in one go and distributed afterwards. Requests
+/// which could not be persisted are reported with their receipt.
+static sam_ret_t *
+publish_batch (
+    sam_t *self,
+    int version,
+    sam_msg_t *msg)
+{
+    int valid, *ns;
+    sam_dist_t *dists;
+    sam_msg_t **reqs;
+
+    sam_ret_t *ret = unpack_batch (
+        self, version, msg, &reqs, &ns, &dists, &valid);
+
+    if (ret->rc) {
+        return ret;
+    }
+
+    // save to buffer and distribute
+    if (valid) {
+        uint64_t *keys = malloc (valid * sizeof (uint64_t));
+        assert (keys);
+
+        sam_buf_save_batch (self->buf, valid, reqs, ns, dists, keys);
+
+        // the receipts of the valid requests are 0, in order
+        int r = 0;
+        for (int i = 0; i < valid; i++) {
+            while (ret->receipts [r]) {
+                r += 1;
+            }
+
+            if (keys [i]) {
+                distribute (self, keys [i], ns [i], dists [i], reqs [i]);
+            }
+            else {
+                ret->receipts [r] = -1;
+                sam_msg_destroy (&reqs [i]);
+            }
+
+            r += 1;
+        }
+
+        free (keys);
+    }
+
+    free (reqs);
+    free (ns);
+    free (dists);
+
+    return ret;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Handle one or a batch of publishing requests asynchronously. The
+/// buffer persists and distributes the requests and hands out the
+/// receipt on its own. Returns NULL if the request was handed over to
+/// the buffer, a return object for immediate replies otherwise.
+static sam_ret_t *
+publish_async (
+    sam_t *self,
+    int version,
+    sam_msg_t *msg,
+    bool batch,
+    void *tag)
+{
+    int valid, *ns;
+    sam_dist_t *dists;
+    sam_msg_t **reqs;
+    sam_ret_t *ret;
+
+    if (batch) {
+        ret = unpack_batch (
+            self, version, msg, &reqs, &ns, &dists, &valid);
+
+        if (ret->rc) {
+            return ret;
+        }
+    }
+
+    else {
+        int n;
+        sam_dist_t dist;
+
+        if (prepare_pub (self, version, msg, &n, &dist)) {
+            return error (msg, "malformed publishing request");
+        }
+
+        sam_stat (self->stat, "sam.publishing requests (clients)", 1);
+        ret = new_ret ();
+
+        reqs = malloc (sizeof (sam_msg_t *));
+        ns = malloc (sizeof (int));
+        dists = malloc (sizeof (sam_dist_t));
+        assert (reqs);
+        assert (ns);
+        assert (dists);
+
+        *ns = n;
+        *dists = dist;
+        sam_msg_own (msg);
+        *reqs = msg;
+        valid = 1;
+    }
+
+    if (valid) {
+        sam_buf_save_async (self->buf, valid, reqs, ns, dists, tag, ret);
+        ret = NULL;
+    }
+
+    free (reqs);
+    free (ns);
+    free (dists);
+
+    return ret;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Register a publishing template (see rfc 9). Identical templates
+/// share their id. Templates live as long as the sam instance, the
+/// reply message contains the id.
+static sam_ret_t *
+register_template (
+    sam_t *self,
+    sam_msg_t *msg)
+{
+    byte *data;
+    size_t size;
+
+    if (sam_msg_size (msg) != 1 || sam_msg_frame (msg, 0, &data, &size)) {
+        return error (msg, "malformed template");
+    }
+
+    int id = 0;
+    while (id < self->template_c && (
+               self->templates [id].size != size ||
+               memcmp (self->templates [id].data, data, size))) {
+        id += 1;
+    }
+
+    if (id == self->template_c) {
+        if (self->template_c == SAM_TEMPLATE_MAX) {
+            return error (msg, "too many templates");
+        }
+
+        void *tpl = NULL;
+        if (self->be_type == SAM_BE_RMQ) {
+            tpl = sam_be_rmq_tpl_new (data, size);
+        }
+
+        if (tpl == NULL) {
+            return error (msg, "malformed template");
+        }
+
+        self->templates = realloc (
+            self->templates, (id + 1) * sizeof (template_t));
+        assert (self->templates);
+
+        template_t *template = &self->templates [id];
+        template->data = malloc (size);
+        assert (template->data);
+
+        memcpy (template->data, data, size);
+        template->size = size;
+        template->tpl = tpl;
+
+        self->template_c += 1;
+        sam_log_infof ("registered publishing template %d", id);
+    }
+
+    sam_msg_destroy (&msg);
+
+    sam_ret_t *ret = new_ret ();
+    ret->msg = malloc (16);
+    assert (ret->msg);
+
+    snprintf (ret->msg, 16, "%d", id);
+    ret->allocated = true;
+    return ret;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Send the sam actor thread a message. The protocol version
+/// decides how publishing requests are encoded.
 sam_ret_t *
 sam_eval (
     sam_t *self,
+    int version,
     sam_msg_t *msg)
 {
     assert (self);
@@ -971,43 +2107,23 @@ sam_eval (
     // publish, synchronous store, asynchronous distribution
     sam_log_tracef ("checking '%s' request", action);
     if (!strcmp (action, "publish")) {
-        rc = check_pub (self->be_type, msg);
-        if (rc) {
-            return error (msg, "malformed publishing request");
-        }
-
-        sam_stat (self->stat, "sam.publishing requests (clients)", 1);
-
-
-        // analyze distribution method and count
-        char *distribution;
-        int rc = sam_msg_pop (msg, "s", &distribution);
-        assert (!rc);
-
-        int n = 1;
-        if (!strcmp (distribution, "redundant")) {
-            rc = sam_msg_pop (msg, "i", &n);
-            assert (!rc);
-        }
-
-
-        // save to buffer
-        sam_msg_own (msg);
-        int key = sam_buf_save (self->buf, msg, n);
+        return publish (self, version, msg);
+    }
 
 
-        // pass the message on for distribution
-        // (0 backends ack'd already)
-        uint64_t be_acks = 0;
-        zframe_t *id_frame = zframe_new (&be_acks, sizeof (be_acks));
+    // batched publish, one storage transaction for all requests
+    else if (!strcmp (action, "publish.batch")) {
+        return publish_batch (self, version, msg);
+    }
 
-        sam_log_tracef ("send () message '%d' internally", key);
-        zsock_send (self->frontend_pub, "ifip", key, id_frame, n, msg);
 
+    // publishing templates
+    else if (
+        !strcmp (action, "template") &&
+        version >= SAM_PROTOCOL_VERSION_TEMPLATE) {
 
-        // clean up
-        zframe_destroy (&id_frame);
-        return new_ret ();
+        sam_stat (self->stat, "sam.template requests", 1);
+        return register_template (self, msg);
     }
 
 
@@ -1065,3 +2181,48 @@ suspend:
     sam_msg_destroy (&msg);
     return new_ret ();
 }
+
+
+//  --------------------------------------------------------------------------
+/// Evaluate a message without waiting for the buffer to persist
+/// publishing requests. All other actions are evaluated synchronously.
+sam_ret_t *
+sam_eval_async (
+    sam_t *self,
+    int version,
+    sam_msg_t *msg,
+    void *tag)
+{
+    assert (self);
+    assert (msg);
+
+    char *action;
+    int rc = sam_msg_get (msg, "s", &action);
+    if (rc) {
+        return sam_eval (self, version, msg);
+    }
+
+    bool
+        single = !strcmp (action, "publish"),
+        batch = !strcmp (action, "publish.batch");
+
+    free (action);
+    if (!single && !batch) {
+        return sam_eval (self, version, msg);
+    }
+
+    sam_msg_pop (msg, "s", &action);
+    sam_stat (self->stat, "sam.publishing requests (asynchronous)", 1);
+    return publish_async (self, version, msg, batch, tag);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the socket where receipts of asynchronous requests arrive.
+zsock_t *
+sam_receipts (
+    sam_t *self)
+{
+    assert (self);
+    return self->receipts;
+}
@@ -60,18 +60,45 @@
 #include "../include/sam_prelude.h"
 
 
-/// store item to be able to map the message key -> sequence number
-typedef struct store_item {
-    unsigned int seq;     ///< amqp sequence number for publisher confirms
-    int key;              ///< message key assigned outside of this module
-} store_item;
+/// marks confirmed slots of the store
+#define STORE_CONFIRMED UINT64_MAX
+
+/// initial capacity of the store, must be a power of 2
+#define STORE_SIZE 1024
+
+/// header carrying the sequence number of mandatory messages
+#define SEQ_HEADER "x-sam-seq"
+
+/// amount of amqp properties of a publishing request
+#define PROP_C 12
+
+/// flags of binary publishing options
+#define FLAG_MANDATORY 0x01
+#define FLAG_IMMEDIATE 0x02
+#define FLAG_ROUTING_KEY 0x40
+
+/// properties translated by encode_props
+#define PROPS_ALL ((1 << PROP_C) - 1)
 
 
 /// the be_rmq state
 struct sam_be_rmq_t {
     char *name;        ///< identifier assigned by the user
-    uint64_t id;       ///< identifier used by sam_buf
-    zlist_t *store;    ///< maps message keys to sequence numbers
+    int id;            ///< identifier used by sam_buf
+
+
+    struct {                  ///< maps sequence numbers to message keys
+        uint64_t *keys;       ///< ring buffer indexed by sequence number
+        unsigned int size;    ///< capacity, always a power of 2
+        unsigned int first;   ///< oldest unconfirmed sequence number
+        unsigned int next;    ///< sequence number of the next publish
+        unsigned int pending; ///< number of unconfirmed messages
+    } store;
+
+
+    /// number of publishing requests that are no longer in flight
+    /// (confirmed, rejected or discarded), read by the sam actor
+    unsigned int released;
 
 
     struct {                                ///< amqp connection
@@ -83,6 +110,12 @@ struct sam_be_rmq_t {
     } amqp;
 
 
+    struct {                          ///< headers of mandatory messages
+        amqp_table_entry_t *headers;  ///< options' headers and the seq
+        int size;                     ///< capacity, grown on demand
+    } scratch;
+
+
     struct {
         bool established;        ///< indicator needed for destroy ()
         sam_be_rmq_opts_t opts;  ///< for re-connecting tries
@@ -90,6 +123,10 @@ struct sam_be_rmq_t {
     } connection;
 
 
+    bool saturated;    ///< publishing requests are not read
+    zloop_t *loop;     ///< to (un)register the publishing socket
+
+
     struct {
         zsock_t *sig;           ///< send signals to the be maintainer
         zsock_t *pub;           ///< accepting publishing requests
@@ -116,18 +153,21 @@ be_to_string (
     sam_be_rmq_opts_t *opts = &self->connection.opts;
 
     snprintf (str, buf_size,
-              "%s (id: 0x%" PRIx64 ") (%s:%d as '%s'):\n"
+              "%s (id: %d) (%s:%d as '%s'):\n"
               "  connected: %s (%d/%d tries every %" PRIu64 "ms)\n"
               "  heartbeat: every %d seconds\n"
               "  current sequence number: %d\n"
-              "  pending acks: %zu",
+              "  pending acks: %u (window: %d%s)\n"
+              "  weight: %d",
 
               self->name, self->id, opts->host, opts->port, opts->user,
               (self->connection.established)? "yep": "nope",
               self->connection.tries, opts->tries, opts->interval,
               opts->heartbeat,
               self->amqp.seq,
-              (self->store)? zlist_size (self->store): (size_t) 0);
+              self->store.pending, opts->window,
+              (self->saturated)? ", saturated": "",
+              opts->weight);
 
     return str;
 }
@@ -135,30 +175,127 @@ be_to_string (
 
 
 //  --------------------------------------------------------------------------
-/// Destructor function for the store.
+/// Returns how many publishing requests the backend finished handling.
+/// Called by the sam actor to determine the number of messages in
+/// flight.
+static unsigned int
+be_released (
+    sam_backend_t *be)
+{
+    sam_be_rmq_t *self = be->_self;
+    return __atomic_load_n (&self->released, __ATOMIC_RELAXED);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Marks n publishing requests as no longer in flight.
+static void
+release (
+    sam_be_rmq_t *self,
+    unsigned int n)
+{
+    __atomic_add_fetch (&self->released, n, __ATOMIC_RELAXED);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Empties the store, the next publish gets the provided sequence
+/// number. Messages still unconfirmed are released.
+static void
+store_reset (
+    sam_be_rmq_t *self,
+    unsigned int seq)
+{
+    release (self, self->store.pending);
+    self->store.first = seq;
+    self->store.next = seq;
+    self->store.pending = 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Remembers the message key of a published message. The ring buffer
+/// grows if all slots are occupied by unconfirmed messages.
 static void
-free_store_item (
-    void **store_item)
+store_put (
+    sam_be_rmq_t *self,
+    unsigned int seq,
+    uint64_t key)
 {
-    free (*store_item);
-    *store_item = NULL;
+    assert (seq == self->store.next);
+    unsigned int used = self->store.next - self->store.first;
+
+    if (used == self->store.size) {
+        unsigned int size = STORE_SIZE;
+        if (self->store.size) {
+            size = 2 * self->store.size;
+        }
+
+        uint64_t *keys = malloc (size * sizeof (uint64_t));
+        assert (keys);
+
+        for (unsigned int i = self->store.first; i != self->store.next; i++) {
+            keys [i & (size - 1)] =
+                self->store.keys [i & (self->store.size - 1)];
+        }
+
+        free (self->store.keys);
+        self->store.keys = keys;
+        self->store.size = size;
+    }
+
+    self->store.keys [seq & (self->store.size - 1)] = key;
+    self->store.next = seq + 1;
+    self->store.pending += 1;
 }
 
 
 //  --------------------------------------------------------------------------
-/// Create a new store item.
-static store_item *
-new_store_item (
-    int key,
-    int seq)
+/// Confirms the message with the provided sequence number (or all
+/// messages up to it if multiple is set). The keys of all newly
+/// confirmed messages are written to keys, which must provide enough
+/// space. Returns the number of keys written.
+static unsigned int
+store_confirm (
+    sam_be_rmq_t *self,
+    unsigned int seq,
+    bool multiple,
+    uint64_t *keys)
 {
-    store_item *item = malloc (sizeof (store_item));
-    assert (item);
+    unsigned int mask = self->store.size - 1, n = 0;
+    unsigned int first = (multiple)? self->store.first: seq;
+
+    for (unsigned int i = first; i != seq + 1; i++) {
+        uint64_t *key = &self->store.keys [i & mask];
+        if (*key != STORE_CONFIRMED) {
+            keys [n] = *key;
+            *key = STORE_CONFIRMED;
+            n += 1;
+        }
+    }
+
+    self->store.pending -= n;
+    release (self, n);
+
+    // advance past all confirmed messages
+    while (self->store.first != self->store.next &&
+           self->store.keys [self->store.first & mask] == STORE_CONFIRMED) {
+        self->store.first += 1;
+    }
+
+    return n;
+}
 
-    item->key = key;
-    item->seq = seq;
 
-    return item;
+//  --------------------------------------------------------------------------
+/// Checks if the sequence number lies between the oldest unconfirmed
+/// message and the most recently published one.
+static bool
+store_contains (
+    sam_be_rmq_t *self,
+    unsigned int seq)
+{
+    return seq - self->store.first < self->store.next - self->store.first;
 }
 
 
@@ -201,6 +338,125 @@ c_uint8 (const char *str)
 
 // cyclic
 static int connection_loss (sam_be_rmq_t *self, zloop_t *loop);
+static int try (char const *ctx, amqp_rpc_reply_t x);
+static int handle_publish_req (zloop_t *loop, zsock_t *pll, void *args);
+
+
+//  --------------------------------------------------------------------------
+/// Stops reading publishing requests if the window of unconfirmed
+/// messages is full. Reading resumes when half of the window got
+/// confirmed or the connection got lost (requests are discarded
+/// then). The sam actor gets notified to prefer other backends.
+static void
+check_window (
+    sam_be_rmq_t *self)
+{
+    int window = self->connection.opts.window;
+    unsigned int pending = self->store.pending;
+
+    if (!self->saturated &&
+        self->connection.established &&
+        window <= (int) pending) {
+
+        sam_log_infof (
+            "'%s' is saturated (%u unconfirmed)", self->name, pending);
+
+        zloop_reader_end (self->loop, self->sock.pub);
+        self->saturated = true;
+        zsock_send (
+            self->sock.sig, "is", SAM_BE_SIG_SATURATED, self->name);
+    }
+
+    else if (
+        self->saturated &&
+        (!self->connection.established || (int) pending <= window / 2)) {
+
+        sam_log_infof (
+            "'%s' is relieved (%u unconfirmed)", self->name, pending);
+
+        zloop_reader (self->loop, self->sock.pub, handle_publish_req, self);
+        self->saturated = false;
+        zsock_send (
+            self->sock.sig, "is", SAM_BE_SIG_RELIEVED, self->name);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+/// Sends a frame of message keys to sam_buf, either acknowledged or
+/// not acknowledged. Takes ownership of the frame.
+static void
+send_keys (
+    sam_be_rmq_t *self,
+    sam_be_confirm_t type,
+    zframe_t **keys)
+{
+    zsock_send (self->sock.ack, "iif", type, self->id, *keys);
+    zframe_destroy (keys);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Hands a publishing request the backend cannot take care of back
+/// to sam_buf, which re-distributes it to another backend.
+static void
+reject (
+    sam_be_rmq_t *self,
+    uint64_t key)
+{
+    sam_log_tracef (
+        "'%s' send () nack for %" PRIu64, self->name, key);
+
+    zframe_t *keys = zframe_new (&key, sizeof (key));
+    send_keys (self, SAM_BE_NACK, &keys);
+    release (self, 1);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Confirms the message with the provided sequence number (or all
+/// messages up to it) and sends the keys of all newly confirmed
+/// messages to sam_buf at once.
+static void
+confirm (
+    sam_be_rmq_t *self,
+    unsigned int seq,
+    bool multiple,
+    sam_be_confirm_t type)
+{
+    if (!store_contains (self, seq)) {
+        sam_log_errorf (
+            "'%s' received confirm for unknown sequence number %u",
+            self->name, seq);
+        return;
+    }
+
+    // at most all messages up to seq are confirmed
+    unsigned int max = (multiple)? seq - self->store.first + 1: 1;
+    zframe_t *keys = zframe_new (NULL, max * sizeof (uint64_t));
+
+    unsigned int n = store_confirm (
+        self, seq, multiple, (uint64_t *) zframe_data (keys));
+
+    if (!n) {
+        zframe_destroy (&keys);
+        return;
+    }
+
+    if (n < max) {
+        zframe_t *all = keys;
+        keys = zframe_new (zframe_data (all), n * sizeof (uint64_t));
+        zframe_destroy (&all);
+    }
+
+    sam_log_tracef (
+        "'%s' send () %u %s(s), %u pending",
+        self->name, n, (type == SAM_BE_ACK)? "ack": "nack",
+        self->store.pending);
+
+    send_keys (self, type, &keys);
+    check_window (self);
+}
 
 
 //  --------------------------------------------------------------------------
@@ -211,39 +467,82 @@ handle_ack (
     sam_be_rmq_t *self,
     amqp_frame_t *frame)
 {
-    // retrieve frame contents
     amqp_basic_ack_t *props = frame->payload.method.decoded;
 
     assert (props);
     sam_log_tracef (
-        "'%s' received ack no %d", self->name, props->delivery_tag);
-
-    // look the msg key up and update the store
-    store_item *item = zlist_first (self->store);
-    while (item && item->seq != props->delivery_tag) {
-        if (props->multiple) {
-            zlist_remove (self->store, item);
-            item = zlist_first (self->store);
-        }
+        "'%s' received ack no %d (multiple: %d)",
+        self->name, props->delivery_tag, props->multiple);
 
-        else {
-            // this must not happen
-            assert (false);
-        }
+    confirm (self, props->delivery_tag, props->multiple, SAM_BE_ACK);
+}
+
+
+//  --------------------------------------------------------------------------
+/// The broker could not take responsibility for one or more
+/// messages. They are handed back to sam_buf to be re-distributed
+/// immediately.
+static void
+handle_nack (
+    sam_be_rmq_t *self,
+    amqp_frame_t *frame)
+{
+    amqp_basic_nack_t *props = frame->payload.method.decoded;
+
+    assert (props);
+    sam_log_infof (
+        "'%s' received nack no %d (multiple: %d)",
+        self->name, props->delivery_tag, props->multiple);
+
+    confirm (self, props->delivery_tag, props->multiple, SAM_BE_NACK);
+}
+
+
+//  --------------------------------------------------------------------------
+/// A mandatory message could not be routed. The returned content
+/// carries the sequence number in the x-sam-seq header (see
+/// sam_be_rmq_publish). The message is handed back to sam_buf; the
+/// ack which follows the return is ignored.
+static int
+handle_return (
+    sam_be_rmq_t *self,
+    amqp_frame_t *frame)
+{
+    amqp_basic_return_t *props = frame->payload.method.decoded;
+
+    assert (props);
+    sam_log_infof (
+        "'%s' received return: %d %.*s",
+        self->name, props->reply_code,
+        (int) props->reply_text.len, (char *) props->reply_text.bytes);
+
+    amqp_message_t message;
+    amqp_rpc_reply_t reply = amqp_read_message (
+        self->amqp.connection, frame->channel, &message, 0);
+
+    if (try ("reading returned message", reply)) {
+        return -1;
     }
 
-    assert (item);
-    sam_log_tracef ("send () ack for '%d'", item->key);
+    amqp_basic_properties_t *msg_props = &message.properties;
+    if (msg_props->_flags & AMQP_BASIC_HEADERS_FLAG) {
+        amqp_table_t *headers = &msg_props->headers;
 
-    zframe_t *id = zframe_new (&self->id, sizeof (self->id));
-    zsock_send (self->sock.ack, "fi", id, item->key);
-    zframe_destroy (&id);
+        for (int i = 0; i < headers->num_entries; i++) {
+            amqp_table_entry_t *entry = &headers->entries [i];
 
-    sam_log_tracef (
-        "'%s' removes %d (seq: %d) from the store",
-        self->name, item->key, item->seq);
+            if (entry->key.len == strlen (SEQ_HEADER) &&
+                !memcmp (entry->key.bytes, SEQ_HEADER, entry->key.len) &&
+                entry->value.kind == AMQP_FIELD_KIND_I64) {
 
-    zlist_remove (self->store, item);
+                confirm (self, entry->value.value.i64, false, SAM_BE_NACK);
+                break;
+            }
+        }
+    }
+
+    amqp_destroy_message (&message);
+    return 0;
 }
 
 
@@ -273,16 +572,34 @@ handle_amqp (
     // eat all currently buffered frames
     while (rc == AMQP_STATUS_OK) {
 
+        amqp_method_number_t method = frame.payload.method.id;
+        if (frame.frame_type != AMQP_FRAME_METHOD) {
+            method = 0;
+        }
+
+        // handle acknowledgements
+        if (method == AMQP_BASIC_ACK_METHOD) {
+            handle_ack (self, &frame);
+        }
+
+        else if (method == AMQP_BASIC_NACK_METHOD) {
+            handle_nack (self, &frame);
+        }
+
+        // unroutable mandatory messages
+        else if (method == AMQP_BASIC_RETURN_METHOD) {
+            if (handle_return (self, &frame)) {
+                return connection_loss (self, loop);
+            }
+        }
+
         // this must be handled
-        if (frame.payload.method.id != AMQP_BASIC_ACK_METHOD) {
+        else {
             sam_log_errorf (
-                "got something different than an ack: 0x%x",
-                frame.payload.method.id);
+                "got an unexpected frame: 0x%x", method);
             return connection_loss (self, loop);
         }
 
-        // handle acknowledgement
-        handle_ack (self, &frame);
         rc = amqp_simple_wait_frame_noblock (
             self->amqp.connection, &frame, &timeout);
     }
@@ -345,6 +662,11 @@ handle_reconnect (
             sam_log_infof ("successfully reconnected '%s'", self->name);
             self->sock.amqp->fd = sam_be_rmq_sockfd (self);
             zloop_poller (loop, self->sock.amqp, handle_amqp, self);
+            check_window (self);
+
+            zsock_send (
+                self->sock.sig, "is",
+                SAM_BE_SIG_RECONNECTED, self->name);
         }
     }
 
@@ -382,6 +704,20 @@ connection_loss (
     // unsubscribe amqp poller
     zloop_poller_end (loop, self->sock.amqp);
 
+    // the broker will never confirm the pending messages, hand them
+    // back to get re-distributed to the remaining backends (this is
+    // not the messages fault and does not count as a try)
+    if (self->store.pending) {
+        sam_log_infof (
+            "'%s' hands back %u unconfirmed message(s)",
+            self->name, self->store.pending);
+
+        confirm (self, self->store.next - 1, true, SAM_BE_LOST);
+    }
+
+    // reject publishing requests until re-connected
+    check_window (self);
+
 
     // attempt re-connect
     zloop_timer (loop, 0, 1, handle_reconnect, self);
@@ -390,17 +726,9 @@ connection_loss (
 
 
 //  --------------------------------------------------------------------------
-/// Handle publishing request. The frame format contained in the
-/// sam_msg must look like this:
-///
-///    0 | s | destination exchange
-///    1 | s | routing key
-///    2 | i | mandatory
-///    3 | i | immediate
-///    4 | l | list of options
-///    5 | l | list of headers
-///    6 | f | zframe_t * containing the payload
-///
+/// Handle publishing request. The sam_msg carries its decoded
+/// publishing options (see sam_be_rmq_pub_new), which are shared
+/// with the other backends and read only.
 static int
 handle_publish_req (
     zloop_t *loop,
@@ -410,9 +738,9 @@ handle_publish_req (
     sam_be_rmq_t *self = args;
 
     sam_msg_t *msg;
-    int key;
+    uint64_t key;
 
-    int rc = zsock_recv (pll, "ip", &key, &msg);
+    int rc = zsock_recv (pll, "8p", &key, &msg);
     if (rc) {
         sam_log_errorf ("'%s' receive failed", self->name);
         return 0;
@@ -421,54 +749,25 @@ handle_publish_req (
 
     if (!self->connection.established) {
         sam_log_tracef (
-            "backend '%s' not connected, discarding publishing request",
+            "backend '%s' not connected, rejecting publishing request",
             self->name);
 
+        reject (self, key);
         sam_msg_destroy (&msg);
         return 0;
     }
 
 
-    // retrieve data and prepare options
-    sam_be_rmq_pub_t opts;
-    zlist_t
-        *props,
-        *headers;
-
-    rc = sam_msg_get (
-        msg, "ssiillf",
-
-        &opts.exchange,
-        &opts.routing_key,
-        &opts.mandatory,
-        &opts.immediate,
-
-        &props,
-        &headers,
-
-        &opts.payload);
-    assert (!rc);
-
-
-    // set props
-    uint prop_c = 12;
-    assert (zlist_size (props) == prop_c);
-
-    char *prop = zlist_first (props);
-    char **prop_ptr = (char **) &opts.props;
-    while (prop_c) {
-        *prop_ptr = prop;
-        prop_ptr += 1;
-        prop = zlist_next (props);
-        prop_c -= 1;
-    }
-
-    opts.headers = headers;
+    // options got decoded once when the request arrived
+    sam_be_rmq_pub_t *opts = sam_msg_data (msg);
+    assert (opts);
 
     // publish
     unsigned int seq = self->amqp.seq;
-    rc = sam_be_rmq_publish (self, &opts);
+    rc = sam_be_rmq_publish (self, opts);
     if (rc == SAM_BE_SIG_CONNECTION_LOSS) {
+        reject (self, key);
+        sam_msg_destroy (&msg);
         return connection_loss (self, loop);
     }
 
@@ -477,19 +776,12 @@ handle_publish_req (
     }
 
     sam_log_tracef (
-        "'%s' saves message %d (seq: %d) to the store",
+        "'%s' saves message %" PRIu64 " (seq: %d) to the store",
         self->name, key, seq);
-    zlist_append (self->store, new_store_item (key, seq));
-
+    store_put (self, seq, key);
+    check_window (self);
 
-    // clean up
     sam_msg_destroy (&msg);
-    free (opts.exchange);
-    free (opts.routing_key);
-    zlist_destroy (&props);
-    zlist_destroy (&headers);
-    zframe_destroy (&opts.payload);
-
     return 0;
 }
 
@@ -571,6 +863,7 @@ actor (
 
     self->sock.amqp = &amqp_pollitem;
     zloop_t *loop = zloop_new ();
+    self->loop = loop;
 
     zloop_reader (loop, pipe, sam_gen_handle_pipe, NULL);
     zloop_reader (loop, self->sock.pub, handle_publish_req, self);
@@ -685,7 +978,7 @@ sam_be_rmq_sockfd (
 sam_be_rmq_t *
 sam_be_rmq_new (
     const char *name,
-    uint64_t id)
+    int id)
 {
     sam_log_infof (
         "creating rabbitmq message backend (%s:%d)", name, id);
@@ -699,7 +992,10 @@ sam_be_rmq_new (
     strcpy (self->name, name);
 
     self->id = id;
-    self->store = NULL;
+
+    self->store.keys = NULL;
+    self->store.size = 0;
+    store_reset (self, 1);
 
     // init amqp
     memset (&self->amqp.connection, 0, sizeof (amqp_connection_state_t));
@@ -707,9 +1003,15 @@ sam_be_rmq_new (
     self->amqp.method_channel = 2;
     self->amqp.seq = 0;
 
+    self->scratch.headers = NULL;
+    self->scratch.size = 0;
+
     self->connection.established = false;
     self->connection.tries = -2;
 
+    self->saturated = false;
+    self->loop = NULL;
+
     return self;
 }
 
@@ -726,7 +1028,8 @@ sam_be_rmq_destroy (
         "destroying rabbitmq message backend instance '%s'",
         (*self)->name);
 
-    zlist_destroy (&(*self)->store);
+    free ((*self)->store.keys);
+    free ((*self)->scratch.headers);
 
     if ((*self)->connection.established) {
         try ("closing message channel", amqp_channel_close (
@@ -776,6 +1079,13 @@ sam_be_rmq_connect (
 
     // save options for reconnects
     memcpy (&self->connection.opts, opts, sizeof (sam_be_rmq_opts_t));
+    if (self->connection.opts.window <= 0) {
+        self->connection.opts.window = SAM_BE_RMQ_WINDOW;
+    }
+
+    if (self->connection.opts.weight <= 0) {
+        self->connection.opts.weight = 1;
+    }
 
     if (self->connection.tries == -2) {
         self->connection.tries = opts->tries;
@@ -870,19 +1180,674 @@ sam_be_rmq_connect (
 
 
     self->amqp.seq = 1;
+    store_reset (self, self->amqp.seq);
+    self->connection.tries = opts->tries;
+
+    return 0;
+}
 
-    if (self->store) {
-        zlist_destroy (&self->store);
+
+//  --------------------------------------------------------------------------
+/// Parses an integer frame of a publishing request.
+static int
+frame_int (
+    byte *data,
+    size_t size)
+{
+    char buf [16];
+    if (sizeof (buf) <= size) {
+        size = sizeof (buf) - 1;
     }
 
-    self->store = zlist_new ();
-    zlist_set_destructor (self->store, free_store_item);
-    self->connection.tries = opts->tries;
+    memcpy (buf, data, size);
+    buf [size] = '\0';
+    return atoi (buf);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Copies a frame as a null terminated string to the arena and
+/// advances it.
+static char *
+frame_str (
+    char **arena,
+    byte *data,
+    size_t size)
+{
+    char *str = *arena;
+
+    memcpy (str, data, size);
+    str [size] = '\0';
+
+    *arena += size + 1;
+    return str;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Translates the properties selected by the mask. rabbitmq-c only
+/// sends properties whose flag is set: The flags of empty properties
+/// get cleared.
+static void
+encode_props (
+    amqp_basic_properties_t *props,
+    sam_be_rmq_pub_t *opts,
+    uint16_t mask)
+{
+    static const amqp_flags_t flags [PROP_C] = {
+        AMQP_BASIC_CONTENT_TYPE_FLAG,
+        AMQP_BASIC_CONTENT_ENCODING_FLAG,
+        AMQP_BASIC_DELIVERY_MODE_FLAG,
+        AMQP_BASIC_PRIORITY_FLAG,
+        AMQP_BASIC_CORRELATION_ID_FLAG,
+        AMQP_BASIC_REPLY_TO_FLAG,
+        AMQP_BASIC_EXPIRATION_FLAG,
+        AMQP_BASIC_MESSAGE_ID_FLAG,
+        AMQP_BASIC_TYPE_FLAG,
+        AMQP_BASIC_USER_ID_FLAG,
+        AMQP_BASIC_APP_ID_FLAG,
+        AMQP_BASIC_CLUSTER_ID_FLAG
+    };
+
+    amqp_bytes_t *bytes [PROP_C] = {
+        &props->content_type,
+        &props->content_encoding,
+        NULL,                       // delivery_mode
+        NULL,                       // priority
+        &props->correlation_id,
+        &props->reply_to,
+        &props->expiration,
+        &props->message_id,
+        &props->type,
+        &props->user_id,
+        &props->app_id,
+        &props->cluster_id
+    };
+
+    char **prop = (char **) &opts->props;
+    for (int i = 0; i < PROP_C; i++) {
+        if ((mask & (1 << i)) && bytes [i]) {
+            *bytes [i] = c_bytes (prop [i]);
+        }
+    }
+
+    if (mask & (1 << 2)) {
+        props->delivery_mode = c_uint8 (opts->props.delivery_mode);
+    }
+
+    if (mask & (1 << 3)) {
+        props->priority = c_uint8 (opts->props.priority);
+    }
+
+    for (int i = 0; i < PROP_C; i++) {
+        if (!(mask & (1 << i))) {
+            continue;
+        }
+
+        bool present =
+            (i == 2)? props->delivery_mode != 0:
+            (i == 3)? props->priority != 0:
+            bytes [i]->len != 0;
+
+        if (present) {
+            props->_flags |= flags [i];
+        } else {
+            props->_flags &= ~flags [i];
+        }
+    }
+}
+
 
+//  --------------------------------------------------------------------------
+/// Translates the headers from the provided one on.
+static void
+encode_headers (
+    amqp_table_entry_t *headers,
+    sam_be_rmq_pub_t *opts,
+    int from)
+{
+    headers += from;
+    for (int i = from; i < opts->header_c; i++) {
+        char
+            *key = opts->headers [2 * i],
+            *val = opts->headers [2 * i + 1];
+
+        headers->key.len = strlen (key);
+        headers->key.bytes = key;
+
+        headers->value.kind = AMQP_FIELD_KIND_BYTES;
+        headers->value.value.bytes.len = strlen (val);
+        headers->value.value.bytes.bytes = val;
+
+        headers += 1;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+/// Translates the decoded options for amqp_basic_publish. Options
+/// derived from a template start with its translation and share its
+/// header table unless headers were added. The provided table must
+/// be large enough for all headers otherwise.
+static void
+encode_amqp (
+    sam_be_rmq_pub_t *self,
+    amqp_table_entry_t *headers)
+{
+    const sam_be_rmq_tpl_t *tpl = self->tpl;
+    int from = 0;
+
+    self->amqp.exchange = c_bytes (self->exchange);
+    self->amqp.routing_key = c_bytes (self->routing_key);
+
+    if (tpl) {
+        self->amqp.props = tpl->opts->amqp.props;
+        encode_props (&self->amqp.props, self, self->overrides);
+
+        from = tpl->opts->header_c;
+        if (from == self->header_c) {
+            return;
+        }
+
+        memcpy (
+            headers, tpl->opts->amqp.props.headers.entries,
+            from * sizeof (amqp_table_entry_t));
+    }
+    else {
+        memset (&self->amqp.props, 0, sizeof (self->amqp.props));
+        encode_props (&self->amqp.props, self, PROPS_ALL);
+    }
+
+    encode_headers (headers, self, from);
+    self->amqp.props.headers.num_entries = self->header_c;
+    self->amqp.props.headers.entries = headers;
+
+    if (self->header_c) {
+        self->amqp.props._flags |= AMQP_BASIC_HEADERS_FLAG;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+/// Reads the next length prefixed string of binary publishing
+/// options. Returns -1 if it exceeds the options.
+static int
+bin_str (
+    byte *data,
+    size_t size,
+    size_t *pos,
+    byte **str,
+    size_t *len)
+{
+    if (size - *pos < 4) {
+        return -1;
+    }
+
+    *len = sam_gen_le32 (data + *pos);
+    *pos += 4;
+
+    if (size - *pos < *len) {
+        return -1;
+    }
+
+    *str = data + *pos;
+    *pos += *len;
     return 0;
 }
 
 
+//  --------------------------------------------------------------------------
+/// Copies the next string of binary publishing options to the arena.
+/// The options must have been validated.
+static char *
+bin_next (
+    char **arena,
+    byte *data,
+    size_t size,
+    size_t *pos)
+{
+    byte *str;
+    size_t len;
+
+    int rc = bin_str (data, size, pos, &str, &len);
+    assert (!rc);
+
+    return frame_str (arena, str, len);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Decode binary publishing options (see rfc 8 and 9) whose strings
+/// start at the provided position. Without a template they contain
+/// the exchange, routing key, present properties and headers. With a
+/// template, they contain an optional routing key, the overridden
+/// properties and additional headers; everything else is taken from
+/// the template, whose strings are referenced and not copied. Absent
+/// properties become empty strings. Like the decoding of string
+/// frames, the first pass validates the options and sums up the size
+/// of all strings, the second one copies them.
+static sam_be_rmq_pub_t *
+decode_options (
+    byte *data,
+    size_t size,
+    size_t start,
+    const sam_be_rmq_tpl_t *tpl)
+{
+    byte *str;
+    size_t len, pos, str_size = 0;
+
+    uint16_t
+        flags = data [1],
+        bitmap = sam_gen_le16 (data + 4),
+        header_c = sam_gen_le16 (data + 6);
+
+    if (bitmap >> PROP_C) {
+        return NULL;
+    }
+
+    bool routing_key = !tpl || (flags & FLAG_ROUTING_KEY);
+    int str_c =
+        (tpl? 0: 1) + (routing_key? 1: 0) +
+        __builtin_popcount (bitmap) + 2 * header_c;
+
+    pos = start;
+    for (int i = 0; i < str_c; i++) {
+        if (bin_str (data, size, &pos, &str, &len)) {
+            return NULL;
+        }
+
+        str_size += len + 1;
+    }
+
+    if (pos != size) {
+        return NULL;
+    }
+
+
+    // the template's header table is shared if no headers are added
+    int
+        tpl_header_c = (tpl)? tpl->opts->header_c: 0,
+        entry_c = (header_c)? tpl_header_c + header_c: 0;
+
+    size_t
+        entries_size = entry_c * sizeof (amqp_table_entry_t),
+        headers_size = 2 * (tpl_header_c + header_c) * sizeof (char *);
+
+    sam_be_rmq_pub_t *self = malloc (
+        sizeof (sam_be_rmq_pub_t) + entries_size + headers_size +
+        str_size + 1);
+    assert (self);
+
+    amqp_table_entry_t *entries = (amqp_table_entry_t *) (self + 1);
+    self->headers = (char **) (entries + entry_c);
+    char *arena = (char *) self->headers + headers_size;
+
+    // shared by all absent properties
+    char *empty = arena;
+    *arena = '\0';
+    arena += 1;
+
+    char **prop = (char **) &self->props;
+    pos = start;
+
+    if (tpl) {
+        self->exchange = tpl->opts->exchange;
+        self->routing_key = tpl->opts->routing_key;
+        self->mandatory = tpl->opts->mandatory;
+        self->immediate = tpl->opts->immediate;
+
+        memcpy (&self->props, &tpl->opts->props, sizeof (self->props));
+        memcpy (
+            self->headers, tpl->opts->headers,
+            2 * tpl_header_c * sizeof (char *));
+    }
+    else {
+        self->exchange = bin_next (&arena, data, size, &pos);
+        self->mandatory = (flags & FLAG_MANDATORY)? 1: 0;
+        self->immediate = (flags & FLAG_IMMEDIATE)? 1: 0;
+
+        for (int i = 0; i < PROP_C; i++) {
+            prop [i] = empty;
+        }
+    }
+
+    if (routing_key) {
+        self->routing_key = bin_next (&arena, data, size, &pos);
+    }
+
+    for (int i = 0; i < PROP_C; i++) {
+        if (bitmap & (1 << i)) {
+            prop [i] = bin_next (&arena, data, size, &pos);
+        }
+    }
+
+    self->header_c = tpl_header_c + header_c;
+    for (int i = 2 * tpl_header_c; i < 2 * self->header_c; i++) {
+        self->headers [i] = bin_next (&arena, data, size, &pos);
+    }
+
+    self->payload = NULL;
+    self->payload_size = 0;
+    self->tpl = tpl;
+    self->overrides = bitmap;
+
+    encode_amqp (self, entries);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Decode binary publishing options (see rfc 8). The sam_msg
+/// contains the options frame and the payload:
+///
+///    0 | f | options: distribution, flags, min. acknowledged,
+///      |   | property bitmap, header count and strings
+///    1 | f | payload
+static sam_be_rmq_pub_t *
+decode_binary (
+    sam_msg_t *msg)
+{
+    byte *data;
+    size_t size;
+
+    sam_msg_frame (msg, 0, &data, &size);
+    if (size < SAM_PUB_HEAD_SIZE || data [1] & SAM_PUB_TEMPLATE) {
+        return NULL;
+    }
+
+    sam_be_rmq_pub_t *self = decode_options (
+        data, size, SAM_PUB_HEAD_SIZE, NULL);
+
+    if (self) {
+        sam_msg_frame (msg, 1, &self->payload, &self->payload_size);
+    }
+
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Decode the publishing options of a publishing request. Requests
+/// of the binary protocol consist of exactly two frames and get
+/// decoded by decode_binary. Otherwise the frame format contained in
+/// the sam_msg must look like this:
+///
+///    0 | s | destination exchange
+///    1 | s | routing key
+///    2 | i | mandatory
+///    3 | i | immediate
+///    4 | l | list of 12 properties
+///    5 | l | list of headers (alternating keys and values)
+///    6 | f | payload
+///
+/// The first pass validates the frames and sums up the size of all
+/// strings, the second one copies them into the same allocation as
+/// the options. The payload is not copied but points into the
+/// message, so the options must not outlive it.
+sam_be_rmq_pub_t *
+sam_be_rmq_pub_new (
+    sam_msg_t *msg)
+{
+    if (sam_msg_size (msg) == 2) {
+        return decode_binary (msg);
+    }
+
+    byte *data;
+    size_t size, str_size = 0;
+
+    // exchange, routing key and the properties
+    int prop_pos = 5, header_pos = prop_pos + PROP_C + 1;
+    for (int pos = 0; pos < header_pos; pos++) {
+        if (sam_msg_frame (msg, pos, &data, &size)) {
+            return NULL;
+        }
+
+        if (pos == prop_pos - 1 && frame_int (data, size) != PROP_C) {
+            return NULL;
+        }
+
+        if (pos < 2 || prop_pos <= pos) {
+            str_size += size + 1;
+        }
+    }
+
+    // headers
+    if (sam_msg_frame (msg, header_pos - 1, &data, &size)) {
+        return NULL;
+    }
+
+    int header_frame_c = frame_int (data, size);
+    if (header_frame_c < 0) {
+        return NULL;
+    }
+
+    for (int i = 0; i < header_frame_c; i++) {
+        if (sam_msg_frame (msg, header_pos + i, &data, &size)) {
+            return NULL;
+        }
+
+        str_size += size + 1;
+    }
+
+    // payload
+    int payload_pos = header_pos + header_frame_c;
+    if (sam_msg_frame (msg, payload_pos, &data, &size)) {
+        return NULL;
+    }
+
+
+    // a key without value gets ignored
+    int header_c = header_frame_c / 2;
+    size_t
+        entries_size = header_c * sizeof (amqp_table_entry_t),
+        headers_size = 2 * header_c * sizeof (char *);
+
+    sam_be_rmq_pub_t *self = malloc (
+        sizeof (sam_be_rmq_pub_t) + entries_size + headers_size +
+        str_size);
+    assert (self);
+
+    amqp_table_entry_t *entries = (amqp_table_entry_t *) (self + 1);
+    self->headers = (char **) (entries + header_c);
+    char *arena = (char *) self->headers + headers_size;
+
+    sam_msg_frame (msg, 0, &data, &size);
+    self->exchange = frame_str (&arena, data, size);
+
+    sam_msg_frame (msg, 1, &data, &size);
+    self->routing_key = frame_str (&arena, data, size);
+
+    sam_msg_frame (msg, 2, &data, &size);
+    self->mandatory = frame_int (data, size);
+
+    sam_msg_frame (msg, 3, &data, &size);
+    self->immediate = frame_int (data, size);
+
+    char **prop = (char **) &self->props;
+    for (int i = 0; i < PROP_C; i++) {
+        sam_msg_frame (msg, prop_pos + i, &data, &size);
+        prop [i] = frame_str (&arena, data, size);
+    }
+
+    self->header_c = header_c;
+    for (int i = 0; i < 2 * header_c; i++) {
+        sam_msg_frame (msg, header_pos + i, &data, &size);
+        self->headers [i] = frame_str (&arena, data, size);
+    }
+
+    sam_msg_frame (msg, payload_pos, &self->payload, &self->payload_size);
+    self->tpl = NULL;
+    self->overrides = 0;
+
+    encode_amqp (self, entries);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Decode the publishing options of a publishing request referencing
+/// a template (see rfc 9). The sam_msg contains the options frame,
+/// whose head is followed by the template id and the overrides, and
+/// the payload. The options must not outlive the template.
+sam_be_rmq_pub_t *
+sam_be_rmq_pub_derive (
+    const sam_be_rmq_tpl_t *tpl,
+    sam_msg_t *msg)
+{
+    assert (tpl);
+
+    byte *data;
+    size_t size;
+
+    if (sam_msg_size (msg) != 2) {
+        return NULL;
+    }
+
+    sam_msg_frame (msg, 0, &data, &size);
+    if (size < SAM_PUB_HEAD_SIZE + 4 || !(data [1] & SAM_PUB_TEMPLATE)) {
+        return NULL;
+    }
+
+    sam_be_rmq_pub_t *self = decode_options (
+        data, size, SAM_PUB_HEAD_SIZE + 4, tpl);
+
+    if (self) {
+        sam_msg_frame (msg, 1, &self->payload, &self->payload_size);
+    }
+
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Writes a length prefixed string of binary publishing options.
+static byte *
+bin_put (
+    byte *pos,
+    const char *str,
+    size_t len)
+{
+    pos = sam_gen_put_le32 (pos, len);
+    memcpy (pos, str, len);
+    return pos + len;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Encode publishing options as binary options (see rfc 8) which
+/// do not reference a template. The distribution and the min.
+/// acknowledged count are taken from the provided head. Empty
+/// properties are left out.
+byte *
+sam_be_rmq_pub_encode (
+    sam_be_rmq_pub_t *self,
+    const byte *head,
+    size_t *size)
+{
+    char **prop = (char **) &self->props;
+    uint16_t bitmap = 0;
+
+    *size = SAM_PUB_HEAD_SIZE +
+        4 + strlen (self->exchange) +
+        4 + strlen (self->routing_key);
+
+    for (int i = 0; i < PROP_C; i++) {
+        if (*prop [i]) {
+            bitmap |= 1 << i;
+            *size += 4 + strlen (prop [i]);
+        }
+    }
+
+    for (int i = 0; i < 2 * self->header_c; i++) {
+        *size += 4 + strlen (self->headers [i]);
+    }
+
+    byte *data = malloc (*size);
+    assert (data);
+
+    data [0] = head [0];
+    data [1] =
+        (self->mandatory? FLAG_MANDATORY: 0) |
+        (self->immediate? FLAG_IMMEDIATE: 0);
+
+    byte *pos = data + 2;
+    pos = sam_gen_put_le16 (pos, sam_gen_le16 (head + 2));
+    pos = sam_gen_put_le16 (pos, bitmap);
+    pos = sam_gen_put_le16 (pos, self->header_c);
+
+    pos = bin_put (pos, self->exchange, strlen (self->exchange));
+    pos = bin_put (pos, self->routing_key, strlen (self->routing_key));
+
+    for (int i = 0; i < PROP_C; i++) {
+        if (bitmap & (1 << i)) {
+            pos = bin_put (pos, prop [i], strlen (prop [i]));
+        }
+    }
+
+    for (int i = 0; i < 2 * self->header_c; i++) {
+        pos = bin_put (pos, self->headers [i], strlen (self->headers [i]));
+    }
+
+    assert (pos == data + *size);
+    return data;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Destroy decoded publishing options.
+void
+sam_be_rmq_pub_destroy (
+    sam_be_rmq_pub_t **self)
+{
+    assert (*self);
+
+    free (*self);
+    *self = NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Create a publishing template by decoding the binary options and
+/// translating its properties and headers once.
+sam_be_rmq_tpl_t *
+sam_be_rmq_tpl_new (
+    byte *data,
+    size_t size)
+{
+    if (size < SAM_PUB_HEAD_SIZE || data [1] & SAM_PUB_TEMPLATE) {
+        return NULL;
+    }
+
+    sam_be_rmq_pub_t *opts = decode_options (
+        data, size, SAM_PUB_HEAD_SIZE, NULL);
+
+    if (opts == NULL) {
+        return NULL;
+    }
+
+    sam_be_rmq_tpl_t *self = malloc (sizeof (sam_be_rmq_tpl_t));
+    assert (self);
+
+    self->opts = opts;
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Destroy a publishing template.
+void
+sam_be_rmq_tpl_destroy (
+    sam_be_rmq_tpl_t **self)
+{
+    assert (*self);
+
+    sam_be_rmq_pub_destroy (&(*self)->opts);
+
+    free (*self);
+    *self = NULL;
+}
+
+
 //  --------------------------------------------------------------------------
 /// Publish (basic_publish) a message to the RabbitMQ broker.
 int
@@ -891,79 +1856,58 @@ sam_be_rmq_publish (
     sam_be_rmq_pub_t *opts)
 {
     sam_log_tracef (
-        "'%s' publishing message %d of size %d",
+        "'%s' publishing message %d of size %zu",
         self->name,
         self->amqp.seq,
-        zframe_size (opts->payload));
-
+        opts->payload_size);
 
-    // translate headers
-    size_t
-        num_headers = zlist_size (opts->headers),
-        headers_size = sizeof (amqp_table_entry_t) * num_headers;
 
-    amqp_table_entry_t
-        *headers = malloc (headers_size),
-        *headers_ptr = headers;
+    // the options are translated already, mandatory messages
+    // additionally carry their sequence number to be identified
+    // when they are returned.
+    amqp_basic_properties_t props = opts->amqp.props;
 
-    char *key, *val;
-    if (num_headers) {
-        key = zlist_first (opts->headers);
-        val = zlist_next (opts->headers);
+    if (opts->mandatory) {
+        int header_c = props.headers.num_entries;
+        if (self->scratch.size < header_c + 1) {
+            self->scratch.size = header_c + 1;
+            self->scratch.headers = realloc (
+                self->scratch.headers,
+                self->scratch.size * sizeof (amqp_table_entry_t));
 
-        while (key != NULL && val != NULL) {
-            headers_ptr->key.len = strlen (key);
-            headers_ptr->key.bytes = key;
+            assert (self->scratch.headers);
+        }
 
-            headers_ptr->value.kind = AMQP_FIELD_KIND_BYTES;
-            headers_ptr->value.value.bytes.len = strlen (val);
-            headers_ptr->value.value.bytes.bytes = val;
+        amqp_table_entry_t *headers = self->scratch.headers;
+        memcpy (
+            headers, props.headers.entries,
+            header_c * sizeof (amqp_table_entry_t));
 
-            headers_ptr += 1;
+        headers [header_c].key = amqp_cstring_bytes (SEQ_HEADER);
+        headers [header_c].value.kind = AMQP_FIELD_KIND_I64;
+        headers [header_c].value.value.i64 = self->amqp.seq;
 
-            key = zlist_next (opts->headers);
-            val = zlist_next (opts->headers);
-        }
+        props.headers.num_entries = header_c + 1;
+        props.headers.entries = headers;
+        props._flags |= AMQP_BASIC_HEADERS_FLAG;
     }
 
 
-    // translate props
-    amqp_basic_properties_t amqp_props = {
-        ._flags           = 0,
-        .content_type     = c_bytes (opts->props.content_type),
-        .content_encoding = c_bytes (opts->props.content_encoding),
-        .headers          = { .num_entries = num_headers, .entries = headers },
-        .delivery_mode    = c_uint8 (opts->props.delivery_mode),
-        .priority         = c_uint8 (opts->props.priority),
-        .correlation_id   = c_bytes (opts->props.correlation_id),
-        .reply_to         = c_bytes (opts->props.reply_to),
-        .expiration       = c_bytes (opts->props.expiration),
-        .message_id       = c_bytes (opts->props.message_id),
-        .timestamp        = 0,
-        .type             = c_bytes (opts->props.type),
-        .user_id          = c_bytes (opts->props.user_id),
-        .app_id           = c_bytes (opts->props.app_id),
-        .cluster_id       = c_bytes (opts->props.cluster_id)
-    };
-
-
     amqp_bytes_t payload = {
-        .len = zframe_size (opts->payload),
-        .bytes = zframe_data (opts->payload)
+        .len = opts->payload_size,
+        .bytes = opts->payload
     };
 
     int rc = amqp_basic_publish (
         self->amqp.connection,
         self->amqp.message_channel,
-        c_bytes (opts->exchange),
-        c_bytes (opts->routing_key),
+        opts->amqp.exchange,
+        opts->amqp.routing_key,
         opts->mandatory,
         opts->immediate,
-        &amqp_props,
+        &props,
         payload);
 
-    free (headers);
-
     if (rc == AMQP_STATUS_HEARTBEAT_TIMEOUT) {
         sam_log_errorf (
             "'%s' connection lost while publishing!",
@@ -1094,7 +2038,13 @@ sam_be_rmq_start (
     assert (backend);
     backend->name = (*self)->name;
     backend->id = (*self)->id;
+    backend->weight = (*self)->connection.opts.weight;
     backend->str = be_to_string;
+    backend->released = be_released;
+    backend->saturated = false;
+    backend->connected = (*self)->connection.established;
+    backend->dispatched = (*self)->released;
+    backend->current = 0;
 
 
     // signals
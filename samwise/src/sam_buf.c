@@ -14,11 +14,46 @@
    @file sam_buf.c
 
    The samwise buffer encapsulates all persistence layer related
-   operations. Underneath, a Berkeley DB storage engine is used to
-   write message temporarily to a database file. The buffer accepts
+   operations. Underneath, messages are written temporarily to a
+   database via sam_db. The storage engine is selectable by the
+   configuration: Berkeley DB (db/bdb), LMDB (db/lmdb) or an
+   append-only segmented log (db/log). The buffer accepts
    storage requests to persist a message, demultiplexes
    acknowledgements arriving from one or more messaging backends and
-   resends messages based on the configuration file.
+   resends messages based on the configuration file. Messages which
+   are rejected (nack'd) or returned by a broker are re-distributed
+   immediately.
+
+   Storage requests and acknowledgements are applied in groups: A
+   transaction stays open for up to buffer/commit/window milliseconds
+   or buffer/commit/count operations, whichever comes first, and is
+   committed at once. A group may contain operations of several
+   clients which got their receipts already: Operations validate
+   their input before writing, a failing operation is discarded on
+   its own (see sam_db_savepoint). Only if the database fails, the
+   whole group is aborted. Receipts of asynchronous storage requests
+   are only handed out after the commit.
+
+   If buffer/stage/delay is configured, new records are kept in
+   memory (staged) and only written to the database after the delay
+   elapsed or if the staged records exceed buffer/stage/size.
+   Records which get fully acknowledged before that are dropped and
+   never written. Staged records are lost if samwise crashes: The
+   delay is the durability window.
+
+   Records keep their key for their whole lifetime. Their resend
+   deadlines are kept in an in-memory min-heap which is rebuilt from
+   the database upon startup: A resend cycle only touches records
+   that are actually due. An index maps the keys to their position
+   in the heap, entries are removed as soon as their record gets
+   deleted.
+
+   If buffer/hedge/percentile is configured, messages which must be
+   acknowledged by a single backend are tracked until they get
+   confirmed. The confirmation latencies of the most recent messages
+   determine the hedging delay: A message not confirmed within this
+   delay is published to a second backend. The first confirmation
+   deletes the record, the other one is ignored.
 
    <code>
 
@@ -26,6 +61,7 @@
    -----------------------
      PIPE: sam_buf spawns its actor internally
      REQ/REP: storage requests
+     PSH/PLL: asynchronous storage requests
 
    sam_buf_actor | libsam actor
    ----------------------------
@@ -35,6 +71,10 @@
    ---------------------
      PSH/PLL: acknowledgements
 
+   sam_buf actor | libsam
+   ----------------------
+     PSH/PLL: receipts for asynchronous storage requests
+
 
    Topology:
    --------
@@ -48,10 +88,10 @@
                sam_buf actor o <-------- o be[i]
                      |      PULL       PUSH
                      |
-               -------------
-              | Berkeley DB |
-              |  *.db file  |
-               -------------
+               ---------------
+              |    sam_db     |
+              | bdb|lmdb|log  |
+               ---------------
 
 
    </code>
@@ -71,20 +111,74 @@
 /// State object maintained by the actor
 typedef struct state_t {
     // data to be restored after restart
-    int seq;                ///< used to assign unique message id's
-    int last_stored;        ///< used to decide if it's a premature ack
-    int tombstone_zone;     ///< to skip tombstones upon re-send
+    uint64_t seq;           ///< used to assign unique message id's
+    uint64_t last_stored;   ///< largest stored key (premature acks)
+    uint64_t last_early;    ///< largest key a premature ack was stored for
 
     sam_db_t *db;           ///< storage engine
 
     zsock_t *in;            ///< for arriving acknowledgements
     zsock_t *out;           ///< for re-publishing
     zsock_t *store_sock;    ///< for (internal) storage requests
+    zsock_t *store_async;   ///< for asynchronous storage requests
+    zsock_t *receipts;      ///< to hand out asynchronous receipts
 
     int tries;              ///< maximum number of retries for a message
     uint64_t interval;      ///< how often messages are being tried again
     uint64_t threshold;     ///< at which point messages are tried again
 
+    zloop_t *loop;          ///< used to arm the commit timer
+
+    /// group commit
+    struct commit {
+        uint64_t window;    ///< max. time a group stays uncommitted
+        int count;          ///< max. number of operations per group
+        int ops;            ///< operations of the current group
+        bool open;          ///< a transaction is currently open
+        int timer;          ///< id of the window timer or -1
+        zlist_t *pending;   ///< asynchronous requests awaiting the commit
+    } commit;
+
+    /// write-behind staging
+    struct stage {
+        uint64_t delay;     ///< max. time records stay staged, 0 disables
+        uint64_t size;      ///< max. memory used by staged records
+        uint64_t used;      ///< memory currently used by staged records
+        struct staged_t *list;  ///< ordered by key
+        int head;           ///< first entry not yet written
+        int n;
+        int cap;
+    } stage;
+
+    /// resend deadlines and pacing
+    struct resend {
+        struct due_t *heap; ///< min-heap ordered by deadline
+        int n;
+        int cap;
+        struct slot_t *index;   ///< heap positions by key
+        int index_cap;      ///< power of two, at least 2 * n
+
+        int budget;         ///< max. due records handled per cycle
+        uint64_t slice;     ///< max. duration of a cycle, 0 disables
+        int rate;           ///< max. messages per second, 0 disables
+        double tokens;      ///< messages that may currently be sent
+        uint64_t last;      ///< last refill of the tokens
+        int timer;          ///< id of the continuation timer or -1
+    } resend;
+
+    /// hedging of messages acknowledged by a single backend
+    struct hedge {
+        int percentile;     ///< latency percentile to hedge at, 0 disables
+        uint64_t delay;     ///< current hedging delay, 0 until measured
+        struct flight_t *list;  ///< ordered by key
+        int head;           ///< first entry still tracked
+        int next;           ///< first entry not yet considered for hedging
+        int n;
+        int cap;
+        uint64_t *samples;  ///< ring of recent confirmation latencies
+        int sampled;        ///< number of samples taken so far
+    } hedge;
+
     sam_stat_handle_t *stat;
 } state_t;
 
@@ -92,10 +186,86 @@ typedef struct state_t {
 /// buf instance wrapping the buffer
 struct sam_buf_t {
     zsock_t *store_sock;   ///< for (internal) storage requests
+    zsock_t *store_async;  ///< for asynchronous storage requests
     zactor_t *actor;       ///< maintaining the event loop
 };
 
 
+/// asynchronous storage request awaiting its group commit
+typedef struct pending_t {
+    int n;                  ///< number of messages
+    uint64_t *keys;         ///< message ids, 0 if not persisted
+    sam_msg_t **msgs;       ///< stored messages
+    int *counts;            ///< required acknowledgements per message
+    sam_dist_t *dists;      ///< distribution strategy per message
+    void *tag;              ///< handed out with the receipt
+    sam_ret_t *ret;         ///< handed out with the receipt
+} pending_t;
+
+
+/// record kept in memory until it is written to the database, the
+/// message is referenced instead of being copied
+typedef struct staged_t {
+    uint64_t key;             ///< message id
+    struct record_t *header;  ///< header of the record, NULL if dropped
+    sam_msg_t *msg;           ///< message of the record
+    size_t size;              ///< size of the record
+    uint64_t ts;              ///< time of staging
+} staged_t;
+
+
+/// message awaiting its first confirmation
+typedef struct flight_t {
+    uint64_t key;           ///< message id
+    uint64_t ts;            ///< time of storage, 0 if no longer tracked
+} flight_t;
+
+
+/// resend deadline of a record
+typedef struct due_t {
+    uint64_t ts;            ///< point in time the record is due
+    uint64_t key;           ///< message id
+} due_t;
+
+
+/// position of a record in the resend heap (open addressing)
+typedef struct slot_t {
+    uint64_t key;           ///< message id, 0 if the slot is empty
+    int pos;                ///< position in the heap
+} slot_t;
+
+
+/// used if buffer/stage/size is not configured
+#define STAGE_SIZE (16 * 1024 * 1024)
+
+
+/// parts of a record written without an additional allocation
+#define PUT_PARTS 8
+
+
+/// used if buffer/retry/budget is not configured
+#define RESEND_BUDGET 1000
+
+
+/// used if buffer/retry/slice is not configured (ms)
+#define RESEND_SLICE 5
+
+
+/// fibonacci hashing of keys for the resend index
+#define INDEX_HASH(key, cap) \
+    ((int) (((key) * 11400714819323198485ULL) >> 32) & ((cap) - 1))
+
+
+/// number of confirmation latencies the hedging delay is based on
+#define HEDGE_SAMPLES 1024
+
+/// the hedging delay is updated every HEDGE_UPDATE samples
+#define HEDGE_UPDATE 128
+
+/// how often (ms) unconfirmed messages are checked for hedging
+#define HEDGE_TICK 5
+
+
 /*
  *    RECORD DEFINITIONS
  */
@@ -105,40 +275,149 @@ struct sam_buf_t {
 typedef enum {
     RECORD = 0x10,    // arbitrary value, prevents false positives
     RECORD_ACK,
-    RECORD_TOMBSTONE
+    RECORD_TOMBSTONE, // format 0 only, dropped when migrating
+    RECORD_FORMAT
 } record_type_t;
 
 
-/// Meta information stored for every record
+/// key of the record describing the layout of all other records,
+/// message ids start at 1
+#define FORMAT_KEY 0
+
+/// must be incremented whenever the layout of the records changes,
+/// databases without a format record are migrated (see record_v0_t),
+/// format 2 lacks the distribution strategy
+#define FORMAT_VERSION 3
+
+
+/// Meta information stored for every record. The header is followed
+/// by the set of backends that acknowledged the record (see sam_gen)
+/// and the encoded message.
 typedef struct record_t {
-    record_type_t type;   ///< either record or tombstone
+    record_type_t type;   ///< either record or early ack
     union {
 
         /// header stored for messages (encoded message gets appended)
         struct {
-            int prev;             ///< previous tombstone
+            int acks_size;        ///< size of the appended backend set
+            int acks_remaining;   ///< may be negative for early acks
+            int64_t ts;           ///< time of the last (re-)send
+            int tries;            ///< total number of retries
+            int dist;             ///< sam_dist_t the message was sent with
+        } record;                 ///< if type == RECORD
+
+        /// stored once with FORMAT_KEY
+        struct {
+            int version;          ///< FORMAT_VERSION of the writer
+        } format;                 ///< if type == RECORD_FORMAT
+
+    } c;
+} record_t;
+
+
+/// Meta information stored for every record by versions writing no
+/// format record (format 0). Tombstones linked the records.
+typedef struct record_v0_t {
+    record_type_t type;   ///< either record, early ack or tombstone
+    union {
 
+        struct {
+            int prev;             ///< previous tombstone
             uint64_t be_acks;     ///< mask containing backend ids
             int acks_remaining;   ///< may be negative for early acks
             int64_t ts;           ///< insertion time
             int tries;            ///< total number of retries
         } record;                 ///< if type == RECORD
 
-
-        /// data stored for tombstones
         struct {
-            int prev;    ///< previous tombstone or NULL
-            int next;    ///< next record/tombstone
-        } tombstone;     ///< if type == TOMBSTONE
+            int prev;             ///< previous tombstone or NULL
+            int next;             ///< next record/tombstone
+        } tombstone;              ///< if type == RECORD_TOMBSTONE
 
     } c;
-} record_t;
+} record_v0_t;
+
+
+//  --------------------------------------------------------------------------
+/// Returns the set of backends that acknowledged the record.
+static byte *
+record_acks (
+    record_t *header)
+{
+    return (byte *) header + sizeof (record_t);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the size of the header including the backend set.
+static size_t
+record_header_size (
+    record_t *header)
+{
+    return sizeof (record_t) + header->c.record.acks_size;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Checks if the backend already acknowledged the record.
+static bool
+record_acked (
+    record_t *header,
+    int backend_id)
+{
+    return sam_gen_set_contains (
+        record_acks (header), header->c.record.acks_size, backend_id);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Adds the backend to the set of backends that acknowledged the
+/// record. If the set is too small to contain the backend id, a
+/// grown copy of the record is returned (the caller owns it) and the
+/// size gets updated. Otherwise the record is altered in place and
+/// NULL is returned.
+static record_t *
+record_add_ack (
+    record_t *header,
+    size_t *size,
+    int backend_id)
+{
+    size_t
+        acks_size = header->c.record.acks_size,
+        set_size = sam_gen_set_size (backend_id);
+
+    if (set_size <= acks_size) {
+        sam_gen_set_add (record_acks (header), backend_id);
+        return NULL;
+    }
+
+    size_t
+        header_size = record_header_size (header),
+        growth = set_size - acks_size;
+
+    byte *grown = malloc (*size + growth);
+    assert (grown);
+
+    memcpy (grown, header, header_size);
+    memset (grown + header_size, 0, growth);
+    memcpy (
+        grown + header_size + growth,
+        (byte *) header + header_size,
+        *size - header_size);
+
+    record_t *grown_header = (record_t *) grown;
+    grown_header->c.record.acks_size = set_size;
+    sam_gen_set_add (record_acks (grown_header), backend_id);
+
+    *size += growth;
+    return grown_header;
+}
 
 
 //  --------------------------------------------------------------------------
 /// Create a unique, sortable message id. Order determines message
 /// age. Older keys must have smaller keys.
-static int
+static uint64_t
 create_msg_id (
     state_t *state)
 {
@@ -147,86 +426,246 @@ create_msg_id (
 
 
 //  --------------------------------------------------------------------------
-/// Delete a database record and all its tombstones.
-static int
-del (
-    state_t *state)
+/// Returns the index slot of the provided key or the empty slot where
+/// it belongs.
+static slot_t *
+index_slot (
+    struct resend *resend,
+    uint64_t key)
 {
-    assert (state);
+    int
+        mask = resend->index_cap - 1,
+        i = INDEX_HASH (key, resend->index_cap);
 
-    int rc, curr_key, prev_key;
-    rc = curr_key = prev_key = 0;
+    while (resend->index [i].key && resend->index [i].key != key) {
+        i = (i + 1) & mask;
+    }
 
-    sam_db_t *db = state->db;
+    return &resend->index [i];
+}
 
-    do {
-        // determine previous tombstone - if any
-        record_t *header;
-        sam_db_get_val (db, NULL, (void **) &header);
 
-        if (header->type == RECORD) {
-            prev_key = header->c.record.prev;
-        }
-        else if (header->type == RECORD_TOMBSTONE) {
-            prev_key = header->c.tombstone.prev;
+//  --------------------------------------------------------------------------
+/// Removes a key from the index. Succeeding entries are shifted back
+/// to close the gap, there are no tombstones.
+static void
+index_del (
+    struct resend *resend,
+    uint64_t key)
+{
+    slot_t *index = resend->index;
+    int
+        mask = resend->index_cap - 1,
+        i = index_slot (resend, key) - index,
+        j = i;
+
+    if (!index [i].key) {
+        return;
+    }
+
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!index [j].key) {
+            break;
         }
-        else if (header->type == RECORD_ACK) {
-            prev_key = 0;
+
+        // move the entry unless its home lies cyclically in (i, j]
+        int home = INDEX_HASH (index [j].key, resend->index_cap);
+        if ((i < j && (home <= i || j < home)) ||
+            (j < i && home <= i && j < home)) {
+
+            index [i] = index [j];
+            i = j;
         }
-        else {
-            sam_log_errorf ("unexpected record type: 0x%x", header->type);
-            assert (false);
+    }
+
+    index [i].key = 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Puts an entry to the provided position of the heap and updates
+/// the index accordingly.
+static void
+heap_set (
+    struct resend *resend,
+    int pos,
+    due_t entry)
+{
+    resend->heap [pos] = entry;
+    index_slot (resend, entry.key)->pos = pos;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Restores the heap property upwards from the provided position.
+/// Returns the new position of the entry.
+static int
+heap_up (
+    struct resend *resend,
+    int pos)
+{
+    due_t entry = resend->heap [pos];
+
+    while (pos) {
+        int parent = (pos - 1) / 2;
+        if (resend->heap [parent].ts <= entry.ts) {
+            break;
         }
 
-        sam_db_del (db);
+        heap_set (resend, pos, resend->heap [parent]);
+        pos = parent;
+    }
+
+    heap_set (resend, pos, entry);
+    return pos;
+}
 
-        // prepare next round
-        if (prev_key) {
-            curr_key = prev_key;
-            rc = sam_db_get (db, &prev_key);
 
-            if (rc != SAM_DB_OK) {
-                // either DB_NOTFOUND or an error, abort
-                // deletion regardless; errors are handled
-                // one level up via rc
-                prev_key = 0;
-            }
+//  --------------------------------------------------------------------------
+/// Restores the heap property downwards from the provided position.
+static void
+heap_down (
+    struct resend *resend,
+    int pos)
+{
+    due_t *heap = resend->heap;
+    due_t entry = heap [pos];
+
+    for (;;) {
+        int child = 2 * pos + 1;
+        if (resend->n <= child) {
+            break;
         }
 
-    } while (prev_key);
+        if (child + 1 < resend->n && heap [child + 1].ts < heap [child].ts) {
+            child += 1;
+        }
 
-    return rc;
+        if (entry.ts <= heap [child].ts) {
+            break;
+        }
+
+        heap_set (resend, pos, heap [child]);
+        pos = child;
+    }
+
+    heap_set (resend, pos, entry);
 }
 
 
 //  --------------------------------------------------------------------------
-/// Creates a new tombstone record.
-static int
-insert_tombstone (
+/// Removes the entry at the provided position from the heap.
+static void
+heap_remove (
+    struct resend *resend,
+    int pos)
+{
+    index_del (resend, resend->heap [pos].key);
+    resend->n -= 1;
+
+    if (pos < resend->n) {
+        resend->heap [pos] = resend->heap [resend->n];
+        index_slot (resend, resend->heap [pos].key)->pos = pos;
+        heap_down (resend, heap_up (resend, pos));
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+/// Grows the heap and rebuilds the index if another entry would
+/// exceed their capacity.
+static void
+heap_grow (
+    struct resend *resend)
+{
+    if (resend->n == resend->cap) {
+        resend->cap = (resend->cap)? 2 * resend->cap: 1024;
+        resend->heap = realloc (resend->heap, resend->cap * sizeof (due_t));
+        assert (resend->heap);
+    }
+
+    if (2 * (resend->n + 1) <= resend->index_cap) {
+        return;
+    }
+
+    resend->index_cap = (resend->index_cap)? 2 * resend->index_cap: 2048;
+    free (resend->index);
+    resend->index = calloc (resend->index_cap, sizeof (slot_t));
+    assert (resend->index);
+
+    for (int pos = 0; pos < resend->n; pos++) {
+        slot_t *slot = index_slot (resend, resend->heap [pos].key);
+        slot->key = resend->heap [pos].key;
+        slot->pos = pos;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+/// Schedules a record to be re-sent at the provided point in time. A
+/// record is scheduled only once, an earlier deadline gets replaced.
+static void
+schedule_resend (
     state_t *state,
-    int prev,
-    int *position)
+    uint64_t key,
+    uint64_t ts)
 {
-    sam_db_t *db = state->db;
+    struct resend *resend = &state->resend;
+    heap_grow (resend);
+
+    slot_t *slot = index_slot (resend, key);
+    if (slot->key) {
+        heap_remove (resend, slot->pos);
+        slot = index_slot (resend, key);
+    }
 
-    size_t size = sizeof (record_t);
-    int next = sam_db_get_key (db);
+    slot->key = key;
+    resend->heap [resend->n].ts = ts;
+    resend->heap [resend->n].key = key;
+    resend->n += 1;
+
+    heap_up (resend, resend->n - 1);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Removes the deadline of a deleted record from the heap.
+static void
+cancel_resend (
+    state_t *state,
+    uint64_t key)
+{
+    struct resend *resend = &state->resend;
+    if (!resend->n) {
+        return;
+    }
 
-    record_t tombstone;
-    memset (&tombstone, 0, size);
+    slot_t *slot = index_slot (resend, key);
+    if (slot->key) {
+        heap_remove (resend, slot->pos);
+    }
+}
 
-    sam_log_tracef ("creating tombstone: %d | %d", prev, *position, next);
 
-    tombstone.type = RECORD_TOMBSTONE;
-    tombstone.c.tombstone.prev = prev;
-    tombstone.c.tombstone.next = next;
+//  --------------------------------------------------------------------------
+/// Removes the earliest deadline from the heap if it is due. Returns
+/// -1 if no record is due.
+static int
+next_resend (
+    state_t *state,
+    uint64_t now,
+    uint64_t *key)
+{
+    struct resend *resend = &state->resend;
 
-    // write new key
-    sam_db_set_key (db, position);
-    state->tombstone_zone = *position;
+    if (!resend->n || now < resend->heap [0].ts) {
+        return -1;
+    }
 
-    // write new data
-    return sam_db_put (db, size, (void *) &tombstone);
+    *key = resend->heap [0].key;
+    heap_remove (resend, 0);
+    return 0;
 }
 
 
@@ -241,10 +680,11 @@ update_record_tries (
     header->c.record.tries -= 1;
 
     if (!header->c.record.tries) {
-        sam_log_tracef (
-            "discarding message '%d'", sam_db_get_key (state->db));
+        uint64_t key = sam_db_get_key (state->db);
+        sam_log_tracef ("discarding message '%" PRIu64 "'", key);
 
-        del (state);
+        cancel_resend (state, key);
+        sam_db_del (state->db);
 
         sam_stat (state->stat, "buf.discarded messages", 1);
         return -1;
@@ -255,82 +695,159 @@ update_record_tries (
 
 
 //  --------------------------------------------------------------------------
-/// Checks if the record is inside the bounds of messages to be re-sent.
+/// Sends the message of a record via the output channel, which takes
+/// over the callers reference. Backends that acknowledged the record
+/// and the excluded backend (if not 0) are not considered for
+/// distribution. The message is distributed with the strategy stored
+/// in the record, hedged and re-routed messages additionally carry
+/// the flag SAM_DIST_HEDGE or SAM_DIST_REROUTE.
 static int
-resend_condition (
+send_msg (
     state_t *state,
-    record_t *header)
+    uint64_t msg_id,
+    record_t *header,
+    sam_msg_t *msg,
+    int exclude,
+    int count,
+    int flag)
 {
-    assert (header);
+    int dist = header->c.record.dist | flag;
+
+    // wrap backend acknowledgments
+    size_t acks_size = header->c.record.acks_size;
+    if (exclude && acks_size < sam_gen_set_size (exclude)) {
+        acks_size = sam_gen_set_size (exclude);
+    }
+
+    zframe_t *id_frame = zframe_new (NULL, acks_size);
+    byte *be_acks = zframe_data (id_frame);
 
-    if (header->type == RECORD) {
-        int64_t eps = zclock_mono () - header->c.record.ts;
-        return ((int64_t) state->threshold < eps)? 0: -1;
+    memset (be_acks, 0, acks_size);
+    memcpy (be_acks, record_acks (header), header->c.record.acks_size);
+    if (exclude) {
+        sam_gen_set_add (be_acks, exclude);
     }
 
+    sam_log_tracef ("re-sending msg '%" PRIu64 "'", msg_id);
+    zsock_send (
+        state->out, "8fiip", msg_id, id_frame, count, dist, msg);
+
+    zframe_destroy (&id_frame);
     return 0;
 }
 
 
 //  --------------------------------------------------------------------------
-/// Takes a database record, reconstruct the message and sends a copy
-/// it via output channel.
-static int
-resend_message (
-    state_t *state)
+/// Reconstructs the message of a database record. The database only
+/// lends the record, the message is a copy. Returns NULL if the
+/// message can not be decoded.
+static sam_msg_t *
+decode_record (
+    record_t *header,
+    size_t record_size)
 {
-    record_t *header;
-    size_t record_size;
-    sam_db_t *db = state->db;
-
-    sam_db_get_val (db, &record_size, (void **) &header);
-    size_t header_size = sizeof (record_t);
+    size_t header_size = record_header_size (header);
 
-    // decode message
     size_t msg_size = record_size - header_size;
     byte *encoded_msg = (byte *) header + header_size;
     sam_msg_t *msg = sam_msg_decode (encoded_msg, msg_size);
     if (msg == NULL) {
         sam_log_error ("could not decode stored message");
+    }
+
+    return msg;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Takes a database record, reconstructs the message and sends it
+/// via the output channel (see send_msg).
+static int
+send_record (
+    state_t *state,
+    uint64_t msg_id,
+    record_t *header,
+    size_t record_size,
+    int exclude,
+    int count,
+    int flag)
+{
+    sam_msg_t *msg = decode_record (header, record_size);
+    if (msg == NULL) {
         return -1;
     }
 
-    // wrap backend acknowledgments
-    uint64_t be_acks = header->c.record.be_acks;
-    zframe_t *id_frame = zframe_new (&be_acks, sizeof (be_acks));
-    int msg_id = sam_db_get_key (db);
-    int count = header->c.record.acks_remaining;
+    return send_msg (state, msg_id, header, msg, exclude, count, flag);
+}
 
-    sam_log_tracef ("re-sending msg '%d'", msg_id);
-    zsock_send (state->out, "ifip", msg_id, id_frame, count, msg);
 
-    zframe_destroy (&id_frame);
-    return 0;
+//  --------------------------------------------------------------------------
+/// Takes the current database record, reconstruct the message and
+/// sends a copy it via output channel.
+static int
+resend_message (
+    state_t *state)
+{
+    record_t *header;
+    size_t record_size;
+    sam_db_t *db = state->db;
+
+    sam_db_get_val (db, &record_size, (void **) &header);
+    return send_record (
+        state, sam_db_get_key (db), header, record_size,
+        0, header->c.record.acks_remaining, 0);
 }
 
 
 //  --------------------------------------------------------------------------
-/// Determines how much space is needed to store a record in a
-/// continuous block of memory. If the sam_msg is null, just the space
-/// for the header is considered.
+/// Initializes the header of a fresh record based on a sam_msg
+/// enclosed publishing request.
 static void
-record_size (
-    size_t *total_size,
-    size_t *header_size,
+init_header (
+    state_t *state,
+    record_t *header,
+    int count,
+    sam_dist_t dist)
+{
+    header->type = RECORD;
+
+    header->c.record.acks_remaining = count;
+    header->c.record.acks_size = 0;
+    header->c.record.ts = zclock_mono ();
+    header->c.record.tries = state->tries;
+    header->c.record.dist = dist;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Writes a record consisting of the header and the encoded
+/// message. The message is not assembled beforehand, the storage
+/// engine gathers the header and the parts of the message.
+static int
+put_record (
+    state_t *state,
+    record_t *header,
     sam_msg_t *msg)
 {
-    *header_size = sizeof (record_t);
+    struct iovec local [PUT_PARTS], *parts = local;
 
-    if (msg) {
-        *total_size = *header_size + sam_msg_encoded_size (msg);
+    int part_c = 1 + sam_msg_encoded_parts (msg);
+    if (PUT_PARTS < part_c) {
+        parts = malloc (part_c * sizeof (struct iovec));
+        assert (parts);
     }
-    else {
-        *total_size = *header_size;
+
+    parts [0].iov_base = header;
+    parts [0].iov_len = record_header_size (header);
+    sam_msg_encode_parts (msg, parts + 1);
+
+    int rc = sam_db_putv (state->db, parts, part_c);
+
+    if (parts != local) {
+        free (parts);
     }
 
-    sam_log_tracef (
-        "determined record size: %d (header: %d)",
-        *total_size, *header_size);
+    return rc;
 }
 
 
@@ -341,40 +858,18 @@ static int
 create_record_store (
     state_t *state,
     sam_msg_t *msg,
-    int count)
+    int count,
+    sam_dist_t dist)
 {
-    size_t size, header_size;
-    record_size (&size, &header_size, msg);
-
-    byte *record;
-    record = malloc (size);
-    if (!record) {
-        return -1;
-    }
+    record_t header;
+    init_header (state, &header, count, dist);
 
-    sam_db_t *db = state->db;
     sam_log_tracef (
-        "creating record for msg '%d'", sam_db_get_key (db));
-
-    // set header data
-    record_t *header = (record_t *) record;
-    header->type = RECORD;
-    header->c.record.prev = 0;
-
-    header->c.record.acks_remaining = count;
-    header->c.record.be_acks = 0;
-    header->c.record.ts = zclock_mono ();
-    header->c.record.tries = state->tries;
-
-    // set content data
-    byte *content = record + header_size;
-    sam_msg_encode (msg, &content);
-
-    state->last_stored += 1;
-    sam_db_ret_t ret = sam_db_put (db, size, record);
+        "creating record for msg '%" PRIu64 "'",
+        sam_db_get_key (state->db));
 
-    free (record);
-    return ret;
+    state->last_stored = sam_db_get_key (state->db);
+    return put_record (state, &header, msg);
 }
 
 
@@ -387,43 +882,33 @@ static int
 update_record_store (
     state_t *state,
     sam_msg_t *msg,
-    int count)
+    int count,
+    sam_dist_t dist)
 {
     int rc = 0;
-    size_t total_size, header_size;
-    record_size (&total_size, &header_size, msg);
-
     sam_db_t *db = state->db;
 
     record_t *header;
-    sam_db_get_val (db, NULL, (void **) &header);
+    sam_db_edit (db, NULL, (void **) &header);
     assert (header->type == RECORD_ACK);
 
     sam_log_tracef (
         "ack already there, %d arrived already",
         header->c.record.acks_remaining * -1);
     header->c.record.acks_remaining += count;
+    header->c.record.dist = dist;
+    state->last_stored = sam_db_get_key (db);
 
     // remove if there are no outstanding acks
     if (!header->c.record.acks_remaining) {
-        rc = del (state);
+        cancel_resend (state, sam_db_get_key (db));
+        rc = sam_db_del (db);
     }
 
-    // add encoded message to the record
+    // add encoded message to the record, the edited
+    // header does not reside in the database
     else {
-        byte *record = malloc (total_size);
-        if (!record) {
-            return -1;
-        }
-
-        // copy header
-        byte
-            *header_cpy = memmove (record, header, header_size),
-            *content = record + header_size;
-
-        assert (header_cpy);
-        sam_msg_encode (msg, &content);
-        rc = sam_db_put (db, total_size, record);
+        rc = put_record (state, header, msg);
     }
 
     return rc;
@@ -436,18 +921,33 @@ update_record_store (
 static int
 create_record_ack (
     state_t *state,
-    uint64_t backend_id)
+    int backend_id)
 {
-    record_t record;
-    record.type = RECORD_ACK;
-    record.c.record.acks_remaining = -1;
-    record.c.record.be_acks = backend_id;
+    size_t
+        acks_size = sam_gen_set_size (backend_id),
+        size = sizeof (record_t) + acks_size;
 
-    sam_log_tracef (
-        "created record (ack) '%d'", sam_db_get_key (state->db));
+    record_t *record = calloc (1, size);
+    if (!record) {
+        return -1;
+    }
 
-    return sam_db_put (state->db, sizeof (record_t), (void *) &record);
-}
+    record->type = RECORD_ACK;
+    record->c.record.acks_remaining = -1;
+    record->c.record.acks_size = acks_size;
+    sam_gen_set_add (record_acks (record), backend_id);
+
+    uint64_t key = sam_db_get_key (state->db);
+    if (state->last_early < key) {
+        state->last_early = key;
+    }
+
+    sam_log_tracef ("created record (ack) '%" PRIu64 "'", key);
+
+    int rc = sam_db_put (state->db, size, (void *) record);
+    free (record);
+    return rc;
+}
 
 
 //  --------------------------------------------------------------------------
@@ -456,64 +956,54 @@ create_record_ack (
 /// already sent an acknowledgment (a highly unlikely case). If not,
 /// the backend gets added to the list of backends that already
 /// acknowledged the message. If enough backends confirmed, then the
-/// record and all its tombstones gets deleted. Otherwise it's updated.
+/// record gets deleted. Otherwise it's updated.
 static int
 update_record_ack (
     state_t *state,
-    uint64_t backend_id)
+    int backend_id)
 {
     sam_db_t *db = state->db;
     int rc = 0;
 
-    // skip all tombstones up to the record
     record_t *header;
-
     sam_db_get_val (db, NULL, (void **) &header);
-    while (header->type == RECORD_TOMBSTONE) {
-        int new_id = header->c.tombstone.next;
-        sam_log_tracef ("following tombstone chain to '%d'", new_id);
-        if (sam_db_get (db, &new_id)) {
-            return -1;
-        }
-
-        sam_db_get_val (db, NULL, (void **) &header);
-        if (new_id == header->c.tombstone.next) {
-
-            // TODO, was not able to reproduce this error occured when
-            // the daemon crashed with a lot of data in the
-            // database. Upon restart, data was malformed
-            sam_log_error ("malformed data, exiting.");
-            exit (2);
-
-        }
-    }
 
     // if ack arrives multiple times, do nothing
     // -> redundancy guarantee applies only to distinct acks
-    if (header->c.record.be_acks & backend_id) {
+    if (record_acked (header, backend_id)) {
         sam_log_trace ("backend already confirmed, ignoring ack");
         return rc;
     }
 
-    header->c.record.be_acks ^= backend_id;
+    size_t size;
+    sam_db_edit (db, &size, (void **) &header);
     header->c.record.acks_remaining -= 1;
 
 
     // enough acks arrived, delete record
     if (!header->c.record.acks_remaining) {
-        del (state);
+        cancel_resend (state, sam_db_get_key (db));
+        rc = sam_db_del (db);
     }
 
 
     // not enough acks, update record
     else {
         sam_log_tracef (
-            "updating '%d', acks remaining: %d",
+            "updating '%" PRIu64 "', acks remaining: %d",
             sam_db_get_key (db),
             header->c.record.acks_remaining);
 
         header->type = RECORD;
-        rc = sam_db_update (db, SAM_DB_CURRENT);
+        record_t *grown = record_add_ack (header, &size, backend_id);
+
+        if (grown) {
+            rc = sam_db_put (db, size, (byte *) grown);
+            free (grown);
+        }
+        else {
+            rc = sam_db_update (db, SAM_DB_CURRENT);
+        }
     }
 
     return rc;
@@ -521,361 +1011,1749 @@ update_record_ack (
 
 
 //  --------------------------------------------------------------------------
-/// Handles an acknowledgement. If there's already a record in the
-/// database, the record is updated or deleted based on the
-/// "remaining_acks" header field. If the encountered record is a tombstone,
-/// it's reference is followed until the record is found.
-///
-/// @see update_record_ack
-///
-/// If there's no record in the database, then the ack arrived before
-/// the save () finished. In this case a new record is created just
-/// containing meta information.
-///
-/// @see create_record_ack
-///
+/// Passes the messages of an asynchronous storage request on for
+/// distribution (or drops them, if they could not be persisted or the
+/// group was aborted) and hands out the receipt. Batches get a
+/// receipt per message: The receipts of their valid requests are 0,
+/// in order. Other requests fail as a whole.
+static void
+finish_pending (
+    state_t *state,
+    pending_t *pending,
+    bool abort)
+{
+    // empty backend set, no backend ack'd already
+    zframe_t *id_frame = zframe_new (NULL, 0);
+    int *receipts = pending->ret->receipts, r = 0;
+
+    for (int i = 0; i < pending->n; i++) {
+        uint64_t key = pending->keys [i];
+        sam_msg_t *msg = pending->msgs [i];
+
+        while (receipts && receipts [r]) {
+            r += 1;
+        }
+
+        if (!abort && key) {
+            sam_log_tracef ("send () message '%" PRIu64 "' internally", key);
+            zsock_send (
+                state->out, "8fiip", key, id_frame,
+                pending->counts [i], pending->dists [i], msg);
+        }
+
+        // release the reference meant for the sam actor
+        else {
+            sam_msg_destroy (&msg);
+
+            if (receipts) {
+                receipts [r] = -1;
+            }
+            else {
+                pending->ret->rc = -1;
+                pending->ret->msg = "could not persist request";
+            }
+        }
+
+        sam_msg_destroy (&msg);
+        r += 1;
+    }
+
+    zframe_destroy (&id_frame);
+
+    sam_log_trace ("send () receipt");
+    zsock_send (state->receipts, "pp", pending->tag, pending->ret);
+
+    free (pending->keys);
+    free (pending->msgs);
+    free (pending->counts);
+    free (pending->dists);
+    free (pending);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Either commits or aborts the currently open group. Afterwards, all
+/// asynchronous storage requests of the group are finished. Returns
+/// -1 if the group got aborted or could not be committed.
 static int
-handle_ack (
+group_end (
     state_t *state,
-    uint64_t backend_id,
-    int ack_id)
+    bool abort)
 {
-    sam_db_t *db = state->db;
+    if (!state->commit.open) {
+        return 0;
+    }
 
-    if (sam_db_begin (db)) {
+    if (state->commit.timer != -1) {
+        zloop_timer_end (state->loop, state->commit.timer);
+        state->commit.timer = -1;
+    }
+
+    sam_log_tracef (
+        "%s group of %d operation(s)",
+        (abort)? "aborting": "committing",
+        state->commit.ops);
+
+    if (sam_db_end (state->db, abort)) {
+        sam_log_error ("could not commit group");
+        abort = true;
+    }
+
+    state->commit.open = false;
+
+    if (!abort) {
+        sam_stat (state->stat, "buf.group commits", 1);
+    }
+
+    pending_t *pending = zlist_pop (state->commit.pending);
+    while (pending) {
+        finish_pending (state, pending, abort);
+        pending = zlist_pop (state->commit.pending);
+    }
+
+    return (abort)? -1: 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Commits the current group when its window elapsed.
+static int
+handle_commit (
+    zloop_t *loop UU,
+    int timer_id UU,
+    void *args)
+{
+    state_t *state = args;
+
+    // the timer is removed by zloop after firing once
+    state->commit.timer = -1;
+    group_end (state, false);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Opens a transaction if there is no open group yet and arms the
+/// window timer for the new group. Called before every operation to
+/// set a savepoint.
+static int
+group_begin (
+    state_t *state)
+{
+    if (!state->commit.open) {
+        if (sam_db_begin (state->db)) {
+            return -1;
+        }
+
+        state->commit.open = true;
+        state->commit.ops = 0;
+
+        if (state->commit.count > 1) {
+            state->commit.timer = zloop_timer (
+                state->loop, state->commit.window, 1, handle_commit, state);
+        }
+    }
+
+    sam_db_savepoint (state->db);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Discards a failed operation. The operations applied before belong
+/// to other requests and stay in the group. The whole group is
+/// aborted if the failed operation changed the database already or
+/// if the database failed. Returns -1 if the group got aborted.
+static int
+group_fail (
+    state_t *state)
+{
+    if (!state->commit.open) {
         return -1;
     }
 
-    int rc = sam_db_get (db, &ack_id);
+    if (sam_db_rewind (state->db)) {
+        group_end (state, true);
+        return -1;
+    }
 
-    // record already there, update data
-    if (rc == SAM_DB_OK) {
-        rc = update_record_ack (state, backend_id);
+    sam_log_error ("discarded a failed operation");
+    sam_stat (state->stat, "buf.failed operations", 1);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Accounts for a finished operation of the current group. A failed
+/// operation gets discarded (see group_fail). The group gets
+/// committed if it is full.
+static int
+group_op (
+    state_t *state,
+    int rc)
+{
+    state->commit.ops += 1;
+
+    if (rc) {
+        group_fail (state);
     }
 
-    // record not yet there, create db entry
-    else if (rc == SAM_DB_NOTFOUND) {
-        if (ack_id < state->last_stored) {
-            sam_log_tracef ("ignoring late ack '%d'", ack_id);
-            rc = 0;
+    if (state->commit.open && state->commit.ops >= state->commit.count) {
+        group_end (state, false);
+    }
+
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the staged record with the provided key or NULL.
+static staged_t *
+stage_find (
+    state_t *state,
+    uint64_t key)
+{
+    staged_t *list = state->stage.list;
+    int lo = state->stage.head, hi = state->stage.n;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (list [mid].key < key) {
+            lo = mid + 1;
         } else {
-            rc = create_record_ack (state, backend_id);
+            hi = mid;
         }
     }
 
-    else {
-        rc = -1;
+    if (lo < state->stage.n && list [lo].key == key) {
+        return &list [lo];
+    }
+
+    return NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Keeps a new record in memory instead of writing it to the
+/// database. Returns -1 if the record could not be staged.
+static int
+stage_record (
+    state_t *state,
+    uint64_t key,
+    sam_msg_t *msg,
+    int count,
+    sam_dist_t dist)
+{
+    struct stage *stage = &state->stage;
+
+    // keys must be ascending
+    if (stage->head < stage->n && key <= stage->list [stage->n - 1].key) {
+        return -1;
+    }
+
+    if (stage->n == stage->cap) {
+
+        // reuse the space of written records
+        if (stage->head) {
+            stage->n -= stage->head;
+            memmove (
+                stage->list, stage->list + stage->head,
+                stage->n * sizeof (staged_t));
+            stage->head = 0;
+        }
+
+        if (stage->n == stage->cap) {
+            stage->cap = (stage->cap)? 2 * stage->cap: 1024;
+            stage->list = realloc (
+                stage->list, stage->cap * sizeof (staged_t));
+            assert (stage->list);
+        }
+    }
+
+    staged_t *staged = &stage->list [stage->n];
+    staged->header = malloc (sizeof (record_t));
+    if (!staged->header) {
+        return -1;
+    }
+
+    init_header (state, staged->header, count, dist);
+    sam_msg_own (msg);
+    staged->msg = msg;
+    staged->size = sizeof (record_t) + sam_msg_encoded_size (msg);
+
+    sam_log_tracef ("staging record for msg '%" PRIu64 "'", key);
+
+    staged->key = key;
+    staged->ts = zclock_mono ();
+
+    stage->n += 1;
+    stage->used += staged->size;
+    state->last_stored = key;
+
+    sam_stat (state->stat, "buf.staged records", 1);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Releases a staged record, either because it got written or
+/// dropped.
+static void
+stage_release (
+    state_t *state,
+    staged_t *staged)
+{
+    state->stage.used -= staged->size;
+
+    free (staged->header);
+    staged->header = NULL;
+    sam_msg_destroy (&staged->msg);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Applies an acknowledgement to a staged record. Fully acknowledged
+/// records are dropped and never written to the database.
+static void
+stage_ack (
+    state_t *state,
+    staged_t *staged,
+    int backend_id)
+{
+    if (staged->header == NULL) {
+        sam_log_trace ("staged record already dropped, ignoring ack");
+        return;
+    }
+
+    record_t *header = staged->header;
+
+    // if ack arrives multiple times, do nothing
+    if (record_acked (header, backend_id)) {
+        sam_log_trace ("backend already confirmed, ignoring ack");
+        return;
+    }
+
+    header->c.record.acks_remaining -= 1;
+
+    if (!header->c.record.acks_remaining) {
+        sam_log_tracef ("dropping staged record '%" PRIu64 "'", staged->key);
+        cancel_resend (state, staged->key);
+        stage_release (state, staged);
+
+        sam_stat (state->stat, "buf.elided writes", 1);
+        return;
+    }
+
+    size_t
+        header_size = record_header_size (header),
+        size = header_size;
+
+    record_t *grown = record_add_ack (header, &size, backend_id);
+    if (grown) {
+        state->stage.used += size - header_size;
+        staged->size += size - header_size;
+
+        free (staged->header);
+        staged->header = grown;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+/// Writes staged records to the database in a single group. Only
+/// records staged longer than the delay are written, unless the
+/// memory limit is exceeded or all records are requested. No group
+/// is opened if all of them got dropped. The records are released
+/// only after the group got committed: If writing or committing
+/// fails, all of them stay staged and get written with the next
+/// flush.
+static int
+stage_flush (
+    state_t *state,
+    bool all)
+{
+    struct stage *stage = &state->stage;
+
+    uint64_t now = zclock_mono ();
+    size_t written = 0;
+    bool grouped = false;
+    int rc = 0, end = stage->head;
+
+    while (end < stage->n) {
+        staged_t *staged = &stage->list [end];
+
+        if (!all &&
+            stage->used - written <= stage->size &&
+            now < staged->ts + stage->delay) {
+            break;
+        }
+
+        if (staged->header) {
+            rc = group_begin (state);
+            if (rc) {
+                break;
+            }
+
+            grouped = true;
+
+            sam_log_tracef ("writing staged record '%" PRIu64 "'", staged->key);
+            sam_db_set_key (state->db, &staged->key);
+            rc = put_record (state, staged->header, staged->msg);
+            if (rc) {
+                break;
+            }
+
+            written += staged->size;
+        }
+
+        end += 1;
+    }
+
+    if (grouped && rc) {
+        group_fail (state);
+    }
+
+    // the records must be committed before they can be released
+    else if (grouped) {
+        rc = group_end (state, false);
+    }
+
+    if (rc) {
+        sam_log_error ("could not write staged records");
+        return rc;
+    }
+
+    while (stage->head < end) {
+        staged_t *staged = &stage->list [stage->head];
+
+        if (staged->header) {
+            stage_release (state, staged);
+            sam_stat (state->stat, "buf.written staged records", 1);
+        }
+
+        stage->head += 1;
+    }
+
+    if (stage->head == stage->n) {
+        stage->head = stage->n = 0;
+    }
+
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Writes records staged longer than the delay.
+static int
+handle_stage (
+    zloop_t *loop UU,
+    int timer_id UU,
+    void *args)
+{
+    stage_flush (args, false);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Starts tracking a message until its first confirmation.
+static void
+hedge_track (
+    state_t *state,
+    uint64_t key)
+{
+    struct hedge *hedge = &state->hedge;
+
+    // keys must be ascending
+    if (hedge->head < hedge->n && key <= hedge->list [hedge->n - 1].key) {
+        return;
     }
 
-    sam_db_end (db, (rc)? true: false);
-    return rc;
-}
+    if (hedge->n == hedge->cap) {
+
+        // reuse the space of entries no longer tracked
+        if (hedge->head) {
+            hedge->n -= hedge->head;
+            hedge->next -= hedge->head;
+            memmove (
+                hedge->list, hedge->list + hedge->head,
+                hedge->n * sizeof (flight_t));
+            hedge->head = 0;
+        }
+
+        if (hedge->n == hedge->cap) {
+            hedge->cap = (hedge->cap)? 2 * hedge->cap: 1024;
+            hedge->list = realloc (
+                hedge->list, hedge->cap * sizeof (flight_t));
+            assert (hedge->list);
+        }
+    }
+
+    hedge->list [hedge->n].key = key;
+    hedge->list [hedge->n].ts = zclock_mono ();
+    hedge->n += 1;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Compares two latencies, used to sort the samples.
+static int
+compare_latency (
+    const void *a,
+    const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Remembers a confirmation latency. The hedging delay is set to the
+/// configured percentile of the recent samples periodically.
+static void
+hedge_sample (
+    state_t *state,
+    uint64_t latency)
+{
+    struct hedge *hedge = &state->hedge;
+    hedge->samples [hedge->sampled % HEDGE_SAMPLES] = latency;
+    hedge->sampled += 1;
+
+    if (hedge->sampled % HEDGE_UPDATE) {
+        return;
+    }
+
+    int n = (hedge->sampled < HEDGE_SAMPLES)? hedge->sampled: HEDGE_SAMPLES;
+    uint64_t sorted [HEDGE_SAMPLES];
+
+    memcpy (sorted, hedge->samples, n * sizeof (uint64_t));
+    qsort (sorted, n, sizeof (uint64_t), compare_latency);
+
+    hedge->delay = sorted [(n - 1) * hedge->percentile / 100];
+    if (!hedge->delay) {
+        hedge->delay = 1;
+    }
+
+    sam_log_tracef ("hedging after %" PRIu64 "ms", hedge->delay);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Stops tracking a message. Its latency is sampled if it got
+/// confirmed.
+static void
+hedge_confirm (
+    state_t *state,
+    uint64_t key,
+    bool confirmed)
+{
+    struct hedge *hedge = &state->hedge;
+    int lo = hedge->head, hi = hedge->n;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (hedge->list [mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == hedge->n || hedge->list [lo].key != key) {
+        return;
+    }
+
+    flight_t *flight = &hedge->list [lo];
+    if (flight->ts && confirmed) {
+        hedge_sample (state, zclock_mono () - flight->ts);
+    }
+
+    flight->ts = 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Publishes a message to a second backend. The sam actor avoids the
+/// backend the message was published to before.
+static int
+hedge_record (
+    state_t *state,
+    uint64_t key)
+{
+    record_t *header;
+
+    // record is not yet written to the database
+    staged_t *staged = stage_find (state, key);
+    if (staged) {
+        if (staged->header == NULL) {
+            return 0;
+        }
+
+        sam_stat (state->stat, "buf.hedged messages", 1);
+        sam_msg_own (staged->msg);
+        return send_msg (
+            state, key, staged->header, staged->msg,
+            0, 1, SAM_DIST_HEDGE);
+    }
+
+    if (group_begin (state)) {
+        return -1;
+    }
+
+    int rc = sam_db_get (state->db, &key);
+    if (rc == SAM_DB_NOTFOUND) {
+        return group_op (state, 0);
+    }
+
+    if (rc) {
+        return group_op (state, -1);
+    }
+
+    size_t record_size;
+    sam_db_get_val (state->db, &record_size, (void **) &header);
+    if (header->type != RECORD) {
+        return group_op (state, 0);
+    }
+
+    sam_log_tracef ("hedging msg '%" PRIu64 "'", key);
+    sam_stat (state->stat, "buf.hedged messages", 1);
+
+    rc = send_record (
+        state, key, header, record_size,
+        0, 1, SAM_DIST_HEDGE);
+
+    return group_op (state, rc);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Hedges all messages not confirmed within the hedging delay.
+/// Messages are tracked until the retry threshold, unconfirmed ones
+/// are sampled with the threshold as their latency.
+static int
+handle_hedge (
+    zloop_t *loop UU,
+    int timer_id UU,
+    void *args)
+{
+    state_t *state = args;
+    struct hedge *hedge = &state->hedge;
+
+    uint64_t now = zclock_mono ();
+    int rc = 0;
+
+    while (!rc && hedge->delay && hedge->next < hedge->n) {
+        flight_t *flight = &hedge->list [hedge->next];
+        if (flight->ts && now < flight->ts + hedge->delay) {
+            break;
+        }
+
+        if (flight->ts) {
+            rc = hedge_record (state, flight->key);
+        }
+
+        hedge->next += 1;
+    }
+
+    while (hedge->head < hedge->n) {
+        flight_t *flight = &hedge->list [hedge->head];
+        if (flight->ts && now < flight->ts + state->threshold) {
+            break;
+        }
+
+        if (flight->ts) {
+            hedge_sample (state, state->threshold);
+        }
+
+        hedge->head += 1;
+    }
+
+    if (hedge->next < hedge->head) {
+        hedge->next = hedge->head;
+    }
+
+    if (hedge->head == hedge->n) {
+        hedge->head = hedge->next = hedge->n = 0;
+    }
+
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Handles an acknowledgement. If there's already a record in the
+/// database, the record is updated or deleted based on the
+/// "remaining_acks" header field.
+///
+/// @see update_record_ack
+///
+/// If there's no record in the database, then the ack arrived before
+/// the save () finished. In this case a new record is created just
+/// containing meta information.
+///
+/// @see create_record_ack
+///
+static int
+handle_ack (
+    state_t *state,
+    int backend_id,
+    uint64_t ack_id)
+{
+    sam_db_t *db = state->db;
+    hedge_confirm (state, ack_id, true);
+
+    // record is not yet written to the database
+    staged_t *staged = stage_find (state, ack_id);
+    if (staged) {
+        stage_ack (state, staged, backend_id);
+        return 0;
+    }
+
+    if (group_begin (state)) {
+        return -1;
+    }
+
+    int rc = sam_db_get (db, &ack_id);
+
+    // record already there, update data
+    if (rc == SAM_DB_OK) {
+        rc = update_record_ack (state, backend_id);
+    }
+
+    // record not yet there, create db entry unless the record got
+    // stored and deleted already (e.g. ack of a hedged copy)
+    else if (rc == SAM_DB_NOTFOUND) {
+        if (ack_id <= state->last_stored) {
+            sam_log_tracef ("ignoring late ack '%" PRIu64 "'", ack_id);
+            rc = 0;
+        } else {
+            rc = create_record_ack (state, backend_id);
+        }
+    }
+
+    else {
+        rc = -1;
+    }
+
+    return group_op (state, rc);
+}
+
+
+
+//  --------------------------------------------------------------------------
+/// Handles a negative acknowledgement: The backend could not take
+/// responsibility for the message. Instead of waiting for the
+/// threshold, the message is re-distributed immediately to another
+/// backend. Every re-distribution counts as a try, except when the
+/// backend lost its connection (failover).
+static int
+handle_nack (
+    state_t *state,
+    int backend_id,
+    uint64_t nack_id,
+    bool failover)
+{
+    sam_db_t *db = state->db;
+    record_t *header;
+
+    // re-routed, do not hedge
+    hedge_confirm (state, nack_id, false);
+
+    // record is not yet written to the database
+    staged_t *staged = stage_find (state, nack_id);
+    if (staged) {
+        if (staged->header == NULL) {
+            return 0;
+        }
+
+        header = staged->header;
+        if (!failover) {
+            header->c.record.tries -= 1;
+        }
+
+        if (!header->c.record.tries) {
+            sam_log_tracef ("discarding staged message '%" PRIu64 "'", nack_id);
+            cancel_resend (state, nack_id);
+            stage_release (state, staged);
+
+            sam_stat (state->stat, "buf.discarded messages", 1);
+            return 0;
+        }
+
+        sam_stat (state->stat, "buf.rerouted messages", 1);
+        sam_msg_own (staged->msg);
+        return send_msg (
+            state, nack_id, header, staged->msg,
+            backend_id, 1, SAM_DIST_REROUTE);
+    }
+
+    if (group_begin (state)) {
+        return -1;
+    }
+
+    int rc = sam_db_get (db, &nack_id);
+
+    // already acknowledged or discarded
+    if (rc == SAM_DB_NOTFOUND) {
+        return group_op (state, 0);
+    }
+
+    if (rc) {
+        return group_op (state, -1);
+    }
+
+    size_t record_size;
+    sam_db_get_val (db, &record_size, (void **) &header);
+    if (header->type != RECORD) {
+        return group_op (state, 0);
+    }
+
+    // decode before writing, a failure leaves the group intact
+    sam_msg_t *msg = decode_record (header, record_size);
+    if (msg == NULL) {
+        return group_op (state, -1);
+    }
+
+    if (!failover) {
+        sam_db_edit (db, NULL, (void **) &header);
+        if (update_record_tries (state, header)) {
+            sam_msg_destroy (&msg);
+            return group_op (state, 0);
+        }
+
+        rc = sam_db_update (db, SAM_DB_CURRENT);
+    }
+
+    if (rc) {
+        sam_msg_destroy (&msg);
+        return group_op (state, rc);
+    }
+
+    sam_db_get_val (db, NULL, (void **) &header);
+
+    sam_log_tracef ("re-routing msg '%" PRIu64 "'", nack_id);
+    sam_stat (state->stat, "buf.rerouted messages", 1);
+
+    rc = send_msg (
+        state, nack_id, header, msg, backend_id, 1, SAM_DIST_REROUTE);
+
+    return group_op (state, rc);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Writes a single message of a storage request to the database. Must
+/// be called inside a transaction.
+static int
+store_record (
+    state_t *state,
+    uint64_t msg_id,
+    sam_msg_t *msg,
+    int count,
+    sam_dist_t dist)
+{
+    sam_db_ret_t ret = sam_db_get (state->db, &msg_id);
+
+    // record already there (ack arrived early), update data (this is
+    // not possible with the current implementation, but I leave it
+    // for the future where the whole system may act more asynchronously)
+    if (ret == SAM_DB_OK) {
+        return update_record_store (state, msg, count, dist);
+    }
+
+    // record not yet there, create db entry
+    if (ret == SAM_DB_NOTFOUND) {
+        // key was already set by get ()
+        sam_stat (state->stat, "buf.created records", 1);
+        return create_record_store (state, msg, count, dist);
+    }
+
+    return -1;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Persists a single message of a storage request. Records which can
+/// not have a premature ack are staged if staging is enabled. Every
+/// message written to the database is an operation of its own: If it
+/// fails, only this message is discarded. Grouped is set if the
+/// current group contains messages of the request and reset if the
+/// group got aborted.
+static int
+store (
+    state_t *state,
+    uint64_t msg_id,
+    sam_msg_t *msg,
+    int count,
+    sam_dist_t dist,
+    bool *grouped)
+{
+    sam_log_tracef ("handling storage request for '%" PRIu64 "'", msg_id);
+    int rc = 0;
+
+    bool staged =
+        state->stage.delay &&
+        state->last_early < msg_id &&
+        !stage_record (state, msg_id, msg, count, dist);
+
+    // scheduled before writing: records deleted right away because
+    // all acks arrived early remove their deadline again
+    schedule_resend (state, msg_id, zclock_mono () + state->threshold);
+
+    if (!staged) {
+        rc = group_begin (state);
+
+        if (!rc) {
+            *grouped = true;
+            rc = store_record (state, msg_id, msg, count, dist);
+        }
+
+        if (rc && group_fail (state)) {
+            *grouped = false;
+        }
+    }
+
+    if (rc) {
+        cancel_resend (state, msg_id);
+    }
+
+    // single copy messages distributed round robin get hedged, the
+    // other strategies choose a backend deliberately
+    if (!rc &&
+        count == 1 &&
+        dist == SAM_DIST_ROUND_ROBIN &&
+        state->hedge.percentile) {
+
+        hedge_track (state, msg_id);
+    }
+
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Persists all messages of a storage request inside the current
+/// group. The messages get consecutive message ids assigned, keys is
+/// set to 0 for every message which could not be persisted. If the
+/// group gets aborted, the messages written to the database before
+/// are lost as well. Returns the number of messages which could not
+/// be persisted, grouped is set if the group contains messages of
+/// the request.
+static int
+store_request (
+    state_t *state,
+    int n,
+    sam_msg_t **msgs,
+    int *counts,
+    sam_dist_t *dists,
+    uint64_t *keys,
+    bool *grouped)
+{
+    uint64_t first_id = create_msg_id (state);
+    state->seq += n - 1;
+
+    int failed = 0;
+    *grouped = false;
+
+    for (int i = 0; i < n; i++) {
+        bool was_grouped = *grouped;
+        keys [i] = first_id + i;
+
+        if (!store (
+                state, keys [i], msgs [i], counts [i], dists [i], grouped)) {
+            continue;
+        }
+
+        keys [i] = 0;
+        failed += 1;
+
+        // only staged messages survived the abort
+        for (int j = 0; was_grouped && !*grouped && j < i; j++) {
+            if (keys [j] && !stage_find (state, keys [j])) {
+                cancel_resend (state, keys [j]);
+                keys [j] = 0;
+                failed += 1;
+            }
+        }
+    }
+
+    if (failed) {
+        sam_log_errorf ("could not persist %d message(s)", failed);
+    }
+
+    return failed;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Handles a request sent internally to save one or more messages to
+/// the store. All messages of a request are written inside the same
+/// group commit. The caller waits for the receipt: The actor works
+/// on its arrays, which are not copied. The receipt is the number of
+/// messages which could not be persisted, their keys are set to 0.
+static int
+handle_storage_req (
+    zloop_t *loop UU,
+    zsock_t *store_sock,
+    void *args)
+{
+    state_t *state = args;
+
+    int n;
+    sam_msg_t **msgs;
+    int *counts;
+    sam_dist_t *dists;
+    uint64_t *keys;
+
+    sam_log_trace ("recv () storage request");
+    zsock_recv (store_sock, "ipppp", &n, &msgs, &counts, &dists, &keys);
+    assert (n > 0);
+
+    bool grouped;
+    int failed = store_request (
+        state, n, msgs, counts, dists, keys, &grouped);
+
+    if (grouped) {
+        group_op (state, 0);
+    }
+
+    // release the references of the actor, the
+    // arrays must not be used after the receipt
+    for (int i = 0; i < n; i++) {
+        sam_msg_destroy (&msgs [i]);
+    }
+
+    zsock_send (store_sock, "i", failed);
+
+    if (state->stage.used > state->stage.size) {
+        stage_flush (state, false);
+    }
+
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Handles an asynchronous storage request. Other than synchronous
+/// requests, the messages are persisted before the receipt is handed
+/// out. Both the receipt and the distribution of the messages wait
+/// for the group commit.
+static int
+handle_storage_async_req (
+    zloop_t *loop UU,
+    zsock_t *store_async,
+    void *args)
+{
+    state_t *state = args;
+
+    int n;
+    sam_msg_t **msgs;
+    int *counts;
+    sam_dist_t *dists;
+    void *tag;
+    sam_ret_t *ret;
+
+    sam_log_trace ("recv () asynchronous storage request");
+    zsock_recv (
+        store_async, "ippppp", &n, &msgs, &counts, &dists, &tag, &ret);
+    assert (n > 0);
+
+    pending_t *pending = malloc (sizeof (pending_t));
+    assert (pending);
+
+    pending->n = n;
+    pending->keys = malloc (n * sizeof (uint64_t));
+    assert (pending->keys);
+
+    pending->msgs = msgs;
+    pending->counts = counts;
+    pending->dists = dists;
+    pending->tag = tag;
+    pending->ret = ret;
+
+    bool grouped;
+    store_request (
+        state, n, msgs, counts, dists, pending->keys, &grouped);
+
+    // wait for the group commit
+    if (grouped) {
+        zlist_append (state->commit.pending, pending);
+        group_op (state, 0);
+    }
+
+    // all messages are staged or failed, there is nothing to commit
+    else {
+        finish_pending (state, pending, false);
+    }
+
+    if (state->stage.used > state->stage.size) {
+        stage_flush (state, false);
+    }
+
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Demultiplexes (negative) acknowledgements arriving on the
+/// push/pull connection wiring the messaging backends to the
+/// buffer. A backend may confirm many messages at once: The third
+/// frame contains the keys of all confirmed messages. Messages of a
+/// backend that lost its connection are handed back as SAM_BE_LOST.
+///
+/// @see handle_ack
+/// @see handle_nack
+static int
+handle_backend_req (
+    zloop_t *loop UU,
+    zsock_t *pll,
+    void *args)
+{
+    state_t *state = args;
+    int rc = 0;
+
+    int type, be_id;
+    zframe_t *keys_frame;
+
+    zsock_recv (pll, "iif", &type, &be_id, &keys_frame);
+    assert (
+        type == SAM_BE_ACK || type == SAM_BE_NACK || type == SAM_BE_LOST);
+    assert (be_id > 0);
+    assert (keys_frame);
+
+    uint64_t *keys = (uint64_t *) zframe_data (keys_frame);
+    int n = zframe_size (keys_frame) / sizeof (uint64_t);
+
+    for (int i = 0; !rc && i < n; i++) {
+        sam_log_tracef (
+            "%s from '%d' for msg: '%" PRIu64 "'",
+            (type == SAM_BE_ACK)? "ack": "nack", be_id, keys [i]);
+
+        if (type == SAM_BE_ACK) {
+            rc = handle_ack (state, be_id, keys [i]);
+        } else {
+            rc = handle_nack (
+                state, be_id, keys [i], type == SAM_BE_LOST);
+        }
+    }
+
+    zframe_destroy (&keys_frame);
+    sam_stat (
+        state->stat, (type == SAM_BE_ACK)? "buf.acknowledgments":
+        (type == SAM_BE_NACK)? "buf.negative acknowledgments":
+        "buf.failovers", n);
+
+    return rc;
+}
+
+
+
+//  --------------------------------------------------------------------------
+/// Re-sends a single due record. The record keeps its key and gets
+/// scheduled again. Records that got acknowledged in the meantime
+/// are skipped, sent gets incremented otherwise.
+static int
+resend_record (
+    state_t *state,
+    uint64_t key,
+    uint64_t now,
+    int *sent)
+{
+    sam_db_t *db = state->db;
+
+    // not yet written, check again later
+    staged_t *staged = stage_find (state, key);
+    if (staged) {
+        if (staged->header) {
+            schedule_resend (state, key, now + state->interval);
+        }
+
+        return 0;
+    }
+
+    sam_db_ret_t rc = sam_db_get (db, &key);
+    if (rc == SAM_DB_NOTFOUND) {
+        return 0;
+    }
+
+    if (rc) {
+        return -1;
+    }
+
+    record_t *header;
+    sam_db_get_val (db, NULL, (void **) &header);
+    if (header->type != RECORD) {
+        return 0;
+    }
+
+    //  decrement tries
+    sam_db_edit (db, NULL, (void **) &header);
+    if (update_record_tries (state, header)) {
+        return 0;
+    }
+
+    header->c.record.ts = now;
+    if (sam_db_update (db, SAM_DB_CURRENT)) {
+        return -1;
+    }
+
+    //  resend message
+    //  use current dbop state to read the message
+    if (resend_message (state)) {
+        return -1;
+    }
+
+    schedule_resend (state, key, now + state->threshold);
+    sam_stat (state->stat, "buf.re-sent messages", 1);
+
+    *sent += 1;
+    return 0;
+}
+
+
+static int
+handle_resend_continue (zloop_t *loop, int timer_id, void *args);
+
+
+//  --------------------------------------------------------------------------
+/// Determines how many messages may be re-sent right now. The rate
+/// limit is a token bucket allowing bursts of up to one second.
+static int
+resend_budget (
+    state_t *state,
+    uint64_t now)
+{
+    struct resend *resend = &state->resend;
+    int budget = resend->budget;
+
+    if (resend->rate) {
+        resend->tokens += (double) (now - resend->last) * resend->rate / 1000;
+        if (resend->tokens > resend->rate) {
+            resend->tokens = resend->rate;
+        }
+
+        if (resend->tokens < budget) {
+            budget = (int) resend->tokens;
+        }
+    }
+
+    resend->last = now;
+    return budget;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Arms a timer to continue an interrupted resend cycle. If the rate
+/// limit was hit, the cycle continues as soon as the next message may
+/// be sent. Otherwise it continues with the next loop iteration,
+/// after pending requests and acknowledgements were handled.
+static void
+resend_continue (
+    state_t *state)
+{
+    struct resend *resend = &state->resend;
+
+    if (resend->timer != -1 ||
+        !resend->n ||
+        (uint64_t) zclock_mono () < resend->heap [0].ts) {
+        return;
+    }
+
+    uint64_t delay = 1;
+    if (resend->rate && resend->tokens < 1) {
+        delay = (uint64_t) ((1 - resend->tokens) * 1000 / resend->rate) + 1;
+    }
+
+    resend->timer = zloop_timer (
+        state->loop, delay, 1, handle_resend_continue, state);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Re-sends due messages until there are none left or the budget,
+/// rate or time slice of the cycle are exhausted. Every due record
+/// counts against the budget, even if it got skipped: Only the
+/// re-sent messages count against the rate. Interrupted cycles are
+/// continued later.
+static int
+resend_cycle (
+    state_t *state)
+{
+    struct resend *resend = &state->resend;
+    sam_db_t *db = state->db;
+
+    uint64_t now = zclock_mono ();
+    int budget = resend_budget (state, now);
+    uint64_t key;
+
+    if (budget <= 0 || next_resend (state, now, &key)) {
+        resend_continue (state);
+        return 0;
+    }
+
+    // resending works on committed data only
+    group_end (state, false);
+    if (sam_db_begin (db)) {
+        schedule_resend (state, key, now + state->interval);
+        return 0;
+    }
+
+    int rc = 0, sent = 0, handled = 0;
+    do {
+        rc = resend_record (state, key, now, &sent);
+        handled += 1;
+    } while (
+        !rc &&
+        handled < budget &&
+        (!resend->slice || (uint64_t) zclock_mono () < now + resend->slice) &&
+        !next_resend (state, now, &key));
+
+    // try again with the next cycle
+    if (rc) {
+        schedule_resend (state, key, now + state->interval);
+    }
+
+    if (resend->rate) {
+        resend->tokens -= sent;
+    }
+
+    sam_db_end (db, (rc)? true: false);
+    resend_continue (state);
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Checks in a fixed interval if messages need to be re-sent.
+static int
+handle_resend (
+    zloop_t *loop UU,
+    int timer_id UU,
+    void *args)
+{
+    sam_log_trace ("re-send cycle triggered");
+    return resend_cycle (args);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Continues an interrupted resend cycle.
+static int
+handle_resend_continue (
+    zloop_t *loop UU,
+    int timer_id UU,
+    void *args)
+{
+    state_t *state = args;
+
+    // the timer is removed by zloop after firing once
+    state->resend.timer = -1;
 
+    sam_log_trace ("re-send cycle continued");
+    return resend_cycle (state);
+}
 
 
 //  --------------------------------------------------------------------------
-/// Handles a request sent internally to save the message to the store.
-static int
-handle_storage_req (
-    zloop_t *loop UU,
-    zsock_t *store_sock,
+/// The internally started actor. Listens to storage requests and
+/// acknowledgments arriving from the backends.
+static void
+actor (
+    zsock_t *pipe,
     void *args)
 {
+    sam_log_info ("starting actor");
+
     state_t *state = args;
-    sam_db_t *db = state->db;
+    zloop_t *loop = zloop_new ();
+    state->loop = loop;
 
-    int count;
-    sam_msg_t *msg;
-    sam_log_trace ("recv () storage request");
-    zsock_recv (store_sock, "ip", &count, &msg);
+    zloop_reader (loop, state->store_sock, handle_storage_req, state);
+    zloop_reader (
+        loop, state->store_async, handle_storage_async_req, state);
+    zloop_reader (loop, state->in, handle_backend_req, state);
+    zloop_reader (loop, pipe, sam_gen_handle_pipe, NULL);
 
-    int msg_id = create_msg_id (state);
-    assert (msg_id >= 0);
-    sam_log_tracef ("handling storage request for '%d'", msg_id);
+    // is a uint64_t -> size_t conversion okay?
+    zloop_timer (loop, state->interval, 0, handle_resend, state);
 
-    // position of this call handles what guarantee
-    // is promised to the publishing client. See #66
-    zsock_send (store_sock, "i", msg_id);
+    if (state->stage.delay) {
+        uint64_t delay = state->stage.delay / 2;
+        zloop_timer (loop, (delay)? delay: 1, 0, handle_stage, state);
+    }
 
-    if (sam_db_begin (db)) {
-        return -1;
+    if (state->hedge.percentile) {
+        zloop_timer (loop, HEDGE_TICK, 0, handle_hedge, state);
     }
 
-    sam_db_ret_t ret = sam_db_get (db, &msg_id);
-    int rc = -1;
+    sam_log_info ("starting poll loop");
+    zsock_signal (pipe, 0);
+    zloop_start (loop);
 
-    // record already there (ack arrived early), update data (this is
-    // not possible with the current implementation, but I leave it
-    // for the future where the whole system may act more asynchronously)
-    if (ret == SAM_DB_OK) {
-        rc = update_record_store (state, msg, count);
-    }
+    // tear down
+    sam_log_trace ("destroying loop");
+    group_end (state, false);
+    stage_flush (state, true);
+
+    // records which could not be written are lost
+    struct stage *stage = &state->stage;
+    while (stage->head < stage->n) {
+        if (stage->list [stage->head].header) {
+            stage_release (state, &stage->list [stage->head]);
+        }
 
-    // record not yet there, create db entry
-    else if (ret == SAM_DB_NOTFOUND) {
-        // key was already set by get ()
-        rc = create_record_store (state, msg, count);
-        sam_stat (state->stat, "buf.created records", 1);
+        stage->head += 1;
     }
 
-    sam_db_end (db, (rc)? true: false);
-    sam_msg_destroy (&msg);
+    zloop_destroy (&loop);
+    zlist_destroy (&state->commit.pending);
+    free (state->stage.list);
+    free (state->resend.heap);
+    free (state->resend.index);
+    free (state->hedge.list);
+    free (state->hedge.samples);
 
-    return rc;
+    // database
+    sam_db_destroy (&state->db);
+
+    // clean up
+    zsock_destroy (&state->in);
+    zsock_destroy (&state->out);
+    zsock_destroy (&state->store_sock);
+    zsock_destroy (&state->store_async);
+    zsock_destroy (&state->receipts);
+
+    sam_stat_handle_destroy (&state->stat);
+
+    free (state);
 }
 
 
+
 //  --------------------------------------------------------------------------
-/// Demultiplexes acknowledgements arriving on the push/pull
-/// connection wiring the messaging backends to the buffer.
-///
-/// @see ack
-static int
-handle_backend_req (
-    zloop_t *loop UU,
-    zsock_t *pll,
-    void *args)
+/// Converts a record of format 0 to the current layout. Format 0
+/// stored the acknowledging backends as a mask of the ids 1 << n
+/// (n being the position in the configuration), these are converted
+/// to the ids n + 1 assigned today. Returns the new record or NULL if
+/// the record is malformed.
+static record_t *
+migrate_record (
+    record_v0_t *old,
+    size_t old_size,
+    size_t *size)
 {
-    state_t *state = args;
-    int rc = 0;
+    if (old_size < sizeof (record_v0_t) ||
+        (old->type != RECORD && old->type != RECORD_ACK)) {
+        return NULL;
+    }
 
-    zframe_t *id_frame;
-    uint64_t be_id = 0;
-    int msg_id = -1;
+    uint64_t be_acks = old->c.record.be_acks;
+    size_t acks_size = 0;
 
-    zsock_recv (pll, "fi", &id_frame, &msg_id);
-    be_id = *(uint64_t *) zframe_data (id_frame);
+    for (int n = 0; n < 64; n++) {
+        if (be_acks & ((uint64_t) 1 << n)) {
+            acks_size = sam_gen_set_size (n + 1);
+        }
+    }
 
-    assert (id_frame);
-    assert (be_id > 0);
-    assert (msg_id >= 0);
+    size_t payload_size = old_size - sizeof (record_v0_t);
+    *size = sizeof (record_t) + acks_size + payload_size;
 
-    zframe_destroy (&id_frame);
+    record_t *header = malloc (*size);
+    assert (header);
 
-    sam_log_tracef (
-        "ack from '%" PRIu64 "' for msg: '%d'",
-        be_id, msg_id);
+    memset (header, 0, sizeof (record_t) + acks_size);
+    header->type = old->type;
+    header->c.record.acks_size = acks_size;
+    header->c.record.acks_remaining = old->c.record.acks_remaining;
+    header->c.record.ts = zclock_mono ();
+    header->c.record.tries = old->c.record.tries;
 
-    rc = handle_ack (state, be_id, msg_id);
-    sam_stat (state->stat, "buf.acknowledgments", 1);
-    return rc;
-}
+    for (int n = 0; n < 64; n++) {
+        if (be_acks & ((uint64_t) 1 << n)) {
+            sam_gen_set_add (record_acks (header), n + 1);
+        }
+    }
+
+    memcpy (
+        record_acks (header) + acks_size, old + 1, payload_size);
 
+    return header;
+}
 
 
 //  --------------------------------------------------------------------------
-/// Checks in a fixed interval if messages need to be re-sent.
+/// Migrates all records of a database written without a format record
+/// (format 0) to the current layout. Tombstones get deleted. Must be
+/// called inside a transaction with the cursor at the first record.
 static int
-handle_resend (
-    zloop_t *loop UU,
-    int timer_id UU,
-    void *args)
+migrate (
+    state_t *state)
 {
-    sam_log_trace ("re-send cycle triggered");
-
-    state_t *state = args;
     sam_db_t *db = state->db;
 
-    sam_db_begin (db);
+    // the records get replaced, remember the keys beforehand
+    uint64_t *keys = NULL;
+    int key_c = 0, cap = 0;
 
-    int first_requeued_key = 0; // can never be zero
-    sam_db_ret_t rc = SAM_DB_NOTFOUND;
+    int rc = 0;
+    while (!rc) {
+        if (key_c == cap) {
+            cap = (cap)? 2 * cap: 1024;
+            keys = realloc (keys, cap * sizeof (uint64_t));
+            assert (keys);
+        }
 
+        keys [key_c] = sam_db_get_key (db);
+        key_c += 1;
 
-    // skip tombstones if there are any
-    if (state->tombstone_zone) {
-        rc = sam_db_get (db, &state->tombstone_zone);
-    } else {
         rc = sam_db_sibling (db, SAM_DB_NEXT);
     }
 
-
-    record_t *header;
-
-    if (!rc) {
-        sam_db_get_val (db, NULL, (void **) &header);
+    if (rc == SAM_DB_NOTFOUND) {
+        rc = 0;
     }
 
-
-    while (
-        !rc &&                                        // there's another item
-        !resend_condition (state, header) &&          // check threshold
-        first_requeued_key != sam_db_get_key (db)) {  // don't send requeued
-
-        int cur_id = sam_db_get_key (db);
-        sam_db_get_val (db, NULL, (void **) &header);
-
-        // if early acks are reached, no record can follow
-        if (header->type == RECORD_ACK) {
+    for (int i = 0; !rc && i < key_c; i++) {
+        rc = sam_db_get (db, &keys [i]);
+        if (rc) {
             break;
         }
 
+        size_t old_size, size;
+        record_v0_t *old;
+        sam_db_get_val (db, &old_size, (void **) &old);
+
+        if (old_size >= sizeof (record_v0_t) &&
+            old->type == RECORD_TOMBSTONE) {
 
-        // skip tombstones
-        if (header->type == RECORD_TOMBSTONE) {
-            rc = sam_db_sibling (db, SAM_DB_NEXT);
+            rc = sam_db_del (db);
             continue;
         }
 
+        record_t *header = migrate_record (old, old_size, &size);
+        if (header == NULL) {
+            sam_log_errorf (
+                "could not migrate malformed record %" PRIu64, keys [i]);
+            rc = -1;
+            break;
+        }
 
-        //  decrement tries
-        assert (header->type == RECORD);
-        if (update_record_tries (state, header)) {
-            rc = sam_db_sibling (db, SAM_DB_NEXT);
-            continue;
+        rc = sam_db_del (db);
+        if (!rc) {
+            sam_db_set_key (db, &keys [i]);
+            rc = sam_db_put (db, size, (byte *) header);
         }
 
+        free (header);
+    }
 
-        //  update record
-        //  cursor gets positioned to the new records location
-        int new_id = create_msg_id (state);
-        if (!first_requeued_key) {
-            first_requeued_key = new_id;
-        }
+    if (!rc) {
+        sam_log_infof ("migrated %d record(s) of format 0", key_c);
+    }
 
-        sam_db_set_key (db, &new_id);
+    free (keys);
+    return rc;
+}
 
-        int prev_id = header->c.record.prev;
-        header->c.record.ts = zclock_mono ();
-        header->c.record.prev = cur_id;
-        if (sam_db_update (db, SAM_DB_KEY)) {
-            rc = -1;
-            break;
+
+//  --------------------------------------------------------------------------
+/// Migrates all records of a database of format 2 in place. Format 2
+/// did not store the distribution strategy, the records get the
+/// configured default. Must be called inside a transaction with the
+/// cursor at the format record.
+static int
+migrate_dist (
+    state_t *state)
+{
+    sam_db_t *db = state->db;
+
+    // the format record gets updated last
+    uint64_t *keys = NULL;
+    int key_c = 0, cap = 0;
+
+    int rc = sam_db_sibling (db, SAM_DB_NEXT);
+    while (!rc) {
+        if (key_c == cap) {
+            cap = (cap)? 2 * cap: 1024;
+            keys = realloc (keys, cap * sizeof (uint64_t));
+            assert (keys);
         }
-        state->last_stored += 1;
-        sam_log_tracef (
-            "requeued message '%d' (formerly '%d')", new_id, cur_id);
 
+        keys [key_c] = sam_db_get_key (db);
+        key_c += 1;
 
-        //  resend message
-        //  use current dbop state to read the message
-        if (resend_message (state)) {
-            rc = -1;
+        rc = sam_db_sibling (db, SAM_DB_NEXT);
+    }
+
+    if (rc == SAM_DB_NOTFOUND) {
+        rc = 0;
+    }
+
+    for (int i = 0; !rc && i < key_c; i++) {
+        rc = sam_db_get (db, &keys [i]);
+        if (rc) {
             break;
         }
 
-        //  create tombstone
-        //  resets cursor position
-        if (insert_tombstone (state, prev_id, &cur_id)) {
+        size_t size;
+        record_t *header;
+        sam_db_edit (db, &size, (void **) &header);
+
+        if (size < sizeof (record_t) ||
+            (header->type != RECORD && header->type != RECORD_ACK)) {
+
+            sam_log_errorf (
+                "could not migrate malformed record %" PRIu64, keys [i]);
             rc = -1;
             break;
         }
 
-        sam_stat (state->stat, "buf.re-sent messages", 1);
-        rc = sam_db_sibling (db, SAM_DB_NEXT);
+        header->c.record.dist = SAM_DIST_DEFAULT;
+        rc = sam_db_update (db, SAM_DB_CURRENT);
     }
 
-    if (rc == SAM_DB_NOTFOUND) {
-        rc = 0;
+    free (keys);
+
+    uint64_t key = FORMAT_KEY;
+    if (!rc) {
+        rc = sam_db_get (db, &key);
+    }
+
+    if (!rc) {
+        record_t *header;
+        sam_db_edit (db, NULL, (void **) &header);
+        header->c.format.version = FORMAT_VERSION;
+        rc = sam_db_update (db, SAM_DB_CURRENT);
+    }
+
+    if (!rc) {
+        sam_log_infof ("migrated %d record(s) of format 2", key_c);
     }
 
-    sam_db_end (db, (rc)? true: false);
     return rc;
 }
 
 
 //  --------------------------------------------------------------------------
-/// The internally started actor. Listens to storage requests and
-/// acknowledgments arriving from the backends.
-static void
-actor (
-    zsock_t *pipe,
-    void *args)
+/// Checks if the records were written with the current layout. The
+/// format record is the first one of every database, it gets written
+/// to empty databases and after migrating databases of format 0.
+/// Databases of format 2 are migrated in place, databases of other
+/// versions are refused.
+static int
+check_format (
+    state_t *state)
 {
-    sam_log_info ("starting actor");
-
-    state_t *state = args;
-    zloop_t *loop = zloop_new ();
+    sam_db_t *db = state->db;
+    uint64_t key = FORMAT_KEY;
 
-    zloop_reader (loop, state->store_sock, handle_storage_req, state);
-    zloop_reader (loop, state->in, handle_backend_req, state);
-    zloop_reader (loop, pipe, sam_gen_handle_pipe, NULL);
+    int rc = sam_db_sibling (db, SAM_DB_NEXT);
+    if (!rc && sam_db_get_key (db) != FORMAT_KEY) {
+        rc = migrate (state);
+        if (!rc) {
+            rc = SAM_DB_NOTFOUND;
+        }
+    }
 
-    // is a uint64_t -> size_t conversion okay?
-    zloop_timer (loop, state->interval, 0, handle_resend, state);
+    if (rc == SAM_DB_NOTFOUND) {
+        record_t header;
+        memset (&header, 0, sizeof (record_t));
+        header.type = RECORD_FORMAT;
+        header.c.format.version = FORMAT_VERSION;
+
+        sam_log_infof ("initializing database format %d", FORMAT_VERSION);
+        sam_db_set_key (db, &key);
+        return sam_db_put (db, sizeof (record_t), (byte *) &header);
+    }
 
-    sam_log_info ("starting poll loop");
-    zsock_signal (pipe, 0);
-    zloop_start (loop);
+    if (rc) {
+        return -1;
+    }
 
-    // tear down
-    sam_log_trace ("destroying loop");
-    zloop_destroy (&loop);
+    record_t *header;
+    size_t size;
+    sam_db_get_val (db, &size, (void **) &header);
 
-    // database
-    sam_db_destroy (&state->db);
+    if (size != sizeof (record_t) || header->type != RECORD_FORMAT) {
+        sam_log_error ("the format record is malformed");
+        return -1;
+    }
 
-    // clean up
-    zsock_destroy (&state->in);
-    zsock_destroy (&state->out);
-    zsock_destroy (&state->store_sock);
+    if (header->c.format.version == 2) {
+        return migrate_dist (state);
+    }
 
-    sam_stat_handle_destroy (&state->stat);
+    if (header->c.format.version != FORMAT_VERSION) {
+        sam_log_errorf (
+            "unsupported database format %d, expected %d",
+            header->c.format.version, FORMAT_VERSION);
+        return -1;
+    }
 
-    free (state);
+    return 0;
 }
 
 
-
 //  --------------------------------------------------------------------------
 /// If records are saved in the db, the global sequence number and
-/// last_stored property must be set accordingly.
+/// last_stored property must be set accordingly. All stored messages
+/// are scheduled to be re-sent after the threshold.
 int
 sam_db_restore (
     state_t *state)
 {
     state->seq = 0;
     state->last_stored = 0;
-    state->tombstone_zone = 0;
+    state->last_early = 0;
 
     sam_db_t *db = state->db;
     if (sam_db_begin (db)) {
         return -1;
     }
 
-    int rc = sam_db_sibling (db, SAM_DB_PREV);
-    if (rc && rc == SAM_DB_NOTFOUND) {
-        rc = 0;
+    if (check_format (state)) {
+        sam_db_end (db, true);
+        return -1;
+    }
+
+    // all other records follow the format record
+    uint64_t format_key = FORMAT_KEY;
+    int rc = sam_db_get (db, &format_key);
+    if (!rc) {
+        rc = sam_db_sibling (db, SAM_DB_NEXT);
     }
 
-    // there are records in the db, update seq and last_stored
-    else if (!rc) {
-        state->seq = sam_db_get_key (db);
+    uint64_t due = zclock_mono () + state->threshold;
+
+    while (!rc) {
+        uint64_t key = sam_db_get_key (db);
+        state->seq = key;
+
         record_t *header;
         sam_db_get_val (db, NULL, (void **) &header);
 
         if (header->type == RECORD) {
-            state->last_stored = state->seq;
+            state->last_stored = key;
+            schedule_resend (state, key, due);
         }
-
-        // find RECORD with highest key
         else {
-            do {
-                rc = sam_db_sibling (db, SAM_DB_PREV);
-                if (rc == SAM_DB_NOTFOUND) {
-                    state->last_stored = 0;
-                    rc = 0;
-                    break;
-                }
-
-                else if (!rc) {
-                    sam_db_get_val (db, NULL, (void **) &header);
-                    if (header->type == RECORD) {
-                        state->last_stored = sam_db_get_key (db);
-                        break;
-                    }
-                }
-
-            } while (rc);
+            state->last_early = key;
         }
 
+        rc = sam_db_sibling (db, SAM_DB_NEXT);
+    }
+
+    if (rc == SAM_DB_NOTFOUND) {
+        rc = 0;
     }
 
     sam_db_end (db, (rc)? true: false);
 
     sam_log_infof (
-        "restored state; seq: %d, last_stored: %d",
-        state->seq, state->last_stored);
+        "restored state; seq: %" PRIu64 ", last_stored: %" PRIu64
+        ", scheduled: %d",
+        state->seq, state->last_stored, state->resend.n);
 
     return rc;
 }
@@ -887,18 +2765,33 @@ sam_buf_t *
 sam_buf_new (
     sam_cfg_t *cfg,
     zsock_t **in,
-    zsock_t **out)
+    zsock_t **out,
+    zsock_t **receipts)
 {
     assert (cfg);
     assert (*in);
     assert (*out);
+    assert (*receipts);
 
     char *actor_endpoint = "inproc://sam_buf";
+    char *actor_async_endpoint = "inproc://sam_buf_async";
     sam_buf_t *self = malloc (sizeof (sam_buf_t));
     state_t *state = malloc (sizeof (state_t));
 
     assert (self);
     assert (state);
+    state->db = NULL;
+
+    state->in = state->out = state->receipts = NULL;
+    state->store_sock = state->store_async = NULL;
+    self->store_sock = self->store_async = NULL;
+
+    state->resend.heap = NULL;
+    state->resend.n = state->resend.cap = 0;
+    state->resend.index = NULL;
+    state->resend.index_cap = 0;
+    state->hedge.list = NULL;
+    state->hedge.samples = NULL;
 
 
     if (sam_cfg_buf_retry_count (cfg, &state->tries) ||
@@ -909,11 +2802,84 @@ sam_buf_new (
         goto abort;
     }
 
-    // create db
+    // group commit, disabled by default
+    state->commit.window = 0;
+    state->commit.count = 1;
+
+    if (!sam_cfg_buf_commit_count (cfg, &state->commit.count) &&
+        state->commit.count > 1 &&
+        sam_cfg_buf_commit_window (cfg, &state->commit.window)) {
+
+        sam_log_error ("a commit count requires a commit window");
+        goto abort;
+    }
+
+    state->commit.ops = 0;
+    state->commit.open = false;
+    state->commit.timer = -1;
+
+    // write-behind staging, disabled by default
+    state->stage.delay = 0;
+    state->stage.size = STAGE_SIZE;
+    state->stage.used = 0;
+    state->stage.list = NULL;
+    state->stage.head = state->stage.n = state->stage.cap = 0;
+
+    if (!sam_cfg_buf_stage_delay (cfg, &state->stage.delay)) {
+        sam_cfg_buf_stage_size (cfg, &state->stage.size);
+
+        // staged records can not be re-sent
+        if (state->stage.delay >= state->threshold) {
+            sam_log_error ("the stage delay must be below the retry threshold");
+            goto abort;
+        }
+
+        sam_log_infof (
+            "staging records for up to %" PRIu64 "ms",
+            state->stage.delay);
+    }
+
+    // resend pacing, the rate limit is disabled by default
+    state->resend.budget = RESEND_BUDGET;
+    state->resend.slice = RESEND_SLICE;
+    state->resend.rate = 0;
+    state->resend.timer = -1;
+
+    sam_cfg_buf_retry_budget (cfg, &state->resend.budget);
+    sam_cfg_buf_retry_slice (cfg, &state->resend.slice);
+    sam_cfg_buf_retry_rate (cfg, &state->resend.rate);
+
+    state->resend.tokens = state->resend.rate;
+    state->resend.last = zclock_mono ();
+
+    // hedging, disabled by default
+    state->hedge.percentile = 0;
+    state->hedge.delay = 0;
+    state->hedge.head = state->hedge.next = 0;
+    state->hedge.n = state->hedge.cap = 0;
+    state->hedge.sampled = 0;
+
+    if (!sam_cfg_buf_hedge_percentile (cfg, &state->hedge.percentile)) {
+        if (state->hedge.percentile >= 100) {
+            sam_log_error ("the hedge percentile must be below 100");
+            goto abort;
+        }
+
+        state->hedge.samples = malloc (HEDGE_SAMPLES * sizeof (uint64_t));
+        assert (state->hedge.samples);
+
+        sam_log_infof (
+            "hedging at the %d. latency percentile",
+            state->hedge.percentile);
+    }
+
+    // create db, the engine is determined by the
+    // name of the first section below "db"
     zconfig_t *db_conf;
-    const char *db_conf_path = "db/bdb";
+    const char *db_conf_path = "db";
 
-    if (sam_cfg_get (cfg, db_conf_path, &db_conf)) {
+    if (sam_cfg_get (cfg, db_conf_path, &db_conf) ||
+        (db_conf = zconfig_child (db_conf)) == NULL) {
         sam_log_errorf ("could not load db config (%s)", db_conf_path);
         goto abort;
     }
@@ -930,6 +2896,8 @@ sam_buf_new (
     *in = NULL;
     state->out = *out;
     *out = NULL;
+    state->receipts = *receipts;
+    *receipts = NULL;
 
     // storage
     state->store_sock = zsock_new_rep (actor_endpoint);
@@ -938,12 +2906,19 @@ sam_buf_new (
     assert (state->store_sock);
     assert (self->store_sock);
 
+    state->store_async = zsock_new_pull (actor_async_endpoint);
+    self->store_async = zsock_new_push (actor_async_endpoint);
+
+    assert (state->store_async);
+    assert (self->store_async);
+
     // restore state
     if (sam_db_restore (state)) {
         goto abort;
     }
 
     state->stat = sam_stat_handle_new ();
+    state->commit.pending = zlist_new ();
 
     // spawn actor
     self->actor = zactor_new (actor, state);
@@ -956,6 +2931,18 @@ abort:
         sam_db_destroy (&state->db);
     }
 
+    zsock_destroy (&state->in);
+    zsock_destroy (&state->out);
+    zsock_destroy (&state->receipts);
+    zsock_destroy (&state->store_sock);
+    zsock_destroy (&state->store_async);
+    zsock_destroy (&self->store_sock);
+    zsock_destroy (&self->store_async);
+
+    free (state->resend.heap);
+    free (state->resend.index);
+    free (state->hedge.samples);
+
     free (self);
     free (state);
     return NULL;
@@ -972,6 +2959,7 @@ sam_buf_destroy (
     sam_log_info ("destroying buffer instance");
 
     zsock_destroy (&(*self)->store_sock);
+    zsock_destroy (&(*self)->store_async);
     zactor_destroy (&(*self)->actor);
 
     free (*self);
@@ -980,18 +2968,84 @@ sam_buf_destroy (
 
 
 //  --------------------------------------------------------------------------
-/// Save a message, get a message id as the receipt.
-int
+/// Save a message, get a message id as the receipt. Returns 0 if the
+/// message could not be persisted.
+uint64_t
 sam_buf_save (
     sam_buf_t *self,
     sam_msg_t *msg,
-    int count)
+    int count,
+    sam_dist_t dist)
 {
     assert (self);
-    zsock_send (self->store_sock, "ip", count, msg);
 
-    int msg_id;
-    zsock_recv (self->store_sock, "i", &msg_id);
+    uint64_t msg_id;
+    int failed;
+
+    zsock_send (
+        self->store_sock, "ipppp", 1, &msg, &count, &dist, &msg_id);
+    zsock_recv (self->store_sock, "i", &failed);
 
     return msg_id;
 }
+
+
+//  --------------------------------------------------------------------------
+/// Save n messages at once, get a message id per message as the
+/// receipt. The actor works on the arrays while waiting for the
+/// receipt, nothing gets copied. Returns the number of messages which
+/// could not be persisted, their keys are set to 0.
+int
+sam_buf_save_batch (
+    sam_buf_t *self,
+    int n,
+    sam_msg_t **msgs,
+    int *counts,
+    sam_dist_t *dists,
+    uint64_t *keys)
+{
+    assert (self);
+    assert (n > 0);
+
+    int failed;
+    zsock_send (self->store_sock, "ipppp", n, msgs, counts, dists, keys);
+    zsock_recv (self->store_sock, "i", &failed);
+
+    return failed;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Save n messages asynchronously. The arrays are copied, the actor
+/// takes ownership of the copies. As soon as the messages are
+/// persisted, the tag and return object are handed out via the
+/// receipts socket.
+void
+sam_buf_save_async (
+    sam_buf_t *self,
+    int n,
+    sam_msg_t **msgs,
+    int *counts,
+    sam_dist_t *dists,
+    void *tag,
+    sam_ret_t *ret)
+{
+    assert (self);
+    assert (n > 0);
+    assert (ret);
+
+    sam_msg_t **msgs_cpy = malloc (n * sizeof (sam_msg_t *));
+    int *counts_cpy = malloc (n * sizeof (int));
+    sam_dist_t *dists_cpy = malloc (n * sizeof (sam_dist_t));
+    assert (msgs_cpy);
+    assert (counts_cpy);
+    assert (dists_cpy);
+
+    memcpy (msgs_cpy, msgs, n * sizeof (sam_msg_t *));
+    memcpy (counts_cpy, counts, n * sizeof (int));
+    memcpy (dists_cpy, dists, n * sizeof (sam_dist_t));
+
+    zsock_send (
+        self->store_async, "ippppp",
+        n, msgs_cpy, counts_cpy, dists_cpy, tag, ret);
+}
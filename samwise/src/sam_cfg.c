@@ -302,6 +302,32 @@ sam_cfg_get (
 }
 
 
+//  --------------------------------------------------------------------------
+/// Converts a BINARY value without altering the provided string.
+int
+sam_cfg_binary_value (
+    const char *str,
+    uint64_t *value)
+{
+    assert (str);
+    assert (value);
+
+    char *size_str = strdup (str);
+    assert (size_str);
+
+    uint64_t rc = conv_binary_prefix (size_str);
+    free (size_str);
+
+    if (rc == 0) {
+        sam_log_errorf ("could not convert binary value '%s'", str);
+        return -1;
+    }
+
+    *value = rc;
+    return 0;
+}
+
+
 //  --------------------------------------------------------------------------
 /// Retrieve the maximum size of the buffer.
 int
@@ -379,6 +405,162 @@ sam_cfg_buf_retry_threshold (
 }
 
 
+//  --------------------------------------------------------------------------
+/// Retrieve the maximum time a group of storage operations may stay
+/// uncommitted.
+int
+sam_cfg_buf_commit_window (
+    sam_cfg_t *self,
+    uint64_t *window)
+{
+    assert (self);
+    assert (window);
+
+    return retrieve_time_value (
+        self, "buffer/commit/window", window);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Retrieve the maximum number of storage operations committed at once.
+int
+sam_cfg_buf_commit_count (
+    sam_cfg_t *self,
+    int *count)
+{
+    assert (self);
+    assert (count);
+
+    char *count_str = zconfig_resolve (
+        self->zcfg, "buffer/commit/count", NULL);
+
+    if (count_str != NULL && atoi (count_str) > 0) {
+        *count = atoi (count_str);
+        return 0;
+    }
+
+    sam_log_info ("could not load commit count");
+    return -1;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Retrieve a positive integer value.
+static int
+retrieve_count_value (
+    sam_cfg_t *self,
+    const char *path,
+    int *count)
+{
+    char *count_str = zconfig_resolve (self->zcfg, path, NULL);
+
+    if (count_str != NULL && atoi (count_str) > 0) {
+        *count = atoi (count_str);
+        return 0;
+    }
+
+    sam_log_infof ("could not load %s", path);
+    return -1;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Retrieve the maximum number of messages re-sent at once.
+int
+sam_cfg_buf_retry_budget (
+    sam_cfg_t *self,
+    int *budget)
+{
+    assert (self);
+    assert (budget);
+
+    return retrieve_count_value (self, "buffer/retry/budget", budget);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Retrieve the maximum time spent re-sending at once.
+int
+sam_cfg_buf_retry_slice (
+    sam_cfg_t *self,
+    uint64_t *slice)
+{
+    assert (self);
+    assert (slice);
+
+    return retrieve_time_value (
+        self, "buffer/retry/slice", slice);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Retrieve the maximum number of messages re-sent per second.
+int
+sam_cfg_buf_retry_rate (
+    sam_cfg_t *self,
+    int *rate)
+{
+    assert (self);
+    assert (rate);
+
+    return retrieve_count_value (self, "buffer/retry/rate", rate);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Retrieve the percentile of the confirmation latency after which
+/// round robin messages are published to a second backend.
+int
+sam_cfg_buf_hedge_percentile (
+    sam_cfg_t *self,
+    int *percentile)
+{
+    assert (self);
+    assert (percentile);
+
+    return retrieve_count_value (
+        self, "buffer/hedge/percentile", percentile);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Retrieve the maximum time new records are kept in memory.
+int
+sam_cfg_buf_stage_delay (
+    sam_cfg_t *self,
+    uint64_t *delay)
+{
+    assert (self);
+    assert (delay);
+
+    return retrieve_time_value (
+        self, "buffer/stage/delay", delay);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Retrieve the maximum memory of records kept in memory.
+int
+sam_cfg_buf_stage_size (
+    sam_cfg_t *self,
+    uint64_t *size)
+{
+    assert (self);
+    assert (size);
+
+    char *size_str = zconfig_resolve (
+        self->zcfg, "buffer/stage/size", NULL);
+
+    if (size_str != NULL && !sam_cfg_binary_value (size_str, size)) {
+        return 0;
+    }
+
+    sam_log_info ("could not load stage size");
+    return -1;
+}
+
+
+
 
 //  --------------------------------------------------------------------------
 /// Retrieve the public endpoint string. Used to bind a socket clients
@@ -401,6 +583,27 @@ sam_cfg_endpoint (
 }
 
 
+//  --------------------------------------------------------------------------
+/// Retrieve the optional asynchronous endpoint string. Used to bind a
+/// router socket clients can pipeline requests to.
+int
+sam_cfg_async_endpoint (
+    sam_cfg_t *self,
+    char **endpoint)
+{
+    assert (self);
+    char *val = zconfig_resolve (self->zcfg, "/async_endpoint", NULL);
+
+    if (val == NULL) {
+        sam_log_trace ("no asynchronous endpoint configured");
+        return -1;
+    }
+
+    *endpoint = val;
+    return 0;
+}
+
+
 //  --------------------------------------------------------------------------
 /// Retrieve the backend type. Used to determine what kind of
 /// messaging backend to spawn and what configuration to expect.
@@ -431,6 +634,29 @@ sam_cfg_be_type (
 }
 
 
+//  --------------------------------------------------------------------------
+/// Retrieve the name of the default distribution strategy. It applies
+/// to publishing requests asking for the "default" distribution and
+/// to messages re-sent by the buffer.
+int
+sam_cfg_be_distribution (
+    sam_cfg_t *self,
+    char **distribution)
+{
+    assert (self);
+    assert (distribution);
+
+    char *val = zconfig_resolve (self->zcfg, "backend/distribution", NULL);
+    if (val == NULL) {
+        sam_log_trace ("no default distribution configured");
+        return -1;
+    }
+
+    *distribution = val;
+    return 0;
+}
+
+
 //  --------------------------------------------------------------------------
 /// Load RabbitMQ specific configuration options used to spawn be_rmq
 /// instances.
@@ -491,6 +717,20 @@ read_backends_rmq (
         }
 
         be_opts->interval = conv_time_prefix (interval_str);
+
+        // optional
+        char *window_str = zconfig_resolve (cfg_ptr, "window", NULL);
+        be_opts->window = SAM_BE_RMQ_WINDOW;
+        if (window_str != NULL && atoi (window_str) > 0) {
+            be_opts->window = atoi (window_str);
+        }
+
+        char *weight_str = zconfig_resolve (cfg_ptr, "weight", NULL);
+        be_opts->weight = 1;
+        if (weight_str != NULL && atoi (weight_str) > 0) {
+            be_opts->weight = atoi (weight_str);
+        }
+
         cfg_ptr = zconfig_next (cfg_ptr);
     }
 
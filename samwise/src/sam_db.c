@@ -0,0 +1,310 @@
+/*  =========================================================================
+
+    sam_db - Storage system agnostic db interface
+
+    This Source Code Form is subject to the terms of the MIT
+    License. If a copy of the MIT License was not distributed with
+    this file, You can obtain one at http://opensource.org/licenses/MIT
+
+    =========================================================================
+*/
+/**
+
+   @brief Storage system agnostic db interface
+   @file sam_db.c
+
+   Selects a storage engine based on the configuration and forwards
+   all calls to it.
+
+   Savepoints allow to discard a failed operation without aborting
+   the whole transaction. None of the engines supports nested
+   transactions and copying every change to be able to replay it is
+   too expensive: Operations validate their input before writing
+   anything. Rewinding to the savepoint succeeds as long as no change
+   was attempted and the engine did not fail since then, there is
+   nothing to discard in this case. Otherwise, the transaction must
+   be aborted.
+
+
+*/
+
+
+#include "../include/sam_prelude.h"
+
+
+/// all supported storage engines
+static const sam_db_engine_t *engines [] = {
+    &sam_db_bdb,
+    &sam_db_lmdb,
+    &sam_db_log,
+    NULL
+};
+
+
+/// engine and its state
+struct sam_db_t {
+    const sam_db_engine_t *engine;  ///< engine implementation
+    void *state;                    ///< engine specific state
+
+    /// state of the current transaction since the latest savepoint
+    struct savepoint {
+        bool set;           ///< a savepoint was set
+        bool dirty;         ///< a change was attempted or the engine failed
+    } savepoint;
+};
+
+
+
+//  --------------------------------------------------------------------------
+/// Determines the engine by the configuration sections name and
+/// opens the database.
+sam_db_t *
+sam_db_new (
+    zconfig_t *conf)
+{
+    assert (conf);
+
+    const char *name = zconfig_name (conf);
+    const sam_db_engine_t **engine = engines;
+
+    while (*engine && strcmp ((*engine)->name, name)) {
+        engine += 1;
+    }
+
+    if (*engine == NULL) {
+        sam_log_errorf ("unknown storage engine '%s'", name);
+        return NULL;
+    }
+
+    void *state = (*engine)->new (conf);
+    if (state == NULL) {
+        return NULL;
+    }
+
+    sam_db_t *self = malloc (sizeof (sam_db_t));
+    assert (self);
+
+    self->engine = *engine;
+    self->state = state;
+
+    self->savepoint.set = self->savepoint.dirty = false;
+
+    sam_log_infof ("using storage engine '%s'", name);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Remembers that the transaction changed since the latest savepoint
+/// or that the engine failed. Returns the provided status code.
+static sam_db_ret_t
+dirty (
+    sam_db_t *self,
+    bool changed,
+    sam_db_ret_t ret)
+{
+    if (changed || ret == SAM_DB_ERROR) {
+        self->savepoint.dirty = true;
+    }
+
+    return ret;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Closes the database.
+void
+sam_db_destroy (
+    sam_db_t **self)
+{
+    assert (*self);
+
+    (*self)->engine->destroy (&(*self)->state);
+    free (*self);
+    *self = NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Begin a series of database operations.
+sam_db_ret_t
+sam_db_begin (
+    sam_db_t *self)
+{
+    return self->engine->begin (self->state);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Either commit or abort the current series of operations.
+sam_db_ret_t
+sam_db_end (
+    sam_db_t *self,
+    bool abort)
+{
+    self->savepoint.set = self->savepoint.dirty = false;
+    return self->engine->end (self->state, abort);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Marks the current state of the transaction. The following
+/// operation may be discarded as long as it does not change anything.
+void
+sam_db_savepoint (
+    sam_db_t *self)
+{
+    self->savepoint.set = true;
+    self->savepoint.dirty = false;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Discards the operation started at the latest savepoint. Fails if
+/// there is no savepoint, if a change was attempted or if the engine
+/// failed since then: The transaction must be aborted in this case.
+sam_db_ret_t
+sam_db_rewind (
+    sam_db_t *self)
+{
+    if (!self->savepoint.set || self->savepoint.dirty) {
+        return SAM_DB_ERROR;
+    }
+
+    sam_log_trace ("rewinding, nothing to discard");
+    return SAM_DB_OK;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the key of the current record.
+uint64_t
+sam_db_get_key (
+    sam_db_t *self)
+{
+    return self->engine->get_key (self->state);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Sets the key of the current record.
+void
+sam_db_set_key (
+    sam_db_t *self,
+    uint64_t *key)
+{
+    self->engine->set_key (self->state, key);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Return the (read only) value of the current record.
+void
+sam_db_get_val (
+    sam_db_t *self,
+    size_t *size,
+    void **record)
+{
+    self->engine->get_val (self->state, size, record);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Return a writable version of the current record.
+void
+sam_db_edit (
+    sam_db_t *self,
+    size_t *size,
+    void **record)
+{
+    self->engine->edit (self->state, size, record);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Position the cursor on the record with the provided key.
+sam_db_ret_t
+sam_db_get (
+    sam_db_t *self,
+    uint64_t *key)
+{
+    return dirty (self, false, self->engine->get (self->state, key));
+}
+
+
+//  --------------------------------------------------------------------------
+/// Position the cursor on the previous or next record.
+sam_db_ret_t
+sam_db_sibling (
+    sam_db_t *self,
+    sam_db_flag_t trav)
+{
+    return dirty (self, false, self->engine->sibling (self->state, trav));
+}
+
+
+//  --------------------------------------------------------------------------
+/// Insert a record.
+sam_db_ret_t
+sam_db_put (
+    sam_db_t *self,
+    size_t size,
+    byte *record)
+{
+    return dirty (self, true, self->engine->put (self->state, size, record));
+}
+
+
+//  --------------------------------------------------------------------------
+/// Insert a record consisting of several parts. Engines able to
+/// write them directly avoid concatenating them first.
+sam_db_ret_t
+sam_db_putv (
+    sam_db_t *self,
+    struct iovec *parts,
+    int part_c)
+{
+    if (self->engine->putv) {
+        return dirty (
+            self, true, self->engine->putv (self->state, parts, part_c));
+    }
+
+    size_t size = 0;
+    for (int i = 0; i < part_c; i++) {
+        size += parts [i].iov_len;
+    }
+
+    byte *record = malloc (size);
+    assert (record);
+
+    byte *dest = record;
+    for (int i = 0; i < part_c; i++) {
+        memcpy (dest, parts [i].iov_base, parts [i].iov_len);
+        dest += parts [i].iov_len;
+    }
+
+    sam_db_ret_t ret = sam_db_put (self, size, record);
+    free (record);
+    return ret;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Write back the current record.
+sam_db_ret_t
+sam_db_update (
+    sam_db_t *self,
+    sam_db_flag_t flag)
+{
+    return dirty (self, true, self->engine->update (self->state, flag));
+}
+
+
+//  --------------------------------------------------------------------------
+/// Delete the current record.
+sam_db_ret_t
+sam_db_del (
+    sam_db_t *self)
+{
+    return dirty (self, true, self->engine->del (self->state));
+}
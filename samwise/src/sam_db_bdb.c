@@ -11,10 +11,16 @@
 /**
 
    @brief BerkeleyDB storage
-   @file sam_buf.c
+   @file sam_db_bdb.c
 
    Uses the BerkeleyDB b+tree storage engine to persist messages.
 
+   Keys are 64 bit wide. Databases written by former versions use
+   int keys: When the database gets opened, every such record is
+   deleted and put again with a 64 bit key. The comparator orders
+   both key sizes alike, so the records keep their position and the
+   conversion happens in place within a single transaction.
+
 
 */
 
@@ -23,7 +29,7 @@
 
 
 /// all database related stuff
-struct sam_db_t {
+typedef struct sam_db_bdb_t {
     bool txn;          ///< transactions enabled?
 
     DB_ENV *env;       ///< database environment
@@ -37,11 +43,10 @@ struct sam_db_t {
         DBT val;       ///< buffer for the records data
     } op;
 
-};
+} sam_db_bdb_t;
 
 
 
-#define DBOP_SIZE sizeof (sam_db_t.op)
 #define DBT_SIZE sizeof (DBT)
 
 
@@ -50,7 +55,7 @@ struct sam_db_t {
 /// Returns the current size of the database. This is an expensive operation.
 static void
 stat_db_size (
-    sam_db_t *self)
+    sam_db_bdb_t *self)
 {
     DB_BTREE_STAT *statp;
     self->dbp->stat (self->dbp, NULL, &statp, 0);
@@ -61,7 +66,7 @@ stat_db_size (
 
 /*
 static void
-PRINT_DB_INFO (sam_db_t *self)
+PRINT_DB_INFO (sam_db_bdb_t *self)
 {
     stat_db_size (self);
 
@@ -74,7 +79,7 @@ PRINT_DB_INFO (sam_db_t *self)
     DBC *cursor;
     self->dbp->cursor (self->dbp, NULL, &cursor, 0);
     while (!cursor->get (cursor, &key, &data, DB_NEXT)) {
-        printf ("%d - ", *(int *) key.data);
+        printf ("%" PRIu64 " - ", read_key (&key));
     }
 
     cursor->close (cursor);
@@ -83,18 +88,35 @@ PRINT_DB_INFO (sam_db_t *self)
 */
 
 
+//  --------------------------------------------------------------------------
+/// Reads a key, which is an int for records of former versions.
+static uint64_t
+read_key (
+    const DBT *key)
+{
+    if (key->size == sizeof (int)) {
+        return *(int *) key->data;
+    }
+
+    assert (key->size == sizeof (uint64_t));
+    return *(uint64_t *) key->data;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Orders the records by their keys.
 static int
-bt_compare_int (
+bt_compare_key (
     DB *dbp UU,
     const DBT *a,
     const DBT *b,
     size_t *size UU)
 {
-    int
-        ai = *(int *) a->data,
-        bi = *(int *) b->data;
+    uint64_t
+        ak = read_key (a),
+        bk = read_key (b);
 
-    return ai - bi;
+    return (ak > bk) - (ak < bk);
 }
 
 
@@ -114,7 +136,7 @@ db_error_handler (
 /// Resets the current state.
 static void
 clear_op (
-    sam_db_t *self)
+    sam_db_bdb_t *self)
 {
     self->op.txn = NULL;
     self->op.cursor = NULL;
@@ -130,11 +152,116 @@ clear_op (
 }
 
 
+//  --------------------------------------------------------------------------
+/// Close (partially) initialized database and environment.
+static void
+close_db (
+    sam_db_bdb_t *self)
+{
+    int rc = 0;
+
+    if (self->dbp) {
+        stat_db_size (self);
+        rc = self->dbp->close (self->dbp, 0);
+        if (rc) {
+            sam_log_errorf (
+                "could not safely close db: %s",
+                db_strerror (rc));
+        }
+    }
+
+    if (self->env) {
+        rc = self->env->close (self->env, 0);
+        if (rc) {
+            sam_log_errorf (
+                "could not safely close db environment: %s",
+                db_strerror (rc));
+        }
+    }
+
+    free (self);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Rewrites all records of a database written with int keys using
+/// 64 bit keys (see the file header).
+static int
+migrate (
+    sam_db_bdb_t *self)
+{
+    DB_TXN *txn = NULL;
+    if (self->txn) {
+        int rc = self->env->txn_begin (self->env, NULL, &txn, 0);
+        if (rc) {
+            return rc;
+        }
+    }
+
+    DBC *cursor = NULL;
+    int rc = self->dbp->cursor (self->dbp, txn, &cursor, 0);
+
+    DBT key, val;
+    memset (&key, 0, DBT_SIZE);
+    memset (&val, 0, DBT_SIZE);
+
+    int record_c = 0;
+    while (!rc) {
+        rc = cursor->get (cursor, &key, &val, DB_NEXT);
+        if (rc || key.size == sizeof (uint64_t)) {
+            continue;
+        }
+
+        // the data is owned by the cursor
+        uint64_t id = read_key (&key);
+        DBT new_key, new_val;
+        memset (&new_key, 0, DBT_SIZE);
+        memset (&new_val, 0, DBT_SIZE);
+
+        new_key.data = &id;
+        new_key.size = sizeof (id);
+        new_val.size = val.size;
+        new_val.data = malloc (val.size);
+        assert (new_val.data);
+        memcpy (new_val.data, val.data, val.size);
+
+        rc = cursor->del (cursor, 0);
+        if (!rc) {
+            rc = cursor->put (cursor, &new_key, &new_val, DB_KEYFIRST);
+        }
+
+        free (new_val.data);
+        record_c += 1;
+    }
+
+    if (cursor) {
+        cursor->close (cursor);
+    }
+
+    if (rc == DB_NOTFOUND) {
+        rc = 0;
+    }
+
+    if (txn && rc) {
+        txn->abort (txn);
+    }
+    else if (txn) {
+        rc = txn->commit (txn, 0);
+    }
+
+    if (!rc && record_c) {
+        sam_log_infof ("migrated %d record(s) to 64 bit keys", record_c);
+    }
+
+    return rc;
+}
+
+
 //  --------------------------------------------------------------------------
 /// Creates an environment, initializes the logging and locking and
 /// (re-)opens the database.
-sam_db_t *
-sam_db_new (
+static void *
+bdb_new (
     zconfig_t *conf)
 {
     char
@@ -147,10 +274,13 @@ sam_db_new (
         return NULL;
     }
 
-    sam_db_t *self = malloc (sizeof (sam_db_t));
+    sam_db_bdb_t *self = malloc (sizeof (sam_db_bdb_t));
     assert (self);
     clear_op (self);
 
+    self->env = NULL;
+    self->dbp = NULL;
+
 
     // initialize the environment
     uint32_t env_flags =
@@ -165,6 +295,7 @@ sam_db_new (
         sam_log_errorf (
             "could not create db environment: %s",
             db_strerror (rc));
+        close_db (self);
         return NULL;
     }
 
@@ -173,7 +304,7 @@ sam_db_new (
         sam_log_errorf (
             "could not open db environment: %s",
             db_strerror (rc));
-        sam_db_destroy (&self);
+        close_db (self);
         return NULL;
     }
 
@@ -195,11 +326,11 @@ sam_db_new (
     rc = db_create (&self->dbp, self->env, 0);
     if (rc) {
         self->env->err (self->env, rc, "database creation failed");
-        sam_db_destroy (&self);
+        close_db (self);
         return NULL;
     }
 
-    self->dbp->set_bt_compare (self->dbp, bt_compare_int);
+    self->dbp->set_bt_compare (self->dbp, bt_compare_key);
 
     rc = self->dbp->open (
         self->dbp,
@@ -212,7 +343,14 @@ sam_db_new (
 
     if (rc) {
         self->env->err (self->env, rc, "database open failed");
-        sam_db_destroy (&self);
+        close_db (self);
+        return NULL;
+    }
+
+    rc = migrate (self);
+    if (rc) {
+        self->env->err (self->env, rc, "key conversion failed");
+        close_db (self);
         return NULL;
     }
 
@@ -223,48 +361,27 @@ sam_db_new (
 
 
 //  --------------------------------------------------------------------------
-/// Close (partially) initialized database and environment.
-void
-sam_db_destroy (
-    sam_db_t **self)
+/// Destroy the engine state.
+static void
+bdb_destroy (
+    void **db)
 {
-    int rc = 0;
-    sam_db_t *db = *self;
-
-
-    if (db->dbp) {
-        stat_db_size (db);
-        rc = db->dbp->close (db->dbp, 0);
-        if (rc) {
-            sam_log_errorf (
-                "could not safely close db: %s",
-                db_strerror (rc));
-        }
-    }
-
-    if (db->env) {
-        rc = db->env->close (db->env, 0);
-        if (rc) {
-            sam_log_errorf (
-                "could not safely close db environment: %s",
-                db_strerror (rc));
-        }
-    }
-
-
-    free (*self);
-    *self = NULL;
+    close_db (*db);
+    *db = NULL;
 }
 
 
 //  --------------------------------------------------------------------------
 /// Close the database cursor and end the transaction based on the
 /// abort parameter: Either commit or abort.
-void
-sam_db_end (
-    sam_db_t *self,
+static sam_db_ret_t
+bdb_end (
+    void *db,
     bool abort)
 {
+    sam_db_bdb_t *self = db;
+    sam_db_ret_t ret = SAM_DB_OK;
+
     // handle cursor
     if (self->op.cursor != NULL) {
         self->op.cursor->close (self->op.cursor);
@@ -282,20 +399,24 @@ sam_db_end (
             int rc = self->op.txn->commit (self->op.txn, 0);
             if (rc) {
                 self->env->err (self->env, rc, "transaction failed");
+                ret = SAM_DB_ERROR;
             }
         }
     }
 
     clear_op (self);
+    return ret;
 }
 
 
 //  --------------------------------------------------------------------------
 /// Create a database cursor and transaction handle.
-sam_db_ret_t
-sam_db_begin (
-    sam_db_t *self)
+static sam_db_ret_t
+bdb_begin (
+    void *db)
 {
+    sam_db_bdb_t *self = db;
+
     assert (self->op.txn == NULL);
     assert (self->op.cursor == NULL);
 
@@ -318,7 +439,7 @@ sam_db_begin (
     self->dbp->cursor (self->dbp, self->op.txn, &self->op.cursor, 0);
     if (self->op.cursor == NULL) {
         sam_log_error ("could not initialize cursor");
-        sam_db_end (self, true);
+        bdb_end (self, true);
         return SAM_DB_ERROR;
     }
 
@@ -328,36 +449,42 @@ sam_db_begin (
 
 //  --------------------------------------------------------------------------
 /// Returns the key of the current op-state.
-int
-sam_db_get_key (
-    sam_db_t *self)
+static uint64_t
+bdb_get_key (
+    void *db)
 {
+    sam_db_bdb_t *self = db;
+
     assert (self->op.key.data);
-    return *(int *) self->op.key.data;
+    return read_key (&self->op.key);
 }
 
 
 //  --------------------------------------------------------------------------
 /// Sets the key of the current op-state.
-void
-sam_db_set_key (
-    sam_db_t *self,
-    int *id)
+static void
+bdb_set_key (
+    void *db,
+    uint64_t *id)
 {
+    sam_db_bdb_t *self = db;
+
     DBT *key = &self->op.key;
     key->data = id;
-    key->size = sizeof (int);
+    key->size = sizeof (uint64_t);
 }
 
 
 //  --------------------------------------------------------------------------
 /// Return the value of the current op-states record.
-void
-sam_db_get_val (
-    sam_db_t *self,
+static void
+bdb_get_val (
+    void *db,
     size_t *size,
     void **record)
 {
+    sam_db_bdb_t *self = db;
+
     if (size != NULL) {
         *size = self->op.val.size;
     }
@@ -368,6 +495,19 @@ sam_db_get_val (
 }
 
 
+//  --------------------------------------------------------------------------
+/// BerkeleyDB hands out memory owned by the cursor which can be
+/// altered directly.
+static void
+bdb_edit (
+    void *db,
+    size_t *size,
+    void **record)
+{
+    bdb_get_val (db, size, record);
+}
+
+
 //  --------------------------------------------------------------------------
 /// Resets the key and value db thangs.
 static void
@@ -385,27 +525,29 @@ reset (
 /// This function searches the db for the provided id and either fills
 /// the op structure (return code 0), returns SAM_DB_NOTFOUND or
 /// SAM_DB_ERROR.
-sam_db_ret_t
-sam_db_get (
-    sam_db_t *self,
-    int *id)
+static sam_db_ret_t
+bdb_get (
+    void *db,
+    uint64_t *id)
 {
+    sam_db_bdb_t *self = db;
+
     assert (self);
-    sam_log_tracef ("get, setting cursor to '%d'", *id);
+    sam_log_tracef ("get, setting cursor to '%" PRIu64 "'", *id);
 
     DBT
         *key = &self->op.key,
         *val = &self->op.val;
 
     reset (key, val);
-    sam_db_set_key (self, id);
+    bdb_set_key (self, id);
 
     DBC *cursor = self->op.cursor;
     int rc = cursor->get (cursor, key, val, DB_SET);
 
     if (rc == DB_NOTFOUND) {
         sam_log_tracef (
-            "'%d' was not found!", sam_db_get_key (self));
+            "'%" PRIu64 "' was not found!", bdb_get_key (self));
         return SAM_DB_NOTFOUND;
     }
 
@@ -421,11 +563,13 @@ sam_db_get (
 //  --------------------------------------------------------------------------
 /// Traverse the database and either return the previous or next
 /// sibling of the cursors current position.
-sam_db_ret_t
-sam_db_sibling (
-    sam_db_t *self,
+static sam_db_ret_t
+bdb_sibling (
+    void *db,
     sam_db_flag_t trav)
 {
+    sam_db_bdb_t *self = db;
+
     assert (self);
     assert (trav == SAM_DB_PREV || trav == SAM_DB_NEXT);
 
@@ -452,7 +596,8 @@ sam_db_sibling (
     }
 
     if (rc != DB_NOTFOUND) {
-        sam_log_tracef ("get record '%d' as sibling", sam_db_get_key (self));
+        sam_log_tracef (
+            "get record '%" PRIu64 "' as sibling", bdb_get_key (self));
     }
 
     return (rc == DB_NOTFOUND)? SAM_DB_NOTFOUND: SAM_DB_OK;
@@ -461,19 +606,21 @@ sam_db_sibling (
 
 //  --------------------------------------------------------------------------
 /// Insert a database record.
-sam_db_ret_t
-sam_db_put (
-    sam_db_t *self,
+static sam_db_ret_t
+bdb_put (
+    void *db,
     size_t size,
     byte *record)
 {
+    sam_db_bdb_t *self = db;
+
     assert (self);
     assert (record);
     assert (self->op.key.data);
 
     sam_log_tracef (
-        "putting '%d' (size %d) into the database",
-        sam_db_get_key (self), size);
+        "putting '%" PRIu64 "' (size %zu) into the database",
+        bdb_get_key (self), size);
 
     DBT
         *key = &self->op.key,
@@ -499,11 +646,13 @@ sam_db_put (
 /// Update a database record. If the flag is SAM_DB_CURRENT, the key is
 /// ignored and the cursors position is updated; if the flag is
 /// SAM_DB_KEY, the key is used to determine where to put the record.
-sam_db_ret_t
-sam_db_update (
-    sam_db_t *self,
+static sam_db_ret_t
+bdb_update (
+    void *db,
     sam_db_flag_t kind)
 {
+    sam_db_bdb_t *self = db;
+
     assert (self);
     assert (kind == SAM_DB_CURRENT || kind == SAM_DB_KEY);
 
@@ -511,12 +660,14 @@ sam_db_update (
     if (kind == SAM_DB_CURRENT) {
         flag = DB_CURRENT;
         sam_log_tracef (
-            "update '%d', replacing current", sam_db_get_key (self));
+            "update '%" PRIu64 "', replacing current",
+            bdb_get_key (self));
 
     } else if (kind == SAM_DB_KEY) {
         flag = DB_KEYFIRST;
         sam_log_tracef (
-            "update '%d', inserting at new position", sam_db_get_key (self));
+            "update '%" PRIu64 "', inserting at new position",
+            bdb_get_key (self));
     }
 
     DBT
@@ -537,12 +688,15 @@ sam_db_update (
 
 //  --------------------------------------------------------------------------
 /// Delete the record the cursor currently points to.
-sam_db_ret_t
-sam_db_del (
-    sam_db_t *self)
+static sam_db_ret_t
+bdb_del (
+    void *db)
 {
+    sam_db_bdb_t *self = db;
+
     assert (self);
-    sam_log_tracef ("deleting '%d' from db", sam_db_get_key (self));
+    sam_log_tracef (
+        "deleting '%" PRIu64 "' from db", bdb_get_key (self));
 
     DBC *cursor = self->op.cursor;
     int rc = cursor->del (cursor, 0);
@@ -553,3 +707,25 @@ sam_db_del (
 
     return SAM_DB_OK;
 }
+
+
+const sam_db_engine_t sam_db_bdb = {
+    .name = "bdb",
+
+    .new = bdb_new,
+    .destroy = bdb_destroy,
+
+    .begin = bdb_begin,
+    .end = bdb_end,
+
+    .get_key = bdb_get_key,
+    .set_key = bdb_set_key,
+    .get_val = bdb_get_val,
+    .edit = bdb_edit,
+
+    .get = bdb_get,
+    .sibling = bdb_sibling,
+    .put = bdb_put,
+    .update = bdb_update,
+    .del = bdb_del
+};
@@ -0,0 +1,712 @@
+/*  =========================================================================
+
+    sam_db_lmdb - LMDB storage
+
+    This Source Code Form is subject to the terms of the MIT
+    License. If a copy of the MIT License was not distributed with
+    this file, You can obtain one at http://opensource.org/licenses/MIT
+
+    =========================================================================
+*/
+/**
+
+   @brief LMDB storage
+   @file sam_db_lmdb.c
+
+   Uses the memory mapped LMDB b+tree to persist messages. Records
+   returned by get_val point directly into the (read only) map and
+   are not copied. Records that get altered are copied into a
+   scratch buffer by edit and written back by update.
+
+   Keys are 64 bit wide integer keys (MDB_INTEGERKEY, which requires
+   a size_t). Databases written by former versions use int keys:
+   When the database gets opened, its records are copied to memory,
+   the database gets emptied and the records are put again with 64
+   bit keys. LMDB can not mix key sizes, so the conversion can not
+   happen record by record, but it happens within the transaction
+   opening the database and leaves the file untouched on failure.
+
+
+*/
+
+
+#include <lmdb.h>
+#include "../include/sam_prelude.h"
+
+
+/// all database related stuff
+typedef struct sam_db_lmdb_t {
+    bool txn;             ///< synchronous commits enabled?
+
+    MDB_env *env;         ///< database environment
+    MDB_dbi dbi;          ///< database handle
+
+    struct op {
+        MDB_txn *txn;     ///< transaction handle
+        MDB_cursor *cursor; ///< to traverse the tree
+
+        MDB_val key;      ///< points to the records key
+        MDB_val val;      ///< points to the records data
+
+        bool deleted;     ///< cursor already points to the successor
+        uint64_t deleted_key; ///< key of the last deleted record
+    } op;
+
+    struct scratch {
+        size_t size;      ///< allocated memory
+        byte *data;       ///< writable copy of the current record
+    } scratch;
+
+} sam_db_lmdb_t;
+
+
+/// used if db/lmdb/size is not configured
+#define DEFAULT_MAP_SIZE "1G"
+
+
+
+//  --------------------------------------------------------------------------
+/// Logs the current size of the database.
+static void
+stat_db_size (
+    sam_db_lmdb_t *self)
+{
+    MDB_stat stat;
+    if (!mdb_env_stat (self->env, &stat)) {
+        sam_log_infof ("db contains %d record(s)", (int) stat.ms_entries);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+/// Resets the current state.
+static void
+clear_op (
+    sam_db_lmdb_t *self)
+{
+    self->op.txn = NULL;
+    self->op.cursor = NULL;
+    self->op.deleted = false;
+
+    memset (&self->op.key, 0, sizeof (MDB_val));
+    memset (&self->op.val, 0, sizeof (MDB_val));
+}
+
+
+//  --------------------------------------------------------------------------
+/// Point key and value to the cursors current position inside the map.
+static int
+refresh (
+    sam_db_lmdb_t *self)
+{
+    self->op.deleted = false;
+    return mdb_cursor_get (
+        self->op.cursor, &self->op.key, &self->op.val, MDB_GET_CURRENT);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Re-inserts all records of a database written with int keys using
+/// 64 bit keys. Integer keys of different sizes can not be mixed, so
+/// all records are copied, the database gets emptied and refilled.
+static int
+migrate (
+    sam_db_lmdb_t *self,
+    MDB_txn *txn)
+{
+    MDB_cursor *cursor;
+    MDB_val key, val;
+
+    int rc = mdb_cursor_open (txn, self->dbi, &cursor);
+    if (rc) {
+        return rc;
+    }
+
+    rc = mdb_cursor_get (cursor, &key, &val, MDB_FIRST);
+    if (rc || key.mv_size != sizeof (int)) {
+        mdb_cursor_close (cursor);
+        return (rc == MDB_NOTFOUND)? 0: rc;
+    }
+
+    zlist_t *records = zlist_new ();
+    zlist_set_destructor (records, (czmq_destructor *) zframe_destroy);
+
+    while (!rc) {
+        uint64_t id = *(int *) key.mv_data;
+        zframe_t *record = zframe_new (NULL, sizeof (id) + val.mv_size);
+
+        memcpy (zframe_data (record), &id, sizeof (id));
+        memcpy (zframe_data (record) + sizeof (id), val.mv_data, val.mv_size);
+        zlist_append (records, record);
+
+        rc = mdb_cursor_get (cursor, &key, &val, MDB_NEXT);
+    }
+
+    mdb_cursor_close (cursor);
+    if (rc == MDB_NOTFOUND) {
+        rc = mdb_drop (txn, self->dbi, 0);
+    }
+
+    zframe_t *record = zlist_first (records);
+    while (!rc && record) {
+        key.mv_size = sizeof (uint64_t);
+        key.mv_data = zframe_data (record);
+        val.mv_size = zframe_size (record) - sizeof (uint64_t);
+        val.mv_data = zframe_data (record) + sizeof (uint64_t);
+
+        rc = mdb_put (txn, self->dbi, &key, &val, MDB_APPEND);
+        record = zlist_next (records);
+    }
+
+    if (!rc) {
+        sam_log_infof (
+            "migrated %d record(s) to 64 bit keys", (int) zlist_size (records));
+    }
+
+    zlist_destroy (&records);
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Close (partially) initialized environment.
+static void
+close_db (
+    sam_db_lmdb_t *self)
+{
+    if (self->env) {
+        stat_db_size (self);
+        mdb_env_close (self->env);
+    }
+
+    free (self->scratch.data);
+    free (self);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Creates an environment, maps the database file and opens the
+/// database.
+static void *
+lmdb_new (
+    zconfig_t *conf)
+{
+    char
+        *hname = zconfig_resolve (conf, "home", NULL),
+        *fname = zconfig_resolve (conf, "file", NULL),
+        *size_str = zconfig_resolve (conf, "size", DEFAULT_MAP_SIZE),
+        *txn_str = zconfig_resolve (conf, "transactions", NULL);
+
+    // integer keys must be of size_t
+    assert (sizeof (size_t) == sizeof (uint64_t));
+
+    uint64_t map_size;
+    if (hname == NULL || fname == NULL || txn_str == NULL ||
+        sam_cfg_binary_value (size_str, &map_size)) {
+
+        sam_log_error ("could not load configuration");
+        return NULL;
+    }
+
+    sam_db_lmdb_t *self = malloc (sizeof (sam_db_lmdb_t));
+    assert (self);
+    clear_op (self);
+
+    self->env = NULL;
+    self->scratch.size = 0;
+    self->scratch.data = NULL;
+
+
+    // without transactions, commits are not synced to disk
+    self->txn = (!strcmp (txn_str, "yes")? true: false);
+    if (self->txn) {
+        sam_log_info ("enabled transactions");
+    }
+    else {
+        sam_log_info ("disabled transactions");
+    }
+
+    uint32_t env_flags = MDB_NOSUBDIR;
+    if (!self->txn) {
+        env_flags |= MDB_NOSYNC;
+    }
+
+
+    // initialize the environment
+    int rc = mdb_env_create (&self->env);
+    if (rc) {
+        sam_log_errorf (
+            "could not create db environment: %s",
+            mdb_strerror (rc));
+        self->env = NULL;
+        close_db (self);
+        return NULL;
+    }
+
+    rc = mdb_env_set_mapsize (self->env, map_size);
+    if (rc) {
+        sam_log_errorf ("could not set map size: %s", mdb_strerror (rc));
+        close_db (self);
+        return NULL;
+    }
+
+    char *path = malloc (strlen (hname) + strlen (fname) + 2);
+    assert (path);
+    sprintf (path, "%s/%s", hname, fname);
+
+    rc = mdb_env_open (self->env, path, env_flags, 0664);
+    free (path);
+
+    if (rc) {
+        sam_log_errorf (
+            "could not open db environment: %s",
+            mdb_strerror (rc));
+        close_db (self);
+        return NULL;
+    }
+
+
+    // open the database
+    MDB_txn *txn;
+    rc = mdb_txn_begin (self->env, NULL, 0, &txn);
+    if (!rc) {
+        rc = mdb_dbi_open (txn, NULL, MDB_INTEGERKEY, &self->dbi);
+        if (!rc) {
+            rc = migrate (self, txn);
+        }
+
+        if (rc) {
+            mdb_txn_abort (txn);
+        }
+        else {
+            rc = mdb_txn_commit (txn);
+        }
+    }
+
+    if (rc) {
+        sam_log_errorf ("database open failed: %s", mdb_strerror (rc));
+        close_db (self);
+        return NULL;
+    }
+
+    stat_db_size (self);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Destroy the engine state.
+static void
+lmdb_destroy (
+    void **db)
+{
+    close_db (*db);
+    *db = NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Close the database cursor and end the transaction based on the
+/// abort parameter: Either commit or abort.
+static sam_db_ret_t
+lmdb_end (
+    void *db,
+    bool abort)
+{
+    sam_db_lmdb_t *self = db;
+    sam_db_ret_t ret = SAM_DB_OK;
+
+    // handle cursor
+    if (self->op.cursor != NULL) {
+        mdb_cursor_close (self->op.cursor);
+    }
+
+    // handle transaction
+    if (self->op.txn) {
+        if (abort) {
+            sam_log_error ("aborting transaction");
+            mdb_txn_abort (self->op.txn);
+        }
+
+        else {
+            sam_log_trace ("commiting transaction");
+            int rc = mdb_txn_commit (self->op.txn);
+            if (rc) {
+                sam_log_errorf ("transaction failed: %s", mdb_strerror (rc));
+                ret = SAM_DB_ERROR;
+            }
+        }
+    }
+
+    clear_op (self);
+    return ret;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Create a write transaction and a database cursor.
+static sam_db_ret_t
+lmdb_begin (
+    void *db)
+{
+    sam_db_lmdb_t *self = db;
+
+    assert (self->op.txn == NULL);
+    assert (self->op.cursor == NULL);
+
+    int rc = mdb_txn_begin (self->env, NULL, 0, &self->op.txn);
+    if (rc) {
+        sam_log_errorf (
+            "transaction begin failed: %s", mdb_strerror (rc));
+        self->op.txn = NULL;
+        return SAM_DB_ERROR;
+    }
+
+    rc = mdb_cursor_open (self->op.txn, self->dbi, &self->op.cursor);
+    if (rc) {
+        sam_log_error ("could not initialize cursor");
+        self->op.cursor = NULL;
+        lmdb_end (self, true);
+        return SAM_DB_ERROR;
+    }
+
+    return SAM_DB_OK;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the key of the current op-state.
+static uint64_t
+lmdb_get_key (
+    void *db)
+{
+    sam_db_lmdb_t *self = db;
+
+    assert (self->op.key.mv_data);
+    return *(uint64_t *) self->op.key.mv_data;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Sets the key of the current op-state.
+static void
+lmdb_set_key (
+    void *db,
+    uint64_t *id)
+{
+    sam_db_lmdb_t *self = db;
+
+    self->op.key.mv_data = id;
+    self->op.key.mv_size = sizeof (uint64_t);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Return the value of the current op-states record. The memory
+/// belongs to the map and must not be altered.
+static void
+lmdb_get_val (
+    void *db,
+    size_t *size,
+    void **record)
+{
+    sam_db_lmdb_t *self = db;
+
+    if (size != NULL) {
+        *size = self->op.val.mv_size;
+    }
+
+    if (record != NULL) {
+        *record = self->op.val.mv_data;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+/// Copy the current record into the scratch buffer which gets used
+/// as the records value from now on.
+static void
+lmdb_edit (
+    void *db,
+    size_t *size,
+    void **record)
+{
+    sam_db_lmdb_t *self = db;
+    MDB_val *val = &self->op.val;
+
+    if (val->mv_data != self->scratch.data) {
+        if (self->scratch.size < val->mv_size) {
+            self->scratch.data = realloc (self->scratch.data, val->mv_size);
+            assert (self->scratch.data);
+            self->scratch.size = val->mv_size;
+        }
+
+        memcpy (self->scratch.data, val->mv_data, val->mv_size);
+        val->mv_data = self->scratch.data;
+    }
+
+    lmdb_get_val (self, size, record);
+}
+
+
+//  --------------------------------------------------------------------------
+/// This function searches the db for the provided id and either fills
+/// the op structure (return code 0), returns SAM_DB_NOTFOUND or
+/// SAM_DB_ERROR.
+static sam_db_ret_t
+lmdb_get (
+    void *db,
+    uint64_t *id)
+{
+    sam_db_lmdb_t *self = db;
+
+    assert (self);
+    sam_log_tracef ("get, setting cursor to '%" PRIu64 "'", *id);
+
+    lmdb_set_key (self, id);
+    self->op.deleted = false;
+
+    int rc = mdb_cursor_get (
+        self->op.cursor, &self->op.key, &self->op.val, MDB_SET_KEY);
+
+    if (rc == MDB_NOTFOUND) {
+        sam_log_tracef ("'%" PRIu64 "' was not found!", *id);
+        return SAM_DB_NOTFOUND;
+    }
+
+    if (rc) {
+        sam_log_errorf ("could not get record: %s", mdb_strerror (rc));
+        return SAM_DB_ERROR;
+    }
+
+    return SAM_DB_OK;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Traverse the database and either return the previous or next
+/// sibling of the cursors current position. LMDB moves the cursor
+/// to the successor when deleting a record: in this case, the next
+/// sibling is the current position.
+static sam_db_ret_t
+lmdb_sibling (
+    void *db,
+    sam_db_flag_t trav)
+{
+    sam_db_lmdb_t *self = db;
+
+    assert (self);
+    assert (trav == SAM_DB_PREV || trav == SAM_DB_NEXT);
+
+    MDB_cursor_op op = MDB_NEXT;
+    if (trav == SAM_DB_PREV) {
+        op = MDB_PREV;
+    } else if (self->op.deleted) {
+        op = MDB_GET_CURRENT;
+    }
+
+    int rc = mdb_cursor_get (
+        self->op.cursor, &self->op.key, &self->op.val, op);
+
+    // the database got emptied
+    if (rc == EINVAL && self->op.deleted) {
+        rc = MDB_NOTFOUND;
+    }
+
+    self->op.deleted = false;
+
+    if (rc && rc != MDB_NOTFOUND) {
+        sam_log_errorf (
+            "could not get next/previous item: %s", mdb_strerror (rc));
+        return SAM_DB_ERROR;
+    }
+
+    if (rc != MDB_NOTFOUND) {
+        sam_log_tracef (
+            "get record '%" PRIu64 "' as sibling", lmdb_get_key (self));
+    }
+
+    return (rc == MDB_NOTFOUND)? SAM_DB_NOTFOUND: SAM_DB_OK;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Write the current value at the position of the current key and
+/// move the cursor there.
+static sam_db_ret_t
+write_val (
+    sam_db_lmdb_t *self,
+    uint32_t flag)
+{
+    int rc = mdb_cursor_put (
+        self->op.cursor, &self->op.key, &self->op.val, flag);
+
+    if (!rc) {
+        rc = refresh (self);
+    }
+
+    if (rc == MDB_MAP_FULL) {
+        sam_log_error ("could not write record: map size exceeded");
+        return SAM_DB_ERROR;
+    }
+
+    if (rc) {
+        sam_log_errorf ("could not write record: %s", mdb_strerror (rc));
+        return SAM_DB_ERROR;
+    }
+
+    return SAM_DB_OK;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Insert a database record.
+static sam_db_ret_t
+lmdb_put (
+    void *db,
+    size_t size,
+    byte *record)
+{
+    sam_db_lmdb_t *self = db;
+
+    assert (self);
+    assert (record);
+    assert (self->op.key.mv_data);
+
+    sam_log_tracef (
+        "putting '%" PRIu64 "' (size %zu) into the database",
+        lmdb_get_key (self), size);
+
+    self->op.val.mv_size = size;
+    self->op.val.mv_data = record;
+
+    return write_val (self, 0);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Insert a database record consisting of several parts. The space
+/// gets reserved inside the map and the parts are copied there
+/// directly.
+static sam_db_ret_t
+lmdb_putv (
+    void *db,
+    struct iovec *parts,
+    int part_c)
+{
+    sam_db_lmdb_t *self = db;
+
+    assert (self);
+    assert (parts);
+    assert (self->op.key.mv_data);
+
+    size_t size = 0;
+    for (int i = 0; i < part_c; i++) {
+        size += parts [i].iov_len;
+    }
+
+    sam_log_tracef (
+        "putting '%" PRIu64 "' (size %zu) into the database",
+        lmdb_get_key (self), size);
+
+    self->op.val.mv_size = size;
+    self->op.val.mv_data = NULL;
+
+    sam_db_ret_t ret = write_val (self, MDB_RESERVE);
+    if (ret) {
+        return ret;
+    }
+
+    // the cursor points to the reserved space
+    byte *dest = self->op.val.mv_data;
+    for (int i = 0; i < part_c; i++) {
+        memcpy (dest, parts [i].iov_base, parts [i].iov_len);
+        dest += parts [i].iov_len;
+    }
+
+    return SAM_DB_OK;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Update a database record. If the flag is SAM_DB_CURRENT, the
+/// cursors position is updated; if the flag is SAM_DB_KEY, the key
+/// is used to determine where to put the record. The value must not
+/// reside in the map while writing, so it gets copied if it was not
+/// edited before.
+static sam_db_ret_t
+lmdb_update (
+    void *db,
+    sam_db_flag_t kind)
+{
+    sam_db_lmdb_t *self = db;
+
+    assert (self);
+    assert (kind == SAM_DB_CURRENT || kind == SAM_DB_KEY);
+
+    uint32_t flag = 0;
+    if (kind == SAM_DB_CURRENT) {
+        flag = MDB_CURRENT;
+        sam_log_tracef (
+            "update '%" PRIu64 "', replacing current",
+            lmdb_get_key (self));
+
+    } else if (kind == SAM_DB_KEY) {
+        sam_log_tracef (
+            "update '%" PRIu64 "', inserting at new position",
+            lmdb_get_key (self));
+    }
+
+    lmdb_edit (self, NULL, NULL);
+    return write_val (self, flag);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Delete the record the cursor currently points to.
+static sam_db_ret_t
+lmdb_del (
+    void *db)
+{
+    sam_db_lmdb_t *self = db;
+
+    assert (self);
+    sam_log_tracef (
+        "deleting '%" PRIu64 "' from db", lmdb_get_key (self));
+
+    // the key must stay readable after deletion
+    self->op.deleted_key = lmdb_get_key (self);
+    lmdb_set_key (self, &self->op.deleted_key);
+
+    int rc = mdb_cursor_del (self->op.cursor, 0);
+    if (rc) {
+        sam_log_errorf ("could not delete record: %s", mdb_strerror (rc));
+        return SAM_DB_ERROR;
+    }
+
+    self->op.deleted = true;
+    return SAM_DB_OK;
+}
+
+
+const sam_db_engine_t sam_db_lmdb = {
+    .name = "lmdb",
+
+    .new = lmdb_new,
+    .destroy = lmdb_destroy,
+
+    .begin = lmdb_begin,
+    .end = lmdb_end,
+
+    .get_key = lmdb_get_key,
+    .set_key = lmdb_set_key,
+    .get_val = lmdb_get_val,
+    .edit = lmdb_edit,
+
+    .get = lmdb_get,
+    .sibling = lmdb_sibling,
+    .put = lmdb_put,
+    .putv = lmdb_putv,
+    .update = lmdb_update,
+    .del = lmdb_del
+};
@@ -0,0 +1,1547 @@
+/*  =========================================================================
+
+    sam_db_log - Append-only log storage
+
+    This Source Code Form is subject to the terms of the MIT
+    License. If a copy of the MIT License was not distributed with
+    this file, You can obtain one at http://opensource.org/licenses/MIT
+
+    =========================================================================
+*/
+/**
+
+   @brief Append-only segmented log storage
+   @file sam_db_log.c
+
+   Every change is appended to the newest of a series of fixed size
+   segment files (<home>/<file>.<sequence>). Stores write the whole
+   record, updates of a record of the same size only append the
+   altered byte range (a patch) and deletions append the key. The
+   location of every live record is kept in a sorted in-memory
+   index, which gets rebuilt from the segments on startup.
+
+   All changes between begin and end are collected in memory and
+   appended with a single write followed by a commit entry, which
+   carries a CRC-32 of the entries of the transaction. Replaying the
+   log stops at the first transaction which is incomplete or does
+   not match its checksum: The segment gets cut off there and all
+   later segments are renamed (<segment>.discarded) and ignored.
+
+   Each segment counts the live records (and patches) it contains.
+   Fully acknowledged segments are reclaimed oldest first by deleting
+   the file. Whenever a new segment is begun and the live data of the
+   oldest segment is small, the live records get copied to the new
+   segment (compaction), so that a few long living records do not
+   keep the oldest segment and all its successors from being
+   reclaimed.
+
+   Segments written by former versions contain entries with int keys
+   (legacy entries). They are still replayed (without checksums),
+   but never appended to: If the newest segment is a legacy one, a
+   new segment is begun. Legacy segments vanish as their records get
+   deleted or compacted.
+
+
+*/
+
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../include/sam_prelude.h"
+
+
+/// kinds of log entries
+typedef enum {
+    ENTRY_PUT = 0x5a4d0011,
+    ENTRY_PATCH = 0x5a4d0012,
+    ENTRY_DEL = 0x5a4d0013,
+    ENTRY_COMMIT = 0x5a4d0014
+} entry_kind_t;
+
+
+/// legacy entries use the kinds minus this offset
+#define LEGACY_KIND 0x10
+
+
+/// precedes every entry of a segment file
+typedef struct entry_t {
+    uint32_t kind;    ///< one of entry_kind_t
+    uint32_t pos;     ///< offset inside the record (patches only)
+    uint64_t key;     ///< key of the record
+    uint32_t size;    ///< size of the following data
+    uint32_t crc;     ///< checksum of the transaction (commits only)
+} entry_t;
+
+
+/// precedes every entry of a legacy segment file
+typedef struct legacy_entry_t {
+    uint32_t kind;    ///< one of entry_kind_t - LEGACY_KIND
+    int key;          ///< key of the record
+    uint32_t pos;     ///< offset inside the record (patches only)
+    uint32_t size;    ///< size of the following data
+} legacy_entry_t;
+
+
+/// a segment file
+typedef struct segment_t {
+    int seq;          ///< sequence number
+    int fd;           ///< file descriptor
+    size_t size;      ///< committed size
+    int live;         ///< referenced by this many records and patches
+    int64_t live_size;    ///< size of the referenced data
+    bool legacy;      ///< contains legacy entries
+} segment_t;
+
+
+/// in-memory index entry
+typedef struct record_t {
+    uint64_t key;     ///< key of the record
+    bool live;        ///< false for deleted records
+
+    int seq;          ///< segment containing the record
+    uint32_t offset;  ///< position of the record inside the segment
+    uint32_t size;    ///< size of the record
+
+    int patch_seq;    ///< segment containing the latest patch
+    uint32_t patch_pos;   ///< offset of the patch inside the record
+    uint32_t patch_size;  ///< size of the patch
+    byte *patch;      ///< patched bytes, NULL if unpatched
+} record_t;
+
+
+/// used to revert the index when aborting
+typedef struct undo_t {
+    uint64_t key;     ///< key of the altered record
+    record_t record;  ///< former state of the record
+} undo_t;
+
+
+/// growing chunk of memory
+typedef struct buffer_t {
+    byte *data;
+    size_t size;
+    size_t cap;
+} buffer_t;
+
+
+/// all database related stuff
+typedef struct sam_db_log_t {
+    bool txn;               ///< sync to disk on commit?
+    char *home;             ///< directory of the segment files
+    char *file;             ///< prefix of the segment files
+    uint64_t segment_size;  ///< begin a new segment if exceeded
+
+    struct segments {
+        segment_t *list;    ///< ordered by sequence number
+        int n;
+        int cap;
+    } segments;
+
+    struct index {
+        record_t *list;     ///< ordered by key
+        int n;
+        int cap;
+        int live;           ///< amount of live records
+    } index;
+
+    struct undo {
+        undo_t *list;
+        int n;
+        int cap;
+    } undo;
+
+    struct op {
+        bool active;        ///< between begin and end
+        int pos;            ///< cursor position, -1 if unset
+        uint64_t key;       ///< last set or retrieved key
+        bool loaded;        ///< current record read into rbuf
+        bool edited;        ///< current record copied into ebuf
+    } op;
+
+    buffer_t wbuf;          ///< entries of the current transaction
+    buffer_t rbuf;          ///< current record
+    buffer_t ebuf;          ///< writable copy of the current record
+
+} sam_db_log_t;
+
+
+/// used if db/log/segment is not configured
+#define DEFAULT_SEGMENT_SIZE "16M"
+
+/// compact the index if there are more dead entries
+#define COMPACT_THRESHOLD 1024
+
+/// compact the oldest segment if its live data does not exceed
+/// this fraction of the segment size
+#define COMPACT_RATIO 4
+
+/// entries are aligned to eight bytes (legacy entries to four bytes)
+#define PADDED(size) (((size) + 7) & ~((size_t) 7))
+#define LEGACY_PADDED(size) (((size) + 3) & ~((size_t) 3))
+
+
+
+/// CRC-32 (IEEE 802.3) of every half byte
+static const uint32_t crc_table [16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+
+
+//  --------------------------------------------------------------------------
+/// Compute the CRC-32 of a chunk of memory.
+static uint32_t
+checksum (
+    const byte *data,
+    size_t size)
+{
+    uint32_t crc = ~0u;
+
+    for (size_t i = 0; i < size; i++) {
+        crc ^= data [i];
+        crc = (crc >> 4) ^ crc_table [crc & 0xf];
+        crc = (crc >> 4) ^ crc_table [crc & 0xf];
+    }
+
+    return ~crc;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Ensure that a buffer can hold the provided amount of bytes.
+static void
+reserve (
+    buffer_t *buf,
+    size_t size)
+{
+    if (buf->cap < size) {
+        buf->cap = (size < 2 * buf->cap)? 2 * buf->cap: size;
+        buf->data = realloc (buf->data, buf->cap);
+        assert (buf->data);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+/// Grow an array of elements if it is full.
+static void *
+grow (
+    void *list,
+    int n,
+    int *cap,
+    size_t size)
+{
+    if (n == *cap) {
+        *cap = (*cap)? 2 * *cap: 64;
+        list = realloc (list, *cap * size);
+        assert (list);
+    }
+
+    return list;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Write the path of a segment file.
+static void
+segment_path (
+    sam_db_log_t *self,
+    int seq,
+    char *path,
+    size_t size)
+{
+    snprintf (path, size, "%s/%s.%08d", self->home, self->file, seq);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the segment with the provided sequence number.
+static segment_t *
+segment (
+    sam_db_log_t *self,
+    int seq)
+{
+    int i = seq - self->segments.list [0].seq;
+    assert (0 <= i && i < self->segments.n);
+    return &self->segments.list [i];
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the segment currently appended to.
+static segment_t *
+active_segment (
+    sam_db_log_t *self)
+{
+    return &self->segments.list [self->segments.n - 1];
+}
+
+
+//  --------------------------------------------------------------------------
+/// Open (or create) a segment file and append it to the list.
+static segment_t *
+segment_open (
+    sam_db_log_t *self,
+    int seq)
+{
+    char path [256];
+    segment_path (self, seq, path, 256);
+
+    int fd = open (path, O_RDWR | O_CREAT, 0664);
+    if (fd == -1) {
+        sam_log_errorf ("could not open segment '%s'", path);
+        return NULL;
+    }
+
+    self->segments.list = grow (
+        self->segments.list, self->segments.n,
+        &self->segments.cap, sizeof (segment_t));
+
+    segment_t *seg = &self->segments.list [self->segments.n];
+    self->segments.n += 1;
+
+    seg->seq = seq;
+    seg->fd = fd;
+    seg->size = lseek (fd, 0, SEEK_END);
+    seg->live = 0;
+    seg->live_size = 0;
+    seg->legacy = false;
+
+    sam_log_tracef ("opened segment '%s'", path);
+    return seg;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Delete the oldest segments as long as they do not contain any
+/// live data. The active segment is never deleted.
+static void
+reclaim (
+    sam_db_log_t *self)
+{
+    char path [256];
+
+    while (1 < self->segments.n && !self->segments.list [0].live) {
+        segment_t *seg = &self->segments.list [0];
+        segment_path (self, seg->seq, path, 256);
+
+        close (seg->fd);
+        if (unlink (path)) {
+            sam_log_errorf ("could not delete segment '%s'", path);
+        }
+        else {
+            sam_log_tracef ("reclaimed segment '%s'", path);
+        }
+
+        self->segments.n -= 1;
+        memmove (
+            self->segments.list, self->segments.list + 1,
+            self->segments.n * sizeof (segment_t));
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+/// Adjust the live counters of the segments a record resides in.
+static void
+ref (
+    sam_db_log_t *self,
+    record_t *record,
+    int delta)
+{
+    if (!record->live) {
+        return;
+    }
+
+    segment_t *seg = segment (self, record->seq);
+    seg->live += delta;
+    seg->live_size += delta * (int64_t) record->size;
+
+    if (record->patch) {
+        seg = segment (self, record->patch_seq);
+        seg->live += delta;
+        seg->live_size += delta * (int64_t) record->patch_size;
+    }
+
+    self->index.live += delta;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Binary search for a key. Returns the position of the key or the
+/// position where it would have to be inserted.
+static int
+index_find (
+    sam_db_log_t *self,
+    uint64_t key,
+    bool *found)
+{
+    int lo = 0, hi = self->index.n;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (self->index.list [mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    *found = (lo < self->index.n && self->index.list [lo].key == key);
+    return lo;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the position of a key, inserts a dead entry if necessary.
+static int
+index_slot (
+    sam_db_log_t *self,
+    uint64_t key)
+{
+    bool found;
+    int pos = index_find (self, key, &found);
+
+    if (!found) {
+        self->index.list = grow (
+            self->index.list, self->index.n,
+            &self->index.cap, sizeof (record_t));
+
+        record_t *list = self->index.list;
+        memmove (
+            list + pos + 1, list + pos,
+            (self->index.n - pos) * sizeof (record_t));
+
+        memset (list + pos, 0, sizeof (record_t));
+        list [pos].key = key;
+        self->index.n += 1;
+    }
+
+    return pos;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Replace an index entry and remember the former state.
+static void
+index_set (
+    sam_db_log_t *self,
+    int pos,
+    record_t *record)
+{
+    record_t *current = &self->index.list [pos];
+
+    self->undo.list = grow (
+        self->undo.list, self->undo.n,
+        &self->undo.cap, sizeof (undo_t));
+
+    undo_t *undo = &self->undo.list [self->undo.n];
+    self->undo.n += 1;
+
+    undo->key = current->key;
+    undo->record = *current;
+
+    ref (self, current, -1);
+    ref (self, record, 1);
+    *current = *record;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Revert all index changes since begin.
+static void
+index_revert (
+    sam_db_log_t *self)
+{
+    while (self->undo.n) {
+        self->undo.n -= 1;
+        undo_t *undo = &self->undo.list [self->undo.n];
+
+        bool found;
+        int pos = index_find (self, undo->key, &found);
+        assert (found);
+
+        record_t *current = &self->index.list [pos];
+        ref (self, current, -1);
+        free (current->patch);
+
+        ref (self, &undo->record, 1);
+        *current = undo->record;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+/// Make all index changes since begin permanent.
+static void
+index_commit (
+    sam_db_log_t *self)
+{
+    for (int i = 0; i < self->undo.n; i++) {
+        free (self->undo.list [i].record.patch);
+    }
+
+    self->undo.n = 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Remove dead entries from the index.
+static void
+index_compact (
+    sam_db_log_t *self)
+{
+    int dead = self->index.n - self->index.live;
+    if (dead < COMPACT_THRESHOLD || dead < self->index.live) {
+        return;
+    }
+
+    int n = 0;
+    for (int i = 0; i < self->index.n; i++) {
+        if (self->index.list [i].live) {
+            self->index.list [n] = self->index.list [i];
+            n += 1;
+        }
+    }
+
+    sam_log_tracef ("compacted index, removed %d entries", dead);
+    self->index.n = n;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Append an entry to the current transaction and return the
+/// position of its data inside the active segment. The data is
+/// gathered from the provided parts.
+static uint32_t
+append (
+    sam_db_log_t *self,
+    entry_kind_t kind,
+    uint64_t key,
+    uint32_t pos,
+    struct iovec *parts,
+    int part_c)
+{
+    buffer_t *wbuf = &self->wbuf;
+    size_t entry_size = sizeof (entry_t);
+
+    size_t size = 0;
+    for (int i = 0; i < part_c; i++) {
+        size += parts [i].iov_len;
+    }
+
+    reserve (wbuf, wbuf->size + entry_size + PADDED (size));
+
+    entry_t *entry = (entry_t *) (wbuf->data + wbuf->size);
+    entry->kind = kind;
+    entry->pos = pos;
+    entry->key = key;
+    entry->size = size;
+    entry->crc = 0;
+
+    wbuf->size += entry_size;
+    uint32_t offset = active_segment (self)->size + wbuf->size;
+
+    if (size) {
+        byte *dest = wbuf->data + wbuf->size;
+        for (int i = 0; i < part_c; i++) {
+            memcpy (dest, parts [i].iov_base, parts [i].iov_len);
+            dest += parts [i].iov_len;
+        }
+
+        memset (dest, 0, PADDED (size) - size);
+        wbuf->size += PADDED (size);
+    }
+
+    return offset;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Read data either from a segment file or from the pending writes.
+static int
+read_data (
+    sam_db_log_t *self,
+    int seq,
+    uint32_t offset,
+    uint32_t size,
+    byte *dest)
+{
+    segment_t *seg = segment (self, seq);
+
+    if (seg == active_segment (self) && seg->size <= offset) {
+        memcpy (dest, self->wbuf.data + (offset - seg->size), size);
+        return 0;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t rc = pread (seg->fd, dest + done, size - done, offset + done);
+        if (rc <= 0) {
+            sam_log_errorf ("could not read segment %d", seq);
+            return -1;
+        }
+
+        done += rc;
+    }
+
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Read the record at the cursors position into rbuf.
+static int
+load (
+    sam_db_log_t *self)
+{
+    if (self->op.loaded) {
+        return 0;
+    }
+
+    assert (0 <= self->op.pos && self->op.pos < self->index.n);
+    record_t *record = &self->index.list [self->op.pos];
+    assert (record->live);
+
+    reserve (&self->rbuf, record->size);
+    if (read_data (
+            self, record->seq, record->offset,
+            record->size, self->rbuf.data)) {
+        return -1;
+    }
+
+    if (record->patch) {
+        memcpy (
+            self->rbuf.data + record->patch_pos,
+            record->patch, record->patch_size);
+    }
+
+    self->rbuf.size = record->size;
+    self->op.loaded = true;
+    self->op.edited = false;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Move the cursor.
+static void
+position (
+    sam_db_log_t *self,
+    int pos)
+{
+    self->op.pos = pos;
+    self->op.key = self->index.list [pos].key;
+    self->op.loaded = false;
+    self->op.edited = false;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Append a record consisting of several parts and position the
+/// cursor there.
+static void
+write_parts (
+    sam_db_log_t *self,
+    uint64_t key,
+    struct iovec *parts,
+    int part_c)
+{
+    record_t record;
+    memset (&record, 0, sizeof (record_t));
+
+    record.key = key;
+    record.live = true;
+    record.seq = active_segment (self)->seq;
+    record.offset = append (self, ENTRY_PUT, key, 0, parts, part_c);
+
+    for (int i = 0; i < part_c; i++) {
+        record.size += parts [i].iov_len;
+    }
+
+    int pos = index_slot (self, key);
+    index_set (self, pos, &record);
+    position (self, pos);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Append a record and position the cursor there.
+static void
+write_record (
+    sam_db_log_t *self,
+    uint64_t key,
+    byte *data,
+    size_t size)
+{
+    struct iovec part = { .iov_base = data, .iov_len = size };
+    write_parts (self, key, &part, 1);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Replace the current record by appending the range of bytes that
+/// differs from the stored version. Falls back to writing the whole
+/// record if the patch would cover most of it.
+static void
+write_patch (
+    sam_db_log_t *self)
+{
+    record_t *current = &self->index.list [self->op.pos];
+    byte
+        *orig = self->rbuf.data,
+        *edit = self->ebuf.data;
+
+    size_t size = current->size;
+    size_t lo = 0, hi = size;
+
+    while (lo < size && orig [lo] == edit [lo]) {
+        lo += 1;
+    }
+
+    // nothing changed
+    if (lo == size) {
+        return;
+    }
+
+    while (orig [hi - 1] == edit [hi - 1]) {
+        hi -= 1;
+    }
+
+    // include the former patch
+    if (current->patch) {
+        size_t patch_hi = current->patch_pos + current->patch_size;
+        lo = (current->patch_pos < lo)? current->patch_pos: lo;
+        hi = (hi < patch_hi)? patch_hi: hi;
+    }
+
+    if (size < 2 * (hi - lo)) {
+        write_record (self, current->key, edit, size);
+        return;
+    }
+
+    record_t record = *current;
+    record.patch_seq = active_segment (self)->seq;
+    record.patch_pos = lo;
+    record.patch_size = hi - lo;
+    record.patch = malloc (hi - lo);
+    assert (record.patch);
+    memcpy (record.patch, edit + lo, hi - lo);
+
+    struct iovec part = { .iov_base = edit + lo, .iov_len = hi - lo };
+    append (self, ENTRY_PATCH, current->key, lo, &part, 1);
+    index_set (self, self->op.pos, &record);
+
+    // the edited version is the current one now
+    buffer_t tmp = self->rbuf;
+    self->rbuf = self->ebuf;
+    self->ebuf = tmp;
+
+    self->op.edited = false;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Write all pending entries to the active segment.
+static int
+flush (
+    sam_db_log_t *self)
+{
+    segment_t *seg = active_segment (self);
+    buffer_t *wbuf = &self->wbuf;
+
+    size_t done = 0;
+    while (done < wbuf->size) {
+        ssize_t rc = pwrite (
+            seg->fd, wbuf->data + done,
+            wbuf->size - done, seg->size + done);
+
+        if (rc <= 0) {
+            sam_log_errorf ("could not write segment %d", seg->seq);
+            if (ftruncate (seg->fd, seg->size)) {
+                sam_log_error ("could not truncate segment");
+            }
+            return -1;
+        }
+
+        done += rc;
+    }
+
+    if (self->txn && fdatasync (seg->fd)) {
+        sam_log_errorf ("could not sync segment %d", seg->seq);
+        return -1;
+    }
+
+    seg->size += wbuf->size;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Reads the entry header at the offset into the provided entry.
+/// Returns the size of the header or 0 if there is not enough data.
+static size_t
+read_entry (
+    segment_t *seg,
+    byte *data,
+    size_t offset,
+    entry_t *entry)
+{
+    if (!seg->legacy) {
+        if (seg->size < offset + sizeof (entry_t)) {
+            return 0;
+        }
+
+        *entry = *(entry_t *) (data + offset);
+        return sizeof (entry_t);
+    }
+
+    if (seg->size < offset + sizeof (legacy_entry_t)) {
+        return 0;
+    }
+
+    legacy_entry_t *legacy = (legacy_entry_t *) (data + offset);
+    entry->kind = legacy->kind + LEGACY_KIND;
+    entry->pos = legacy->pos;
+    entry->key = legacy->key;
+    entry->size = legacy->size;
+    entry->crc = 0;
+
+    return sizeof (legacy_entry_t);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Rebuild the index from the entries of a segment. Replaying stops
+/// at the first incomplete or corrupt transaction, the segment gets
+/// cut off there and cut is set.
+static int
+replay (
+    sam_db_log_t *self,
+    segment_t *seg,
+    bool *cut)
+{
+    byte *data = malloc (seg->size + 1);
+    assert (data);
+
+    size_t done = 0;
+    while (done < seg->size) {
+        ssize_t rc = pread (seg->fd, data + done, seg->size - done, done);
+        if (rc <= 0) {
+            sam_log_errorf ("could not read segment %d", seg->seq);
+            free (data);
+            return -1;
+        }
+
+        done += rc;
+    }
+
+
+    // the first entry tells the format of the segment
+    seg->legacy = (
+        sizeof (uint32_t) <= seg->size &&
+        *(uint32_t *) data + LEGACY_KIND >= ENTRY_PUT &&
+        *(uint32_t *) data + LEGACY_KIND <= ENTRY_COMMIT);
+
+    size_t
+        entry_size,
+        offset = 0,
+        committed = 0;
+
+    entry_t entry_buf, *entry = &entry_buf;
+    while ((entry_size = read_entry (seg, data, offset, entry))) {
+        size_t padded_size = (seg->legacy)?
+            LEGACY_PADDED (entry->size): PADDED (entry->size);
+
+        if (seg->size < offset + entry_size + padded_size) {
+            break;
+        }
+
+        size_t entry_offset = offset;
+        uint32_t data_offset = offset + entry_size;
+        offset = data_offset + padded_size;
+
+        bool found;
+        int pos = index_find (self, entry->key, &found);
+        record_t record;
+
+        if (entry->kind == ENTRY_PUT) {
+            memset (&record, 0, sizeof (record_t));
+            record.key = entry->key;
+            record.live = true;
+            record.seq = seg->seq;
+            record.offset = data_offset;
+            record.size = entry->size;
+
+            index_set (self, index_slot (self, entry->key), &record);
+        }
+
+        else if (entry->kind == ENTRY_PATCH) {
+            if (!found || !self->index.list [pos].live) {
+                continue;
+            }
+
+            record = self->index.list [pos];
+            record.patch_seq = seg->seq;
+            record.patch_pos = entry->pos;
+            record.patch_size = entry->size;
+            record.patch = malloc (entry->size);
+            assert (record.patch);
+            memcpy (record.patch, data + data_offset, entry->size);
+
+            index_set (self, pos, &record);
+        }
+
+        else if (entry->kind == ENTRY_DEL) {
+            if (found && self->index.list [pos].live) {
+                memset (&record, 0, sizeof (record_t));
+                record.key = entry->key;
+                index_set (self, pos, &record);
+            }
+        }
+
+        else if (entry->kind == ENTRY_COMMIT) {
+            if (!seg->legacy && entry->crc !=
+                checksum (data + committed, entry_offset - committed)) {
+
+                sam_log_errorf (
+                    "checksum mismatch in segment %d at %zu",
+                    seg->seq, committed);
+                break;
+            }
+
+            index_commit (self);
+            committed = offset;
+        }
+
+        else {
+            sam_log_errorf (
+                "corrupt entry in segment %d at %d", seg->seq, offset);
+            break;
+        }
+    }
+
+    index_revert (self);
+    free (data);
+
+    if (committed < seg->size) {
+        sam_log_errorf (
+            "discarding %zu uncommitted bytes of segment %d",
+            seg->size - committed, seg->seq);
+
+        if (ftruncate (seg->fd, committed)) {
+            sam_log_error ("could not truncate segment");
+            return -1;
+        }
+
+        seg->size = committed;
+        *cut = true;
+    }
+
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Move a segment following a cut off segment aside, its
+/// transactions must not be replayed.
+static int
+discard (
+    sam_db_log_t *self,
+    int seq)
+{
+    char path [256], discarded [272];
+    segment_path (self, seq, path, 256);
+    snprintf (discarded, 272, "%s.discarded", path);
+
+    sam_log_errorf ("discarding segment '%s'", path);
+    if (rename (path, discarded)) {
+        sam_log_errorf ("could not rename segment '%s'", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Compare function for qsort ().
+static int
+compare_int (
+    const void *a,
+    const void *b)
+{
+    return *(int *) a - *(int *) b;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Open and replay all existing segments in order.
+static int
+restore (
+    sam_db_log_t *self)
+{
+    DIR *dir = opendir (self->home);
+    if (dir == NULL) {
+        sam_log_errorf ("could not open directory '%s'", self->home);
+        return -1;
+    }
+
+    int *seqs = NULL, n = 0, cap = 0;
+    size_t prefix_len = strlen (self->file);
+
+    struct dirent *dirent;
+    while ((dirent = readdir (dir)) != NULL) {
+        char *name = dirent->d_name;
+        if (strncmp (name, self->file, prefix_len) ||
+            name [prefix_len] != '.') {
+            continue;
+        }
+
+        char *end;
+        long seq = strtol (name + prefix_len + 1, &end, 10);
+        if (*end || seq <= 0) {
+            continue;
+        }
+
+        seqs = grow (seqs, n, &cap, sizeof (int));
+        seqs [n] = seq;
+        n += 1;
+    }
+
+    closedir (dir);
+    if (n) {
+        qsort (seqs, n, sizeof (int), compare_int);
+    }
+
+    int rc = 0;
+    bool cut = false;
+
+    for (int i = 0; !rc && i < n; i++) {
+        if (i && seqs [i] != seqs [i - 1] + 1) {
+            sam_log_errorf ("segment %d is missing", seqs [i - 1] + 1);
+            rc = -1;
+        }
+
+        // replaying stopped at the first failure
+        if (!rc && cut) {
+            rc = discard (self, seqs [i]);
+            continue;
+        }
+
+        segment_t *seg = segment_open (self, seqs [i]);
+        if (!rc && (seg == NULL || replay (self, seg, &cut))) {
+            rc = -1;
+        }
+    }
+
+    if (!rc && !n && segment_open (self, 1) == NULL) {
+        rc = -1;
+    }
+
+    // never append to a legacy segment
+    if (!rc && n && active_segment (self)->legacy) {
+        sam_log_info ("found legacy segments, beginning a new segment");
+        if (segment_open (self, active_segment (self)->seq + 1) == NULL) {
+            rc = -1;
+        }
+    }
+
+    free (seqs);
+    if (!rc) {
+        reclaim (self);
+        index_compact (self);
+    }
+
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Close (partially) initialized database.
+static void
+close_db (
+    sam_db_log_t *self)
+{
+    for (int i = 0; i < self->segments.n; i++) {
+        close (self->segments.list [i].fd);
+    }
+
+    for (int i = 0; i < self->index.n; i++) {
+        free (self->index.list [i].patch);
+    }
+
+    free (self->segments.list);
+    free (self->index.list);
+    free (self->undo.list);
+
+    free (self->wbuf.data);
+    free (self->rbuf.data);
+    free (self->ebuf.data);
+
+    free (self->home);
+    free (self->file);
+    free (self);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Opens all segments and rebuilds the index.
+static void *
+log_new (
+    zconfig_t *conf)
+{
+    char
+        *hname = zconfig_resolve (conf, "home", NULL),
+        *fname = zconfig_resolve (conf, "file", NULL),
+        *size_str = zconfig_resolve (conf, "segment", DEFAULT_SEGMENT_SIZE),
+        *txn_str = zconfig_resolve (conf, "transactions", NULL);
+
+    uint64_t segment_size;
+    if (hname == NULL || fname == NULL || txn_str == NULL ||
+        sam_cfg_binary_value (size_str, &segment_size) ||
+        UINT32_MAX / 2 < segment_size) {
+
+        sam_log_error ("could not load configuration");
+        return NULL;
+    }
+
+    sam_db_log_t *self = malloc (sizeof (sam_db_log_t));
+    assert (self);
+    memset (self, 0, sizeof (sam_db_log_t));
+
+    self->home = strdup (hname);
+    self->file = strdup (fname);
+    self->segment_size = segment_size;
+    self->op.pos = -1;
+
+    // without transactions, commits are not synced to disk
+    self->txn = (!strcmp (txn_str, "yes")? true: false);
+    if (self->txn) {
+        sam_log_info ("enabled transactions");
+    }
+    else {
+        sam_log_info ("disabled transactions");
+    }
+
+    if (restore (self)) {
+        sam_log_error ("could not restore log");
+        close_db (self);
+        return NULL;
+    }
+
+    sam_log_infof (
+        "db contains %d record(s) in %d segment(s)",
+        self->index.live, self->segments.n);
+
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Destroy the engine state.
+static void
+log_destroy (
+    void **db)
+{
+    sam_db_log_t *self = *db;
+    sam_log_infof ("db contains %d record(s)", self->index.live);
+
+    close_db (self);
+    *db = NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Either append all collected entries or revert the index.
+static sam_db_ret_t
+log_end (
+    void *db,
+    bool abort)
+{
+    sam_db_log_t *self = db;
+    sam_db_ret_t ret = SAM_DB_OK;
+
+    if (!self->op.active) {
+        return ret;
+    }
+
+    if (!abort && self->wbuf.size) {
+        uint32_t crc = checksum (self->wbuf.data, self->wbuf.size);
+        append (self, ENTRY_COMMIT, 0, 0, NULL, 0);
+
+        entry_t *commit = (entry_t *)
+            (self->wbuf.data + self->wbuf.size - sizeof (entry_t));
+        commit->crc = crc;
+
+        sam_log_trace ("commiting transaction");
+        if (flush (self)) {
+            ret = SAM_DB_ERROR;
+            abort = true;
+        }
+    }
+
+    if (abort) {
+        sam_log_error ("aborting transaction");
+        index_revert (self);
+    }
+    else {
+        index_commit (self);
+        reclaim (self);
+        index_compact (self);
+    }
+
+    self->wbuf.size = 0;
+    self->op.active = false;
+    self->op.pos = -1;
+    self->op.loaded = false;
+    self->op.edited = false;
+    return ret;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Copies the live records of the oldest segment to the active one
+/// in a transaction of its own, so that the oldest segment gets
+/// reclaimed. Only done if the live data is small compared to the
+/// segment size. A failure leaves the segments as they are.
+static void
+compact (
+    sam_db_log_t *self)
+{
+    segment_t *oldest = &self->segments.list [0];
+    if (self->segments.n < 2 || !oldest->live ||
+        (int64_t) self->segment_size < COMPACT_RATIO * oldest->live_size) {
+        return;
+    }
+
+    int seq = oldest->seq, record_c = 0;
+    self->op.active = true;
+
+    for (int i = 0; i < self->index.n; i++) {
+        record_t *record = &self->index.list [i];
+        if (!record->live || (record->seq != seq &&
+            (!record->patch || record->patch_seq != seq))) {
+            continue;
+        }
+
+        position (self, i);
+        if (load (self)) {
+            log_end (self, true);
+            return;
+        }
+
+        write_record (self, record->key, self->rbuf.data, self->rbuf.size);
+        record_c += 1;
+    }
+
+    if (log_end (self, false) == SAM_DB_OK) {
+        sam_log_tracef (
+            "compacted segment %d, copied %d record(s)", seq, record_c);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+/// Start collecting changes, begins a new segment if the active one
+/// is full.
+static sam_db_ret_t
+log_begin (
+    void *db)
+{
+    sam_db_log_t *self = db;
+    assert (!self->op.active);
+
+    segment_t *seg = active_segment (self);
+    if (self->segment_size <= seg->size) {
+        if (segment_open (self, seg->seq + 1) == NULL) {
+            return SAM_DB_ERROR;
+        }
+
+        reclaim (self);
+        compact (self);
+    }
+
+    self->op.active = true;
+    self->op.pos = -1;
+    return SAM_DB_OK;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the key of the current op-state.
+static uint64_t
+log_get_key (
+    void *db)
+{
+    sam_db_log_t *self = db;
+    return self->op.key;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Sets the key of the current op-state.
+static void
+log_set_key (
+    void *db,
+    uint64_t *id)
+{
+    sam_db_log_t *self = db;
+    self->op.key = *id;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Return the value of the current record. It gets read into memory
+/// on first access.
+static void
+log_get_val (
+    void *db,
+    size_t *size,
+    void **record)
+{
+    sam_db_log_t *self = db;
+
+    int rc = load (self);
+    assert (!rc);
+
+    if (size != NULL) {
+        *size = self->rbuf.size;
+    }
+
+    if (record != NULL) {
+        *record = self->rbuf.data;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+/// Return a copy of the current record, updates compare it with the
+/// stored version to determine the altered range.
+static void
+log_edit (
+    void *db,
+    size_t *size,
+    void **record)
+{
+    sam_db_log_t *self = db;
+
+    int rc = load (self);
+    assert (!rc);
+
+    if (!self->op.edited) {
+        reserve (&self->ebuf, self->rbuf.size);
+        memcpy (self->ebuf.data, self->rbuf.data, self->rbuf.size);
+        self->ebuf.size = self->rbuf.size;
+        self->op.edited = true;
+    }
+
+    if (size != NULL) {
+        *size = self->ebuf.size;
+    }
+
+    if (record != NULL) {
+        *record = self->ebuf.data;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+/// Position the cursor at the record with the provided key.
+static sam_db_ret_t
+log_get (
+    void *db,
+    uint64_t *id)
+{
+    sam_db_log_t *self = db;
+    sam_log_tracef ("get, setting cursor to '%" PRIu64 "'", *id);
+
+    bool found;
+    int pos = index_find (self, *id, &found);
+    self->op.key = *id;
+
+    if (!found || !self->index.list [pos].live) {
+        sam_log_tracef ("'%" PRIu64 "' was not found!", *id);
+        return SAM_DB_NOTFOUND;
+    }
+
+    position (self, pos);
+    return SAM_DB_OK;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Move the cursor to the previous or next live record. An unset
+/// cursor moves to the first or last record.
+static sam_db_ret_t
+log_sibling (
+    void *db,
+    sam_db_flag_t trav)
+{
+    sam_db_log_t *self = db;
+    assert (trav == SAM_DB_PREV || trav == SAM_DB_NEXT);
+
+    int pos = self->op.pos, step = 1;
+    if (trav == SAM_DB_PREV) {
+        step = -1;
+        if (pos == -1) {
+            pos = self->index.n;
+        }
+    }
+
+    do {
+        pos += step;
+    } while (
+        0 <= pos && pos < self->index.n &&
+        !self->index.list [pos].live);
+
+    if (pos < 0 || self->index.n <= pos) {
+        return SAM_DB_NOTFOUND;
+    }
+
+    position (self, pos);
+    sam_log_tracef ("get record '%" PRIu64 "' as sibling", self->op.key);
+    return SAM_DB_OK;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Append a record.
+static sam_db_ret_t
+log_put (
+    void *db,
+    size_t size,
+    byte *record)
+{
+    sam_db_log_t *self = db;
+
+    assert (record);
+    assert (self->op.active);
+
+    sam_log_tracef (
+        "putting '%" PRIu64 "' (size %zu) into the database",
+        self->op.key, size);
+
+    write_record (self, self->op.key, record, size);
+    return SAM_DB_OK;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Append a record consisting of several parts, they are gathered
+/// directly into the pending writes.
+static sam_db_ret_t
+log_putv (
+    void *db,
+    struct iovec *parts,
+    int part_c)
+{
+    sam_db_log_t *self = db;
+
+    assert (parts);
+    assert (self->op.active);
+
+    sam_log_tracef (
+        "putting '%" PRIu64 "' (%d parts) into the database",
+        self->op.key, part_c);
+
+    write_parts (self, self->op.key, parts, part_c);
+    return SAM_DB_OK;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Update a record. For SAM_DB_CURRENT, only the edited range gets
+/// appended; for SAM_DB_KEY the record gets stored with the current
+/// key.
+static sam_db_ret_t
+log_update (
+    void *db,
+    sam_db_flag_t kind)
+{
+    sam_db_log_t *self = db;
+
+    assert (kind == SAM_DB_CURRENT || kind == SAM_DB_KEY);
+    assert (self->op.active);
+
+    if (load (self)) {
+        return SAM_DB_ERROR;
+    }
+
+    buffer_t *buf = (self->op.edited)? &self->ebuf: &self->rbuf;
+
+    if (kind == SAM_DB_CURRENT) {
+        sam_log_tracef (
+            "update '%" PRIu64 "', replacing current", self->op.key);
+        if (self->op.edited && self->ebuf.size == self->rbuf.size) {
+            write_patch (self);
+        }
+        else {
+            uint64_t key = self->index.list [self->op.pos].key;
+            write_record (self, key, buf->data, buf->size);
+        }
+    }
+
+    else {
+        sam_log_tracef (
+            "update '%" PRIu64 "', inserting at new position",
+            self->op.key);
+        write_record (self, self->op.key, buf->data, buf->size);
+    }
+
+    return SAM_DB_OK;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Delete the record the cursor currently points to.
+static sam_db_ret_t
+log_del (
+    void *db)
+{
+    sam_db_log_t *self = db;
+
+    assert (self->op.active);
+    assert (0 <= self->op.pos && self->op.pos < self->index.n);
+
+    record_t *current = &self->index.list [self->op.pos];
+    sam_log_tracef ("deleting '%" PRIu64 "' from db", current->key);
+
+    record_t record;
+    memset (&record, 0, sizeof (record_t));
+    record.key = current->key;
+
+    append (self, ENTRY_DEL, record.key, 0, NULL, 0);
+    index_set (self, self->op.pos, &record);
+
+    self->op.loaded = false;
+    self->op.edited = false;
+    return SAM_DB_OK;
+}
+
+
+const sam_db_engine_t sam_db_log = {
+    .name = "log",
+
+    .new = log_new,
+    .destroy = log_destroy,
+
+    .begin = log_begin,
+    .end = log_end,
+
+    .get_key = log_get_key,
+    .set_key = log_set_key,
+    .get_val = log_get_val,
+    .edit = log_edit,
+
+    .get = log_get,
+    .sibling = log_sibling,
+    .put = log_put,
+    .putv = log_putv,
+    .update = log_update,
+    .del = log_del
+};
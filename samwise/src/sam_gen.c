@@ -15,6 +15,14 @@
 
    Gather all functions commonly used by multiple modules.
 
+   Backend sets are bitmaps of variable length where bit n stands for
+   the backend with the id n. Backend ids are small and get reused,
+   so most sets fit into a single byte. A set may be shorter than
+   necessary to contain an id, missing bytes count as zeroes.
+
+   Integers of the binary protocol (see rfc 8) are little-endian
+   regardless of the host byte order.
+
 */
 
 
@@ -53,3 +61,93 @@ sam_gen_handle_pipe (
 
     return 0;
 }
+
+
+//  --------------------------------------------------------------------------
+/// Returns the amount of bytes a backend set needs to contain the id.
+size_t
+sam_gen_set_size (
+    int id)
+{
+    assert (id >= 0);
+    return id / 8 + 1;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Checks if the id is contained in the backend set.
+bool
+sam_gen_set_contains (
+    const byte *set,
+    size_t size,
+    int id)
+{
+    if (size < sam_gen_set_size (id)) {
+        return false;
+    }
+
+    return set [id / 8] & (1 << (id % 8));
+}
+
+
+//  --------------------------------------------------------------------------
+/// Adds the id to the backend set. The set must be large enough.
+void
+sam_gen_set_add (
+    byte *set,
+    int id)
+{
+    set [id / 8] |= 1 << (id % 8);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Reads a little-endian 16 bit integer.
+uint16_t
+sam_gen_le16 (
+    const byte *data)
+{
+    return data [0] | data [1] << 8;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Reads a little-endian 32 bit integer.
+uint32_t
+sam_gen_le32 (
+    const byte *data)
+{
+    return
+        (uint32_t) data [0] |
+        (uint32_t) data [1] << 8 |
+        (uint32_t) data [2] << 16 |
+        (uint32_t) data [3] << 24;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Writes a little-endian 16 bit integer.
+byte *
+sam_gen_put_le16 (
+    byte *data,
+    uint16_t val)
+{
+    data [0] = val;
+    data [1] = val >> 8;
+    return data + 2;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Writes a little-endian 32 bit integer.
+byte *
+sam_gen_put_le32 (
+    byte *data,
+    uint32_t val)
+{
+    for (int i = 0; i < 4; i++) {
+        data [i] = val >> (8 * i);
+    }
+
+    return data + 4;
+}
@@ -16,18 +16,67 @@
    This is a wrapper around zmsg to enable convenient frame access,
    some memory management help and general error handling.
 
+   All frames are kept in a single buffer in their encoded form
+   (see sam_msg_encode) along with an offset table, so encoding is a
+   few memcpy's and decoding a single allocation. Popping only
+   advances the index of the first frame. Once a message is handed
+   to other threads, it must not be altered anymore: All read-only
+   accessors (_get (), _size (), _expect (), _encode ()) work on the
+   immutable view of the frames and can be used concurrently without
+   any locking or copying. The reference counter is atomic.
+
+   Payloads are not copied on their way through samwise: Large
+   frames received from zeromq are adopted instead of being copied
+   into the buffer, which only holds their size prefix. The buffer
+   and the adopted frames are reference counted chunks of immutable
+   memory, so messages split from, duplicated from or replacing a
+   frame of another message share them.
+
 */
 
 #include "../include/sam_prelude.h"
 
 
+/// reference counted, immutable memory shared by messages
+typedef struct chunk_t {
+    int refs;                      ///< owners, changed atomically
+    zframe_t *frame;               ///< adopted frame owning the data
+    byte *data;                    ///< follows the chunk if not adopted
+    size_t size;
+} chunk_t;
+
+
+/// one frame of the message
+typedef struct frame_t {
+    size_t pos;                    ///< offset of the frames size prefix
+    size_t size;                   ///< size of the frames data
+    chunk_t *ext;                  ///< adopted data, not in the buffer
+} frame_t;
+
+
+/// amount of frames indexed without an additional allocation
+#define INLINE_FRAMES 32
+
+
+/// frames of at least this size are adopted instead of copied
+#define ADOPT_SIZE 1024
+
+
 /// a zmsg wrapper
 struct sam_msg_t {
     int owner_refs;                ///< reference counting by _own ()
-    pthread_mutex_t own_lock;      ///< used in _own ()
-    pthread_mutex_t get_lock;      ///< used in _get ()
 
-    zlist_t *frames;               ///< payload of the message
+    void *data;                    ///< attached decoded representation
+    sam_msg_data_destructor *data_destructor; ///< destroys data
+
+    struct frames {
+        chunk_t *buf;              ///< all frames in their encoded form
+        frame_t *items;            ///< offset table of the buffer
+        int head;                  ///< position of the first frame
+        int tail;                  ///< position after the last frame
+        int capacity;              ///< allocated item slots
+        frame_t inline_items [INLINE_FRAMES]; ///< used for small messages
+    } frames;
 
     struct refs {
         zlist_t *s;                ///< for allocated strings
@@ -37,6 +86,72 @@ struct sam_msg_t {
 };
 
 
+//  --------------------------------------------------------------------------
+/// Create a chunk of the provided size to be filled by the caller.
+static chunk_t *
+chunk_new (
+    size_t size)
+{
+    chunk_t *chunk = malloc (sizeof (chunk_t) + size);
+    assert (chunk);
+
+    chunk->refs = 1;
+    chunk->frame = NULL;
+    chunk->data = (byte *) (chunk + 1);
+    chunk->size = size;
+    return chunk;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Create a chunk taking ownership of a frame. Its data gets
+/// referenced without being copied.
+static chunk_t *
+chunk_adopt (
+    zframe_t **frame)
+{
+    chunk_t *chunk = malloc (sizeof (chunk_t));
+    assert (chunk);
+
+    chunk->refs = 1;
+    chunk->frame = *frame;
+    chunk->data = zframe_data (*frame);
+    chunk->size = zframe_size (*frame);
+
+    *frame = NULL;
+    return chunk;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Become another owner of the chunk.
+static chunk_t *
+chunk_ref (
+    chunk_t *chunk)
+{
+    __atomic_add_fetch (&chunk->refs, 1, __ATOMIC_RELAXED);
+    return chunk;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Give up ownership, the last owner destroys the chunk.
+static void
+chunk_release (
+    chunk_t **chunk)
+{
+    if (!__atomic_sub_fetch (&(*chunk)->refs, 1, __ATOMIC_ACQ_REL)) {
+        if ((*chunk)->frame) {
+            zframe_destroy (&(*chunk)->frame);
+        }
+
+        free (*chunk);
+    }
+
+    *chunk = NULL;
+}
+
+
 //  --------------------------------------------------------------------------
 /// Used by zlist_purge () and zlist_destroy () for char * list items
 static void
@@ -61,12 +176,213 @@ refs_f_destructor (
 }
 
 
+//  --------------------------------------------------------------------------
+/// Remember memory handed out by pop (). The lists are created on
+/// demand, most messages never get popped from.
+static void
+keep (
+    zlist_t **refs,
+    void *item,
+    czmq_destructor destructor)
+{
+    if (*refs == NULL) {
+        *refs = zlist_new ();
+        zlist_set_destructor (*refs, destructor);
+    }
+
+    zlist_append (*refs, item);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Size of the prefix encoding the size of a frame (taken from
+/// zmsg_encode).
+static size_t
+prefix_size (
+    size_t size)
+{
+    return (size < 0xFF)? 1: 1 + 4;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the data of a frame inside the buffer.
+static byte *
+frame_data (
+    sam_msg_t *self,
+    frame_t *frame)
+{
+    if (frame->ext) {
+        return frame->ext->data;
+    }
+
+    return self->frames.buf->data + frame->pos + prefix_size (frame->size);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the offset of the buffer after the frame. Adopted frames
+/// only occupy their size prefix.
+static size_t
+frame_end (
+    frame_t *frame)
+{
+    size_t end = frame->pos + prefix_size (frame->size);
+    return (frame->ext)? end: end + frame->size;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns a null terminated copy of the frames data.
+static char *
+frame_strdup (
+    sam_msg_t *self,
+    frame_t *frame)
+{
+    char *str = malloc (frame->size + 1);
+    assert (str);
+
+    memcpy (str, frame_data (self, frame), frame->size);
+    str [frame->size] = '\0';
+    return str;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Write the size prefix of a frame to dest, returns the position
+/// after the prefix.
+static byte *
+write_prefix (
+    byte *dest,
+    size_t size)
+{
+    if (size < 0xFF) {
+        *dest++ = (byte) size;
+    }
+    else {
+        *dest++ = 0xFF;
+        *dest++ = (size >> 24) & 255;
+        *dest++ = (size >> 16) & 255;
+        *dest++ = (size >>  8) & 255;
+        *dest++ = size        & 255;
+    }
+
+    return dest;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Write a frame with its size prefix to dest, returns the position
+/// after the frame.
+static byte *
+write_frame (
+    byte *dest,
+    byte *data,
+    size_t size)
+{
+    dest = write_prefix (dest, size);
+    memcpy (dest, data, size);
+    return dest + size;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Append a frame to the offset table, takes ownership of the
+/// adopted data.
+static void
+append (
+    sam_msg_t *self,
+    size_t pos,
+    size_t size,
+    chunk_t *ext)
+{
+    struct frames *frames = &self->frames;
+
+    if (frames->tail == frames->capacity) {
+        frames->capacity *= 2;
+
+        if (frames->items == frames->inline_items) {
+            frames->items = malloc (frames->capacity * sizeof (frame_t));
+            assert (frames->items);
+            memcpy (
+                frames->items, frames->inline_items,
+                sizeof (frames->inline_items));
+        }
+        else {
+            frames->items = realloc (
+                frames->items, frames->capacity * sizeof (frame_t));
+            assert (frames->items);
+        }
+    }
+
+    frames->items [frames->tail].pos = pos;
+    frames->items [frames->tail].size = size;
+    frames->items [frames->tail].ext = ext;
+    frames->tail += 1;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Builds the offset table of the buffer (taken from zmsg_decode).
+static int
+index_frames (
+    sam_msg_t *self)
+{
+    byte *buf = self->frames.buf->data;
+    byte *source = buf;
+    byte *limit = buf + self->frames.buf->size;
+
+    while (source < limit) {
+        size_t pos = source - buf;
+        size_t frame_size = *source++;
+
+        if (frame_size == 0xFF) {
+            if (source > limit - 4) {
+                return -1;
+            }
+
+            frame_size = (source [0] << 24)
+                         + (source [1] << 16)
+                         + (source [2] << 8)
+                         +  source [3];
+            source += 4;
+        }
+
+        if ((size_t) (limit - source) < frame_size) {
+            return -1;
+        }
+
+        append (self, pos, frame_size, NULL);
+        source += frame_size;
+    }
+
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Remove the first frame.
+static frame_t *
+pop (
+    sam_msg_t *self)
+{
+    if (self->frames.head == self->frames.tail) {
+        return NULL;
+    }
+
+    frame_t *frame = &self->frames.items [self->frames.head];
+    self->frames.head += 1;
+    return frame;
+}
+
+
 //  --------------------------------------------------------------------------
 /// Converter function that accepts a type character and a variadic
 /// argument to be set.
 static void *
 resolve (
-    zframe_t *frame,
+    sam_msg_t *self,
+    frame_t *frame,
     char type,
     va_list arg_p)
 {
@@ -77,7 +393,7 @@ resolve (
             return NULL;
         }
 
-        *va_p = zframe_dup (frame);
+        *va_p = zframe_new (frame_data (self, frame), frame->size);
         return va_p;
     }
 
@@ -85,20 +401,21 @@ resolve (
     // pointer
     else if (type == 'p') {
         void **va_p = va_arg (arg_p, void **);
-        if (!va_p || zframe_size (frame) != sizeof (void *)) {
+        if (!va_p || frame->size != sizeof (void *)) {
             return NULL;
         }
 
-        *va_p = *((void **) zframe_data (frame));
+        memcpy (va_p, frame_data (self, frame), sizeof (void *));
         return va_p;
     }
 
 
     // string
     else if (type == 's') {
-        char *str = zframe_strdup (frame);
+        char *str = frame_strdup (self, frame);
         char **va_p = va_arg (arg_p, char **);
         if (!va_p) {
+            free (str);
             return NULL;
         }
 
@@ -109,15 +426,16 @@ resolve (
 
     // integer
     else if (type == 'i') {
-        char *str = zframe_strdup (frame);
+        char *str = frame_strdup (self, frame);
         int nbr = atoi (str);
         int *va_p = va_arg (arg_p, int *);
+        free (str);
+
         if (!va_p) {
             return NULL;
         }
 
         *va_p = nbr;
-        free (str);
         return va_p;
     }
 
@@ -127,37 +445,36 @@ resolve (
 
 
 //  --------------------------------------------------------------------------
-/// Get n char * elements.
+/// Get n char * elements. The position gets advanced past the list
+/// items, which either is the head of the message (remove) or a
+/// position of the callers view.
 static int
 resolve_l (
     sam_msg_t *self,
-    zframe_t *frame,
-    zlist_t *frames,
+    frame_t *frame,
+    int *pos,
     zlist_t **list,
     bool remove)
 {
-    char *strdata = zframe_strdup (frame);
+    char *strdata = frame_strdup (self, frame);
     int amount = atoi (strdata);
     free (strdata);
 
-    if (remove) {
-        zframe_destroy (&frame);
-    }
-
     *list = zlist_new ();
 
     while (amount > 0) {
 
-        frame = (remove)? zlist_pop (frames): zlist_next (frames);
-        if (frame == NULL) {
+        if (*pos == self->frames.tail) {
             return -1;
         }
 
-        char *str = zframe_strdup (frame);
+        frame = &self->frames.items [*pos];
+        *pos += 1;
+
+        char *str = frame_strdup (self, frame);
 
         if (remove) {
-            zlist_append (self->refs.s, str);
-            zframe_destroy (&frame);
+            keep (&self->refs.s, str, refs_s_destructor);
         }
 
         zlist_append (*list, str);
@@ -173,30 +490,30 @@ resolve_l (
 
 
 //  --------------------------------------------------------------------------
-/// Constructor function used by both _new () and _decode ().
+/// Constructor function used by _new (), _decode () and share ().
+/// Takes ownership of the buffer, the frames get appended by the
+/// caller.
 static sam_msg_t *
-new ()
+new (
+    chunk_t *buf)
 {
     sam_msg_t *self = malloc (sizeof (sam_msg_t));
     assert (self);
 
     // store for frames
-    self->frames = zlist_new ();
-    zlist_set_destructor (self->frames, refs_f_destructor);
+    self->frames.buf = buf;
+    self->frames.items = self->frames.inline_items;
+    self->frames.head = 0;
+    self->frames.tail = 0;
+    self->frames.capacity = INLINE_FRAMES;
 
     // store for popped values
-    self->refs.s = zlist_new ();
-    self->refs.f = zlist_new ();
+    self->refs.s = NULL;
+    self->refs.f = NULL;
 
-    zlist_set_destructor (self->refs.s, refs_s_destructor);
-    zlist_set_destructor (self->refs.f, refs_f_destructor);
-
-    // mutexes
-    int rc = pthread_mutex_init (&self->own_lock, NULL);
-    assert (!rc);
-
-    rc = pthread_mutex_init (&self->get_lock, NULL);
-    assert (!rc);
+    // attachment
+    self->data = NULL;
+    self->data_destructor = NULL;
 
     // reference counting
     self->owner_refs = 1;
@@ -206,22 +523,95 @@ new ()
 
 
 //  --------------------------------------------------------------------------
-/// Create a new sam_msg instance.
+/// Create a new sam_msg instance containing the frames from the
+/// position on to (excluding) the end position. The frames data is
+/// shared, not copied.
+static sam_msg_t *
+share (
+    sam_msg_t *self,
+    int pos,
+    int end)
+{
+    sam_msg_t *msg = new (chunk_ref (self->frames.buf));
+
+    for (; pos < end; pos++) {
+        frame_t *frame = &self->frames.items [pos];
+        chunk_t *ext = (frame->ext)? chunk_ref (frame->ext): NULL;
+        append (msg, frame->pos, frame->size, ext);
+    }
+
+    return msg;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Move a contiguous frame collection into a new sam_msg instance.
+/// Collections must not be empty (see rfc 4).
+static int
+resolve_m (
+    sam_msg_t *self,
+    frame_t *frame,
+    sam_msg_t **msg)
+{
+    char *strdata = frame_strdup (self, frame);
+    int amount = atoi (strdata);
+    free (strdata);
+
+    if (amount <= 0 || amount > sam_msg_size (self)) {
+        return -1;
+    }
+
+    int pos = self->frames.head;
+    *msg = share (self, pos, pos + amount);
+    self->frames.head += amount;
+
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Create a new sam_msg instance. Small frames get copied into a
+/// single buffer, large ones get adopted.
 sam_msg_t *
 sam_msg_new (
     zmsg_t **zmsg)
 {
     assert (zmsg);
-    sam_msg_t *self = new ();
 
-    // optimally, this could just access zmsg->frames...
-    zframe_t *frame = zmsg_pop (*zmsg);
+    size_t size = 0;
+    zframe_t *frame = zmsg_first (*zmsg);
     while (frame) {
-        zlist_append (self->frames, frame);
-        frame = zmsg_pop (*zmsg);
+        size_t frame_size = zframe_size (frame);
+        size += prefix_size (frame_size);
+        if (frame_size < ADOPT_SIZE) {
+            size += frame_size;
+        }
+
+        frame = zmsg_next (*zmsg);
+    }
+
+    sam_msg_t *self = new (chunk_new (size));
+    byte
+        *buf = self->frames.buf->data,
+        *dest = buf;
+
+    while ((frame = zmsg_pop (*zmsg))) {
+        size_t
+            pos = dest - buf,
+            frame_size = zframe_size (frame);
+
+        if (frame_size < ADOPT_SIZE) {
+            dest = write_frame (dest, zframe_data (frame), frame_size);
+            append (self, pos, frame_size, NULL);
+            zframe_destroy (&frame);
+        }
+        else {
+            dest = write_prefix (dest, frame_size);
+            append (self, pos, frame_size, chunk_adopt (&frame));
+        }
     }
-    zmsg_destroy (zmsg);
 
+    zmsg_destroy (zmsg);
     return self;
 }
 
@@ -237,23 +627,37 @@ sam_msg_destroy (
 
     // please make sure no one tries to _own after the first
     // _destroys, @see sam_msg_own
-    pthread_mutex_lock (&(*self)->own_lock);
-    (*self)->owner_refs -= 1;
-    int refs = (*self)->owner_refs;
-    pthread_mutex_unlock (&(*self)->own_lock);
+    int refs = __atomic_sub_fetch (
+        &(*self)->owner_refs, 1, __ATOMIC_ACQ_REL);
 
     if (refs) {
         return;
     }
 
 
-    zlist_destroy (&(*self)->frames);
+    if ((*self)->data) {
+        (*self)->data_destructor (&(*self)->data);
+    }
 
-    zlist_destroy (&(*self)->refs.s);
-    zlist_destroy (&(*self)->refs.f);
+    for (int pos = 0; pos < (*self)->frames.tail; pos++) {
+        frame_t *frame = &(*self)->frames.items [pos];
+        if (frame->ext) {
+            chunk_release (&frame->ext);
+        }
+    }
+
+    chunk_release (&(*self)->frames.buf);
+    if ((*self)->frames.items != (*self)->frames.inline_items) {
+        free ((*self)->frames.items);
+    }
 
-    pthread_mutex_destroy (&(*self)->own_lock);
-    pthread_mutex_destroy (&(*self)->get_lock);
+    if ((*self)->refs.s) {
+        zlist_destroy (&(*self)->refs.s);
+    }
+
+    if ((*self)->refs.f) {
+        zlist_destroy (&(*self)->refs.f);
+    }
 
     free (*self);
     *self = NULL;
@@ -261,20 +665,104 @@ sam_msg_destroy (
 
 
 //  --------------------------------------------------------------------------
-/// Duplicate a message.
+/// Duplicate a message. The frames are immutable, so the copy shares
+/// their data.
 sam_msg_t *
 sam_msg_dup (
     sam_msg_t *self)
 {
-    sam_msg_t *dup = new ();
+    return share (self, self->frames.head, self->frames.tail);
+}
 
-    zframe_t *frame = zlist_first (self->frames);
-    while (frame) {
-        zlist_append (dup->frames, zframe_dup (frame));
-        frame = zlist_next (self->frames);
+
+//  --------------------------------------------------------------------------
+/// Move the next n frames into a new message. Used to split frame
+/// collections whose size is known beforehand.
+sam_msg_t *
+sam_msg_split (
+    sam_msg_t *self,
+    int n)
+{
+    assert (self);
+
+    if (n < 0 || sam_msg_size (self) < n) {
+        return NULL;
+    }
+
+    int pos = self->frames.head;
+    self->frames.head += n;
+    return share (self, pos, pos + n);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Replace the frame at the position (relative to the first frame)
+/// by copying the remaining frames and the new one into a new
+/// buffer. Adopted frames are kept, already popped frames are
+/// dropped. Frames handed out by sam_msg_frame () become invalid.
+int
+sam_msg_replace (
+    sam_msg_t *self,
+    int pos,
+    byte *data,
+    size_t size)
+{
+    assert (self);
+
+    struct frames *frames = &self->frames;
+    pos += frames->head;
+    if (pos < frames->head || frames->tail <= pos) {
+        return -1;
+    }
+
+    for (int i = 0; i < frames->head; i++) {
+        if (frames->items [i].ext) {
+            chunk_release (&frames->items [i].ext);
+        }
+    }
+
+    if (frames->items [pos].ext) {
+        chunk_release (&frames->items [pos].ext);
+    }
+
+    frames->items [pos].size = size;
+
+    size_t buf_size = prefix_size (size) + size;
+    for (int i = frames->head; i < frames->tail; i++) {
+        if (i != pos) {
+            frame_t *frame = &frames->items [i];
+            buf_size += frame_end (frame) - frame->pos;
+        }
     }
 
-    return dup;
+    chunk_t *buf = chunk_new (buf_size);
+    byte *dest = buf->data;
+
+    int n = 0;
+    for (int i = frames->head; i < frames->tail; i++) {
+        frame_t frame = frames->items [i];
+        size_t frame_pos = dest - buf->data;
+
+        if (i == pos) {
+            dest = write_frame (dest, data, size);
+        }
+        else if (frame.ext) {
+            dest = write_prefix (dest, frame.size);
+        }
+        else {
+            dest = write_frame (dest, frame_data (self, &frame), frame.size);
+        }
+
+        frame.pos = frame_pos;
+        frames->items [n] = frame;
+        n += 1;
+    }
+
+    chunk_release (&frames->buf);
+    frames->buf = buf;
+    frames->head = 0;
+    frames->tail = n;
+    return 0;
 }
 
 
@@ -302,9 +790,7 @@ void
 sam_msg_own (
     sam_msg_t *self)
 {
-    pthread_mutex_lock (&self->own_lock);
-    self->owner_refs += 1;
-    pthread_mutex_unlock (&self->own_lock);
+    __atomic_add_fetch (&self->owner_refs, 1, __ATOMIC_RELAXED);
 }
 
 
@@ -314,7 +800,62 @@ int
 sam_msg_size (
     sam_msg_t *self)
 {
-    return zlist_size (self->frames);
+    return self->frames.tail - self->frames.head;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Attach data to the message, e.g. a decoded representation of its
+/// frames. The data gets destroyed with the message. It must be
+/// attached before the message gets shared and must not be altered
+/// afterwards.
+void
+sam_msg_set_data (
+    sam_msg_t *self,
+    void *data,
+    sam_msg_data_destructor *destructor)
+{
+    assert (self);
+    assert (self->data == NULL);
+    assert (destructor);
+
+    self->data = data;
+    self->data_destructor = destructor;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the attached data or NULL.
+void *
+sam_msg_data (
+    sam_msg_t *self)
+{
+    assert (self);
+    return self->data;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the data of the frame at the provided position without
+/// copying it. The memory belongs to the message.
+int
+sam_msg_frame (
+    sam_msg_t *self,
+    int pos,
+    byte **data,
+    size_t *size)
+{
+    assert (self);
+    assert (0 <= pos);
+
+    if (sam_msg_size (self) <= pos) {
+        return -1;
+    }
+
+    frame_t *frame = &self->frames.items [self->frames.head + pos];
+    *data = frame_data (self, frame);
+    *size = frame->size;
+    return 0;
 }
 
 
@@ -328,8 +869,14 @@ sam_msg_free (
     sam_msg_t *self)
 {
     assert (self);
-    zlist_purge (self->refs.s);
-    zlist_purge (self->refs.f);
+
+    if (self->refs.s) {
+        zlist_purge (self->refs.s);
+    }
+
+    if (self->refs.f) {
+        zlist_purge (self->refs.f);
+    }
 }
 
 
@@ -344,10 +891,12 @@ sam_msg_free (
 ///   'f': for zframe_t *
 ///   'p': for void *
 ///   'l': for zlist_t * containing char *
+///   'm': for sam_msg_t * containing a non-empty frame collection
+///   '?': skips a frame
 ///
 /// Pop'd or contained 's' and 'f' are automatically garbage collected
 /// with sam_msg_destroy () or manually by invoking sam_msg_free ()
-/// Proper destruction of 'p' must be handled by the
+/// Proper destruction of 'p' and 'm' must be handled by the
 /// caller. Obviously, 'i' must not be garbage collected.
 int
 sam_msg_pop (
@@ -362,7 +911,7 @@ sam_msg_pop (
     va_start (arg_p, pic);
 
     while (*pic) {
-        zframe_t *frame = zlist_pop (self->frames);
+        frame_t *frame = pop (self);
         if (frame == NULL) {
             return -1;
         }
@@ -374,25 +923,39 @@ sam_msg_pop (
                 return -1;
             }
 
-            if (resolve_l (self, frame, self->frames, list, true)) {
+            if (resolve_l (self, frame, &self->frames.head, list, true)) {
+                return -1;
+            }
+        }
+
+        // handle 'm'
+        else if (*pic == 'm') {
+            sam_msg_t **msg = va_arg (arg_p, sam_msg_t **);
+            if (!msg) {
+                return -1;
+            }
+
+            if (resolve_m (self, frame, msg)) {
                 return -1;
             }
         }
 
+        // skip '?'
+        else if (*pic == '?') {
+        }
+
         // handle others
         else {
-            void *ptr = resolve (frame, *pic, arg_p);
-            zframe_destroy (&frame);
-
+            void *ptr = resolve (self, frame, *pic, arg_p);
             if (ptr == NULL) {
                 return -1;
             }
 
             if (*pic == 'f') {
-                zlist_append (self->refs.f, *(zframe_t **) ptr);
+                keep (&self->refs.f, *(zframe_t **) ptr, refs_f_destructor);
             }
             else if (*pic == 's') {
-                zlist_append (self->refs.s, *(char **) ptr);
+                keep (&self->refs.s, *(char **) ptr, refs_s_destructor);
             }
         }
 
@@ -408,7 +971,8 @@ sam_msg_pop (
 /// Get data from the message without removing it. Caller is
 /// responsible for freeing all allocated memory ('s', 'f', 'l'). For
 /// 'l', a correct destructor function is set for items, so a call to
-/// zlist_destroy is sufficient to free all memory.
+/// zlist_destroy is sufficient to free all memory. Only reads the
+/// immutable frame view and is therefore safe for concurrent use.
 int
 sam_msg_get (
     sam_msg_t *self,
@@ -418,17 +982,14 @@ sam_msg_get (
     assert (self);
     assert (pic);
 
-    // copy list for thread safety
-    pthread_mutex_lock (&self->get_lock);
-    zlist_t *frames = zlist_dup (self->frames);
-    pthread_mutex_unlock (&self->get_lock);
-    zlist_set_destructor (frames, NULL);
-
     va_list arg_p;
     va_start (arg_p, pic);
 
-    zframe_t *frame = zlist_first (frames);
-    while (*pic && frame != NULL) {
+    int pos = self->frames.head;
+    while (*pic && pos < self->frames.tail) {
+        frame_t *frame = &self->frames.items [pos];
+        pos += 1;
+
         if (*pic != '?') {
 
             if (*pic == 'l') {
@@ -437,25 +998,22 @@ sam_msg_get (
                     return -1;
                 }
 
-                if (resolve_l (self, frame, frames, list, false)) {
+                if (resolve_l (self, frame, &pos, list, false)) {
                     return -1;
                 }
             }
 
             else {
-                void *ptr = resolve (frame, *pic, arg_p);
+                void *ptr = resolve (self, frame, *pic, arg_p);
                 if (ptr == NULL) {
                     return -1;
                 }
             }
         }
 
-        frame = zlist_next (frames);
         pic += 1;
     }
 
-    // clean up
-    zlist_destroy (&frames);
     va_end (arg_p);
 
     // insufficient frames
@@ -485,28 +1043,32 @@ sam_msg_expect (
     va_list arg_p;
     va_start (arg_p, size);
 
-    zframe_t *frame = zlist_first (self->frames);
+    int pos = self->frames.head;
     while (size > 0) {
+        if (pos == self->frames.tail) {
+            return -1;
+        }
+
+        frame_t *frame = &self->frames.items [pos];
+        pos += 1;
+
         sam_msg_rule_t rule = va_arg (arg_p, sam_msg_rule_t);
-        if (rule == SAM_MSG_NONZERO && zframe_size (frame) == 0) {
+        if (rule == SAM_MSG_NONZERO && frame->size == 0) {
             return -1;
         }
 
         if (rule == SAM_MSG_LIST) {
-            char *str = zframe_strdup (frame);
+            char *str = frame_strdup (self, frame);
             int amount = atoi (str);
             free (str);
 
-            while (amount) {
-                frame = zlist_next (self->frames);
-                if (frame == NULL) {
-                    return -1;
-                }
-                amount -= 1;
+            if (amount < 0 || self->frames.tail - pos < amount) {
+                return -1;
             }
+
+            pos += amount;
         }
 
-        frame = zlist_next (self->frames);
         size -= 1;
     }
 
@@ -516,35 +1078,102 @@ sam_msg_expect (
 
 
 //  --------------------------------------------------------------------------
-/// Returns the number of bytes needed to store the fully encoded message.
+/// Describes the encoded non-popped frames as parts of memory: Runs
+/// of the buffer interrupted by the adopted frames. Only counts the
+/// parts if none are provided.
+static int
+parts (
+    sam_msg_t *self,
+    struct iovec *iov)
+{
+    struct frames *frames = &self->frames;
+    if (frames->head == frames->tail) {
+        return 0;
+    }
+
+    int part_c = 0;
+    byte *buf = frames->buf->data;
+    size_t run = frames->items [frames->head].pos;
+
+    for (int pos = frames->head; pos < frames->tail; pos++) {
+        frame_t *frame = &frames->items [pos];
+        if (frame->ext) {
+            size_t end = frame_end (frame);
+            if (iov) {
+                iov [part_c].iov_base = buf + run;
+                iov [part_c].iov_len = end - run;
+                iov [part_c + 1].iov_base = frame->ext->data;
+                iov [part_c + 1].iov_len = frame->size;
+            }
+
+            part_c += 2;
+            run = end;
+        }
+    }
+
+    size_t end = frame_end (&frames->items [frames->tail - 1]);
+    if (run < end) {
+        if (iov) {
+            iov [part_c].iov_base = buf + run;
+            iov [part_c].iov_len = end - run;
+        }
+
+        part_c += 1;
+    }
+
+    return part_c;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Returns the number of bytes needed to store the fully encoded
+/// message.
 size_t
 sam_msg_encoded_size (
     sam_msg_t *self)
 {
     assert (self);
 
-    size_t buf_size = 0;
-    zframe_t *frame = zlist_first (self->frames);
+    size_t size = 0;
+    for (int pos = self->frames.head; pos < self->frames.tail; pos++) {
+        frame_t *frame = &self->frames.items [pos];
+        size += prefix_size (frame->size) + frame->size;
+    }
 
-    while (frame != NULL) {
-        size_t frame_size = zframe_size (frame);
+    return size;
+}
 
-        if (frame_size < 0xFF) {
-            buf_size += frame_size + 1;
-        }
-        else {
-            buf_size += frame_size + 1 + 4;
-        }
 
-        frame = zlist_next (self->frames);
-    }
+//  --------------------------------------------------------------------------
+/// Returns the number of parts of memory the encoded message
+/// consists of.
+int
+sam_msg_encoded_parts (
+    sam_msg_t *self)
+{
+    assert (self);
+    return parts (self, NULL);
+}
+
 
-    return buf_size;
+//  --------------------------------------------------------------------------
+/// Describe the encoded message by parts of memory without copying
+/// anything, e.g. to write them with a single system call. The parts
+/// belong to the message.
+int
+sam_msg_encode_parts (
+    sam_msg_t *self,
+    struct iovec *iov)
+{
+    assert (self);
+    assert (iov);
+    return parts (self, iov);
 }
 
 
 //  --------------------------------------------------------------------------
-/// Encode a sam_msg object into a buffer.
+/// Encode a sam_msg object into a buffer. All non-popped frames are
+/// copied with one memcpy per part.
 void
 sam_msg_encode (
     sam_msg_t *self,
@@ -553,79 +1182,50 @@ sam_msg_encode (
     assert (self);
     assert (*buf);
 
-    // taken from zmsg_encode
     byte *dest = *buf;
-    zframe_t *frame = zlist_first (self->frames);
+    byte *data = self->frames.buf->data;
+    size_t run = 0, end = 0;
 
-    while (frame) {
-        size_t frame_size = zframe_size (frame);
-        if (frame_size < 0xFF) {
-            *dest++ = (byte) frame_size;
-            memcpy (dest, zframe_data (frame), frame_size);
-            dest += frame_size;
+    for (int pos = self->frames.head; pos < self->frames.tail; pos++) {
+        frame_t *frame = &self->frames.items [pos];
+        if (pos == self->frames.head) {
+            run = frame->pos;
         }
-        else {
-            *dest++ = 0xFF;
-            *dest++ = (frame_size >> 24) & 255;
-            *dest++ = (frame_size >> 16) & 255;
-            *dest++ = (frame_size >>  8) & 255;
-            *dest++ = frame_size        & 255;
-            memcpy (dest, zframe_data (frame), frame_size);
-            dest += frame_size;
+
+        end = frame_end (frame);
+        if (frame->ext) {
+            memcpy (dest, data + run, end - run);
+            dest += end - run;
+
+            memcpy (dest, frame->ext->data, frame->size);
+            dest += frame->size;
+            run = end;
         }
-        frame = zlist_next (self->frames);
+    }
+
+    if (run < end) {
+        memcpy (dest, data + run, end - run);
     }
 }
 
 
 //  --------------------------------------------------------------------------
-/// Decode a sam_msg object from a buffer.
+/// Decode a sam_msg object from a buffer. The buffer gets copied
+/// with a single allocation and indexed, returns NULL if it is
+/// malformed. The copy is needed as storage engines only lend their
+/// memory.
 sam_msg_t *
 sam_msg_decode (
     byte *buf,
     size_t size)
 {
-    // taken from zmsg_decode
-    sam_msg_t *self = new ();
-    if (!self) {
-        return NULL;
+    sam_msg_t *self = new (chunk_new (size));
+    if (size) {
+        memcpy (self->frames.buf->data, buf, size);
     }
 
-    byte *source = buf;
-    byte *limit = buf + size;
-
-    while (source < limit) {
-        size_t frame_size = *source++;
-        if (frame_size == 0xFF) {
-            if (source > limit - 4) {
-                sam_msg_destroy (&self);
-                break;
-            }
-
-            frame_size = (source [0] << 24)
-                         + (source [1] << 16)
-                         + (source [2] << 8)
-                         +  source [3];
-            source += 4;
-        }
-
-        if (source > limit - frame_size) {
-            sam_msg_destroy (&self);
-            break;
-        }
-
-        zframe_t *frame = zframe_new (source, frame_size);
-        if (frame) {
-            if (zlist_append (self->frames, frame)) {
-                sam_msg_destroy (&self);
-                break;
-            }
-            source += frame_size;
-        }
-        else {
-            sam_msg_destroy (&self);
-            break;
-        }
+    if (index_frames (self)) {
+        sam_msg_destroy (&self);
     }
 
     return self;
@@ -14,7 +14,10 @@
    @file samd.c
 
    This is the frontend clients communicate with. Used as a daemon
-   process utilizing libsam.
+   process utilizing libsam. Besides the REP endpoint, an optional
+   ROUTER endpoint accepts tagged requests. Clients may pipeline many
+   of them and get replies (out of order) as soon as the requests
+   got persisted (see rfc 05).
 
 */
 
@@ -29,6 +32,7 @@
 typedef struct samd_t {
     sam_t *sam;              ///< encapsulates a sam thread
     zsock_t *client_rep;     ///< REPLY socket for client requests
+    zsock_t *client_router;  ///< optional ROUTER socket for tagged requests
     sam_stat_handle_t *stat; ///< gathers metrics
 } samd_t;
 
@@ -43,11 +47,96 @@ create_error (
     ret->rc = -1;
     ret->msg = msg;
     ret->allocated = false;
+    ret->count = 0;
+    ret->receipts = NULL;
     return ret;
 }
 
 
 
+//  --------------------------------------------------------------------------
+/// Checks the protocol number to decide if libsam can handle the
+/// request. Returns an error object if not, NULL otherwise.
+static sam_ret_t *
+check_req (
+    samd_t *self,
+    int version,
+    zmsg_t **zmsg)
+{
+    sam_stat (self->stat, "samd.accepted requests", 1);
+    sam_ret_t *ret = NULL;
+
+    if (version == -1) {
+        ret = create_error ("malformed request");
+    }
+
+    else if (
+        version < SAM_PROTOCOL_VERSION_MIN ||
+        version > SAM_PROTOCOL_VERSION) {
+        ret = create_error ("wrong protocol version");
+    }
+
+    else if (zmsg_size (*zmsg) < 1) {
+        ret = create_error ("no payload");
+    }
+
+    if (ret) {
+        zmsg_destroy (zmsg);
+    }
+    else {
+        sam_stat (self->stat, "samd.valid requests", 1);
+    }
+
+    return ret;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Send the reply to a client. The (optional) envelope gets prepended
+/// to route the reply. Free's the return object and the envelope.
+/// Returns -1 if samd must restart, 0 otherwise.
+static int
+send_reply (
+    zsock_t *sock,
+    zmsg_t **envelope,
+    sam_ret_t *ret)
+{
+    sam_log_tracef ("sending reply to client (%d)", ret->rc);
+
+    zmsg_t *reply = (envelope)? *envelope: zmsg_new ();
+    if (envelope) {
+        *envelope = NULL;
+    }
+
+    int rc = (ret->rc == SAM_RET_RESTART)? 0: ret->rc;
+    zmsg_addstrf (reply, "%d", rc);
+    zmsg_addstr (reply, ret->msg);
+
+    // batched requests: append one receipt per request
+    if (ret->count) {
+        zmsg_addstrf (reply, "%d", ret->count);
+
+        for (int i = 0; i < ret->count; i++) {
+            zmsg_addstrf (reply, "%d", ret->receipts [i]);
+        }
+    }
+
+    zmsg_send (&reply, sock);
+
+    if (ret->allocated) {
+        free (ret->msg);
+    }
+
+    if (ret->receipts) {
+        free (ret->receipts);
+    }
+
+    rc = (ret->rc == SAM_RET_RESTART)? -1: 0;
+    free (ret);
+    return rc;
+}
+
+
 //  --------------------------------------------------------------------------
 /// Handle external publishing/rpc requests. Checks the protocol
 /// number to decide if libsam can handle it and then either delegates
@@ -59,48 +148,92 @@ handle_req (
     void *args)
 {
     samd_t *self = args;
-    sam_ret_t *ret;
 
     zmsg_t *zmsg = zmsg_new ();
     int version = -1;
 
     zsock_recv (client_rep, "im", &version, &zmsg);
-    sam_stat (self->stat, "samd.accepted requests", 1);
+    sam_ret_t *ret = check_req (self, version, &zmsg);
 
-    if (version == -1) {
-        ret = create_error ("malformed request");
-        zmsg_destroy (&zmsg);
+    if (!ret) {
+        sam_msg_t *msg = sam_msg_new (&zmsg);
+        ret = sam_eval (self->sam, version, msg);
     }
 
-    else if (version != SAM_PROTOCOL_VERSION) {
-        ret = create_error ("wrong protocol version");
-        zmsg_destroy (&zmsg);
+    return send_reply (client_rep, NULL, ret);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Handle tagged requests arriving on the router socket. The routing
+/// id and the client provided tag form the envelope, which is handed
+/// to libsam and comes back with the receipt.
+static int
+handle_async_req (
+    zloop_t *loop UU,
+    zsock_t *client_router,
+    void *args)
+{
+    samd_t *self = args;
+
+    zmsg_t *zmsg = zmsg_recv (client_router);
+    if (!zmsg) {
+        return 0;
     }
 
-    else if (zmsg_size (zmsg) < 1) {
-        ret = create_error ("no payload");
+    // routing id and tag
+    zmsg_t *envelope = zmsg_new ();
+    for (int i = 0; i < 2 && zmsg_size (zmsg); i++) {
+        zframe_t *frame = zmsg_pop (zmsg);
+        zmsg_append (envelope, &frame);
+    }
+
+    if (zmsg_size (envelope) < 2) {
+        sam_log_error ("discarding request without tag");
+        zmsg_destroy (&envelope);
         zmsg_destroy (&zmsg);
+        return 0;
     }
 
-    else {
-        sam_stat (self->stat, "samd.valid requests", 1);
+    int version = -1;
+    char *version_str = zmsg_popstr (zmsg);
+    if (version_str) {
+        version = atoi (version_str);
+        free (version_str);
+    }
 
+    sam_ret_t *ret = check_req (self, version, &zmsg);
+    if (!ret) {
         sam_msg_t *msg = sam_msg_new (&zmsg);
-        ret = sam_eval (self->sam, msg);
+        ret = sam_eval_async (self->sam, version, msg, envelope);
     }
 
-    sam_log_tracef ("sending reply to client (%d)", ret->rc);
+    // reply arrives later as a receipt
+    if (!ret) {
+        return 0;
+    }
 
-    int rc = (ret->rc == SAM_RET_RESTART)? 0: ret->rc;
-    zsock_send (client_rep, "is", rc, ret->msg);
+    return send_reply (client_router, &envelope, ret);
+}
 
-    if (ret->allocated) {
-        free (ret->msg);
-    }
 
-    rc = (ret->rc == SAM_RET_RESTART)? -1: 0;
-    free (ret);
-    return rc;
+//  --------------------------------------------------------------------------
+/// Handle receipts of asynchronous requests and route them to
+/// the client.
+static int
+handle_receipt (
+    zloop_t *loop UU,
+    zsock_t *receipts,
+    void *args)
+{
+    samd_t *self = args;
+
+    zmsg_t *envelope;
+    sam_ret_t *ret;
+
+    sam_log_trace ("recv () receipt");
+    zsock_recv (receipts, "pp", &envelope, &ret);
+    return send_reply (self->client_router, &envelope, ret);
 }
 
 
@@ -113,6 +246,7 @@ samd_destroy (
     sam_log_info ("destroying samd");
 
     zsock_destroy (&(*self)->client_rep);
+    zsock_destroy (&(*self)->client_router);
     sam_destroy (&(*self)->sam);
     sam_stat_handle_destroy (&(*self)->stat);
 
@@ -130,6 +264,9 @@ samd_new (
     samd_t *self = malloc (sizeof (samd_t));
     assert (self);
 
+    self->client_rep = NULL;
+    self->client_router = NULL;
+
     self->stat = sam_stat_handle_new ();
 
     sam_cfg_t *cfg = sam_cfg_new (cfg_file);
@@ -157,6 +294,17 @@ samd_new (
 
     sam_log_tracef ("bound public endpoint '%s'", endpoint);
 
+    // the router endpoint is optional
+    if (!sam_cfg_async_endpoint (cfg, &endpoint)) {
+        self->client_router = zsock_new_router (endpoint);
+        if (!self->client_router) {
+            sam_log_errorf ("could not bind endpoint '%s'", endpoint);
+            goto abort;
+        }
+
+        sam_log_tracef ("bound asynchronous endpoint '%s'", endpoint);
+    }
+
     rc = sam_init (self->sam, &cfg);
     if (rc) {
         goto abort;
@@ -185,6 +333,11 @@ samd_start (
 {
     zloop_t *loop = zloop_new ();
     zloop_reader (loop, self->client_rep, handle_req, self);
+
+    if (self->client_router) {
+        zloop_reader (loop, self->client_router, handle_async_req, self);
+        zloop_reader (loop, sam_receipts (self->sam), handle_receipt, self);
+    }
     int rc = zloop_start (loop);
     zloop_destroy (&loop);
     sam_log_info ("leaving main loop");
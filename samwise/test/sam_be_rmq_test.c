@@ -14,7 +14,7 @@
 
 // rabbitmq instance
 char *be_name = "test";
-uint64_t be_id = 1;
+int be_id = 1;
 sam_be_rmq_t *rabbit;
 
 // feedback channel for async. communication
@@ -24,9 +24,10 @@ sam_backend_t *backend;
 
 
 //  --------------------------------------------------------------------------
-/// Setups the connection to a RabbitMQ broker.
+/// Setups the connection to a RabbitMQ broker with the provided
+/// window of unconfirmed messages.
 static void
-setup_connection ()
+connect_window (int window)
 {
     rabbit = sam_be_rmq_new (be_name, be_id);
     if (!rabbit) {
@@ -38,7 +39,8 @@ setup_connection ()
         .port = 15672,
         .user = "guest",
         .pass = "guest",
-        .heartbeat = 1
+        .heartbeat = 1,
+        .window = window
     };
 
     int rc = sam_be_rmq_connect (rabbit, &opts);
@@ -46,6 +48,15 @@ setup_connection ()
 }
 
 
+//  --------------------------------------------------------------------------
+/// Setups the connection to a RabbitMQ broker.
+static void
+setup_connection ()
+{
+    connect_window (0);
+}
+
+
 //  --------------------------------------------------------------------------
 /// Destroys a rmq instance.
 static void
@@ -58,9 +69,9 @@ destroy_connection ()
 //  --------------------------------------------------------------------------
 /// Setups a generic rmq message backend, starts the connection beforehand.
 static void
-setup_backend ()
+start_backend (int window)
 {
-    setup_connection ();
+    connect_window (window);
     pll = zsock_new_pull (pll_endpoint);
 
     if (!pll) {
@@ -78,6 +89,61 @@ setup_backend ()
 }
 
 
+//  --------------------------------------------------------------------------
+/// Setups a generic rmq message backend.
+static void
+setup_backend ()
+{
+    start_backend (0);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Setups a generic rmq message backend with a window of two
+/// unconfirmed messages.
+static void
+setup_backend_window ()
+{
+    start_backend (2);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Setups a generic rmq message backend that could not connect to
+/// its broker. It retries only after ten minutes.
+static void
+setup_backend_offline ()
+{
+    rabbit = sam_be_rmq_new (be_name, be_id);
+    if (!rabbit) {
+        ck_abort_msg ("could not create be_rmq instance");
+    }
+
+    sam_be_rmq_opts_t opts = {
+        .host = "localhost",
+        .port = 15673,
+        .user = "guest",
+        .pass = "guest",
+        .heartbeat = 1,
+        .tries = 1,
+        .interval = 10 * 60 * 1000
+    };
+
+    int rc = sam_be_rmq_connect (rabbit, &opts);
+    ck_assert_int_eq (rc, -1);
+
+    pll = zsock_new_pull (pll_endpoint);
+    if (!pll) {
+        ck_abort_msg ("could not create PULL socket");
+    }
+
+    backend = sam_be_rmq_start (&rabbit, pll_endpoint);
+    if (!backend) {
+        ck_abort_msg ("could not create backend");
+    }
+}
+
+
 //  --------------------------------------------------------------------------
 /// Destroys a generic rmq message backend, closes the connection afterwards.
 static void
@@ -129,20 +195,16 @@ START_TEST(test_be_rmq_sync_publish)
 {
     sam_selftest_introduce ("test_be_rmq_sync_publish");
 
-    zframe_t *payload = zframe_new ("hi!", 3);
-
     sam_be_rmq_pub_t opts;
     memset (&opts, 0, sizeof (sam_be_rmq_pub_t));
 
     opts.exchange = "amq.direct";
-    opts.payload = payload;
-    opts.headers = zlist_new ();
+    opts.payload = (byte *) "hi!";
+    opts.payload_size = 3;
 
     int rc = sam_be_rmq_publish (rabbit, &opts);
     ck_assert_int_eq (rc, 0);
 
-    zlist_destroy (&opts.headers);
-
     zmq_pollitem_t items = {
         .socket = NULL,
         .fd = sam_be_rmq_sockfd (rabbit),
@@ -158,7 +220,6 @@ START_TEST(test_be_rmq_sync_publish)
     // TODO: this must either be removed
     // or replaced by something more useful
     sam_be_rmq_handle_ack (rabbit);
-    zframe_destroy (&payload);
 }
 END_TEST
 
@@ -242,11 +303,21 @@ END_TEST
 
 
 //  --------------------------------------------------------------------------
-/// Test asynchronous publishing.
-START_TEST(test_be_rmq_async_publish)
+/// Destroys the publishing options attached to a message.
+static void
+destroy_pub (
+    void **opts)
 {
-    sam_selftest_introduce ("test_be_rmq_async_publish");
+    sam_be_rmq_pub_destroy ((sam_be_rmq_pub_t **) opts);
+}
+
 
+//  --------------------------------------------------------------------------
+/// Create a publishing request for the generic backend, decoded like
+/// sam does before distributing it.
+static sam_msg_t *
+new_publish_msg (const char *routing_key, const char *mandatory)
+{
     zmsg_t *zmsg = zmsg_new ();
     char *str_payload = "hi!";
     zframe_t *frame = zframe_new (str_payload, strlen (str_payload));
@@ -266,28 +337,445 @@ START_TEST(test_be_rmq_async_publish)
 
     // args
     zmsg_pushstr (zmsg, "0");           // 4. immediate
-    zmsg_pushstr (zmsg, "0");           // 3. mandatory
-    frame = zframe_new_empty ();
-    zmsg_prepend (zmsg, &frame);        // 2. routing key
+    zmsg_pushstr (zmsg, mandatory);     // 3. mandatory
+    zmsg_pushstr (zmsg, routing_key);   // 2. routing key
     zmsg_pushstr (zmsg, "amq.direct");  // 1. exchange
 
-    int msg_id = 17;
     sam_msg_t *msg = sam_msg_new (&zmsg);
-    int rc = zsock_send (backend->sock_pub, "ip", msg_id, msg);
+    sam_be_rmq_pub_t *opts = sam_be_rmq_pub_new (msg);
+    ck_assert (opts);
+
+    sam_msg_set_data (msg, opts, destroy_pub);
+    return msg;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Test decoding of publishing options.
+START_TEST(test_be_rmq_pub_decode)
+{
+    sam_selftest_introduce ("test_be_rmq_pub_decode");
+
+    zmsg_t *zmsg = zmsg_new ();
+    zmsg_addstr (zmsg, "amq.direct");
+    zmsg_addstr (zmsg, "key");
+    zmsg_addstr (zmsg, "1");
+    zmsg_addstr (zmsg, "0");
+
+    zmsg_addstr (zmsg, "12");
+    zmsg_addstr (zmsg, "text/plain");
+    for (int i = 1; i < 12; i++) {
+        zmsg_addstr (zmsg, "");
+    }
+
+    zmsg_addstr (zmsg, "4");
+    zmsg_addstr (zmsg, "k1");
+    zmsg_addstr (zmsg, "v1");
+    zmsg_addstr (zmsg, "k2");
+    zmsg_addstr (zmsg, "v2");
+    zmsg_addstr (zmsg, "payload");
+
+    sam_msg_t *msg = sam_msg_new (&zmsg);
+    sam_be_rmq_pub_t *opts = sam_be_rmq_pub_new (msg);
+    ck_assert (opts);
+
+    ck_assert_str_eq (opts->exchange, "amq.direct");
+    ck_assert_str_eq (opts->routing_key, "key");
+    ck_assert_int_eq (opts->mandatory, 1);
+    ck_assert_int_eq (opts->immediate, 0);
+    ck_assert_str_eq (opts->props.content_type, "text/plain");
+    ck_assert_str_eq (opts->props.cluster_id, "");
+
+    ck_assert_int_eq (opts->header_c, 2);
+    ck_assert_str_eq (opts->headers [0], "k1");
+    ck_assert_str_eq (opts->headers [3], "v2");
+
+    ck_assert_int_eq (opts->payload_size, 7);
+    ck_assert (!memcmp (opts->payload, "payload", 7));
+
+    // only present properties get sent
+    amqp_flags_t flags = opts->amqp.props._flags;
+    ck_assert (flags & AMQP_BASIC_CONTENT_TYPE_FLAG);
+    ck_assert (flags & AMQP_BASIC_HEADERS_FLAG);
+    ck_assert (!(flags & AMQP_BASIC_CLUSTER_ID_FLAG));
+    ck_assert (!(flags & AMQP_BASIC_DELIVERY_MODE_FLAG));
+
+    sam_be_rmq_pub_destroy (&opts);
+    ck_assert (opts == NULL);
+
+    // missing payload
+    zmsg = zmsg_new ();
+    zmsg_addstr (zmsg, "amq.direct");
+    zmsg_addstr (zmsg, "key");
+    zmsg_addstr (zmsg, "0");
+    zmsg_addstr (zmsg, "0");
+    zmsg_addstr (zmsg, "12");
+    for (int i = 0; i < 12; i++) {
+        zmsg_addstr (zmsg, "");
+    }
+    zmsg_addstr (zmsg, "0");
+
+    sam_msg_destroy (&msg);
+    msg = sam_msg_new (&zmsg);
+    ck_assert (sam_be_rmq_pub_new (msg) == NULL);
+
+    sam_msg_destroy (&msg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test decoding binary publishing options (see rfc 8).
+START_TEST(test_be_rmq_pub_decode_binary)
+{
+    sam_selftest_introduce ("test_be_rmq_pub_decode_binary");
+
+    byte opts_buf [] = {
+        0x01, 0x02,                 // round robin, immediate
+        0x00, 0x00,                 // min. acknowledged
+        0x01, 0x08,                 // content_type, cluster_id
+        0x01, 0x00,                 // header count
+        10, 0, 0, 0, 'a', 'm', 'q', '.', 'd', 'i', 'r', 'e', 'c', 't',
+        0, 0, 0, 0,                 // empty routing key
+        4, 0, 0, 0, 't', 'e', 'x', 't',
+        2, 0, 0, 0, 'c', '1',
+        2, 0, 0, 0, 'k', '1',
+        2, 0, 0, 0, 'v', '1'
+    };
+
+    zmsg_t *zmsg = zmsg_new ();
+    zmsg_addmem (zmsg, opts_buf, sizeof (opts_buf));
+    zmsg_addstr (zmsg, "payload");
+
+    sam_msg_t *msg = sam_msg_new (&zmsg);
+    sam_be_rmq_pub_t *opts = sam_be_rmq_pub_new (msg);
+    ck_assert (opts);
+
+    ck_assert_str_eq (opts->exchange, "amq.direct");
+    ck_assert_str_eq (opts->routing_key, "");
+    ck_assert_int_eq (opts->mandatory, 0);
+    ck_assert_int_eq (opts->immediate, 1);
+    ck_assert_str_eq (opts->props.content_type, "text");
+    ck_assert_str_eq (opts->props.priority, "");
+    ck_assert_str_eq (opts->props.cluster_id, "c1");
+
+    ck_assert_int_eq (opts->header_c, 1);
+    ck_assert_str_eq (opts->headers [0], "k1");
+    ck_assert_str_eq (opts->headers [1], "v1");
+
+    ck_assert_int_eq (opts->payload_size, 7);
+    ck_assert (!memcmp (opts->payload, "payload", 7));
+
+    sam_be_rmq_pub_destroy (&opts);
+    sam_msg_destroy (&msg);
+
+    // header value exceeding the options
+    zmsg = zmsg_new ();
+    zmsg_addmem (zmsg, opts_buf, sizeof (opts_buf) - 1);
+    zmsg_addstr (zmsg, "payload");
+
+    msg = sam_msg_new (&zmsg);
+    ck_assert (sam_be_rmq_pub_new (msg) == NULL);
+    sam_msg_destroy (&msg);
+
+    // unknown property
+    opts_buf [5] = 0x10;
+    zmsg = zmsg_new ();
+    zmsg_addmem (zmsg, opts_buf, sizeof (opts_buf));
+    zmsg_addstr (zmsg, "payload");
+
+    msg = sam_msg_new (&zmsg);
+    ck_assert (sam_be_rmq_pub_new (msg) == NULL);
+    sam_msg_destroy (&msg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test creating a publishing template, deriving options with
+/// overrides from it and encoding them self-contained (see rfc 9).
+START_TEST(test_be_rmq_pub_template)
+{
+    sam_selftest_introduce ("test_be_rmq_pub_template");
+
+    byte tpl_buf [] = {
+        0x00, 0x01,                 // mandatory
+        0x00, 0x00,
+        0x01, 0x00,                 // content_type
+        0x01, 0x00,                 // header count
+        10, 0, 0, 0, 'a', 'm', 'q', '.', 'd', 'i', 'r', 'e', 'c', 't',
+        3, 0, 0, 0, 'k', 'e', 'y',
+        4, 0, 0, 0, 't', 'e', 'x', 't',
+        2, 0, 0, 0, 'k', '1',
+        2, 0, 0, 0, 'v', '1'
+    };
+
+    sam_be_rmq_tpl_t *tpl = sam_be_rmq_tpl_new (tpl_buf, sizeof (tpl_buf));
+    ck_assert (tpl);
+    ck_assert_int_eq (tpl->opts->amqp.props.content_type.len, 4);
+    ck_assert_int_eq (tpl->opts->amqp.props.headers.num_entries, 1);
+
+    byte opts_buf [] = {
+        0x02, 0xc0,                 // redundant, template, routing key
+        0x02, 0x00,                 // min. acknowledged
+        0x00, 0x08,                 // cluster_id
+        0x01, 0x00,                 // header count
+        0x00, 0x00, 0x00, 0x00,     // template id
+        3, 0, 0, 0, 'r', 'k', '2',
+        2, 0, 0, 0, 'c', '2',
+        2, 0, 0, 0, 'k', '2',
+        2, 0, 0, 0, 'v', '2'
+    };
+
+    zmsg_t *zmsg = zmsg_new ();
+    zmsg_addmem (zmsg, opts_buf, sizeof (opts_buf));
+    zmsg_addstr (zmsg, "payload");
+
+    sam_msg_t *msg = sam_msg_new (&zmsg);
+    sam_be_rmq_pub_t *opts = sam_be_rmq_pub_derive (tpl, msg);
+    ck_assert (opts);
+
+    ck_assert (opts->tpl == tpl);
+    ck_assert_int_eq (opts->overrides, 0x0800);
+    ck_assert_str_eq (opts->exchange, "amq.direct");
+    ck_assert_str_eq (opts->routing_key, "rk2");
+    ck_assert_int_eq (opts->mandatory, 1);
+    ck_assert_str_eq (opts->props.content_type, "text");
+    ck_assert_str_eq (opts->props.cluster_id, "c2");
+    ck_assert_int_eq (opts->header_c, 2);
+    ck_assert_str_eq (opts->headers [0], "k1");
+    ck_assert_str_eq (opts->headers [3], "v2");
+    ck_assert_int_eq (opts->payload_size, 7);
+
+    // translated once, reusing the template's translation
+    ck_assert_int_eq (opts->amqp.exchange.len, 10);
+    ck_assert_int_eq (opts->amqp.routing_key.len, 3);
+    ck_assert_int_eq (opts->amqp.props.content_type.len, 4);
+    ck_assert_int_eq (opts->amqp.props.cluster_id.len, 2);
+    ck_assert_int_eq (opts->amqp.props.headers.num_entries, 2);
+    ck_assert (!memcmp (
+        opts->amqp.props.headers.entries [1].key.bytes, "k2", 2));
+
+    amqp_flags_t flags = opts->amqp.props._flags;
+    ck_assert (flags & AMQP_BASIC_CONTENT_TYPE_FLAG);
+    ck_assert (flags & AMQP_BASIC_CLUSTER_ID_FLAG);
+    ck_assert (flags & AMQP_BASIC_HEADERS_FLAG);
+
+
+    // self-contained encoding
+    size_t size;
+    byte *data = sam_be_rmq_pub_encode (opts, opts_buf, &size);
+    sam_be_rmq_pub_destroy (&opts);
+    sam_msg_destroy (&msg);
+
+    ck_assert_int_eq (data [0], 0x02);
+    ck_assert_int_eq (data [1], 0x01);
+    ck_assert_int_eq (sam_gen_le16 (data + 2), 2);
+
+    zmsg = zmsg_new ();
+    zmsg_addmem (zmsg, data, size);
+    zmsg_addstr (zmsg, "payload");
+    free (data);
+
+    msg = sam_msg_new (&zmsg);
+    opts = sam_be_rmq_pub_new (msg);
+    ck_assert (opts);
+
+    ck_assert (opts->tpl == NULL);
+    ck_assert_str_eq (opts->exchange, "amq.direct");
+    ck_assert_str_eq (opts->routing_key, "rk2");
+    ck_assert_int_eq (opts->mandatory, 1);
+    ck_assert_str_eq (opts->props.content_type, "text");
+    ck_assert_str_eq (opts->props.cluster_id, "c2");
+    ck_assert_str_eq (opts->props.priority, "");
+    ck_assert_int_eq (opts->header_c, 2);
+    ck_assert_str_eq (opts->headers [1], "v1");
+    ck_assert_str_eq (opts->headers [2], "k2");
+
+    sam_be_rmq_pub_destroy (&opts);
+    sam_msg_destroy (&msg);
+
+
+    // templates must not reference templates
+    ck_assert (sam_be_rmq_tpl_new (opts_buf, sizeof (opts_buf)) == NULL);
+
+    sam_be_rmq_tpl_destroy (&tpl);
+    ck_assert (tpl == NULL);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test asynchronous publishing.
+START_TEST(test_be_rmq_async_publish)
+{
+    sam_selftest_introduce ("test_be_rmq_async_publish");
+
+    uint64_t msg_id = 17;
+    sam_msg_t *msg = new_publish_msg ("", "0");
+    int rc = zsock_send (backend->sock_pub, "8p", msg_id, msg);
     ck_assert_int_eq (rc, 0);
 
     // wait for ack
-    uint64_t returned_be_id;
-    zframe_t *id_frame;
-    int returned_msg_id;
+    int type, returned_be_id;
+    zframe_t *keys_frame;
+
+    rc = zsock_recv (pll, "iif", &type, &returned_be_id, &keys_frame);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (type, SAM_BE_ACK);
+
+    ck_assert_int_eq (returned_be_id, be_id);
+    ck_assert_int_eq (zframe_size (keys_frame), sizeof (uint64_t));
+    ck_assert_int_eq (*(uint64_t *) zframe_data (keys_frame), msg_id);
+    zframe_destroy (&keys_frame);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that every message of a series gets acknowledged exactly
+/// once, regardless of how the broker groups its confirms.
+START_TEST(test_be_rmq_async_publish_many)
+{
+    sam_selftest_introduce ("test_be_rmq_async_publish_many");
+
+    int n = 100;
+    uint64_t first_id = 100;
+    for (int i = 0; i < n; i++) {
+        sam_msg_t *msg = new_publish_msg ("", "0");
+        int rc = zsock_send (backend->sock_pub, "8p", first_id + i, msg);
+        ck_assert_int_eq (rc, 0);
+    }
+
+    bool acked [100];
+    memset (acked, 0, sizeof (acked));
+
+    int received = 0;
+    while (received < n) {
+        int type, returned_be_id;
+        zframe_t *keys_frame;
+        int rc = zsock_recv (
+            pll, "iif", &type, &returned_be_id, &keys_frame);
+
+        ck_assert_int_eq (rc, 0);
+        ck_assert_int_eq (type, SAM_BE_ACK);
+        ck_assert_int_eq (returned_be_id, be_id);
+
+        uint64_t *keys = (uint64_t *) zframe_data (keys_frame);
+        int keys_c = zframe_size (keys_frame) / sizeof (uint64_t);
 
-    rc = zsock_recv (pll, "fi", &id_frame, &returned_msg_id);
-    returned_be_id = *(uint64_t *) zframe_data (id_frame);
-    zframe_destroy (&id_frame);
+        for (int i = 0; i < keys_c; i++) {
+            int pos = keys [i] - first_id;
+            ck_assert (0 <= pos && pos < n);
+            ck_assert (!acked [pos]);
+            acked [pos] = true;
+        }
 
+        received += keys_c;
+        zframe_destroy (&keys_frame);
+    }
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that unroutable mandatory messages are handed back.
+START_TEST(test_be_rmq_async_publish_return)
+{
+    sam_selftest_introduce ("test_be_rmq_async_publish_return");
+
+    uint64_t msg_id = 23;
+    sam_msg_t *msg = new_publish_msg ("no-such-binding", "1");
+    int rc = zsock_send (backend->sock_pub, "8p", msg_id, msg);
+    ck_assert_int_eq (rc, 0);
+
+    int type, returned_be_id;
+    zframe_t *keys_frame;
+
+    rc = zsock_recv (pll, "iif", &type, &returned_be_id, &keys_frame);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (type, SAM_BE_NACK);
+    ck_assert_int_eq (returned_be_id, be_id);
+    ck_assert_int_eq (*(uint64_t *) zframe_data (keys_frame), msg_id);
+
+    zframe_destroy (&keys_frame);
+
+    // the ack following the return is not forwarded
+    zpoller_t *poller = zpoller_new (pll, NULL);
+    ck_assert (zpoller_wait (poller, 100) == NULL);
+    zpoller_destroy (&poller);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that the backend signals saturation if the window is full
+/// and relief after the messages got confirmed.
+/// Window: 2
+START_TEST(test_be_rmq_async_window)
+{
+    sam_selftest_introduce ("test_be_rmq_async_window");
+
+    for (int i = 0; i < 3; i++) {
+        sam_msg_t *msg = new_publish_msg ("", "0");
+        int rc = zsock_send (
+            backend->sock_pub, "8p", (uint64_t) 30 + i, msg);
+        ck_assert_int_eq (rc, 0);
+    }
+
+    int code;
+    char *name;
+
+    zsock_recv (backend->sock_sig, "is", &code, &name);
+    ck_assert_int_eq (code, SAM_BE_SIG_SATURATED);
+    free (name);
+
+    zsock_recv (backend->sock_sig, "is", &code, &name);
+    ck_assert_int_eq (code, SAM_BE_SIG_RELIEVED);
+    free (name);
+
+    // all messages get published eventually
+    int received = 0;
+    while (received < 3) {
+        int type, returned_be_id;
+        zframe_t *keys_frame;
+
+        zsock_recv (pll, "iif", &type, &returned_be_id, &keys_frame);
+        ck_assert_int_eq (returned_be_id, be_id);
+        received += zframe_size (keys_frame) / sizeof (uint64_t);
+
+        zframe_destroy (&keys_frame);
+    }
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that a backend without connection reports itself as
+/// disconnected and hands publishing requests back immediately.
+START_TEST(test_be_rmq_async_offline)
+{
+    sam_selftest_introduce ("test_be_rmq_async_offline");
+    ck_assert (!backend->connected);
+
+    uint64_t msg_id = 42;
+    sam_msg_t *msg = new_publish_msg ("", "0");
+    int rc = zsock_send (backend->sock_pub, "8p", msg_id, msg);
+    ck_assert_int_eq (rc, 0);
+
+    int type, returned_be_id;
+    zframe_t *keys_frame;
+
+    rc = zsock_recv (pll, "iif", &type, &returned_be_id, &keys_frame);
     ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (type, SAM_BE_NACK);
     ck_assert_int_eq (returned_be_id, be_id);
-    ck_assert_int_eq (returned_msg_id, msg_id);
+    ck_assert_int_eq (*(uint64_t *) zframe_data (keys_frame), msg_id);
+
+    zframe_destroy (&keys_frame);
+
+    // the request is no longer in flight
+    ck_assert_int_eq (backend->released (backend), 1);
 }
 END_TEST
 
@@ -306,12 +794,30 @@ sam_be_rmq_test ()
     tcase_add_test (tc, test_be_rmq_sync_publish);
     suite_add_tcase (s, tc);
 
-    tc = tcase_create("asynchronous");
+    tc = tcase_create("decoding");
+    tcase_add_test (tc, test_be_rmq_pub_decode);
+    tcase_add_test (tc, test_be_rmq_pub_decode_binary);
+    tcase_add_test (tc, test_be_rmq_pub_template);
+    suite_add_tcase (s, tc);
+
+        tc = tcase_create("asynchronous");
     tcase_add_unchecked_fixture (tc, setup_backend, destroy_backend);
     tcase_add_test (tc, test_be_rmq_async_beprops);
     tcase_add_test (tc, test_be_rmq_async_xdecl);
     tcase_add_test (tc, test_be_rmq_async_xdel);
     tcase_add_test (tc, test_be_rmq_async_publish);
+    tcase_add_test (tc, test_be_rmq_async_publish_many);
+    tcase_add_test (tc, test_be_rmq_async_publish_return);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create("window");
+    tcase_add_unchecked_fixture (tc, setup_backend_window, destroy_backend);
+    tcase_add_test (tc, test_be_rmq_async_window);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create("offline");
+    tcase_add_unchecked_fixture (tc, setup_backend_offline, destroy_backend);
+    tcase_add_test (tc, test_be_rmq_async_offline);
     suite_add_tcase (s, tc);
 
     return s;
@@ -15,16 +15,17 @@
 
 zsock_t
     *backend_push,  // messages arriving from backends
-    *frontend_pull; // messages distributed by libsam
+    *frontend_pull, // messages distributed by libsam
+    *receipts_pull; // receipts of asynchronous storage requests
 
 sam_cfg_t *cfg;
 sam_buf_t *buf;
 
 
 //  --------------------------------------------------------------------------
-/// Create sockets and a sam_buf instance.
+/// Create sockets and a sam_buf instance based on a configuration file.
 static void
-setup ()
+setup_cfg (const char *cfg_file)
 {
     char *endpoint = "inproc://test-buf_be";
     zsock_t *backend_pull = zsock_new_pull (endpoint);
@@ -34,8 +35,12 @@ setup ()
     zsock_t *frontend_push = zsock_new_push (endpoint);
     frontend_pull = zsock_new_pull (endpoint);
 
-    cfg = sam_cfg_new ("cfg/test/buf.cfg");
-    buf = sam_buf_new (cfg, &backend_pull, &frontend_push);
+    endpoint = "inproc://test-buf_receipts";
+    receipts_pull = zsock_new_pull (endpoint);
+    zsock_t *receipts_push = zsock_new_push (endpoint);
+
+    cfg = sam_cfg_new (cfg_file);
+    buf = sam_buf_new (cfg, &backend_pull, &frontend_push, &receipts_push);
 
     if (!buf) {
         ck_abort_msg ("buf instance was not created");
@@ -49,6 +54,84 @@ setup ()
         ck_abort_msg ("frontend push still reachable");
     }
 
+    if (receipts_push) {
+        ck_abort_msg ("receipts push still reachable");
+    }
+
+}
+
+
+//  --------------------------------------------------------------------------
+/// Create sockets and a sam_buf instance.
+static void
+setup ()
+{
+    setup_cfg ("cfg/test/buf.cfg");
+}
+
+
+//  --------------------------------------------------------------------------
+/// Create sockets and a sam_buf instance with group commit enabled.
+static void
+setup_commit ()
+{
+    setup_cfg ("cfg/test/buf_commit.cfg");
+}
+
+
+//  --------------------------------------------------------------------------
+/// Create sockets and a sam_buf instance storing to LMDB.
+static void
+setup_lmdb ()
+{
+    setup_cfg ("cfg/test/buf_lmdb.cfg");
+}
+
+
+//  --------------------------------------------------------------------------
+/// Create sockets and a sam_buf instance storing to an append-only log.
+static void
+setup_log ()
+{
+    setup_cfg ("cfg/test/buf_log.cfg");
+}
+
+
+//  --------------------------------------------------------------------------
+/// Create sockets and a sam_buf instance with write-behind staging.
+static void
+setup_stage ()
+{
+    setup_cfg ("cfg/test/buf_stage.cfg");
+}
+
+
+//  --------------------------------------------------------------------------
+/// Create sockets and a sam_buf instance staging records for a
+/// database too small to take all of them.
+static void
+setup_stage_full ()
+{
+    setup_cfg ("cfg/test/buf_stage_full.cfg");
+}
+
+
+//  --------------------------------------------------------------------------
+/// Create sockets and a sam_buf instance hedging messages.
+static void
+setup_hedge ()
+{
+    setup_cfg ("cfg/test/buf_hedge.cfg");
+}
+
+
+//  --------------------------------------------------------------------------
+/// Create sockets and a sam_buf instance re-sending one message per
+/// step.
+static void
+setup_pacing ()
+{
+    setup_cfg ("cfg/test/buf_pacing.cfg");
 }
 
 
@@ -61,6 +144,7 @@ destroy ()
     sam_cfg_destroy (&cfg);
     zsock_destroy (&backend_push);
     zsock_destroy (&frontend_pull);
+    zsock_destroy (&receipts_pull);
 }
 
 
@@ -77,31 +161,40 @@ get_interval ()
 
 
 //  --------------------------------------------------------------------------
-/// Emulates a backend sending an acknowledgement.
-void
-send_ack (uint64_t be_id, int key)
+/// Emulates a backend sending a (negative) acknowledgement.
+static void
+send_confirm (sam_be_confirm_t type, int be_id, uint64_t key)
 {
-    zframe_t *id_frame = zframe_new (&be_id, sizeof (be_id));
+    zframe_t *keys_frame = zframe_new (&key, sizeof (key));
 
     zsock_send (
-        backend_push, "fi",
-        id_frame, key);
+        backend_push, "iif",
+        type, be_id, keys_frame);
 
-    zframe_destroy (&id_frame);
+    zframe_destroy (&keys_frame);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Emulates a backend sending an acknowledgement.
+void
+send_ack (int be_id, uint64_t key)
+{
+    send_confirm (SAM_BE_ACK, be_id, key);
 
 }
 
 
 //  --------------------------------------------------------------------------
 /// Finish composing the message and hand it over to sam_buf.
-static int
-save (const char *payload, int count)
+static uint64_t
+save (const char *payload, int count, sam_dist_t dist)
 {
     zmsg_t *zmsg = zmsg_new ();
     zmsg_addstr (zmsg, payload);
 
     sam_msg_t *msg = sam_msg_new (&zmsg);
-    return sam_buf_save (buf, msg, count);
+    return sam_buf_save (buf, msg, count, dist);
 }
 
 
@@ -117,11 +210,14 @@ eat ()
     zpoller_t *poller = zpoller_new (frontend_pull, NULL);
     while (zpoller_wait (poller, 0) != NULL) {
 
-        int msg_id;
+        uint64_t msg_id;
+        int count, dist;
         zframe_t *be_acks;
         sam_msg_t *msg;
 
-        zsock_recv (frontend_pull, "ifp", &msg_id, &be_acks, &msg);
+        zsock_recv (
+            frontend_pull, "8fiip",
+            &msg_id, &be_acks, &count, &dist, &msg);
         zframe_destroy (&be_acks);
         sam_msg_destroy (&msg);
 
@@ -133,19 +229,19 @@ eat ()
 
 //  --------------------------------------------------------------------------
 /// Save a sam_msg_t to sam_buf with round robin distribution type.
-static int
+static uint64_t
 save_roundrobin (const char *payload)
 {
-    return save (payload, 1);
+    return save (payload, 1, SAM_DIST_ROUND_ROBIN);
 }
 
 
 //  --------------------------------------------------------------------------
 /// Save a sam_msg_t to sam_buf with redundant distribution type.
-static int
+static uint64_t
 save_redundant (const char *payload, int count)
 {
-    return save (payload, count);
+    return save (payload, count, SAM_DIST_ROUND_ROBIN);
 }
 
 
@@ -165,7 +261,7 @@ consume_resends ()
         zsock_recv (frontend_pull, "ifp", &key, &id_frame, &msg);
 
         ck_assert (key);
-        ck_assert (*(uint64_t *) zframe_data (id_frame) == 0);
+        ck_assert (zframe_size (id_frame) == 0);
         ck_assert_int_eq (sam_msg_size (msg), 4);
 
         zframe_destroy (&id_frame);
@@ -212,21 +308,19 @@ END_TEST
 
 
 //  --------------------------------------------------------------------------
-/// Test saving redundantly acknowledged messages. n=3, backends: 1, 2, 4.
-/// Flow: save -> ack 1 -> ack 2 -> ack 4.
+/// Test saving redundantly acknowledged messages. n=3, backends: 1, 2, 3.
+/// Flow: save -> ack 1 -> ack 2 -> ack 3.
 START_TEST(test_buf_save_redundant)
 {
     sam_selftest_introduce ("test_buf_save_redundant");
 
     // save
-    int key = save_redundant ("redundant", 3);
+    uint64_t key = save_redundant ("redundant", 3);
     zclock_sleep (10);
 
-    // ack1, ack2, ack4
-    int be_power;
-    for (be_power = 0; be_power < 3; be_power++) {
+    // ack1, ack2, ack3
+    for (int be_id = 1; be_id <= 3; be_id++) {
         zclock_sleep (10);
-        uint64_t be_id = 1 << be_power;
         send_ack (be_id, key);
     }
 
@@ -247,7 +341,7 @@ START_TEST(test_buf_save_redundant_race)
     zclock_sleep (10);
 
     // save
-    int key = save_redundant ("redundant race", 2);
+    uint64_t key = save_redundant ("redundant race", 2);
     ck_assert_int_eq (key, 4);  // TODO global state is bad!
     zclock_sleep (10);
 
@@ -310,6 +404,635 @@ START_TEST(test_buf_save_redundant_race_idempotency)
 END_TEST
 
 
+//  --------------------------------------------------------------------------
+/// Test saving multiple messages at once. Keys must be consecutive.
+/// Flow: save (3) -> ack1 -> ack1 -> ack1
+START_TEST(test_buf_save_batch)
+{
+    sam_selftest_introduce ("test_buf_save_batch");
+
+    sam_msg_t *msgs [3];
+    int counts [] = { 1, 1, 1 };
+    sam_dist_t dists [] = {
+        SAM_DIST_ROUND_ROBIN, SAM_DIST_WEIGHTED, SAM_DIST_AFFINITY };
+    uint64_t keys [3];
+
+    for (int i = 0; i < 3; i++) {
+        zmsg_t *zmsg = zmsg_new ();
+        zmsg_addstrf (zmsg, "batch %d", i);
+        msgs [i] = sam_msg_new (&zmsg);
+    }
+
+    int failed = sam_buf_save_batch (buf, 3, msgs, counts, dists, keys);
+    ck_assert_int_eq (failed, 0);
+    ck_assert (keys [0]);
+    ck_assert_int_eq (keys [1], keys [0] + 1);
+    ck_assert_int_eq (keys [2], keys [0] + 2);
+    zclock_sleep (10);
+
+    for (int i = 0; i < 3; i++) {
+        send_ack (1, keys [i]);
+    }
+
+    zclock_sleep (10);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test saving a message asynchronously. The receipt must arrive
+/// and the message must be passed on for distribution.
+START_TEST(test_buf_save_async)
+{
+    sam_selftest_introduce ("test_buf_save_async");
+
+    zmsg_t *zmsg = zmsg_new ();
+    zmsg_addstr (zmsg, "async");
+    sam_msg_t *msg = sam_msg_new (&zmsg);
+
+    // one reference for the buffer, one for the distribution
+    sam_msg_own (msg);
+
+    int count = 1;
+    sam_dist_t dist = SAM_DIST_WEIGHTED;
+    int tag = 42;
+    sam_ret_t ret = { 0, "", false, 0, NULL };
+    sam_buf_save_async (buf, 1, &msg, &count, &dist, &tag, &ret);
+
+    // receipt
+    void *ret_tag;
+    sam_ret_t *ret_ptr;
+    int rc = zsock_recv (receipts_pull, "pp", &ret_tag, &ret_ptr);
+    ck_assert_int_eq (rc, 0);
+    ck_assert (ret_tag == &tag);
+    ck_assert (ret_ptr == &ret);
+    ck_assert_int_eq (ret.rc, 0);
+
+    // distribution
+    uint64_t key;
+    int n, strategy;
+    zframe_t *be_acks;
+    sam_msg_t *dist_msg;
+
+    rc = zsock_recv (
+        frontend_pull, "8fiip", &key, &be_acks, &n, &strategy, &dist_msg);
+
+    ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (n, 1);
+    ck_assert_int_eq (strategy, SAM_DIST_WEIGHTED);
+    ck_assert (dist_msg == msg);
+
+    zframe_destroy (&be_acks);
+    sam_msg_destroy (&dist_msg);
+
+    send_ack (1, key);
+    zclock_sleep (10);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Hands a message asynchronously over to the buffer.
+static void
+save_async (const char *payload, sam_ret_t *ret)
+{
+    zmsg_t *zmsg = zmsg_new ();
+    zmsg_addstr (zmsg, payload);
+    sam_msg_t *msg = sam_msg_new (&zmsg);
+
+    // one reference for the buffer, one for the distribution
+    sam_msg_own (msg);
+
+    int count = 1;
+    sam_dist_t dist = SAM_DIST_DEFAULT;
+    sam_buf_save_async (buf, 1, &msg, &count, &dist, NULL, ret);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Waits for a receipt, returns 0 if one arrived.
+static int
+await_receipt (int timeout)
+{
+    zpoller_t *poller = zpoller_new (receipts_pull, NULL);
+    zsock_t *sock = zpoller_wait (poller, timeout);
+    zpoller_destroy (&poller);
+
+    if (sock == NULL) {
+        return -1;
+    }
+
+    void *tag;
+    sam_ret_t *ret;
+    zsock_recv (receipts_pull, "pp", &tag, &ret);
+    ck_assert_int_eq (ret->rc, 0);
+
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Test that receipts are handed out when the group is full.
+/// Config: count = 3, window = 50ms
+START_TEST(test_buf_commit_count)
+{
+    sam_selftest_introduce ("test_buf_commit_count");
+
+    sam_ret_t rets [3];
+    memset (rets, 0, sizeof (rets));
+
+    save_async ("commit count 1", &rets [0]);
+    save_async ("commit count 2", &rets [1]);
+
+    // group is still open
+    ck_assert_int_eq (await_receipt (10), -1);
+
+    // group is full
+    save_async ("commit count 3", &rets [2]);
+    for (int i = 0; i < 3; i++) {
+        ck_assert_int_eq (await_receipt (10), 0);
+    }
+
+    eat ();
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that receipts are handed out when the window elapsed.
+/// Config: count = 3, window = 50ms
+START_TEST(test_buf_commit_window)
+{
+    sam_selftest_introduce ("test_buf_commit_window");
+
+    sam_ret_t ret;
+    memset (&ret, 0, sizeof (ret));
+
+    save_async ("commit window", &ret);
+    ck_assert_int_eq (await_receipt (10), -1);
+    ck_assert_int_eq (await_receipt (100), 0);
+
+    eat ();
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Counts the re-sends of the message with the provided key (or of
+/// all messages if 0) within the provided time.
+static int
+count_resends_of (uint64_t key, int timeout)
+{
+    int resends = 0;
+    int64_t deadline = zclock_mono () + timeout;
+    zpoller_t *poller = zpoller_new (frontend_pull, NULL);
+
+    while (zclock_mono () < deadline) {
+        if (zpoller_wait (poller, 10) == NULL) {
+            continue;
+        }
+
+        uint64_t msg_id;
+        int count, dist;
+        zframe_t *be_acks;
+        sam_msg_t *msg;
+
+        zsock_recv (
+            frontend_pull, "8fiip",
+            &msg_id, &be_acks, &count, &dist, &msg);
+        zframe_destroy (&be_acks);
+        sam_msg_destroy (&msg);
+
+        if (!key || msg_id == key) {
+            resends += 1;
+        }
+    }
+
+    zpoller_destroy (&poller);
+    return resends;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Counts the messages re-sent within the provided time.
+static int
+count_resends (int timeout)
+{
+    return count_resends_of (0, timeout);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Test that staged records get written and re-sent if they are
+/// not acknowledged in time.
+/// Config: stage delay = 20ms, threshold = 100ms
+START_TEST(test_buf_stage_flush)
+{
+    sam_selftest_introduce ("test_buf_stage_flush");
+
+    uint64_t key = save_roundrobin ("stage flush");
+    ck_assert (count_resends (500) > 0);
+
+    send_ack (1, key);
+    eat ();
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that staged records are kept if writing them fails: The
+/// second record does not fit into the database, the first one must
+/// not get lost with the aborted group.
+/// Config: map size = 1M, stage size = 1M, delay = 100ms
+START_TEST(test_buf_stage_flush_fail)
+{
+    sam_selftest_introduce ("test_buf_stage_flush_fail");
+
+    size_t size = 600 * 1024;
+    char *payload = malloc (size);
+    ck_assert (payload != NULL);
+    memset (payload, 'x', size);
+
+    sam_msg_t *msgs [3];
+    int counts [] = { 1, 1, 1 };
+    sam_dist_t dists [] = {
+        SAM_DIST_ROUND_ROBIN, SAM_DIST_ROUND_ROBIN, SAM_DIST_ROUND_ROBIN };
+    uint64_t keys [3];
+
+    for (int i = 0; i < 3; i++) {
+        zmsg_t *zmsg = zmsg_new ();
+        zmsg_addmem (zmsg, payload, size);
+        msgs [i] = sam_msg_new (&zmsg);
+    }
+
+    free (payload);
+
+    // exceeds the stage size, the flush fails
+    int failed = sam_buf_save_batch (buf, 3, msgs, counts, dists, keys);
+    ck_assert_int_eq (failed, 0);
+
+    // the remaining record fits
+    send_ack (1, keys [1]);
+    send_ack (1, keys [2]);
+
+    ck_assert (count_resends_of (keys [0], 1000) > 0);
+
+    send_ack (1, keys [0]);
+    eat ();
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that records acknowledged while staged never get re-sent.
+/// Config: stage delay = 20ms, threshold = 100ms
+START_TEST(test_buf_stage_elide)
+{
+    sam_selftest_introduce ("test_buf_stage_elide");
+
+    uint64_t key = save_redundant ("stage elide", 2);
+    send_ack (1, key);
+    send_ack (2, key);
+
+    // duplicate acks of dropped records are ignored
+    send_ack (2, key);
+
+    ck_assert_int_eq (count_resends (500), 0);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that a message not confirmed in time is published to a
+/// second backend and that the first confirmation wins.
+/// Config: threshold = 1s, percentile = 50
+START_TEST(test_buf_hedge)
+{
+    sam_selftest_introduce ("test_buf_hedge");
+
+    // measure the confirmation latency
+    for (int i = 0; i < 128; i++) {
+        send_ack (1, save_roundrobin ("hedge sample"));
+    }
+
+    uint64_t key = save_roundrobin ("hedge");
+
+    zpoller_t *poller = zpoller_new (frontend_pull, NULL);
+    ck_assert (zpoller_wait (poller, 200) != NULL);
+    zpoller_destroy (&poller);
+
+    uint64_t msg_id;
+    int count, dist;
+    zframe_t *be_acks;
+    sam_msg_t *msg;
+
+    zsock_recv (
+        frontend_pull, "8fiip", &msg_id, &be_acks, &count, &dist, &msg);
+
+    ck_assert_int_eq (msg_id, key);
+    ck_assert_int_eq (count, 1);
+    ck_assert_int_eq (dist, SAM_DIST_ROUND_ROBIN | SAM_DIST_HEDGE);
+
+    zframe_destroy (&be_acks);
+    sam_msg_destroy (&msg);
+
+    // the second confirmation is ignored
+    send_ack (2, key);
+    send_ack (1, key);
+
+    ck_assert_int_eq (count_resends (1200), 0);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that only round robin messages are hedged: Other strategies
+/// choose their backend deliberately.
+/// Config: threshold = 1s, percentile = 50
+START_TEST(test_buf_hedge_strategy)
+{
+    sam_selftest_introduce ("test_buf_hedge_strategy");
+
+    // measure the confirmation latency
+    for (int i = 0; i < 128; i++) {
+        send_ack (1, save_roundrobin ("hedge sample"));
+    }
+
+    uint64_t key = save ("hedge weighted", 1, SAM_DIST_WEIGHTED);
+    ck_assert_int_eq (count_resends (200), 0);
+
+    send_ack (1, key);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that the confirmation of a hedged copy arriving after the
+/// record got deleted does not leave a record behind.
+START_TEST(test_buf_hedge_late_ack)
+{
+    sam_selftest_introduce ("test_buf_hedge_late_ack");
+
+    uint64_t key = save_roundrobin ("hedge late ack");
+    send_ack (1, key);
+    send_ack (2, key);
+
+    zclock_sleep (100);
+    destroy ();
+
+    sam_cfg_t *hedge_cfg = sam_cfg_new ("cfg/test/buf_hedge.cfg");
+
+    zconfig_t *db_conf;
+    int rc = sam_cfg_get (hedge_cfg, "db/bdb", &db_conf);
+    ck_assert_int_eq (rc, 0);
+
+    sam_db_t *db = sam_db_new (db_conf);
+    ck_assert (db != NULL);
+
+    sam_db_begin (db);
+    ck_assert (sam_db_get (db, &key) == SAM_DB_NOTFOUND);
+    sam_db_end (db, true);
+
+    sam_db_destroy (&db);
+    sam_cfg_destroy (&hedge_cfg);
+
+    setup_hedge ();
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that re-sent messages keep their key and distribution
+/// strategy and that an acknowledgement for that key ends the
+/// re-sending.
+/// Config: interval = 100ms, threshold = 100ms
+START_TEST(test_buf_resend_key)
+{
+    sam_selftest_introduce ("test_buf_resend_key");
+
+    uint64_t key = save ("resend key", 1, SAM_DIST_WEIGHTED);
+
+    zpoller_t *poller = zpoller_new (frontend_pull, NULL);
+    ck_assert (zpoller_wait (poller, 500) != NULL);
+    zpoller_destroy (&poller);
+
+    uint64_t msg_id;
+    int count, dist;
+    zframe_t *be_acks;
+    sam_msg_t *msg;
+
+    zsock_recv (
+        frontend_pull, "8fiip", &msg_id, &be_acks, &count, &dist, &msg);
+
+    ck_assert_int_eq (msg_id, key);
+    ck_assert_int_eq (count, 1);
+    ck_assert_int_eq (dist, SAM_DIST_WEIGHTED);
+
+    zframe_destroy (&be_acks);
+    sam_msg_destroy (&msg);
+
+    // drop re-sends which crossed the ack
+    send_ack (1, key);
+    count_resends (get_interval ());
+
+    ck_assert_int_eq (count_resends (500), 0);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that a nack'd message gets re-distributed immediately with
+/// its strategy, excluding the rejecting backend.
+START_TEST(test_buf_nack)
+{
+    sam_selftest_introduce ("test_buf_nack");
+
+    uint64_t key = save ("nack", 1, SAM_DIST_AFFINITY);
+    send_confirm (SAM_BE_NACK, 2, key);
+
+    zpoller_t *poller = zpoller_new (frontend_pull, NULL);
+    ck_assert (zpoller_wait (poller, 50) != NULL);
+    zpoller_destroy (&poller);
+
+    uint64_t msg_id;
+    int count, dist;
+    zframe_t *be_acks;
+    sam_msg_t *msg;
+
+    zsock_recv (
+        frontend_pull, "8fiip", &msg_id, &be_acks, &count, &dist, &msg);
+
+    ck_assert_int_eq (msg_id, key);
+    ck_assert_int_eq (count, 1);
+    ck_assert_int_eq (dist, SAM_DIST_AFFINITY | SAM_DIST_REROUTE);
+    ck_assert_int_eq (zframe_size (be_acks), 1);
+    ck_assert (sam_gen_set_contains (zframe_data (be_acks), 1, 2));
+
+    zframe_destroy (&be_acks);
+    sam_msg_destroy (&msg);
+
+    send_ack (1, key);
+    eat ();
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that messages of a backend which lost its connection get
+/// re-distributed without using up their tries (buf.cfg: 5).
+START_TEST(test_buf_failover)
+{
+    sam_selftest_introduce ("test_buf_failover");
+
+    uint64_t key = save_roundrobin ("failover");
+    zpoller_t *poller = zpoller_new (frontend_pull, NULL);
+
+    for (int i = 0; i < 8; i++) {
+        send_confirm (SAM_BE_LOST, 2, key);
+        ck_assert (zpoller_wait (poller, 50) != NULL);
+
+        uint64_t msg_id;
+        int count, dist;
+        zframe_t *be_acks;
+        sam_msg_t *msg;
+
+        zsock_recv (
+            frontend_pull, "8fiip", &msg_id, &be_acks, &count, &dist, &msg);
+
+        ck_assert_int_eq (msg_id, key);
+        ck_assert_int_eq (dist, SAM_DIST_ROUND_ROBIN | SAM_DIST_REROUTE);
+        ck_assert (sam_gen_set_contains (
+            zframe_data (be_acks), zframe_size (be_acks), 2));
+
+        zframe_destroy (&be_acks);
+        sam_msg_destroy (&msg);
+    }
+
+    zpoller_destroy (&poller);
+
+    send_ack (1, key);
+    eat ();
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that all messages of a failed batch (e.g. the unconfirmed
+/// messages of a backend that lost its connection) are re-routed.
+START_TEST(test_buf_nack_batch)
+{
+    sam_selftest_introduce ("test_buf_nack_batch");
+
+    uint64_t keys [3];
+    for (int i = 0; i < 3; i++) {
+        keys [i] = save_roundrobin ("nack batch");
+    }
+
+    int be_id = 4;
+    zframe_t *keys_frame = zframe_new (keys, sizeof (keys));
+
+    zsock_send (backend_push, "iif", SAM_BE_NACK, be_id, keys_frame);
+    zframe_destroy (&keys_frame);
+
+    zpoller_t *poller = zpoller_new (frontend_pull, NULL);
+    for (int i = 0; i < 3; i++) {
+        ck_assert (zpoller_wait (poller, 50) != NULL);
+
+        uint64_t msg_id;
+        int count, dist;
+        zframe_t *be_acks;
+        sam_msg_t *msg;
+
+        zsock_recv (
+            frontend_pull, "8fiip", &msg_id, &be_acks, &count, &dist, &msg);
+
+        ck_assert_int_eq (msg_id, keys [i]);
+        ck_assert_int_eq (count, 1);
+        ck_assert (sam_gen_set_contains (
+            zframe_data (be_acks), zframe_size (be_acks), be_id));
+
+        zframe_destroy (&be_acks);
+        sam_msg_destroy (&msg);
+    }
+
+    zpoller_destroy (&poller);
+
+    for (int i = 0; i < 3; i++) {
+        send_ack (1, keys [i]);
+    }
+
+    eat ();
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that backend ids beyond 64 are remembered: The set of
+/// backends that acknowledged a record grows and a re-routed message
+/// avoids them.
+START_TEST(test_buf_nack_many_backends)
+{
+    sam_selftest_introduce ("test_buf_nack_many_backends");
+
+    uint64_t key = save_redundant ("many backends", 2);
+    send_ack (100, key);
+    send_confirm (SAM_BE_NACK, 70, key);
+
+    zpoller_t *poller = zpoller_new (frontend_pull, NULL);
+    ck_assert (zpoller_wait (poller, 50) != NULL);
+    zpoller_destroy (&poller);
+
+    uint64_t msg_id;
+    int count, dist;
+    zframe_t *be_acks;
+    sam_msg_t *msg;
+
+    zsock_recv (
+        frontend_pull, "8fiip", &msg_id, &be_acks, &count, &dist, &msg);
+
+    byte *set = zframe_data (be_acks);
+    size_t size = zframe_size (be_acks);
+
+    ck_assert_int_eq (msg_id, key);
+    ck_assert_int_eq (size, sam_gen_set_size (100));
+    ck_assert (sam_gen_set_contains (set, size, 100));
+    ck_assert (sam_gen_set_contains (set, size, 70));
+    ck_assert (!sam_gen_set_contains (set, size, 1));
+
+    zframe_destroy (&be_acks);
+    sam_msg_destroy (&msg);
+
+    send_ack (1, key);
+    eat ();
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test that a resend cycle exceeding its budget is continued
+/// without waiting for the next interval.
+/// Config: interval = 300ms, threshold = 100ms, budget = 1
+START_TEST(test_buf_resend_budget)
+{
+    sam_selftest_introduce ("test_buf_resend_budget");
+
+    uint64_t keys [3];
+    keys [0] = save_roundrobin ("budget 1");
+    keys [1] = save_roundrobin ("budget 2");
+    keys [2] = save_roundrobin ("budget 3");
+
+    // at most two intervals elapse
+    ck_assert (count_resends (600) >= 3);
+
+    for (int i = 0; i < 3; i++) {
+        send_ack (1, keys [i]);
+    }
+
+    eat ();
+}
+END_TEST
+
+
 /*
 //  --------------------------------------------------------------------------
 /// Lets the buffer resend a message multiple times, before an
@@ -369,6 +1092,241 @@ START_TEST(test_buf_restore)
 END_TEST
 
 
+//  --------------------------------------------------------------------------
+/// Refuses databases containing malformed records of a former layout.
+START_TEST(test_buf_format)
+{
+    sam_selftest_introduce ("test_buf_format");
+
+    sam_cfg_t *format_cfg = sam_cfg_new ("cfg/test/buf_format.cfg");
+
+    zconfig_t *db_conf;
+    int rc = sam_cfg_get (format_cfg, "db/bdb", &db_conf);
+    ck_assert_int_eq (rc, 0);
+
+    // a record without the format record
+    sam_db_t *db = sam_db_new (db_conf);
+    ck_assert (db != NULL);
+
+    uint64_t key = 1;
+    int data = 0xf00;
+
+    sam_db_begin (db);
+    sam_db_set_key (db, &key);
+    sam_db_put (db, sizeof (data), (void *) &data);
+    sam_db_end (db, false);
+    sam_db_destroy (&db);
+
+    zsock_t
+        *in = zsock_new_pull ("inproc://test-buf_format_be"),
+        *out = zsock_new_push ("inproc://test-buf_format_fe"),
+        *receipts = zsock_new_push ("inproc://test-buf_format_receipts");
+
+    sam_buf_t *format_buf = sam_buf_new (format_cfg, &in, &out, &receipts);
+    ck_assert (format_buf == NULL);
+
+    sam_cfg_destroy (&format_cfg);
+}
+END_TEST
+
+
+/// record header written before the format record (format 0)
+typedef struct record_v0_t {
+    int type;
+    union {
+        struct {
+            int prev;
+            uint64_t be_acks;
+            int acks_remaining;
+            int64_t ts;
+            int tries;
+        } record;
+        struct {
+            int prev;
+            int next;
+        } tombstone;
+    } c;
+} record_v0_t;
+
+
+//  --------------------------------------------------------------------------
+/// Migrates databases written without a format record: Tombstones are
+/// dropped, messages are kept and re-sent. The mask of acknowledging
+/// backends (1 << n) becomes the set of their current ids (n + 1).
+START_TEST(test_buf_format_migrate)
+{
+    sam_selftest_introduce ("test_buf_format_migrate");
+
+    sam_cfg_t *migrate_cfg = sam_cfg_new ("cfg/test/buf_migrate.cfg");
+
+    zconfig_t *db_conf;
+    int rc = sam_cfg_get (migrate_cfg, "db/bdb", &db_conf);
+    ck_assert_int_eq (rc, 0);
+
+    sam_db_t *db = sam_db_new (db_conf);
+    ck_assert (db != NULL);
+
+    byte record [sizeof (record_v0_t) + 6];
+    record_v0_t *header = (record_v0_t *) record;
+    memset (record, 0, sizeof (record));
+    sam_db_begin (db);
+
+    uint64_t key = 1;
+    header->type = 0x12;  // tombstone
+    header->c.tombstone.next = 2;
+    sam_db_set_key (db, &key);
+    sam_db_put (db, sizeof (record_v0_t), record);
+
+    key = 2;
+    header->type = 0x10;  // record
+    header->c.record.prev = 1;
+    header->c.record.be_acks = 1 << 1;
+    header->c.record.acks_remaining = 1;
+    header->c.record.tries = 5;
+    memcpy (record + sizeof (record_v0_t), "\x05hello", 6);
+    sam_db_set_key (db, &key);
+    sam_db_put (db, sizeof (record), record);
+
+    sam_db_end (db, false);
+    sam_db_destroy (&db);
+
+    zsock_t
+        *in = zsock_new_pull ("inproc://test-buf_migrate_be"),
+        *out_pull = zsock_new_pull ("inproc://test-buf_migrate_fe"),
+        *out = zsock_new_push ("inproc://test-buf_migrate_fe"),
+        *receipts = zsock_new_push ("inproc://test-buf_migrate_receipts");
+
+    sam_buf_t *migrate_buf = sam_buf_new (migrate_cfg, &in, &out, &receipts);
+    ck_assert (migrate_buf != NULL);
+
+    // the message survived and gets re-sent after the threshold
+    zpoller_t *poller = zpoller_new (out_pull, NULL);
+    ck_assert (zpoller_wait (poller, 500) != NULL);
+    zpoller_destroy (&poller);
+
+    uint64_t msg_id;
+    int count, dist;
+    zframe_t *be_acks;
+    sam_msg_t *msg;
+
+    zsock_recv (
+        out_pull, "8fiip", &msg_id, &be_acks, &count, &dist, &msg);
+
+    ck_assert_int_eq (msg_id, 2);
+    ck_assert_int_eq (count, 1);
+    ck_assert_int_eq (dist, SAM_DIST_DEFAULT);
+    ck_assert_int_eq (zframe_size (be_acks), 1);
+    ck_assert (sam_gen_set_contains (zframe_data (be_acks), 1, 2));
+    ck_assert (!sam_gen_set_contains (zframe_data (be_acks), 1, 1));
+
+    char *payload;
+    rc = sam_msg_pop (msg, "s", &payload);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_str_eq (payload, "hello");
+
+    zframe_destroy (&be_acks);
+    sam_msg_destroy (&msg);
+
+    sam_buf_destroy (&migrate_buf);
+    zsock_destroy (&out_pull);
+    sam_cfg_destroy (&migrate_cfg);
+}
+END_TEST
+
+
+/// record header written by format 2, lacking the strategy
+typedef struct record_v2_t {
+    int type;
+    union {
+        struct {
+            int acks_size;
+            int acks_remaining;
+            int64_t ts;
+            int tries;
+            int padding;
+        } record;
+        struct {
+            int version;
+        } format;
+    } c;
+} record_v2_t;
+
+
+//  --------------------------------------------------------------------------
+/// Migrates databases of format 2 in place: Whatever the padding of
+/// the records contained, they are re-sent with the default strategy.
+START_TEST(test_buf_format_migrate_dist)
+{
+    sam_selftest_introduce ("test_buf_format_migrate_dist");
+
+    sam_cfg_t *migrate_cfg = sam_cfg_new ("cfg/test/buf_migrate_dist.cfg");
+
+    zconfig_t *db_conf;
+    int rc = sam_cfg_get (migrate_cfg, "db/bdb", &db_conf);
+    ck_assert_int_eq (rc, 0);
+
+    sam_db_t *db = sam_db_new (db_conf);
+    ck_assert (db != NULL);
+
+    byte record [sizeof (record_v2_t) + 6];
+    record_v2_t *header = (record_v2_t *) record;
+    memset (record, 0, sizeof (record));
+    sam_db_begin (db);
+
+    uint64_t key = 0;
+    header->type = 0x13;  // format
+    header->c.format.version = 2;
+    sam_db_set_key (db, &key);
+    sam_db_put (db, sizeof (record_v2_t), record);
+
+    key = 1;
+    memset (record, 0, sizeof (record));
+    header->type = 0x10;  // record
+    header->c.record.acks_remaining = 1;
+    header->c.record.tries = 5;
+    header->c.record.padding = 0x7f7f;
+    memcpy (record + sizeof (record_v2_t), "\x05hello", 6);
+    sam_db_set_key (db, &key);
+    sam_db_put (db, sizeof (record), record);
+
+    sam_db_end (db, false);
+    sam_db_destroy (&db);
+
+    zsock_t
+        *in = zsock_new_pull ("inproc://test-buf_migrate_dist_be"),
+        *out_pull = zsock_new_pull ("inproc://test-buf_migrate_dist_fe"),
+        *out = zsock_new_push ("inproc://test-buf_migrate_dist_fe"),
+        *receipts = zsock_new_push ("inproc://test-buf_migrate_dist_receipts");
+
+    sam_buf_t *migrate_buf = sam_buf_new (migrate_cfg, &in, &out, &receipts);
+    ck_assert (migrate_buf != NULL);
+
+    zpoller_t *poller = zpoller_new (out_pull, NULL);
+    ck_assert (zpoller_wait (poller, 500) != NULL);
+    zpoller_destroy (&poller);
+
+    uint64_t msg_id;
+    int count, dist;
+    zframe_t *be_acks;
+    sam_msg_t *msg;
+
+    zsock_recv (
+        out_pull, "8fiip", &msg_id, &be_acks, &count, &dist, &msg);
+
+    ck_assert_int_eq (msg_id, 1);
+    ck_assert_int_eq (count, 1);
+    ck_assert_int_eq (dist, SAM_DIST_DEFAULT);
+
+    zframe_destroy (&be_acks);
+    sam_msg_destroy (&msg);
+
+    sam_buf_destroy (&migrate_buf);
+    zsock_destroy (&out_pull);
+    sam_cfg_destroy (&migrate_cfg);
+}
+END_TEST
+
+
 void *
 sam_buf_test ()
 {
@@ -388,7 +1346,64 @@ sam_buf_test ()
     tcase_add_test (tc, test_buf_save_redundant_race_idempotency);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("lmdb storage");
+    tcase_add_unchecked_fixture (tc, setup_lmdb, destroy);
+    tcase_add_test (tc, test_buf_save_roundrobin);
+    tcase_add_test (tc, test_buf_save_redundant);
+    tcase_add_test (tc, test_buf_save_redundant_race);
+    tcase_add_test (tc, test_buf_save_redundant_idempotency);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("log storage");
+    tcase_add_unchecked_fixture (tc, setup_log, destroy);
+    tcase_add_test (tc, test_buf_save_roundrobin);
+    tcase_add_test (tc, test_buf_save_redundant);
+    tcase_add_test (tc, test_buf_save_redundant_race);
+    tcase_add_test (tc, test_buf_save_redundant_idempotency);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("save batch");
+    tcase_add_unchecked_fixture (tc, setup, destroy);
+    tcase_add_test (tc, test_buf_save_batch);
+    tcase_add_test (tc, test_buf_save_async);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("group commit");
+    tcase_add_unchecked_fixture (tc, setup_commit, destroy);
+    tcase_add_test (tc, test_buf_commit_count);
+    tcase_add_test (tc, test_buf_commit_window);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("write-behind staging");
+    tcase_add_unchecked_fixture (tc, setup_stage, destroy);
+    tcase_add_test (tc, test_buf_stage_flush);
+    tcase_add_test (tc, test_buf_stage_elide);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("staging failures");
+    tcase_add_unchecked_fixture (tc, setup_stage_full, destroy);
+    tcase_add_test (tc, test_buf_stage_flush_fail);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("hedging");
+    tcase_add_unchecked_fixture (tc, setup_hedge, destroy);
+    tcase_add_test (tc, test_buf_hedge);
+    tcase_add_test (tc, test_buf_hedge_strategy);
+    tcase_add_test (tc, test_buf_hedge_late_ack);
+    suite_add_tcase (s, tc);
+
     tc = tcase_create ("resending");
+    tcase_add_unchecked_fixture (tc, setup, destroy);
+    tcase_add_test (tc, test_buf_resend_key);
+    tcase_add_test (tc, test_buf_nack);
+    tcase_add_test (tc, test_buf_failover);
+    tcase_add_test (tc, test_buf_nack_batch);
+    tcase_add_test (tc, test_buf_nack_many_backends);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("resend pacing");
+    tcase_add_unchecked_fixture (tc, setup_pacing, destroy);
+    tcase_add_test (tc, test_buf_resend_budget);
     // tcase_add_checked_fixture (tc, setup, destroy);
     // tcase_add_test (tc, test_buf_resend);
     // tcase_add_test (tc, test_buf_resend_multiple);
@@ -399,5 +1414,11 @@ sam_buf_test ()
     tcase_add_test (tc, test_buf_restore);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("database format");
+    tcase_add_test (tc, test_buf_format);
+    tcase_add_test (tc, test_buf_format_migrate);
+    tcase_add_test (tc, test_buf_format_migrate_dist);
+    suite_add_tcase (s, tc);
+
     return s;
 }
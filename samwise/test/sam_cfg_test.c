@@ -39,6 +39,26 @@ load (const char *fname)
 }
 
 
+//  --------------------------------------------------------------------------
+/// Test cfg_binary_value ().
+START_TEST(test_cfg_binary_value)
+{
+    sam_selftest_introduce ("test_cfg_binary_value");
+
+    uint64_t value;
+    const char *str = "3K";
+
+    int rc = sam_cfg_binary_value (str, &value);
+    ck_assert_int_eq (rc, 0);
+    ck_assert (value == 3 * 1024);
+    ck_assert_str_eq (str, "3K");
+
+    rc = sam_cfg_binary_value ("3X", &value);
+    ck_assert_int_eq (rc, -1);
+}
+END_TEST
+
+
 //  --------------------------------------------------------------------------
 /// Test cfg_buf_size ().
 START_TEST(test_cfg_buf_size)
@@ -449,6 +469,286 @@ END_TEST
 
 
 
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_commit_window ().
+START_TEST(test_cfg_buf_commit_window)
+{
+    sam_selftest_introduce ("test_cfg_buf_commit_window");
+
+    sam_cfg_t *cfg = load ("buf_commit_window");
+
+    uint64_t window;
+    int rc = sam_cfg_buf_commit_window (cfg, &window);
+    ck_assert_int_eq (rc, 0);
+    ck_assert (window == 20);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_commit_window () with empty config.
+START_TEST(test_cfg_buf_commit_window_empty)
+{
+    sam_selftest_introduce ("test_cfg_buf_commit_window_empty");
+
+    sam_cfg_t *cfg = load ("empty");
+
+    uint64_t window;
+    int rc = sam_cfg_buf_commit_window (cfg, &window);
+    ck_assert_int_eq (rc, -1);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_retry_budget ().
+START_TEST(test_cfg_buf_retry_budget)
+{
+    sam_selftest_introduce ("test_cfg_buf_retry_budget");
+
+    sam_cfg_t *cfg = load ("buf_retry_budget");
+
+    int budget;
+    int rc = sam_cfg_buf_retry_budget (cfg, &budget);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (budget, 500);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_retry_budget () with empty config.
+START_TEST(test_cfg_buf_retry_budget_empty)
+{
+    sam_selftest_introduce ("test_cfg_buf_retry_budget_empty");
+
+    sam_cfg_t *cfg = load ("empty");
+
+    int budget;
+    int rc = sam_cfg_buf_retry_budget (cfg, &budget);
+    ck_assert_int_eq (rc, -1);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_hedge_percentile ().
+START_TEST(test_cfg_buf_hedge_percentile)
+{
+    sam_selftest_introduce ("test_cfg_buf_hedge_percentile");
+
+    sam_cfg_t *cfg = load ("buf_hedge_percentile");
+
+    int percentile;
+    int rc = sam_cfg_buf_hedge_percentile (cfg, &percentile);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (percentile, 95);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_hedge_percentile () with empty config.
+START_TEST(test_cfg_buf_hedge_percentile_empty)
+{
+    sam_selftest_introduce ("test_cfg_buf_hedge_percentile_empty");
+
+    sam_cfg_t *cfg = load ("empty");
+
+    int percentile;
+    int rc = sam_cfg_buf_hedge_percentile (cfg, &percentile);
+    ck_assert_int_eq (rc, -1);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_retry_slice ().
+START_TEST(test_cfg_buf_retry_slice)
+{
+    sam_selftest_introduce ("test_cfg_buf_retry_slice");
+
+    sam_cfg_t *cfg = load ("buf_retry_slice");
+
+    uint64_t slice;
+    int rc = sam_cfg_buf_retry_slice (cfg, &slice);
+    ck_assert_int_eq (rc, 0);
+    ck_assert (slice == 5);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_retry_slice () with empty config.
+START_TEST(test_cfg_buf_retry_slice_empty)
+{
+    sam_selftest_introduce ("test_cfg_buf_retry_slice_empty");
+
+    sam_cfg_t *cfg = load ("empty");
+
+    uint64_t slice;
+    int rc = sam_cfg_buf_retry_slice (cfg, &slice);
+    ck_assert_int_eq (rc, -1);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_retry_rate ().
+START_TEST(test_cfg_buf_retry_rate)
+{
+    sam_selftest_introduce ("test_cfg_buf_retry_rate");
+
+    sam_cfg_t *cfg = load ("buf_retry_rate");
+
+    int rate;
+    int rc = sam_cfg_buf_retry_rate (cfg, &rate);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (rate, 2000);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_retry_rate () with empty config.
+START_TEST(test_cfg_buf_retry_rate_empty)
+{
+    sam_selftest_introduce ("test_cfg_buf_retry_rate_empty");
+
+    sam_cfg_t *cfg = load ("empty");
+
+    int rate;
+    int rc = sam_cfg_buf_retry_rate (cfg, &rate);
+    ck_assert_int_eq (rc, -1);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_stage_delay ().
+START_TEST(test_cfg_buf_stage_delay)
+{
+    sam_selftest_introduce ("test_cfg_buf_stage_delay");
+
+    sam_cfg_t *cfg = load ("buf_stage_delay");
+
+    uint64_t delay;
+    int rc = sam_cfg_buf_stage_delay (cfg, &delay);
+    ck_assert_int_eq (rc, 0);
+    ck_assert (delay == 2000);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_stage_delay () with empty config.
+START_TEST(test_cfg_buf_stage_delay_empty)
+{
+    sam_selftest_introduce ("test_cfg_buf_stage_delay_empty");
+
+    sam_cfg_t *cfg = load ("empty");
+
+    uint64_t delay;
+    int rc = sam_cfg_buf_stage_delay (cfg, &delay);
+    ck_assert_int_eq (rc, -1);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_stage_size ().
+START_TEST(test_cfg_buf_stage_size)
+{
+    sam_selftest_introduce ("test_cfg_buf_stage_size");
+
+    sam_cfg_t *cfg = load ("buf_stage_size");
+
+    uint64_t size;
+    int rc = sam_cfg_buf_stage_size (cfg, &size);
+    ck_assert_int_eq (rc, 0);
+    ck_assert (size == 4 * 1024 * 1024);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_stage_size () with empty config.
+START_TEST(test_cfg_buf_stage_size_empty)
+{
+    sam_selftest_introduce ("test_cfg_buf_stage_size_empty");
+
+    sam_cfg_t *cfg = load ("empty");
+
+    uint64_t size;
+    int rc = sam_cfg_buf_stage_size (cfg, &size);
+    ck_assert_int_eq (rc, -1);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_commit_count ().
+START_TEST(test_cfg_buf_commit_count)
+{
+    sam_selftest_introduce ("test_cfg_buf_commit_count");
+
+    sam_cfg_t *cfg = load ("buf_commit_count");
+
+    int count;
+    int rc = sam_cfg_buf_commit_count (cfg, &count);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (count, 64);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_buf_commit_count () with empty config.
+START_TEST(test_cfg_buf_commit_count_empty)
+{
+    sam_selftest_introduce ("test_cfg_buf_commit_count_empty");
+
+    sam_cfg_t *cfg = load ("empty");
+
+    int count;
+    int rc = sam_cfg_buf_commit_count (cfg, &count);
+    ck_assert_int_eq (rc, -1);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
 //  --------------------------------------------------------------------------
 /// Test cfg_endpoint ().
 START_TEST(test_cfg_endpoint)
@@ -489,6 +789,46 @@ START_TEST(test_cfg_endpoint_empty)
 END_TEST
 
 
+//  --------------------------------------------------------------------------
+/// Test cfg_async_endpoint ().
+START_TEST(test_cfg_async_endpoint)
+{
+    sam_selftest_introduce ("test_cfg_async_endpoint");
+
+    sam_cfg_t *cfg = load ("async_endpoint");
+
+    char *endpoint;
+    int rc = sam_cfg_async_endpoint (cfg, &endpoint);
+    ck_assert_int_eq (rc, 0);
+
+    zsock_t *sock = zsock_new_router (endpoint);
+    if (!sock) {
+        ck_abort_msg ("endpoint is not valid");
+    }
+
+    zsock_destroy (&sock);
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_async_endpoint () when there's no configuration.
+START_TEST(test_cfg_async_endpoint_empty)
+{
+    sam_selftest_introduce ("test_cfg_async_endpoint_empty");
+
+    sam_cfg_t *cfg = load ("empty");
+
+    char *endpoint;
+    int rc = sam_cfg_async_endpoint (cfg, &endpoint);
+    ck_assert_int_eq (rc, -1);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
 //  --------------------------------------------------------------------------
 /// Test cfg_be_type ().
 START_TEST(test_cfg_be_type_rmq)
@@ -523,6 +863,40 @@ START_TEST(test_cfg_be_type_empty)
 END_TEST
 
 
+//  --------------------------------------------------------------------------
+/// Test cfg_be_distribution ().
+START_TEST(test_cfg_be_distribution)
+{
+    sam_selftest_introduce ("test_cfg_be_distribution");
+    sam_cfg_t *cfg = load ("be_distribution");
+
+    char *distribution;
+    int rc = sam_cfg_be_distribution (cfg, &distribution);
+
+    ck_assert_int_eq (rc, 0);
+    ck_assert_str_eq (distribution, "weighted");
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test cfg_be_distribution () when there's no configuration.
+START_TEST(test_cfg_be_distribution_empty)
+{
+    sam_selftest_introduce ("test_cfg_be_distribution_empty");
+    sam_cfg_t *cfg = load ("empty");
+
+    char *distribution;
+    int rc = sam_cfg_be_distribution (cfg, &distribution);
+    ck_assert_int_eq (rc, -1);
+
+    sam_cfg_destroy (&cfg);
+}
+END_TEST
+
+
 
 //  --------------------------------------------------------------------------
 /// Test cfg_be_backends ().
@@ -549,6 +923,8 @@ START_TEST(test_cfg_be_backends_rmq)
     ck_assert_str_eq (opts->pass, "guest");
     ck_assert_int_eq (opts->heartbeat, 3);
     ck_assert_int_eq (opts->tries, -1);
+    ck_assert_int_eq (opts->window, SAM_BE_RMQ_WINDOW);
+    ck_assert_int_eq (opts->weight, 1);
 
     names += 1;
     opts += 1;
@@ -564,6 +940,8 @@ START_TEST(test_cfg_be_backends_rmq)
     ck_assert_int_eq (opts->heartbeat, 3);
     ck_assert_int_eq (opts->tries, 2);
     ck_assert (opts->interval == interval_ref);
+    ck_assert_int_eq (opts->window, 128);
+    ck_assert_int_eq (opts->weight, 3);
 
     // reset pointers for cleanup
     names -= 1;
@@ -608,6 +986,7 @@ sam_cfg_test ()
     Suite *s = suite_create ("sam_cfg");
 
     TCase *tc = tcase_create("buffer size");
+    tcase_add_test (tc, test_cfg_binary_value);
     tcase_add_test (tc, test_cfg_buf_size);
     tcase_add_test (tc, test_cfg_buf_size_b);
     tcase_add_test (tc, test_cfg_buf_size_k);
@@ -641,14 +1020,46 @@ sam_cfg_test ()
     tcase_add_test (tc, test_cfg_buf_retry_threshold_empty);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create("buffer commit");
+    tcase_add_test (tc, test_cfg_buf_commit_window);
+    tcase_add_test (tc, test_cfg_buf_commit_window_empty);
+    tcase_add_test (tc, test_cfg_buf_commit_count);
+    tcase_add_test (tc, test_cfg_buf_commit_count_empty);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create("buffer retry pacing");
+    tcase_add_test (tc, test_cfg_buf_retry_budget);
+    tcase_add_test (tc, test_cfg_buf_retry_budget_empty);
+    tcase_add_test (tc, test_cfg_buf_retry_slice);
+    tcase_add_test (tc, test_cfg_buf_retry_slice_empty);
+    tcase_add_test (tc, test_cfg_buf_retry_rate);
+    tcase_add_test (tc, test_cfg_buf_retry_rate_empty);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create("buffer hedge");
+    tcase_add_test (tc, test_cfg_buf_hedge_percentile);
+    tcase_add_test (tc, test_cfg_buf_hedge_percentile_empty);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create("buffer stage");
+    tcase_add_test (tc, test_cfg_buf_stage_delay);
+    tcase_add_test (tc, test_cfg_buf_stage_delay_empty);
+    tcase_add_test (tc, test_cfg_buf_stage_size);
+    tcase_add_test (tc, test_cfg_buf_stage_size_empty);
+    suite_add_tcase (s, tc);
+
     tc = tcase_create("buffer endpoint");
     tcase_add_test (tc, test_cfg_endpoint);
     tcase_add_test (tc, test_cfg_endpoint_empty);
+    tcase_add_test (tc, test_cfg_async_endpoint);
+    tcase_add_test (tc, test_cfg_async_endpoint_empty);
     suite_add_tcase (s, tc);
 
     tc = tcase_create("backends");
     tcase_add_test (tc, test_cfg_be_type_rmq);
     tcase_add_test (tc, test_cfg_be_type_empty);
+    tcase_add_test (tc, test_cfg_be_distribution);
+    tcase_add_test (tc, test_cfg_be_distribution_empty);
 
     tcase_add_test (tc, test_cfg_be_backends_rmq);
     tcase_add_test (tc, test_cfg_be_backends_rmq_empty);
@@ -0,0 +1,267 @@
+/*  =========================================================================
+
+    sam_db_bench - Compare storage engines
+
+    This Source Code Form is subject to the terms of the MIT
+    License. If a copy of the MIT License was not distributed with
+    this file, You can obtain one at http://opensource.org/licenses/MIT
+
+    =========================================================================
+*/
+/**
+
+   @brief Benchmark the storage engines
+   @file sam_db_bench.c
+
+   Replays the database access pattern of sam_buf for redundantly
+   distributed messages: Every message gets stored, updated by the
+   first acknowledgement and deleted by the second one. A window of
+   messages stays in the database and gets scanned periodically like
+   sam_buf does when restoring its state. Build samwise with a log
+   threshold (e.g. -DLOG_THRESHOLD_ERROR) to get meaningful results.
+
+
+*/
+
+
+#include "../include/sam_prelude.h"
+
+
+/// resembles the header of sam_buf records, followed by a backend
+/// set of one byte
+typedef struct header_t {
+    char type;
+    int acks_size;
+    int acks_remaining;
+    uint64_t ts;
+    int tries;
+} header_t;
+
+
+/// timings of one run
+typedef struct bench_t {
+    int64_t store;
+    int64_t ack;
+    int64_t del;
+    int64_t scan;
+    int scanned;
+} bench_t;
+
+
+#define WINDOW 1000
+#define SCAN_INTERVAL 1000
+#define SCAN_SIZE 100
+
+
+
+//  --------------------------------------------------------------------------
+/// Store a record containing a header and payload.
+static void
+store (
+    sam_db_t *db,
+    uint64_t *key,
+    byte *record,
+    size_t size)
+{
+    sam_db_begin (db);
+    sam_db_set_key (db, key);
+    if (sam_db_put (db, size, record)) {
+        fprintf (stderr, "could not store record %" PRIu64 "\n", *key);
+        exit (2);
+    }
+    sam_db_end (db, false);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Apply the first acknowledgement: Alter the header in place.
+static void
+ack (
+    sam_db_t *db,
+    uint64_t *key)
+{
+    header_t *header;
+
+    sam_db_begin (db);
+    if (!sam_db_get (db, key)) {
+        sam_db_edit (db, NULL, (void **) &header);
+        header->acks_remaining -= 1;
+        sam_gen_set_add ((byte *) (header + 1), 1);
+        sam_db_update (db, SAM_DB_CURRENT);
+    }
+    sam_db_end (db, false);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Apply the second acknowledgement: Delete the record.
+static void
+del (
+    sam_db_t *db,
+    uint64_t *key)
+{
+    sam_db_begin (db);
+    if (!sam_db_get (db, key)) {
+        sam_db_del (db);
+    }
+    sam_db_end (db, false);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Read the oldest records like the re-send cycle does.
+static int
+scan (
+    sam_db_t *db)
+{
+    int n = 0;
+    header_t *header;
+
+    sam_db_begin (db);
+    while (n < SCAN_SIZE && !sam_db_sibling (db, SAM_DB_NEXT)) {
+        sam_db_get_val (db, NULL, (void **) &header);
+        if (header->ts) {
+            n += 1;
+        }
+    }
+    sam_db_end (db, false);
+
+    return n;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Run the benchmark for n messages of the given payload size.
+static void
+run (
+    sam_db_t *db,
+    int n,
+    size_t payload_size,
+    bench_t *bench)
+{
+    size_t size = sizeof (header_t) + 1 + payload_size;
+    byte *record = malloc (size);
+    assert (record);
+    memset (record, 'x', size);
+
+    header_t *header = (header_t *) record;
+    header->type = 1;
+    header->acks_remaining = 2;
+    header->acks_size = 1;
+    record [sizeof (header_t)] = 0;
+    header->tries = 3;
+
+    uint64_t *keys = malloc ((n + 1) * sizeof (uint64_t));
+    assert (keys);
+
+    memset (bench, 0, sizeof (bench_t));
+    int64_t ts;
+
+    for (int i = 1; i <= n + WINDOW; i++) {
+        if (i <= n) {
+            keys [i] = i;
+            header->ts = i;
+
+            ts = zclock_usecs ();
+            store (db, &keys [i], record, size);
+            bench->store += zclock_usecs () - ts;
+        }
+
+        int acked = i - WINDOW;
+        if (0 < acked) {
+            ts = zclock_usecs ();
+            ack (db, &keys [acked]);
+            bench->ack += zclock_usecs () - ts;
+
+            ts = zclock_usecs ();
+            del (db, &keys [acked]);
+            bench->del += zclock_usecs () - ts;
+        }
+
+        if (!(i % SCAN_INTERVAL)) {
+            ts = zclock_usecs ();
+            bench->scanned += scan (db);
+            bench->scan += zclock_usecs () - ts;
+        }
+    }
+
+    free (keys);
+    free (record);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Print the operations per second.
+static void
+report (
+    const char *name,
+    int ops,
+    int64_t usecs)
+{
+    double secs = usecs / 1000000.0;
+    printf (
+        "  %-6s %8d ops  %10.3f s  %12.0f ops/s\n",
+        name, ops, secs, (secs > 0)? ops / secs: 0);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Parse the arguments, open the database and run the benchmark.
+int
+main (
+    int argc,
+    char **argv)
+{
+    if (argc < 2 || 4 < argc) {
+        printf ("sam_db_bench - compare samwise storage engines\n");
+        printf ("usage: sam_db_bench path/to/config.cfg [n] [payload]\n\n");
+        printf ("  n: amount of messages (default 100000)\n");
+        printf ("  payload: payload size in bytes (default 256)\n\n");
+        return 2;
+    }
+
+    int n = (argc > 2)? atoi (argv [2]): 100000;
+    size_t payload_size = (argc > 3)? atoi (argv [3]): 256;
+    if (n <= 0) {
+        printf ("invalid amount of messages\n");
+        return 2;
+    }
+
+    sam_cfg_t *cfg = sam_cfg_new (argv [1]);
+    if (cfg == NULL) {
+        return 2;
+    }
+
+    zconfig_t *conf;
+    if (sam_cfg_get (cfg, "db", &conf) ||
+        (conf = zconfig_child (conf)) == NULL) {
+
+        printf ("no db configuration found\n");
+        sam_cfg_destroy (&cfg);
+        return 2;
+    }
+
+    sam_db_t *db = sam_db_new (conf);
+    if (db == NULL) {
+        sam_cfg_destroy (&cfg);
+        return 2;
+    }
+
+    bench_t bench;
+    run (db, n, payload_size, &bench);
+
+    printf (
+        "%s: %d messages, %zu bytes payload\n",
+        zconfig_name (conf), n, payload_size);
+
+    report ("store", n, bench.store);
+    report ("ack", n, bench.ack);
+    report ("del", n, bench.del);
+    report ("scan", bench.scanned, bench.scan);
+    report ("total", 3 * n + bench.scanned,
+            bench.store + bench.ack + bench.del + bench.scan);
+
+    sam_db_destroy (&db);
+    sam_cfg_destroy (&cfg);
+    return 0;
+}
@@ -10,6 +10,8 @@
 */
 
 
+#include <fcntl.h>
+#include <unistd.h>
 #include "../include/sam_prelude.h"
 
 
@@ -18,17 +20,47 @@ sam_cfg_t *cfg;
 
 
 //  --------------------------------------------------------------------------
-/// Create sockets and a sam_buf instance.
+/// Load the configuration and open the database.
 static void
-setup ()
+setup_engine (
+    const char *cfg_file,
+    const char *path)
 {
-    cfg = sam_cfg_new ("cfg/test/db.cfg");
+    cfg = sam_cfg_new (cfg_file);
 
     zconfig_t *conf;
-    int rc = sam_cfg_get (cfg, "db/bdb", &conf);
+    int rc = sam_cfg_get (cfg, path, &conf);
     ck_assert_int_eq (rc, 0);
 
     db = sam_db_new (conf);
+    ck_assert (db != NULL);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Open a BerkeleyDB database.
+static void
+setup ()
+{
+    setup_engine ("cfg/test/db.cfg", "db/bdb");
+}
+
+
+//  --------------------------------------------------------------------------
+/// Open a LMDB database.
+static void
+setup_lmdb ()
+{
+    setup_engine ("cfg/test/db_lmdb.cfg", "db/lmdb");
+}
+
+
+//  --------------------------------------------------------------------------
+/// Open an append-only log database.
+static void
+setup_log ()
+{
+    setup_engine ("cfg/test/db_log.cfg", "db/log");
 }
 
 
@@ -50,7 +82,7 @@ START_TEST(test_db_get_put)
 {
     sam_selftest_introduce ("test_db_get_put");
 
-    int key = 100;
+    uint64_t key = 100;
     int data = 0xf00;
 
     sam_db_begin (db);
@@ -83,7 +115,7 @@ START_TEST(test_db_get_put)
 
 
     // get_key ()
-    int ret_key = sam_db_get_key (db);
+    uint64_t ret_key = sam_db_get_key (db);
     ck_assert_int_eq (ret_key, key);
 
 
@@ -111,7 +143,7 @@ START_TEST(test_db_sibling)
     sam_db_begin (db);
 
     // insert three records (1, 2), (3, 4), (4, 5)
-    int data [] = {
+    uint64_t data [] = {
         1, 2,
         3, 4
     };
@@ -127,7 +159,7 @@ START_TEST(test_db_sibling)
         ck_assert (ret == SAM_DB_OK);
     }
 
-    int ret_key;
+    uint64_t ret_key;
 
     // iteration with siblings
     ret = sam_db_get (db, &data [0]);
@@ -163,7 +195,7 @@ START_TEST(test_db_update)
 {
     sam_selftest_introduce ("test_db_update");
 
-    int key = 100;
+    uint64_t key = 100;
     int data = 0xf00;
 
     sam_db_begin (db);
@@ -179,9 +211,9 @@ START_TEST(test_db_update)
     ret = sam_db_get (db, &key);
     ck_assert (ret == SAM_DB_OK);
 
-    // retrieve pointer to data to overwrite it
+    // retrieve writable data to overwrite it
     int *record;
-    sam_db_get_val (db, NULL, (void **) &record);
+    sam_db_edit (db, NULL, (void **) &record);
     ck_assert_int_eq (*record, data);
 
     int other_data = 0xbaa;
@@ -210,7 +242,7 @@ START_TEST(test_db_update_key)
 {
     sam_selftest_introduce ("test_db_update_key");
 
-    int key = 100;
+    uint64_t key = 100;
     int data = 0xf00;
 
     sam_db_begin (db);
@@ -226,15 +258,15 @@ START_TEST(test_db_update_key)
     ret = sam_db_get (db, &key);
     ck_assert (ret == SAM_DB_OK);
 
-    // retrieve pointer to data to overwrite it
+    // retrieve writable data to overwrite it
     int *record;
-    sam_db_get_val (db, NULL, (void **) &record);
+    sam_db_edit (db, NULL, (void **) &record);
     ck_assert_int_eq (*record, data);
 
     int other_data = 0xbaa;
     *record = other_data;
 
-    int other_key = 200;
+    uint64_t other_key = 200;
     sam_db_set_key (db, &other_key);
 
     ret = sam_db_update (db, SAM_DB_KEY);
@@ -258,6 +290,470 @@ END_TEST
 
 
 
+//  --------------------------------------------------------------------------
+/// Tests that keys exceeding 32 bit are stored and ordered correctly.
+START_TEST(test_db_wide_keys)
+{
+    sam_selftest_introduce ("test_db_wide_keys");
+    sam_db_begin (db);
+
+    uint64_t keys [] = { 1, 0x80000001, 0x100000001 };
+    int data = 0;
+
+    for (int i = 2; 0 <= i; i--) {
+        sam_db_set_key (db, &keys [i]);
+        sam_db_ret_t ret = sam_db_put (db, sizeof (data), (void *) &data);
+        ck_assert (ret == SAM_DB_OK);
+    }
+
+    sam_db_ret_t ret = sam_db_get (db, &keys [0]);
+    ck_assert (ret == SAM_DB_OK);
+
+    for (int i = 1; i < 3; i++) {
+        ret = sam_db_sibling (db, SAM_DB_NEXT);
+        ck_assert (ret == SAM_DB_OK);
+        ck_assert (sam_db_get_key (db) == keys [i]);
+    }
+
+    sam_db_get (db, &keys [0]);
+    do {
+        sam_db_del (db);
+    } while (!sam_db_sibling (db, SAM_DB_NEXT));
+
+    sam_db_end (db, false);
+}
+END_TEST
+
+
+
+//  --------------------------------------------------------------------------
+/// Tests that BerkeleyDB records written with int keys by former
+/// versions get rewritten with 64 bit keys when the database is opened.
+START_TEST(test_db_bdb_int_keys)
+{
+    sam_selftest_introduce ("test_db_bdb_int_keys");
+
+    DB *dbp;
+    DBT key, val;
+    int rc = db_create (&dbp, NULL, 0);
+    ck_assert_int_eq (rc, 0);
+
+    rc = dbp->open (
+        dbp, NULL, "db/test/int_keys.db", NULL, DB_BTREE, DB_CREATE, 0);
+    ck_assert_int_eq (rc, 0);
+
+    for (int i = 1; i <= 3; i++) {
+        memset (&key, 0, sizeof (DBT));
+        memset (&val, 0, sizeof (DBT));
+        key.data = &i;
+        key.size = sizeof (i);
+        val.data = &i;
+        val.size = sizeof (i);
+
+        rc = dbp->put (dbp, NULL, &key, &val, 0);
+        ck_assert_int_eq (rc, 0);
+    }
+
+    dbp->close (dbp, 0);
+
+
+    // conversion
+    destroy ();
+    setup_engine ("cfg/test/db_int_keys.cfg", "db/bdb");
+
+    sam_db_begin (db);
+    uint64_t id = 2;
+    sam_db_ret_t ret = sam_db_get (db, &id);
+    ck_assert (ret == SAM_DB_OK);
+
+    int *record;
+    sam_db_get_val (db, NULL, (void **) &record);
+    ck_assert_int_eq (*record, 2);
+
+    ret = sam_db_sibling (db, SAM_DB_NEXT);
+    ck_assert (ret == SAM_DB_OK);
+    ck_assert (sam_db_get_key (db) == 3);
+    sam_db_end (db, false);
+
+    destroy ();
+
+
+    // all keys are 64 bit wide
+    rc = db_create (&dbp, NULL, 0);
+    ck_assert_int_eq (rc, 0);
+
+    rc = dbp->open (
+        dbp, NULL, "db/test/int_keys.db", NULL, DB_BTREE, 0, 0);
+    ck_assert_int_eq (rc, 0);
+
+    DBC *cursor;
+    dbp->cursor (dbp, NULL, &cursor, 0);
+    memset (&key, 0, sizeof (DBT));
+    memset (&val, 0, sizeof (DBT));
+
+    int key_c = 0;
+    while (!cursor->get (cursor, &key, &val, DB_NEXT)) {
+        ck_assert_int_eq (key.size, sizeof (uint64_t));
+        key_c += 1;
+    }
+
+    ck_assert_int_eq (key_c, 3);
+    cursor->close (cursor);
+    dbp->close (dbp, 0);
+
+    setup ();
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Tests that the log gets replayed and that segments get reclaimed.
+START_TEST(test_db_log_restore)
+{
+    sam_selftest_introduce ("test_db_log_restore");
+
+    byte data [256];
+    size_t size = sizeof (data);
+    uint64_t keys [16];
+    sam_db_ret_t ret;
+
+    // use a fresh log
+    destroy ();
+    setup_engine ("cfg/test/db_log_restore.cfg", "db/log");
+
+
+    // fill multiple segments (1K each)
+    for (int i = 0; i < 16; i++) {
+        keys [i] = i + 1;
+        memset (data, i, size);
+
+        sam_db_begin (db);
+        sam_db_set_key (db, &keys [i]);
+        ret = sam_db_put (db, size, data);
+        ck_assert (ret == SAM_DB_OK);
+        sam_db_end (db, false);
+    }
+
+    ck_assert (!access ("db/test/restore.log.00000001", F_OK));
+
+
+    // patch a record, abort the deletion of another
+    byte *record;
+    sam_db_begin (db);
+    sam_db_get (db, &keys [2]);
+    sam_db_edit (db, NULL, (void **) &record);
+    record [0] = 0xff;
+    ret = sam_db_update (db, SAM_DB_CURRENT);
+    ck_assert (ret == SAM_DB_OK);
+    sam_db_end (db, false);
+
+    sam_db_begin (db);
+    sam_db_get (db, &keys [3]);
+    sam_db_del (db);
+    sam_db_end (db, true);
+
+
+    // re-open
+    destroy ();
+    setup_engine ("cfg/test/db_log_restore.cfg", "db/log");
+
+    sam_db_begin (db);
+    ret = sam_db_get (db, &keys [2]);
+    ck_assert (ret == SAM_DB_OK);
+
+    size_t ret_size;
+    sam_db_get_val (db, &ret_size, (void **) &record);
+    ck_assert_int_eq (ret_size, size);
+    ck_assert_int_eq (record [0], 0xff);
+    ck_assert_int_eq (record [1], 2);
+
+    ret = sam_db_get (db, &keys [3]);
+    ck_assert (ret == SAM_DB_OK);
+
+
+    // delete everything, the first segment gets reclaimed
+    sam_db_get (db, &keys [0]);
+    do {
+        sam_db_del (db);
+    } while (!sam_db_sibling (db, SAM_DB_NEXT));
+    sam_db_end (db, false);
+
+    ck_assert (access ("db/test/restore.log.00000001", F_OK));
+
+    sam_db_begin (db);
+    ret = sam_db_sibling (db, SAM_DB_NEXT);
+    ck_assert (ret == SAM_DB_NOTFOUND);
+    sam_db_end (db, false);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Tests that replaying the log stops at a transaction not matching
+/// its checksum and that later segments are discarded.
+START_TEST(test_db_log_crc)
+{
+    sam_selftest_introduce ("test_db_log_crc");
+
+    byte data [256];
+    size_t size = sizeof (data);
+    uint64_t keys [12];
+    sam_db_ret_t ret;
+
+    destroy ();
+    setup_engine ("cfg/test/db_log_crc.cfg", "db/log");
+
+
+    // three segments with four records each (1K segments)
+    for (int i = 0; i < 12; i++) {
+        keys [i] = i + 1;
+        memset (data, i, size);
+
+        sam_db_begin (db);
+        sam_db_set_key (db, &keys [i]);
+        ret = sam_db_put (db, size, data);
+        ck_assert (ret == SAM_DB_OK);
+        sam_db_end (db, false);
+    }
+
+    destroy ();
+    ck_assert (!access ("db/test/crc.log.00000003", F_OK));
+
+
+    // flip a byte of the second record of the second segment,
+    // a transaction consists of two headers (24 bytes) and the data
+    int fd = open ("db/test/crc.log.00000002", O_RDWR);
+    ck_assert (fd != -1);
+
+    byte flipped = 0xff;
+    ck_assert_int_eq (pwrite (fd, &flipped, 1, 304 + 24 + 8), 1);
+    close (fd);
+
+
+    // re-open, the records before the corrupt one survive
+    setup_engine ("cfg/test/db_log_crc.cfg", "db/log");
+    sam_db_begin (db);
+
+    ret = sam_db_get (db, &keys [4]);
+    ck_assert (ret == SAM_DB_OK);
+
+    for (int i = 5; i < 12; i++) {
+        ret = sam_db_get (db, &keys [i]);
+        ck_assert (ret == SAM_DB_NOTFOUND);
+    }
+
+    sam_db_end (db, false);
+
+    ck_assert (access ("db/test/crc.log.00000003", F_OK));
+    ck_assert (!access ("db/test/crc.log.00000003.discarded", F_OK));
+
+
+    // the cut off segment gets appended to
+    sam_db_begin (db);
+    sam_db_set_key (db, &keys [5]);
+    ret = sam_db_put (db, size, data);
+    ck_assert (ret == SAM_DB_OK);
+    ret = sam_db_end (db, false);
+    ck_assert (ret == SAM_DB_OK);
+
+    destroy ();
+    setup_engine ("cfg/test/db_log_crc.cfg", "db/log");
+
+    sam_db_begin (db);
+    ret = sam_db_get (db, &keys [5]);
+    ck_assert (ret == SAM_DB_OK);
+    sam_db_end (db, false);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Tests that the live records of the oldest segment get copied when
+/// a new segment is begun, so that the oldest segment gets reclaimed.
+START_TEST(test_db_log_compact)
+{
+    sam_selftest_introduce ("test_db_log_compact");
+
+    byte data [256];
+    size_t size = sizeof (data);
+    uint64_t keys [9];
+    sam_db_ret_t ret;
+
+    destroy ();
+    setup_engine ("cfg/test/db_log_compact.cfg", "db/log");
+
+    for (int i = 0; i < 4; i++) {
+        keys [i] = i + 1;
+        memset (data, i, size);
+
+        sam_db_begin (db);
+        sam_db_set_key (db, &keys [i]);
+        sam_db_put (db, size, data);
+        sam_db_end (db, false);
+    }
+
+
+    // only the first record of the first segment stays alive
+    sam_db_begin (db);
+    for (int i = 1; i < 4; i++) {
+        sam_db_get (db, &keys [i]);
+        sam_db_del (db);
+    }
+    sam_db_end (db, false);
+
+
+    // fill the second segment and begin a third one
+    for (int i = 4; i < 9; i++) {
+        keys [i] = i + 1;
+        memset (data, i, size);
+
+        sam_db_begin (db);
+        sam_db_set_key (db, &keys [i]);
+        sam_db_put (db, size, data);
+        sam_db_end (db, false);
+    }
+
+    ck_assert (access ("db/test/compact.log.00000001", F_OK));
+    ck_assert (!access ("db/test/compact.log.00000002", F_OK));
+
+
+    // the copy survives re-opening
+    destroy ();
+    setup_engine ("cfg/test/db_log_compact.cfg", "db/log");
+
+    byte *record;
+    size_t record_size;
+    sam_db_begin (db);
+
+    ret = sam_db_get (db, &keys [0]);
+    ck_assert (ret == SAM_DB_OK);
+    sam_db_get_val (db, &record_size, (void **) &record);
+    ck_assert_int_eq (record_size, size);
+    ck_assert_int_eq (record [0], 0);
+    ck_assert_int_eq (record [size - 1], 0);
+
+    ret = sam_db_sibling (db, SAM_DB_NEXT);
+    ck_assert (ret == SAM_DB_OK);
+    ck_assert (sam_db_get_key (db) == keys [4]);
+
+    sam_db_end (db, false);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Tests inserting records consisting of several parts
+START_TEST(test_db_putv)
+{
+    sam_selftest_introduce ("test_db_putv");
+
+    uint64_t key = 200;
+    char head [] = "head", body [] = "body";
+    struct iovec parts [] = {
+        { .iov_base = head, .iov_len = 4 },
+        { .iov_base = body, .iov_len = 5 }
+    };
+
+    sam_db_begin (db);
+    sam_db_set_key (db, &key);
+    sam_db_ret_t ret = sam_db_putv (db, parts, 2);
+    ck_assert (ret == SAM_DB_OK);
+    sam_db_end (db, false);
+
+    sam_db_begin (db);
+    ret = sam_db_get (db, &key);
+    ck_assert (ret == SAM_DB_OK);
+
+    size_t size;
+    char *record;
+    sam_db_get_val (db, &size, (void **) &record);
+    ck_assert_int_eq (size, 9);
+    ck_assert_str_eq (record, "headbody");
+
+    ret = sam_db_del (db);
+    ck_assert (ret == SAM_DB_OK);
+    sam_db_end (db, false);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Tests discarding failed operations started at a savepoint.
+START_TEST(test_db_rewind)
+{
+    sam_selftest_introduce ("test_db_rewind");
+
+    uint64_t keys [] = { 300, 301 };
+    int data = 0xf00;
+    size_t size = sizeof (data);
+    sam_db_ret_t ret;
+
+    // no savepoint set
+    sam_db_begin (db);
+    ret = sam_db_rewind (db);
+    ck_assert (ret == SAM_DB_ERROR);
+    sam_db_end (db, true);
+
+    // kept: a new record
+    sam_db_begin (db);
+    sam_db_savepoint (db);
+
+    sam_db_set_key (db, &keys [0]);
+    ret = sam_db_put (db, size, (void *) &data);
+    ck_assert (ret == SAM_DB_OK);
+
+    // discarded: an operation that did not change anything
+    sam_db_savepoint (db);
+
+    ret = sam_db_get (db, &keys [1]);
+    ck_assert (ret == SAM_DB_NOTFOUND);
+
+    ret = sam_db_rewind (db);
+    ck_assert (ret == SAM_DB_OK);
+
+    // not discardable: an operation that changed something
+    sam_db_savepoint (db);
+
+    sam_db_set_key (db, &keys [1]);
+    sam_db_put (db, size, (void *) &data);
+
+    ret = sam_db_rewind (db);
+    ck_assert (ret == SAM_DB_ERROR);
+    sam_db_end (db, true);
+
+    // the whole transaction got aborted
+    sam_db_begin (db);
+
+    ret = sam_db_get (db, &keys [0]);
+    ck_assert (ret == SAM_DB_NOTFOUND);
+
+    ret = sam_db_get (db, &keys [1]);
+    ck_assert (ret == SAM_DB_NOTFOUND);
+
+    // discarding does not affect the committed changes
+    sam_db_savepoint (db);
+    sam_db_set_key (db, &keys [0]);
+    sam_db_put (db, size, (void *) &data);
+
+    sam_db_savepoint (db);
+    ret = sam_db_rewind (db);
+    ck_assert (ret == SAM_DB_OK);
+    sam_db_end (db, false);
+
+    sam_db_begin (db);
+    ret = sam_db_get (db, &keys [0]);
+    ck_assert (ret == SAM_DB_OK);
+
+    int *record;
+    sam_db_get_val (db, NULL, (void **) &record);
+    ck_assert_int_eq (*record, data);
+
+    sam_db_del (db);
+    sam_db_end (db, false);
+}
+END_TEST
+
+
 void *
 sam_db_test ()
 {
@@ -266,9 +762,38 @@ sam_db_test ()
     TCase *tc = tcase_create ("basic db operations");
     tcase_add_unchecked_fixture (tc, setup, destroy);
     tcase_add_test (tc, test_db_get_put);
+    tcase_add_test (tc, test_db_putv);
+    tcase_add_test (tc, test_db_sibling);
+    tcase_add_test (tc, test_db_update);
+    tcase_add_test (tc, test_db_update_key);
+    tcase_add_test (tc, test_db_wide_keys);
+    tcase_add_test (tc, test_db_rewind);
+    tcase_add_test (tc, test_db_bdb_int_keys);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("lmdb operations");
+    tcase_add_unchecked_fixture (tc, setup_lmdb, destroy);
+    tcase_add_test (tc, test_db_get_put);
+    tcase_add_test (tc, test_db_putv);
+    tcase_add_test (tc, test_db_sibling);
+    tcase_add_test (tc, test_db_update);
+    tcase_add_test (tc, test_db_update_key);
+    tcase_add_test (tc, test_db_wide_keys);
+    tcase_add_test (tc, test_db_rewind);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("log operations");
+    tcase_add_unchecked_fixture (tc, setup_log, destroy);
+    tcase_add_test (tc, test_db_get_put);
+    tcase_add_test (tc, test_db_putv);
     tcase_add_test (tc, test_db_sibling);
     tcase_add_test (tc, test_db_update);
     tcase_add_test (tc, test_db_update_key);
+    tcase_add_test (tc, test_db_wide_keys);
+    tcase_add_test (tc, test_db_rewind);
+    tcase_add_test (tc, test_db_log_restore);
+    tcase_add_test (tc, test_db_log_crc);
+    tcase_add_test (tc, test_db_log_compact);
     suite_add_tcase (s, tc);
 
     return s;
@@ -44,6 +44,65 @@ START_TEST(test_sam_handle_pipe)
 END_TEST
 
 
+//  --------------------------------------------------------------------------
+/// Test adding ids to backend sets and looking them up.
+START_TEST(test_sam_set)
+{
+    sam_selftest_introduce ("test_sam_set");
+
+    ck_assert_int_eq (sam_gen_set_size (1), 1);
+    ck_assert_int_eq (sam_gen_set_size (7), 1);
+    ck_assert_int_eq (sam_gen_set_size (8), 2);
+    ck_assert_int_eq (sam_gen_set_size (100), 13);
+
+    size_t size = sam_gen_set_size (100);
+    byte *set = calloc (size, 1);
+    assert (set);
+
+    sam_gen_set_add (set, 1);
+    sam_gen_set_add (set, 64);
+    sam_gen_set_add (set, 100);
+
+    ck_assert (sam_gen_set_contains (set, size, 1));
+    ck_assert (sam_gen_set_contains (set, size, 64));
+    ck_assert (sam_gen_set_contains (set, size, 100));
+
+    ck_assert (!sam_gen_set_contains (set, size, 2));
+    ck_assert (!sam_gen_set_contains (set, size, 65));
+
+    // ids beyond the set are not contained
+    ck_assert (!sam_gen_set_contains (set, size, 104));
+    ck_assert (!sam_gen_set_contains (set, 1, 64));
+    ck_assert (!sam_gen_set_contains (NULL, 0, 1));
+
+    free (set);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test reading little-endian integers.
+START_TEST(test_sam_le)
+{
+    sam_selftest_introduce ("test_sam_le");
+
+    byte data [] = { 0x01, 0x02, 0x03, 0xff };
+
+    ck_assert_int_eq (sam_gen_le16 (data), 0x0201);
+    ck_assert_int_eq (sam_gen_le16 (data + 2), 0xff03);
+    ck_assert (sam_gen_le32 (data) == 0xff030201);
+
+    byte buf [6];
+    byte *pos = sam_gen_put_le16 (buf, 0xff03);
+    pos = sam_gen_put_le32 (pos, 0x01020304);
+
+    ck_assert (pos == buf + 6);
+    ck_assert_int_eq (sam_gen_le16 (buf), 0xff03);
+    ck_assert (sam_gen_le32 (buf + 2) == 0x01020304);
+}
+END_TEST
+
+
 //  --------------------------------------------------------------------------
 /// Self test sam_gen.
 void *
@@ -55,5 +114,13 @@ sam_gen_test ()
     tcase_add_test (tc_handle_pipe, test_sam_handle_pipe);
     suite_add_tcase (s, tc_handle_pipe);
 
+    TCase *tc_set = tcase_create("backend set");
+    tcase_add_test (tc_set, test_sam_set);
+    suite_add_tcase (s, tc_set);
+
+    TCase *tc_le = tcase_create("little-endian");
+    tcase_add_test (tc_le, test_sam_le);
+    suite_add_tcase (s, tc_le);
+
     return s;
 }
@@ -60,6 +60,65 @@ START_TEST(test_msg_own)
 END_TEST
 
 
+//  --------------------------------------------------------------------------
+/// Reads a shared message and releases its reference.
+static void *
+read_shared (
+    void *arg)
+{
+    sam_msg_t *msg = arg;
+
+    for (int i = 0; i < 1000; i++) {
+        char *str;
+        zframe_t *frame;
+
+        int rc = sam_msg_get (msg, "?sf", &str, &frame);
+        ck_assert_int_eq (rc, 0);
+        ck_assert_str_eq (str, "two");
+        ck_assert_int_eq (zframe_size (frame), 5);
+
+        free (str);
+        zframe_destroy (&frame);
+    }
+
+    sam_msg_destroy (&msg);
+    return NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Test concurrent _get () and _destroy () of a shared message.
+START_TEST(test_msg_shared)
+{
+    sam_selftest_introduce ("test_msg_shared");
+
+    zmsg_t *zmsg = zmsg_new ();
+    zmsg_addstr (zmsg, "one");
+    zmsg_addstr (zmsg, "two");
+    zmsg_addstr (zmsg, "three");
+
+    sam_msg_t *msg = sam_msg_new (&zmsg);
+
+    pthread_t threads [4];
+    for (int i = 0; i < 4; i++) {
+        sam_msg_own (msg);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        int rc = pthread_create (&threads [i], NULL, read_shared, msg);
+        ck_assert_int_eq (rc, 0);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        pthread_join (threads [i], NULL);
+    }
+
+    ck_assert_int_eq (sam_msg_size (msg), 3);
+    sam_msg_destroy (&msg);
+    ck_assert (msg == NULL);
+}
+END_TEST
+
 //  --------------------------------------------------------------------------
 /// Try to _pop () an integer.
 START_TEST(test_msg_pop_i)
@@ -272,6 +331,186 @@ START_TEST(test_msg_pop_l_double)
 END_TEST
 
 
+//  --------------------------------------------------------------------------
+/// Try to _pop () two succeeding contiguous frame collections.
+START_TEST(test_msg_pop_m)
+{
+    sam_selftest_introduce ("test_msg_pop_m");
+
+    zmsg_t *zmsg = zmsg_new ();
+
+    if (zmsg_pushstr (zmsg, "three") ||
+        zmsg_pushstr (zmsg, "1")     ||
+        zmsg_pushstr (zmsg, "two")   ||
+        zmsg_pushstr (zmsg, "one")   ||
+        zmsg_pushstr (zmsg, "2")) {
+        ck_abort_msg ("could not build zmsg");
+    }
+
+    sam_msg_t *msg = sam_msg_new (&zmsg);
+    ck_assert_int_eq (sam_msg_size (msg), 5);
+
+    sam_msg_t *msg1, *msg2;
+    int rc = sam_msg_pop (msg, "mm", &msg1, &msg2);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (sam_msg_size (msg), 0);
+
+    ck_assert_int_eq (sam_msg_size (msg1), 2);
+    ck_assert_int_eq (sam_msg_size (msg2), 1);
+
+    char *one, *two, *three;
+    rc = sam_msg_pop (msg1, "ss", &one, &two);
+    ck_assert_int_eq (rc, 0);
+    rc = sam_msg_pop (msg2, "s", &three);
+    ck_assert_int_eq (rc, 0);
+
+    ck_assert_str_eq (one, "one");
+    ck_assert_str_eq (two, "two");
+    ck_assert_str_eq (three, "three");
+
+    sam_msg_destroy (&msg1);
+    sam_msg_destroy (&msg2);
+    sam_msg_destroy (&msg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Try to _pop () a collection announcing more frames than available.
+START_TEST(test_msg_pop_m_insufficient_data)
+{
+    sam_selftest_introduce ("test_msg_pop_m_insufficient_data");
+
+    zmsg_t *zmsg = zmsg_new ();
+
+    if (zmsg_pushstr (zmsg, "one") ||
+        zmsg_pushstr (zmsg, "2")) {
+        ck_abort_msg ("could not build zmsg");
+    }
+
+    sam_msg_t *msg = sam_msg_new (&zmsg);
+
+    sam_msg_t *collection;
+    int rc = sam_msg_pop (msg, "m", &collection);
+    ck_assert_int_eq (rc, -1);
+
+    sam_msg_destroy (&msg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Try to _pop () an empty collection.
+START_TEST(test_msg_pop_m_empty)
+{
+    sam_selftest_introduce ("test_msg_pop_m_empty");
+
+    zmsg_t *zmsg = zmsg_new ();
+
+    if (zmsg_pushstr (zmsg, "one") ||
+        zmsg_pushstr (zmsg, "0")) {
+        ck_abort_msg ("could not build zmsg");
+    }
+
+    sam_msg_t *msg = sam_msg_new (&zmsg);
+
+    sam_msg_t *collection;
+    int rc = sam_msg_pop (msg, "m", &collection);
+    ck_assert_int_eq (rc, -1);
+
+    sam_msg_destroy (&msg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Skip a frame and _split () the following ones.
+START_TEST(test_msg_split)
+{
+    sam_selftest_introduce ("test_msg_split");
+
+    zmsg_t *zmsg = zmsg_new ();
+
+    if (zmsg_pushstr (zmsg, "three") ||
+        zmsg_pushstr (zmsg, "two")   ||
+        zmsg_pushstr (zmsg, "one")   ||
+        zmsg_pushstr (zmsg, "skipped")) {
+        ck_abort_msg ("could not build zmsg");
+    }
+
+    sam_msg_t *msg = sam_msg_new (&zmsg);
+    int rc = sam_msg_pop (msg, "?");
+    ck_assert_int_eq (rc, 0);
+
+    sam_msg_t *part = sam_msg_split (msg, 2);
+    ck_assert (part);
+    ck_assert_int_eq (sam_msg_size (part), 2);
+    ck_assert_int_eq (sam_msg_size (msg), 1);
+
+    char *one, *two;
+    rc = sam_msg_pop (part, "ss", &one, &two);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_str_eq (one, "one");
+    ck_assert_str_eq (two, "two");
+
+    // insufficient frames
+    ck_assert (sam_msg_split (msg, 2) == NULL);
+    ck_assert_int_eq (sam_msg_size (msg), 1);
+
+    sam_msg_destroy (&part);
+    sam_msg_destroy (&msg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// _replace () a frame after popping the first one.
+START_TEST(test_msg_replace)
+{
+    sam_selftest_introduce ("test_msg_replace");
+
+    zmsg_t *zmsg = zmsg_new ();
+
+    if (zmsg_pushstr (zmsg, "three") ||
+        zmsg_pushstr (zmsg, "two")   ||
+        zmsg_pushstr (zmsg, "one")) {
+        ck_abort_msg ("could not build zmsg");
+    }
+
+    sam_msg_t *msg = sam_msg_new (&zmsg);
+    int rc = sam_msg_pop (msg, "?");
+    ck_assert_int_eq (rc, 0);
+
+    byte large [300];
+    memset (large, 'x', sizeof (large));
+
+    rc = sam_msg_replace (msg, 0, large, sizeof (large));
+    ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (sam_msg_size (msg), 2);
+    ck_assert_int_eq (sam_msg_encoded_size (msg), 5 + 300 + 1 + 5);
+
+    byte *data;
+    size_t size;
+    rc = sam_msg_frame (msg, 0, &data, &size);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (size, 300);
+    ck_assert (!memcmp (data, large, size));
+
+    char *three;
+    rc = sam_msg_get (msg, "?s", &three);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_str_eq (three, "three");
+    free (three);
+
+    // no frame at the position
+    rc = sam_msg_replace (msg, 2, large, 1);
+    ck_assert_int_eq (rc, -1);
+
+    sam_msg_destroy (&msg);
+}
+END_TEST
+
+
 //  --------------------------------------------------------------------------
 /// Try to _pop () multiple different values.
 START_TEST(test_msg_pop)
@@ -550,8 +789,12 @@ START_TEST(test_msg_get_f)
 
     zmsg_t *zmsg = zmsg_new ();
     char payload = 'a';
-    zframe_t *frame = zframe_new (&payload, sizeof (payload));
-    int rc = zmsg_push (zmsg, frame);
+
+    zframe_t
+        *frame = zframe_new (&payload, sizeof (payload)),
+        *frame_dup = zframe_dup (frame);
+
+    int rc = zmsg_push (zmsg, frame_dup);
     ck_assert_int_eq (rc, 0);
 
     sam_msg_t *msg = sam_msg_new (&zmsg);
@@ -571,6 +814,7 @@ START_TEST(test_msg_get_f)
     ck_assert (zframe_eq (ref, frame));
     zframe_destroy (&ref);
 
+    zframe_destroy (&frame);
     sam_msg_destroy (&msg);
 }
 END_TEST
@@ -882,6 +1126,140 @@ START_TEST(test_msg_code)
 END_TEST
 
 
+//  --------------------------------------------------------------------------
+/// Test encoding of many and large frames, including frames moved
+/// into a new message with 'm'.
+START_TEST(test_msg_code_large)
+{
+    sam_selftest_introduce ("test_msg_code_large");
+
+    byte large [1000];
+    memset (large, 'x', sizeof (large));
+
+    zmsg_t *zmsg = zmsg_new ();
+    zmsg_addstr (zmsg, "100");
+    for (int i = 0; i < 100; i++) {
+        zmsg_addstrf (zmsg, "%d", i);
+    }
+    zmsg_addmem (zmsg, large, sizeof (large));
+
+    sam_msg_t *msg = sam_msg_new (&zmsg);
+    ck_assert_int_eq (sam_msg_size (msg), 102);
+
+    // 100 + 10 + 90 * 2 bytes for the numbers, 1 + 3 bytes for the
+    // count and 1 + 4 + 1000 bytes for the large frame
+    size_t size = sam_msg_encoded_size (msg);
+    ck_assert_int_eq (size, 290 + 4 + 1005);
+
+    byte *buf = malloc (size);
+    assert (buf);
+    sam_msg_encode (msg, &buf);
+    sam_msg_destroy (&msg);
+
+    msg = sam_msg_decode (buf, size);
+    free (buf);
+    ck_assert_int_eq (sam_msg_size (msg), 102);
+
+    sam_msg_t *numbers;
+    zframe_t *frame;
+    int rc = sam_msg_pop (msg, "mf", &numbers, &frame);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (sam_msg_size (msg), 0);
+    ck_assert_int_eq (zframe_size (frame), sizeof (large));
+    ck_assert (!memcmp (zframe_data (frame), large, sizeof (large)));
+
+    ck_assert_int_eq (sam_msg_size (numbers), 100);
+    for (int i = 0; i < 100; i++) {
+        int nbr;
+        rc = sam_msg_pop (numbers, "i", &nbr);
+        ck_assert_int_eq (rc, 0);
+        ck_assert_int_eq (nbr, i);
+    }
+
+    sam_msg_destroy (&numbers);
+    sam_msg_destroy (&msg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test encoding messages containing adopted frames: The encoded
+/// message is described by the parts in between and the adopted
+/// frames themselves, which are shared by split and replaced
+/// messages.
+START_TEST(test_msg_code_adopted)
+{
+    sam_selftest_introduce ("test_msg_code_adopted");
+
+    byte payload [4096];
+    memset (payload, 'x', sizeof (payload));
+
+    zmsg_t *zmsg = zmsg_new ();
+    zmsg_addstr (zmsg, "one");
+    zmsg_addmem (zmsg, payload, sizeof (payload));
+    zmsg_addstr (zmsg, "two");
+
+    sam_msg_t *msg = sam_msg_new (&zmsg);
+    ck_assert_int_eq (sam_msg_size (msg), 3);
+
+    size_t size = sam_msg_encoded_size (msg);
+    ck_assert_int_eq (size, 4 + 5 + sizeof (payload) + 4);
+
+    // prefixes and "one", the payload, "two"
+    struct iovec iov [3];
+    ck_assert_int_eq (sam_msg_encoded_parts (msg), 3);
+    ck_assert_int_eq (sam_msg_encode_parts (msg, iov), 3);
+    ck_assert_int_eq (iov [0].iov_len, 4 + 5);
+    ck_assert_int_eq (iov [1].iov_len, sizeof (payload));
+    ck_assert_int_eq (iov [2].iov_len, 4);
+
+    byte *data;
+    size_t data_size;
+    sam_msg_frame (msg, 1, &data, &data_size);
+    ck_assert (data == iov [1].iov_base);
+
+    byte *buf = malloc (size);
+    assert (buf);
+    sam_msg_encode (msg, &buf);
+
+    sam_msg_t *decoded = sam_msg_decode (buf, size);
+    free (buf);
+    ck_assert_int_eq (sam_msg_size (decoded), 3);
+    ck_assert_int_eq (sam_msg_encoded_parts (decoded), 1);
+
+    sam_msg_frame (decoded, 1, &data, &data_size);
+    ck_assert_int_eq (data_size, sizeof (payload));
+    ck_assert (!memcmp (data, payload, sizeof (payload)));
+    sam_msg_destroy (&decoded);
+
+    // the split message shares the payload
+    int rc = sam_msg_pop (msg, "?");
+    ck_assert_int_eq (rc, 0);
+
+    sam_msg_t *split = sam_msg_split (msg, 2);
+    sam_msg_destroy (&msg);
+
+    sam_msg_frame (split, 0, &data, &data_size);
+    ck_assert (data == iov [1].iov_base);
+    ck_assert_int_eq (sam_msg_encoded_parts (split), 3);
+
+    // replacing a frame keeps the payload
+    rc = sam_msg_replace (split, 1, (byte *) "three", 5);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (sam_msg_encoded_size (split), 5 + 4096 + 6);
+
+    sam_msg_frame (split, 0, &data, &data_size);
+    ck_assert (data == iov [1].iov_base);
+
+    sam_msg_frame (split, 1, &data, &data_size);
+    ck_assert_int_eq (data_size, 5);
+    ck_assert (!memcmp (data, "three", 5));
+
+    sam_msg_destroy (&split);
+}
+END_TEST
+
+
 //  --------------------------------------------------------------------------
 /// Test encoding and decoding when part of the data is already pop'd.
 START_TEST(test_msg_code_pop)
@@ -1171,6 +1549,7 @@ sam_msg_test ()
     TCase *tc = tcase_create("lifecycle (life)");
     tcase_add_test (tc, test_msg_life_basic);
     tcase_add_test (tc, test_msg_own);
+    tcase_add_test (tc, test_msg_shared);
     suite_add_tcase (s, tc);
 
     tc = tcase_create ("pop ()");
@@ -1181,6 +1560,11 @@ sam_msg_test ()
     tcase_add_test (tc, test_msg_pop_l);
     tcase_add_test (tc, test_msg_pop_l_empty);
     tcase_add_test (tc, test_msg_pop_l_double);
+    tcase_add_test (tc, test_msg_pop_m);
+    tcase_add_test (tc, test_msg_pop_m_insufficient_data);
+    tcase_add_test (tc, test_msg_pop_m_empty);
+    tcase_add_test (tc, test_msg_split);
+    tcase_add_test (tc, test_msg_replace);
     tcase_add_test (tc, test_msg_pop);
     tcase_add_test (tc, test_msg_pop_insufficient_data);
     tcase_add_test (tc, test_msg_pop_successively);
@@ -1211,6 +1595,8 @@ sam_msg_test ()
 
     tc = tcase_create ("encode () and decode ()");
     tcase_add_test (tc, test_msg_code);
+    tcase_add_test (tc, test_msg_code_large);
+    tcase_add_test (tc, test_msg_code_adopted);
     tcase_add_test (tc, test_msg_code_pop);
     suite_add_tcase (s, tc);
 
@@ -12,6 +12,10 @@
 #include "../include/sam_prelude.h"
 
 
+/// string encoded requests (rfc 1 - 7)
+#define VERSION_ASCII 160
+
+
 sam_t *sam;
 sam_cfg_t *cfg;
 size_t char_s = sizeof (char *);
@@ -67,12 +71,75 @@ test_create_msg (uint arg_c, char **arg_v)
 }
 
 
+//  --------------------------------------------------------------------------
+/// Appends a length prefixed string to binary publishing options.
+static void
+test_add_bin_str (zframe_t *opts, const char *str)
+{
+    uint32_t len = strlen (str);
+    size_t size = zframe_size (opts);
+
+    byte *buf = malloc (size + 4 + len);
+    assert (buf);
+    memcpy (buf, zframe_data (opts), size);
+
+    for (int i = 0; i < 4; i++) {
+        buf [size + i] = len >> (8 * i);
+    }
+
+    memcpy (buf + size + 4, str, len);
+    zframe_reset (opts, buf, size + 4 + len);
+    free (buf);
+}
+
+
+//  --------------------------------------------------------------------------
+/// Creates binary publishing options (see rfc 8) for the amq.direct
+/// exchange with the content_type property and a single header.
+static zframe_t *
+test_create_bin_opts (byte dist, uint16_t n)
+{
+    byte head [SAM_PUB_HEAD_SIZE] = {
+        dist,                  // distribution
+        0,                     // flags
+        n, n >> 8,             // min. acknowledged
+        0x01, 0x00,            // property bitmap: content_type
+        0x01, 0x00             // header count
+    };
+
+    zframe_t *opts = zframe_new (head, sizeof (head));
+    test_add_bin_str (opts, "amq.direct");
+    test_add_bin_str (opts, "");
+    test_add_bin_str (opts, "text/plain");
+    test_add_bin_str (opts, "key");
+    test_add_bin_str (opts, "value");
+
+    return opts;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Creates a binary publishing request.
+static sam_msg_t *
+test_create_bin_msg (byte dist, uint16_t n, const char *payload)
+{
+    zmsg_t *zmsg = zmsg_new ();
+    zmsg_addstr (zmsg, "publish");
+
+    zframe_t *opts = test_create_bin_opts (dist, n);
+    zmsg_append (zmsg, &opts);
+    zmsg_addstr (zmsg, payload);
+
+    return sam_msg_new (&zmsg);
+}
+
+
 //  --------------------------------------------------------------------------
 /// Asserts that sam_eval will return with an error.
 static void
 test_assert_error (sam_t *sam, sam_msg_t *msg)
 {
-    sam_ret_t *ret = sam_eval (sam, msg);
+    sam_ret_t *ret = sam_eval (sam, VERSION_ASCII, msg);
     ck_assert_int_eq (ret->rc, -1);
     sam_log_tracef ("got error: %s", ret->msg);
     free (ret);
@@ -108,7 +175,7 @@ START_TEST(test_sam_rmq_publish_roundrobin)
     };
 
     sam_msg_t *msg = test_create_msg (sizeof (pub_msg) / char_s, pub_msg);
-    sam_ret_t *ret = sam_eval (sam, msg);
+    sam_ret_t *ret = sam_eval (sam, VERSION_ASCII, msg);
 
     // let the parts cope before tearing it down
     zclock_sleep (50);
@@ -149,12 +216,264 @@ START_TEST(test_sam_rmq_publish_redundant)
     };
 
     sam_msg_t *msg = test_create_msg (sizeof (pub_msg) / char_s, pub_msg);
-    sam_ret_t *ret = sam_eval (sam, msg);
+    sam_ret_t *ret = sam_eval (sam, VERSION_ASCII, msg);
+
+    // let the parts cope before tearing it down
+    zclock_sleep (50);
+
+    ck_assert_int_eq (ret->rc, 0);
+    free (ret);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test publishing messages with the single backend distribution
+/// strategies (broker-3 has a weight of 2).
+START_TEST(test_sam_rmq_publish_strategies)
+{
+    sam_selftest_introduce ("test_sam_rmq_publish_strategies");
+
+    char *strategies [] = {
+        "least outstanding", "weighted", "affinity", "default"
+    };
+
+    char *pub_msg [] = {
+        "publish",        // action
+        NULL,             // distribution type
+
+        // amqp args
+        "amq.direct",     // exchange
+        "",               // routing key
+        NULL,             // mandatory
+        NULL,             // immediate
+
+        // amqp props (see rfc)
+        "12",
+        NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, NULL, NULL,
+
+        // amqp headers
+        "0",
+
+        // payload
+        "strategy publishing request"
+    };
+
+    for (int i = 0; i < 4; i++) {
+        pub_msg [1] = strategies [i];
+
+        sam_msg_t *msg = test_create_msg (sizeof (pub_msg) / char_s, pub_msg);
+        sam_ret_t *ret = sam_eval (sam, VERSION_ASCII, msg);
+
+        ck_assert_int_eq (ret->rc, 0);
+        free (ret);
+    }
+
+    // let the parts cope before tearing it down
+    zclock_sleep (50);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test publishing binary encoded messages with all distribution
+/// strategies.
+START_TEST(test_sam_rmq_publish_binary)
+{
+    sam_selftest_introduce ("test_sam_rmq_publish_binary");
+
+    for (byte dist = 0; dist < 6; dist++) {
+        sam_msg_t *msg = test_create_bin_msg (
+            dist, 2, "binary publishing request");
+
+        sam_ret_t *ret = sam_eval (sam, SAM_PROTOCOL_VERSION_BINARY, msg);
+
+        ck_assert_int_eq (ret->rc, 0);
+        free (ret);
+    }
+
+    // let the parts cope before tearing it down
+    zclock_sleep (50);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test publishing a binary encoded batch containing one valid and
+/// one malformed publishing request.
+START_TEST(test_sam_rmq_publish_binary_batch)
+{
+    sam_selftest_introduce ("test_sam_rmq_publish_binary_batch");
+
+    zmsg_t *zmsg = zmsg_new ();
+    zmsg_addstr (zmsg, "publish.batch");
+
+    byte count [] = { 0x02, 0x00, 0x00, 0x00 };
+    zmsg_addmem (zmsg, count, sizeof (count));
+
+    zframe_t *opts = test_create_bin_opts (1, 0);
+    zmsg_append (zmsg, &opts);
+    zmsg_addstr (zmsg, "first batched publishing request");
+
+    // unknown distribution
+    opts = test_create_bin_opts (6, 0);
+    zmsg_append (zmsg, &opts);
+    zmsg_addstr (zmsg, "second batched publishing request");
+
+    sam_msg_t *msg = sam_msg_new (&zmsg);
+    sam_ret_t *ret = sam_eval (sam, SAM_PROTOCOL_VERSION_BINARY, msg);
 
     // let the parts cope before tearing it down
     zclock_sleep (50);
 
     ck_assert_int_eq (ret->rc, 0);
+    ck_assert_int_eq (ret->count, 2);
+    ck_assert_int_eq (ret->receipts [0], 0);
+    ck_assert_int_eq (ret->receipts [1], -1);
+
+    free (ret->receipts);
+    free (ret);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Registers a template and returns the reply's return code and id.
+static int
+test_register_template (int version, int *id)
+{
+    zmsg_t *zmsg = zmsg_new ();
+    zmsg_addstr (zmsg, "template");
+
+    zframe_t *opts = test_create_bin_opts (0, 0);
+    zmsg_append (zmsg, &opts);
+
+    sam_ret_t *ret = sam_eval (sam, version, sam_msg_new (&zmsg));
+    int rc = ret->rc;
+
+    if (!rc) {
+        *id = atoi (ret->msg);
+    }
+
+    if (ret->allocated) {
+        free (ret->msg);
+    }
+
+    free (ret);
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+/// Test registering a publishing template and publishing messages
+/// referencing it (see rfc 9).
+START_TEST(test_sam_rmq_publish_template)
+{
+    sam_selftest_introduce ("test_sam_rmq_publish_template");
+
+    int id = -1;
+    int rc = test_register_template (SAM_PROTOCOL_VERSION_TEMPLATE, &id);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (id, 0);
+
+    // identical templates share their id
+    id = -1;
+    rc = test_register_template (SAM_PROTOCOL_VERSION_TEMPLATE, &id);
+    ck_assert_int_eq (rc, 0);
+    ck_assert_int_eq (id, 0);
+
+    // unknown to protocol version 2.0
+    rc = test_register_template (SAM_PROTOCOL_VERSION_BINARY, &id);
+    ck_assert_int_eq (rc, -1);
+
+    byte opts [] = {
+        0x01, SAM_PUB_TEMPLATE,     // round robin, template
+        0x00, 0x00,                 // min. acknowledged
+        0x00, 0x00,                 // property bitmap
+        0x00, 0x00,                 // header count
+        0x00, 0x00, 0x00, 0x00      // template id
+    };
+
+    for (int i = 0; i < 2; i++) {
+        zmsg_t *zmsg = zmsg_new ();
+        zmsg_addstr (zmsg, "publish");
+        zmsg_addmem (zmsg, opts, sizeof (opts));
+        zmsg_addstr (zmsg, "templated publishing request");
+
+        sam_ret_t *ret = sam_eval (
+            sam, SAM_PROTOCOL_VERSION_TEMPLATE, sam_msg_new (&zmsg));
+
+        // the second one references an unknown template
+        ck_assert_int_eq (ret->rc, i? -1: 0);
+        free (ret);
+
+        opts [SAM_PUB_HEAD_SIZE] = 1;
+    }
+
+    // let the parts cope before tearing it down
+    zclock_sleep (50);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Test publishing a batch containing two valid and one malformed
+/// publishing request.
+START_TEST(test_sam_rmq_publish_batch)
+{
+    sam_selftest_introduce ("test_sam_rmq_publish_batch");
+
+    char *pub_msg [] = {
+        "publish.batch",  // action
+        "3",              // request count
+
+        // first request
+        "19",             // frame count
+        "round robin",    // distribution type
+        "amq.direct",     // exchange
+        "",               // routing key
+        NULL,             // mandatory
+        NULL,             // immediate
+        "12",
+        NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, NULL, NULL,
+        "0",
+        "first batched publishing request",
+
+        // second request (malformed)
+        "2",              // frame count
+        "round robin",    // distribution type
+        "amq.direct",     // exchange
+
+        // third request
+        "20",             // frame count
+        "redundant",      // distribution type
+        "2",              // distribution count
+        "amq.direct",     // exchange
+        "",               // routing key
+        NULL,             // mandatory
+        NULL,             // immediate
+        "12",
+        NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, NULL, NULL,
+        "0",
+        "third batched publishing request"
+    };
+
+    sam_msg_t *msg = test_create_msg (sizeof (pub_msg) / char_s, pub_msg);
+    sam_ret_t *ret = sam_eval (sam, VERSION_ASCII, msg);
+
+    // let the parts cope before tearing it down
+    zclock_sleep (50);
+
+    ck_assert_int_eq (ret->rc, 0);
+    ck_assert_int_eq (ret->count, 3);
+    ck_assert_int_eq (ret->receipts [0], 0);
+    ck_assert_int_eq (ret->receipts [1], -1);
+    ck_assert_int_eq (ret->receipts [2], 0);
+
+    free (ret->receipts);
     free (ret);
 }
 END_TEST
@@ -178,7 +497,7 @@ START_TEST(test_sam_rmq_xdecl)
     sam_msg_t *msg = test_create_msg (
         sizeof (exch_decl_msg) / char_s, exch_decl_msg);
 
-    sam_ret_t *ret = sam_eval (sam, msg);
+    sam_ret_t *ret = sam_eval (sam, VERSION_ASCII, msg);
 
     ck_assert_int_eq (ret->rc, 0);
     free (ret);
@@ -201,7 +520,7 @@ START_TEST(test_sam_rmq_xdel)
     sam_msg_t *msg = test_create_msg (
         sizeof (exch_del_msg) / char_s, exch_del_msg);
 
-    sam_ret_t *ret = sam_eval (sam, msg);
+    sam_ret_t *ret = sam_eval (sam, VERSION_ASCII, msg);
 
     ck_assert_int_eq (ret->rc, 0);
     free (ret);
@@ -269,6 +588,26 @@ START_TEST(test_sam_rmq_prot_error_missing_dcount)
 END_TEST
 
 
+//  --------------------------------------------------------------------------
+/// Send a request with an unknown distribution type.
+START_TEST(test_sam_rmq_prot_error_unknown_type)
+{
+    sam_selftest_introduce ("test_sam_rmq_prot_error_unknown_type");
+
+    char *a [] = {
+        "publish", "random", "amq.direct", "", NULL, NULL,
+        "12",
+        NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, NULL, NULL,
+        "0", "hi!"
+    };
+
+    sam_msg_t *msg = test_create_msg (sizeof (a) / char_s, a);
+    test_assert_error (sam, msg);
+}
+END_TEST
+
+
 //  --------------------------------------------------------------------------
 /// Send a wrongly formatted publishing request.
 START_TEST(test_sam_rmq_prot_error_publish)
@@ -285,6 +624,78 @@ START_TEST(test_sam_rmq_prot_error_publish)
 END_TEST
 
 
+//  --------------------------------------------------------------------------
+/// Send malformed binary publishing requests.
+START_TEST(test_sam_rmq_prot_error_binary)
+{
+    sam_selftest_introduce ("test_sam_rmq_prot_error_binary");
+    int version = SAM_PROTOCOL_VERSION_BINARY;
+
+    // redundant without min. acknowledged
+    sam_msg_t *msg = test_create_bin_msg (2, 0, "payload");
+    sam_ret_t *ret = sam_eval (sam, version, msg);
+    ck_assert_int_eq (ret->rc, -1);
+    free (ret);
+
+    // string exceeding the options
+    zmsg_t *zmsg = zmsg_new ();
+    zmsg_addstr (zmsg, "publish");
+    zframe_t *opts = test_create_bin_opts (1, 0);
+    zmsg_addmem (zmsg, zframe_data (opts), zframe_size (opts) - 1);
+    zframe_destroy (&opts);
+    zmsg_addstr (zmsg, "payload");
+
+    ret = sam_eval (sam, version, sam_msg_new (&zmsg));
+    ck_assert_int_eq (ret->rc, -1);
+    free (ret);
+
+    // string encoded request
+    char *a [] = {
+        "publish", "round robin", "amq.direct", "", NULL, NULL, "12",
+        NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, NULL, NULL,
+        "0", "payload"
+    };
+
+    msg = test_create_msg (sizeof (a) / char_s, a);
+    ret = sam_eval (sam, version, msg);
+    ck_assert_int_eq (ret->rc, -1);
+    free (ret);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Send a batch announcing more requests than provided.
+START_TEST(test_sam_rmq_prot_error_batch_count)
+{
+    sam_selftest_introduce ("test_sam_rmq_prot_error_batch_count");
+
+    char *a [] = {
+        "publish.batch", "2", "3", "round robin", "amq.direct", ""
+    };
+
+    sam_msg_t *msg = test_create_msg (sizeof (a) / char_s, a);
+    test_assert_error (sam, msg);
+}
+END_TEST
+
+
+//  --------------------------------------------------------------------------
+/// Send a batch with a request announcing more frames than provided.
+START_TEST(test_sam_rmq_prot_error_batch_frames)
+{
+    sam_selftest_introduce ("test_sam_rmq_prot_error_batch_frames");
+
+    char *a [] = {
+        "publish.batch", "1", "19", "round robin", "amq.direct"
+    };
+
+    sam_msg_t *msg = test_create_msg (sizeof (a) / char_s, a);
+    test_assert_error (sam, msg);
+}
+END_TEST
+
 //  --------------------------------------------------------------------------
 /// Send a wrong exchange.declare with missing options.
 START_TEST(test_sam_rmq_prot_error_xdecl1)
@@ -377,6 +788,11 @@ sam_test ()
     tcase_add_unchecked_fixture (tc, setup_rmq, destroy);
     tcase_add_test (tc, test_sam_rmq_publish_roundrobin);
     tcase_add_test (tc, test_sam_rmq_publish_redundant);
+    tcase_add_test (tc, test_sam_rmq_publish_strategies);
+    tcase_add_test (tc, test_sam_rmq_publish_batch);
+    tcase_add_test (tc, test_sam_rmq_publish_binary);
+    tcase_add_test (tc, test_sam_rmq_publish_binary_batch);
+    tcase_add_test (tc, test_sam_rmq_publish_template);
     suite_add_tcase (s, tc);
 
     tc = tcase_create ("rpc");
@@ -391,7 +807,11 @@ sam_test ()
     tcase_add_test(tc, test_sam_rmq_prot_error_unknown);
     tcase_add_test(tc, test_sam_rmq_prot_error_missing_type);
     tcase_add_test(tc, test_sam_rmq_prot_error_missing_dcount);
+    tcase_add_test(tc, test_sam_rmq_prot_error_unknown_type);
     tcase_add_test(tc, test_sam_rmq_prot_error_publish);
+    tcase_add_test(tc, test_sam_rmq_prot_error_binary);
+    tcase_add_test(tc, test_sam_rmq_prot_error_batch_count);
+    tcase_add_test(tc, test_sam_rmq_prot_error_batch_frames);
     tcase_add_test(tc, test_sam_rmq_prot_error_xdecl1);
     tcase_add_test(tc, test_sam_rmq_prot_error_xdecl2);
     tcase_add_test(tc, test_sam_rmq_prot_error_xdecl3);